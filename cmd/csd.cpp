@@ -19,6 +19,8 @@
  */
 
 #include "csd.hpp"
+
+#include <boost/lexical_cast.hpp>
 #include <thread>
 
 namespace ndn {
@@ -31,14 +33,32 @@ main(int argc, char* argv[])
   Runner runner(&app);
   QObject::connect(&runner, SIGNAL(terminateApp()), &app, SLOT(quit()), Qt::QueuedConnection);
 
-  if (argc != 4) {
-    std::cerr << "Usage: ./csd <username> <shared-folder> <path>" << std::endl;
+  if (argc < 4 || argc > 6) {
+    std::cerr << "Usage: ./csd <username> <shared-folder> <path> [<segment-size> [fixed|cdc]]" << std::endl;
     return 1;
   }
 
   std::string username = argv[1];
   std::string sharedFolder = argv[2];
   std::string path = argv[3];
+  size_t segmentSize = DEFAULT_FILE_SEGMENT_SIZE;
+  if (argc >= 5) {
+    try {
+      segmentSize = boost::lexical_cast<size_t>(argv[4]);
+    }
+    catch (const boost::bad_lexical_cast&) {
+      std::cerr << "ERROR: invalid segment size [" << argv[4] << "]" << std::endl;
+      return 1;
+    }
+  }
+  bool isContentDefinedChunking = false;
+  if (argc == 6) {
+    if (std::string(argv[5]) != "fixed" && std::string(argv[5]) != "cdc") {
+      std::cerr << "ERROR: invalid chunking mode [" << argv[5] << "]" << std::endl;
+      return 1;
+    }
+    isContentDefinedChunking = (std::string(argv[5]) == "cdc");
+  }
 
   std::cout << "Starting ChronoShare for [" << username << "] shared-folder [" << sharedFolder
             << "] at [" << path << "]" << std::endl;
@@ -46,7 +66,8 @@ main(int argc, char* argv[])
   boost::asio::io_service ioService;
   Face face(ioService);
 
-  Dispatcher dispatcher(username, sharedFolder, path, face);
+  Dispatcher dispatcher(username, sharedFolder, path, face, segmentSize);
+  dispatcher.setContentDefinedChunking(isContentDefinedChunking);
 
   std::thread ioThread([&ioService, &runner] {
     try {
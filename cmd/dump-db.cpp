@@ -19,6 +19,7 @@
  */
 
 #include "dispatcher.hpp"
+#include "pack-store.hpp"
 #include "sync-core.hpp"
 
 #include "core/logging.hpp"
@@ -43,7 +44,7 @@ class StateLogDumper : public DbHelper
 {
 public:
   StateLogDumper(const fs::path& path)
-    : DbHelper(path / ".chronoshare", "sync-log.db")
+    : DbHelper(path / ".chronoshare", "metadata.db")
   {
   }
 
@@ -101,7 +102,7 @@ public:
   DumpLog()
   {
     sqlite3_stmt* stmt;
-    sqlite3_prepare_v2(m_db, "SELECT state_hash, last_update, state_id, last_update "
+    sqlite3_prepare_v2(m_db, "SELECT state_hash, last_update, state_id, prev_state_id "
                              "   FROM SyncLog "
                              "   ORDER BY last_update",
                        -1, &stmt, 0);
@@ -122,6 +123,11 @@ public:
                 .substr(0, 8)
            << " | "; // state hash
 
+      // states other than checkpoints only list the changes from the previous state
+      if (sqlite3_column_type(stmt, 3) != SQLITE_NULL) {
+        cout << "+ ";
+      }
+
       sqlite3_stmt* stmt2;
       sqlite3_prepare_v2(m_db,
                          "SELECT device_name, ss.seq_no "
@@ -149,7 +155,7 @@ class ActionLogDumper : public DbHelper
 {
 public:
   ActionLogDumper(const fs::path& path)
-    : DbHelper(path / ".chronoshare", "action-log.db")
+    : DbHelper(path / ".chronoshare", "metadata.db")
   {
   }
 
@@ -240,6 +246,15 @@ public:
           if (action->has_seg_num()) {
             cout << "Segment number = " << action->seg_num() << endl;
           }
+          if (action->has_seg_size()) {
+            cout << "Segment size = " << action->seg_size() << endl;
+          }
+          if (action->has_manifest_digest()) {
+            cout << "Manifest digest = "
+                 << toHex(reinterpret_cast<const uint8_t*>(action->manifest_digest().data()),
+                          action->manifest_digest().size())
+                 << endl;
+          }
           if (action->has_file_hash()) {
             cout << "File hash = "
                  << toHex(reinterpret_cast<const uint8_t*>(action->file_hash().data()),
@@ -267,7 +282,7 @@ class FileStateDumper : public DbHelper
 {
 public:
   FileStateDumper(const fs::path& path)
-    : DbHelper(path / ".chronoshare", "file-state.db")
+    : DbHelper(path / ".chronoshare", "metadata.db")
   {
   }
 
@@ -318,11 +333,27 @@ public:
   }
 };
 
+void
+DumpObjects(const fs::path& path)
+{
+  PackStore::Stats stats = PackStore::open(path / ".chronoshare")->getStats();
+
+  cout << ">> OBJECTS <<" << endl;
+  cout << "===================================================================================="
+       << endl;
+  cout << "segments:        " << stats.nSegments << endl;
+  cout << "shared payloads: " << stats.nChunks << endl;
+  cout << "compressed:      " << stats.nCompressedChunks << endl;
+  cout << "logical size:    " << stats.logicalSize << endl;
+  cout << "stored size:     " << stats.storedSize << endl;
+  cout << "dedup ratio:     " << stats.getDedupRatio() << endl;
+}
+
 int
 main(int argc, char* argv[])
 {
   if (argc != 3 && !(argc == 5 && std::string(argv[1]) == "action")) {
-    cerr << "Usage: ./dump-db state|action|file|all <path-to-shared-folder>" << endl;
+    cerr << "Usage: ./dump-db state|action|file|objects|all <path-to-shared-folder>" << endl;
     cerr << "   or: ./dump-db action <path-to-shared-folder> <device-name> <seq-no>" << endl;
     return 1;
   }
@@ -346,6 +377,9 @@ main(int argc, char* argv[])
     FileStateDumper dumper(argv[2]);
     dumper.Dump();
   }
+  else if (type == "objects") {
+    DumpObjects(argv[2]);
+  }
   else if (type == "all") {
     {
       StateLogDumper dumper(argv[2]);
@@ -362,10 +396,12 @@ main(int argc, char* argv[])
       FileStateDumper dumper(argv[2]);
       dumper.Dump();
     }
+
+    DumpObjects(argv[2]);
   }
   else {
     cerr << "ERROR: Wrong database type" << endl;
-    cerr << "\nUsage: ./dump-db state|action|file|all <path-to-shared-folder>" << endl;
+    cerr << "\nUsage: ./dump-db state|action|file|objects|all <path-to-shared-folder>" << endl;
     return 1;
   }
 
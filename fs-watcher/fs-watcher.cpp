@@ -255,6 +255,8 @@ FsWatcher::initFileStateDb()
     std::cout << "FS-Watcher DB error: " << errmsg << std::endl;
     sqlite3_free(errmsg);
   }
+
+  DbHelper::applyDurability(m_db, DbHelper::getDefaultDurability());
 }
 
 bool
@@ -48,6 +48,12 @@ _LOG_INIT(Gui);
 
 ChronoShareGui::ChronoShareGui(QWidget* parent)
   : QDialog(parent)
+  , m_segmentSize(DEFAULT_FILE_SEGMENT_SIZE)
+  , m_isContentDefinedChunking(false)
+  , m_isInPlaceMaterialization(false)
+  , m_isCompression(false)
+  , m_objectRetentionDays(30)
+  , m_isRelaxedDurability(false)
   , m_httpServer(0)
 #ifdef AUTOUPDATE
   , m_sparkle(CHRONOSHARE_APPCAST)
@@ -127,6 +133,12 @@ ChronoShareGui::ChronoShareGui(QString dirPath, QString username, QString shared
   , m_dirPath(dirPath)
   , m_username(username)
   , m_sharedFolderName(sharedFolderName)
+  , m_segmentSize(DEFAULT_FILE_SEGMENT_SIZE)
+  , m_isContentDefinedChunking(false)
+  , m_isInPlaceMaterialization(false)
+  , m_isCompression(false)
+  , m_objectRetentionDays(30)
+  , m_isRelaxedDurability(false)
 #ifdef AUTOUPDATE
   , m_sparkle(CHRONOSHARE_APPCAST)
 #endif
@@ -174,10 +186,17 @@ ChronoShareGui::startBackend(bool restart /*=false*/)
             << " m_sharedFolderName:" << m_sharedFolderName.toStdString()
             << " realPathToFolder: " << realPathToFolder);
 
+  DbHelper::setDefaultDurability(m_isRelaxedDurability ? DbHelper::DURABILITY_FAST
+                                                      : DbHelper::DURABILITY_SAFE);
+
   m_ioService.reset(new boost::asio::io_service());
   m_face.reset(new Face(*m_ioService));
   m_dispatcher.reset(new Dispatcher(m_username.toStdString(), m_sharedFolderName.toStdString(),
-                                    realPathToFolder, *m_face));
+                                    realPathToFolder, *m_face, m_segmentSize));
+  m_dispatcher->setContentDefinedChunking(m_isContentDefinedChunking);
+  m_dispatcher->setInPlaceMaterialization(m_isInPlaceMaterialization);
+  m_dispatcher->setCompression(m_isCompression);
+  m_dispatcher->setObjectRetention(time::days(m_objectRetentionDays));
 
   // Alex: this **must** be here, otherwise m_dirPath will be uninitialized
   m_watcher.reset(new FsWatcher(*m_ioService, realPathToFolder.string().c_str(),
@@ -617,6 +636,14 @@ ChronoShareGui::loadSettings()
 
   editSharedFolderPath->setText(m_dirPath);
 
+  // optional, the default is used when not configured
+  m_segmentSize = settings.value("segmentSize", static_cast<int>(DEFAULT_FILE_SEGMENT_SIZE)).toInt();
+  m_isContentDefinedChunking = settings.value("contentDefinedChunking", false).toBool();
+  m_isInPlaceMaterialization = settings.value("inPlaceMaterialization", false).toBool();
+  m_isCompression = settings.value("compression", false).toBool();
+  m_objectRetentionDays = settings.value("objectRetentionDays", 30).toInt();
+  m_isRelaxedDurability = settings.value("relaxedDurability", false).toBool();
+
   _LOG_DEBUG("Found configured path: " << (successful ? m_dirPath.toStdString() : std::string("no")));
 
   return successful;
@@ -632,6 +659,12 @@ ChronoShareGui::saveSettings()
   settings.setValue("dirPath", m_dirPath);
   settings.setValue("username", m_username);
   settings.setValue("sharedfoldername", m_sharedFolderName);
+  settings.setValue("segmentSize", m_segmentSize);
+  settings.setValue("contentDefinedChunking", m_isContentDefinedChunking);
+  settings.setValue("inPlaceMaterialization", m_isInPlaceMaterialization);
+  settings.setValue("compression", m_isCompression);
+  settings.setValue("objectRetentionDays", m_objectRetentionDays);
+  settings.setValue("relaxedDurability", m_isRelaxedDurability);
 }
 
 void
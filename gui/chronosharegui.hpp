@@ -166,6 +166,12 @@ private:
   QString m_dirPath;          // shared directory
   QString m_username;         // username
   QString m_sharedFolderName; // shared folder name
+  int m_segmentSize;          // payload size of published file segments
+  bool m_isContentDefinedChunking; // whether published files are cut at content-defined boundaries
+  bool m_isInPlaceMaterialization; // whether fetched files are written in place as segments arrive
+  bool m_isCompression; // whether stored segment payloads are compressed
+  int m_objectRetentionDays; // how long superseded file versions are kept
+  bool m_isRelaxedDurability; // whether the last commits may be lost on power failure
 
   http::server::server* m_httpServer;
   IoServiceManager* m_ioServiceManager;
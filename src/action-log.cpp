@@ -61,6 +61,7 @@ CREATE INDEX ActionLog_filename_version ON ActionLog (filename,version);
 CREATE INDEX ActionLog_parent ON ActionLog (parent_device_name, parent_seq_no);   \n\
 CREATE INDEX ActionLog_action_name ON ActionLog (action_name);          \n\
 CREATE INDEX ActionLog_filename_version_hash ON ActionLog (filename,version,file_hash); \n\
+CREATE INDEX ActionLog_device_hash ON ActionLog (device_name,file_hash); \n\
                                                                         \n\
 CREATE TRIGGER ActionLogInsert_trigger                                  \n\
     AFTER INSERT ON ActionLog                                           \n\
@@ -93,7 +94,7 @@ ActionLog::ActionLog(Face& face, const boost::filesystem::path& path, SyncLogPtr
                      const std::string& sharedFolder, const name::Component& appName,
                      OnFileAddedOrChangedCallback onFileAddedOrChanged,
                      OnFileRemovedCallback onFileRemoved)
-  : DbHelper(path / ".chronoshare", "action-log.db")
+  : DbHelper(path / ".chronoshare", "metadata.db")
   , m_syncLog(syncLog)
   // , m_face(face)
   , m_sharedFolderName(sharedFolder)
@@ -101,9 +102,6 @@ ActionLog::ActionLog(Face& face, const boost::filesystem::path& path, SyncLogPtr
   , m_onFileAddedOrChanged(onFileAddedOrChanged)
   , m_onFileRemoved(onFileRemoved)
 {
-  sqlite3_exec(m_db, "PRAGMA foreign_keys = OFF", NULL, NULL, NULL);
-  _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
-
   sqlite3_exec(m_db, INIT_DATABASE.c_str(), NULL, NULL, NULL);
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
 
@@ -114,6 +112,9 @@ ActionLog::ActionLog(Face& face, const boost::filesystem::path& path, SyncLogPtr
     BOOST_THROW_EXCEPTION(Error("Cannot create function ``apply_action''"));
   }
 
+  // before m_fileState is set, so imported actions are not applied again
+  importLegacyTables(path / ".chronoshare" / "action-log.db", {"ActionLog"});
+
   m_fileState = make_shared<FileState>(path);
 }
 
@@ -121,15 +122,9 @@ std::tuple<sqlite3_int64 /*version*/, BufferPtr /*device name*/, sqlite3_int64 /
 ActionLog::GetLatestActionForFile(const std::string& filename)
 {
   // check if something already exists
-  sqlite3_stmt* stmt;
-  int res = sqlite3_prepare_v2(m_db, "SELECT version,device_name,seq_no,action "
-                                     "FROM ActionLog "
-                                     "WHERE filename=? ORDER BY version DESC LIMIT 1",
-                               -1, &stmt, 0);
-
-  if (res != SQLITE_OK) {
-    BOOST_THROW_EXCEPTION(Error("Some error with GetExistingRecord"));
-  }
+  Statement stmt(*this, "SELECT version,device_name,seq_no,action "
+                        "FROM ActionLog "
+                        "WHERE filename=? ORDER BY version DESC LIMIT 1");
 
   sqlite3_int64 version = -1;
   BufferPtr parent_device_name;
@@ -147,14 +142,13 @@ ActionLog::GetLatestActionForFile(const std::string& filename)
     }
   }
 
-  sqlite3_finalize(stmt);
   return std::make_tuple(version, parent_device_name, parent_seq_no);
 }
 
 // local add action. remote action is extracted from content object
 ActionItemPtr
 ActionLog::AddLocalActionUpdate(const std::string& filename, const Buffer& hash, time_t wtime,
-                                int mode, int seg_num)
+                                int mode, int seg_num, int seg_size, ConstBufferPtr manifest_digest)
 {
   sqlite3_exec(m_db, "BEGIN TRANSACTION;", 0, 0, 0);
 
@@ -170,27 +164,20 @@ ActionLog::AddLocalActionUpdate(const std::string& filename, const Buffer& hash,
   tie(version, parent_device_name, parent_seq_no) = GetLatestActionForFile(filename);
   version++;
 
-  sqlite3_stmt* stmt;
-  int res =
-    sqlite3_prepare_v2(m_db,
-                       "INSERT INTO ActionLog "
-                       "(device_name, seq_no, action, filename, version, action_timestamp, "
-                       "file_hash, file_atime, file_mtime, file_ctime, file_chmod, file_seg_num, "
-                       "parent_device_name, parent_seq_no, "
-                       "action_name, action_content_object) "
-                       "VALUES (?, ?, ?, ?, ?, datetime(?, 'unixepoch', 'localtime'),"
-                       "        ?, datetime(?, 'unixepoch', 'localtime'), datetime(?, 'unixepoch', 'localtime'), "
-                       "        datetime(?, 'unixepoch', 'localtime'), ?, ?, "
-                       "        ?, ?, "
-                       "        ?, ?);",
-                       -1, &stmt, 0);
+  Statement stmt(*this,
+                 "INSERT INTO ActionLog "
+                 "(device_name, seq_no, action, filename, version, action_timestamp, "
+                 "file_hash, file_atime, file_mtime, file_ctime, file_chmod, file_seg_num, "
+                 "parent_device_name, parent_seq_no, "
+                 "action_name, action_content_object) "
+                 "VALUES (?, ?, ?, ?, ?, datetime(?, 'unixepoch', 'localtime'),"
+                 "        ?, datetime(?, 'unixepoch', 'localtime'), datetime(?, 'unixepoch', 'localtime'), "
+                 "        datetime(?, 'unixepoch', 'localtime'), ?, ?, "
+                 "        ?, ?, "
+                 "        ?, ?);");
 
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
 
-  if (res != SQLITE_OK) {
-    BOOST_THROW_EXCEPTION(Error(sqlite3_errmsg(m_db)));
-  }
-
   sqlite3_bind_blob(stmt, 1, device_name.wire(), device_name.size(), SQLITE_STATIC);
   sqlite3_bind_int64(stmt, 2, seq_no);
   sqlite3_bind_int(stmt, 3, 0);
@@ -222,6 +209,12 @@ ActionLog::AddLocalActionUpdate(const std::string& filename, const Buffer& hash,
   // item->set_ctime(ctime);
   item->set_mode(mode);
   item->set_seg_num(seg_num);
+  if (seg_size > 0) {
+    item->set_seg_size(seg_size);
+  }
+  if (manifest_digest) {
+    item->set_manifest_digest(manifest_digest->buf(), manifest_digest->size());
+  }
 
   if (parent_device_name && parent_seq_no > 0) {
     // cout << Name(*parent_device_name) << endl;
@@ -259,26 +252,22 @@ ActionLog::AddLocalActionUpdate(const std::string& filename, const Buffer& hash,
 
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_DONE, sqlite3_errmsg(m_db));
 
-  sqlite3_finalize(stmt);
-
   // I had a problem including directory_name assignment as part of the initial insert.
-  sqlite3_prepare_v2(m_db,
-                     "UPDATE ActionLog SET directory=directory_name(filename) WHERE device_name=? AND seq_no=?",
-                     -1, &stmt, 0);
+  Statement updateStmt(*this,
+                       "UPDATE ActionLog SET directory=directory_name(filename) WHERE device_name=? AND seq_no=?");
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
 
-  sqlite3_bind_blob(stmt, 1, device_name.wire(), device_name.size(), SQLITE_STATIC);
-  sqlite3_bind_int64(stmt, 2, seq_no);
-  sqlite3_step(stmt);
+  sqlite3_bind_blob(updateStmt, 1, device_name.wire(), device_name.size(), SQLITE_STATIC);
+  sqlite3_bind_int64(updateStmt, 2, seq_no);
+  sqlite3_step(updateStmt);
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_DONE, sqlite3_errmsg(m_db));
 
-  sqlite3_finalize(stmt);
-
-  sqlite3_exec(m_db, "END TRANSACTION;", 0, 0, 0);
-
   // set complete for local file
   m_fileState->SetFileComplete(filename);
 
+  // the sequence number, the action and the file state are committed together
+  sqlite3_exec(m_db, "END TRANSACTION;", 0, 0, 0);
+
   return item;
 }
 
@@ -309,16 +298,13 @@ ActionLog::AddLocalActionDelete(const std::string& filename)
     _LOG_DEBUG("Nothing to delete... [" << filename << "]");
 
     // just in case, remove data from FileState
-    sqlite3_stmt* stmt;
-    sqlite3_prepare_v2(m_db, "DELETE FROM FileState WHERE filename = ? ", -1, &stmt, 0);
+    Statement stmt(*this, "DELETE FROM FileState WHERE filename = ? ");
     sqlite3_bind_text(stmt, 1, filename.c_str(), filename.size(), SQLITE_STATIC); // file
 
     sqlite3_step(stmt);
 
     _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_DONE, sqlite3_errmsg(m_db));
 
-    sqlite3_finalize(stmt);
-
     sqlite3_exec(m_db, "END TRANSACTION;", 0, 0, 0);
     return ActionItemPtr();
   }
@@ -326,15 +312,13 @@ ActionLog::AddLocalActionDelete(const std::string& filename)
 
   sqlite3_int64 seq_no = m_syncLog->GetNextLocalSeqNo();
 
-  sqlite3_stmt* stmt;
-  sqlite3_prepare_v2(m_db, "INSERT INTO ActionLog "
-                           "(device_name, seq_no, action, filename, version, action_timestamp, "
-                           "parent_device_name, parent_seq_no, "
-                           "action_name, action_content_object) "
-                           "VALUES(?, ?, ?, ?, ?, datetime(?, 'unixepoch', 'localtime'),"
-                           "        ?, ?,"
-                           "        ?, ?)",
-                     -1, &stmt, 0);
+  Statement stmt(*this, "INSERT INTO ActionLog "
+                        "(device_name, seq_no, action, filename, version, action_timestamp, "
+                        "parent_device_name, parent_seq_no, "
+                        "action_name, action_content_object) "
+                        "VALUES(?, ?, ?, ?, ?, datetime(?, 'unixepoch', 'localtime'),"
+                        "        ?, ?,"
+                        "        ?, ?)");
 
   sqlite3_bind_blob(stmt, 1, device_name.wire(), device_name.size(), SQLITE_STATIC);
   sqlite3_bind_int64(stmt, 2, seq_no);
@@ -383,21 +367,16 @@ ActionLog::AddLocalActionDelete(const std::string& filename)
 
   // assign name to the action, serialize action, and create content object
 
-  sqlite3_finalize(stmt);
-
   // I had a problem including directory_name assignment as part of the initial insert.
-  sqlite3_prepare_v2(m_db,
-                     "UPDATE ActionLog SET directory=directory_name(filename) WHERE device_name=? AND seq_no=?",
-                     -1, &stmt, 0);
+  Statement updateStmt(*this,
+                       "UPDATE ActionLog SET directory=directory_name(filename) WHERE device_name=? AND seq_no=?");
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
 
-  sqlite3_bind_blob(stmt, 1, device_name.wire(), device_name.size(), SQLITE_STATIC);
-  sqlite3_bind_int64(stmt, 2, seq_no);
-  sqlite3_step(stmt);
+  sqlite3_bind_blob(updateStmt, 1, device_name.wire(), device_name.size(), SQLITE_STATIC);
+  sqlite3_bind_int64(updateStmt, 2, seq_no);
+  sqlite3_step(updateStmt);
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_DONE, sqlite3_errmsg(m_db));
 
-  sqlite3_finalize(stmt);
-
   sqlite3_exec(m_db, "END TRANSACTION;", 0, 0, 0);
 
   return item;
@@ -406,10 +385,8 @@ ActionLog::AddLocalActionDelete(const std::string& filename)
 shared_ptr<Data>
 ActionLog::LookupActionData(const Name& deviceName, sqlite3_int64 seqno)
 {
-  sqlite3_stmt* stmt;
-  sqlite3_prepare_v2(m_db,
-                     "SELECT action_content_object FROM ActionLog WHERE device_name=? AND seq_no=?",
-                     -1, &stmt, 0);
+  Statement stmt(*this,
+                 "SELECT action_content_object FROM ActionLog WHERE device_name=? AND seq_no=?");
 
   sqlite3_bind_blob(stmt, 1, deviceName.wireEncode().wire(), deviceName.wireEncode().size(),
                     SQLITE_STATIC); // ndn version
@@ -428,7 +405,6 @@ ActionLog::LookupActionData(const Name& deviceName, sqlite3_int64 seqno)
   }
   // _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK && sqlite3_errcode(m_db) != SQLITE_ROW,
   // sqlite3_errmsg(m_db));
-  sqlite3_finalize(stmt);
 
   return retval;
 }
@@ -448,9 +424,7 @@ ActionLog::LookupAction(const Name& deviceName, sqlite3_int64 seqno)
 shared_ptr<Data>
 ActionLog::LookupActionData(const Name& actionName)
 {
-  sqlite3_stmt* stmt;
-  sqlite3_prepare_v2(m_db, "SELECT action_content_object FROM ActionLog WHERE action_name=?", -1,
-                     &stmt, 0);
+  Statement stmt(*this, "SELECT action_content_object FROM ActionLog WHERE action_name=?");
 
   _LOG_DEBUG(actionName);
 
@@ -470,7 +444,6 @@ ActionLog::LookupActionData(const Name& actionName)
     _LOG_TRACE("No action found for name: " << actionName);
   }
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_ROW, sqlite3_errmsg(m_db));
-  sqlite3_finalize(stmt);
 
   return retval;
 }
@@ -491,15 +464,13 @@ ActionLog::LookupAction(const Name& actionName)
 FileItemPtr
 ActionLog::LookupAction(const std::string& filename, sqlite3_int64 version, const Buffer& filehash)
 {
-  sqlite3_stmt* stmt;
-  sqlite3_prepare_v2(m_db,
-                     "SELECT device_name, seq_no, strftime('%s', file_mtime), file_chmod, file_seg_num, file_hash "
-                     " FROM ActionLog "
-                     " WHERE action = 0 AND "
-                     "       filename=? AND "
-                     "       version=? AND "
-                     "       is_prefix(?, file_hash)=1",
-                     -1, &stmt, 0);
+  Statement stmt(*this,
+                 "SELECT device_name, seq_no, strftime('%s', file_mtime), file_chmod, file_seg_num, file_hash "
+                 " FROM ActionLog "
+                 " WHERE action = 0 AND "
+                 "       filename=? AND "
+                 "       version=? AND "
+                 "       is_prefix(?, file_hash)=1");
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
 
   sqlite3_bind_text(stmt, 1, filename.c_str(), filename.size(), SQLITE_STATIC);
@@ -527,6 +498,30 @@ ActionLog::LookupAction(const std::string& filename, sqlite3_int64 version, cons
   return fileItem;
 }
 
+ActionItemPtr
+ActionLog::LookupActionForHash(const Name& deviceName, const Buffer& filehash)
+{
+  Statement stmt(*this,
+                 "SELECT action_content_object FROM ActionLog "
+                 " WHERE action = 0 AND device_name=? AND file_hash=? "
+                 " ORDER BY seq_no DESC LIMIT 1");
+
+  sqlite3_bind_blob(stmt, 1, deviceName.wireEncode().wire(), deviceName.wireEncode().size(),
+                    SQLITE_STATIC);
+  sqlite3_bind_blob(stmt, 2, filehash.buf(), filehash.size(), SQLITE_STATIC);
+
+  ActionItemPtr action;
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    Data data(Block(reinterpret_cast<const uint8_t*>(sqlite3_column_blob(stmt, 0)),
+                    sqlite3_column_bytes(stmt, 0)));
+    action = deserializeMsg<ActionItem>(Buffer(data.getContent().value(), data.getContent().value_size()));
+  }
+  else {
+    _LOG_TRACE("No action found for deviceName [" << deviceName << "] and hash " << toHex(filehash));
+  }
+
+  return action;
+}
 
 ActionItemPtr
 ActionLog::AddRemoteAction(const Name& deviceName, sqlite3_int64 seqno, shared_ptr<Data> actionData)
@@ -545,18 +540,16 @@ ActionLog::AddRemoteAction(const Name& deviceName, sqlite3_int64 seqno, shared_p
 
   _LOG_DEBUG("AddRemoteAction: [" << deviceName.toUri() << "] seqno: " << seqno);
 
-  sqlite3_stmt* stmt;
-  sqlite3_prepare_v2(m_db,
-                     "INSERT INTO ActionLog "
-                     "(device_name, seq_no, action, filename, version, action_timestamp, "
-                     "file_hash, file_atime, file_mtime, file_ctime, file_chmod, file_seg_num, "
-                     "parent_device_name, parent_seq_no, "
-                     "action_name, action_content_object) "
-                     "VALUES (?, ?, ?, ?, ?, datetime(?, 'unixepoch'),"
-                     "        ?, datetime(?, 'unixepoch'), datetime(?, 'unixepoch'), datetime(?, 'unixepoch'), ?,?, "
-                     "        ?, ?, "
-                     "        ?, ?);",
-                     -1, &stmt, 0);
+  Statement stmt(*this,
+                 "INSERT INTO ActionLog "
+                 "(device_name, seq_no, action, filename, version, action_timestamp, "
+                 "file_hash, file_atime, file_mtime, file_ctime, file_chmod, file_seg_num, "
+                 "parent_device_name, parent_seq_no, "
+                 "action_name, action_content_object) "
+                 "VALUES (?, ?, ?, ?, ?, datetime(?, 'unixepoch'),"
+                 "        ?, datetime(?, 'unixepoch'), datetime(?, 'unixepoch'), datetime(?, 'unixepoch'), ?,?, "
+                 "        ?, ?, "
+                 "        ?, ?);");
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
 
   sqlite3_bind_blob(stmt, 1, deviceName.wireEncode().wire(), deviceName.wireEncode().size(),
@@ -599,22 +592,17 @@ ActionLog::AddRemoteAction(const Name& deviceName, sqlite3_int64 seqno, shared_p
 
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_DONE, sqlite3_errmsg(m_db));
 
-  sqlite3_finalize(stmt);
-
   // I had a problem including directory_name assignment as part of the initial insert.
-  sqlite3_prepare_v2(m_db,
-                     "UPDATE ActionLog SET directory=directory_name(filename) WHERE device_name=? AND seq_no=?",
-                     -1, &stmt, 0);
+  Statement updateStmt(*this,
+                       "UPDATE ActionLog SET directory=directory_name(filename) WHERE device_name=? AND seq_no=?");
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
 
-  sqlite3_bind_blob(stmt, 1, deviceName.wireEncode().wire(), deviceName.wireEncode().size(),
+  sqlite3_bind_blob(updateStmt, 1, deviceName.wireEncode().wire(), deviceName.wireEncode().size(),
                     SQLITE_STATIC);
-  sqlite3_bind_int64(stmt, 2, seqno);
-  sqlite3_step(stmt);
+  sqlite3_bind_int64(updateStmt, 2, seqno);
+  sqlite3_step(updateStmt);
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_DONE, sqlite3_errmsg(m_db));
 
-  sqlite3_finalize(stmt);
-
   return action;
 }
 
@@ -655,8 +643,7 @@ ActionLog::AddRemoteAction(shared_ptr<Data> actionData)
 sqlite3_int64
 ActionLog::LogSize()
 {
-  sqlite3_stmt* stmt;
-  sqlite3_prepare_v2(m_db, "SELECT count(*) FROM ActionLog", -1, &stmt, 0);
+  Statement stmt(*this, "SELECT count(*) FROM ActionLog");
 
   sqlite3_int64 retval = -1;
   if (sqlite3_step(stmt) == SQLITE_ROW) {
@@ -676,22 +663,23 @@ ActionLog::LookupActionsInFolderRecursively(
   if (limit >= 0)
     limit += 1; // to check if there is more data
 
-  sqlite3_stmt* stmt;
+  /// @todo Do something to improve efficiency of this query. Right now it is basically scanning the whole database
+  // there is a small ambiguity with is_prefix matching, but should be ok for now
+  Statement stmt(*this, folder != "" ?
+                        "SELECT device_name,seq_no,action,filename,directory,version,strftime('%s', action_timestamp), "
+                        "       file_hash,strftime('%s', file_mtime),file_chmod,file_seg_num, "
+                        "       parent_device_name,parent_seq_no "
+                        "   FROM ActionLog "
+                        "   WHERE is_dir_prefix (?, directory)=1 "
+                        "   ORDER BY action_timestamp DESC "
+                        "   LIMIT ? OFFSET ?" :
+                        "SELECT device_name,seq_no,action,filename,directory,version,strftime('%s', action_timestamp), "
+                        "       file_hash,strftime('%s', file_mtime),file_chmod,file_seg_num, "
+                        "       parent_device_name,parent_seq_no "
+                        "   FROM ActionLog "
+                        "   ORDER BY action_timestamp DESC "
+                        "   LIMIT ? OFFSET ?");
   if (folder != "") {
-    /// @todo Do something to improve efficiency of this query. Right now it is basically scanning the whole database
-
-    sqlite3_prepare_v2(m_db,
-                       "SELECT device_name,seq_no,action,filename,directory,version,strftime('%s', action_timestamp), "
-                       "       file_hash,strftime('%s', file_mtime),file_chmod,file_seg_num, "
-                       "       parent_device_name,parent_seq_no "
-                       "   FROM ActionLog "
-                       "   WHERE is_dir_prefix (?, directory)=1 "
-                       "   ORDER BY action_timestamp DESC "
-                       "   LIMIT ? OFFSET ?",
-                       -1, &stmt,
-                       0); // there is a small ambiguity with is_prefix matching, but should be ok for now
-    _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
-
     sqlite3_bind_text(stmt, 1, folder.c_str(), folder.size(), SQLITE_STATIC);
     _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
 
@@ -699,14 +687,6 @@ ActionLog::LookupActionsInFolderRecursively(
     sqlite3_bind_int(stmt, 3, offset);
   }
   else {
-    sqlite3_prepare_v2(m_db,
-                       "SELECT device_name,seq_no,action,filename,directory,version,strftime('%s', action_timestamp), "
-                       "       file_hash,strftime('%s', file_mtime),file_chmod,file_seg_num, "
-                       "       parent_device_name,parent_seq_no "
-                       "   FROM ActionLog "
-                       "   ORDER BY action_timestamp DESC "
-                       "   LIMIT ? OFFSET ?",
-                       -1, &stmt, 0);
     sqlite3_bind_int(stmt, 1, limit);
     sqlite3_bind_int(stmt, 2, offset);
   }
@@ -748,8 +728,6 @@ ActionLog::LookupActionsInFolderRecursively(
 
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_DONE, sqlite3_errmsg(m_db));
 
-  sqlite3_finalize(stmt);
-
   return (limit == 1); // more data is available
 }
 
@@ -768,17 +746,14 @@ ActionLog::LookupActionsForFile(
   if (limit >= 0)
     limit += 1; // to check if there is more data
 
-  sqlite3_stmt* stmt;
-  sqlite3_prepare_v2(m_db,
-                     "SELECT device_name,seq_no,action,filename,directory,version,strftime('%s', action_timestamp), "
-                     "       file_hash,strftime('%s', file_mtime),file_chmod,file_seg_num, "
-                     "       parent_device_name,parent_seq_no "
-                     "   FROM ActionLog "
-                     "   WHERE filename=? "
-                     "   ORDER BY action_timestamp DESC "
-                     "   LIMIT ? OFFSET ?",
-                     -1, &stmt,
-                     0); // there is a small ambiguity with is_prefix matching, but should be ok for now
+  Statement stmt(*this,
+                 "SELECT device_name,seq_no,action,filename,directory,version,strftime('%s', action_timestamp), "
+                 "       file_hash,strftime('%s', file_mtime),file_chmod,file_seg_num, "
+                 "       parent_device_name,parent_seq_no "
+                 "   FROM ActionLog "
+                 "   WHERE filename=? "
+                 "   ORDER BY action_timestamp DESC "
+                 "   LIMIT ? OFFSET ?"); // there is a small ambiguity with is_prefix matching, but should be ok for now
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
 
   sqlite3_bind_text(stmt, 1, file.c_str(), file.size(), SQLITE_STATIC);
@@ -824,8 +799,6 @@ ActionLog::LookupActionsForFile(
 
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_DONE, sqlite3_errmsg(m_db));
 
-  sqlite3_finalize(stmt);
-
   return (limit == 1); // more data is available
 }
 
@@ -833,19 +806,16 @@ void
 ActionLog::LookupRecentFileActions(const function<void(const std::string&, int, int)>& visitor,
                                    int limit)
 {
-  sqlite3_stmt* stmt;
-
-  sqlite3_prepare_v2(m_db,
-                     "SELECT AL.filename, AL.action"
-                     "   FROM ActionLog AL"
-                     "   JOIN "
-                     "   (SELECT filename, MAX(action_timestamp) AS action_timestamp "
-                     "       FROM ActionLog "
-                     "       GROUP BY filename ) AS GAL"
-                     "   ON AL.filename = GAL.filename AND AL.action_timestamp = GAL.action_timestamp "
-                     "   ORDER BY AL.action_timestamp DESC "
-                     "   LIMIT ?;",
-                     -1, &stmt, 0);
+  Statement stmt(*this,
+                 "SELECT AL.filename, AL.action"
+                 "   FROM ActionLog AL"
+                 "   JOIN "
+                 "   (SELECT filename, MAX(action_timestamp) AS action_timestamp "
+                 "       FROM ActionLog "
+                 "       GROUP BY filename ) AS GAL"
+                 "   ON AL.filename = GAL.filename AND AL.action_timestamp = GAL.action_timestamp "
+                 "   ORDER BY AL.action_timestamp DESC "
+                 "   LIMIT ?;");
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
   sqlite3_bind_int(stmt, 1, limit);
   int index = 0;
@@ -859,9 +829,24 @@ ActionLog::LookupRecentFileActions(const function<void(const std::string&, int,
 
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_DONE, sqlite3_errmsg(m_db));
 
-  sqlite3_finalize(stmt);
 }
 
+void
+ActionLog::LookupFileHashesSince(const function<void(const Buffer&)>& visitor, time_t since)
+{
+  Statement stmt(*this,
+                 "SELECT DISTINCT file_hash FROM ActionLog "
+                 "   WHERE action = 0 AND file_hash IS NOT NULL AND "
+                 "         strftime('%s', action_timestamp) >= ?");
+  _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
+  sqlite3_bind_int64(stmt, 1, since);
+
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    visitor(Buffer(sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0)));
+  }
+  _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_DONE, sqlite3_errmsg(m_db));
+
+}
 
 ///////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////
@@ -872,6 +857,12 @@ ActionLog::apply_action_xFun(sqlite3_context* context, int argc, sqlite3_value**
 {
   ActionLog* the = reinterpret_cast<ActionLog*>(sqlite3_user_data(context));
 
+  if (the->m_fileState == nullptr) {
+    // legacy action log is being imported, its file state is imported separately
+    sqlite3_result_null(context);
+    return;
+  }
+
   if (argc != 11) {
     sqlite3_result_error(context, "``apply_action'' expects 10 arguments", -1);
     return;
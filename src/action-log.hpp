@@ -70,9 +70,14 @@ public:
   //////////////////////////
   // Local operations     //
   //////////////////////////
+  /**
+   * @brief Add local UPDATE action
+   * @param seg_size payload size of file segments (not recorded in the action if 0)
+   * @param manifest_digest root of the file manifest (not recorded in the action if nullptr)
+   */
   ActionItemPtr
   AddLocalActionUpdate(const std::string& filename, const Buffer& hash, time_t wtime, int mode,
-                       int seg_num);
+                       int seg_num, int seg_size = 0, ConstBufferPtr manifest_digest = nullptr);
 
   // void
   // AddActionMove(const std::string &oldFile, const std::string &newFile);
@@ -115,6 +120,14 @@ public:
   FileItemPtr
   LookupAction(const std::string& filename, sqlite3_int64 version, const Buffer& filehash);
 
+  /**
+   * @brief Lookup the latest update action of @p deviceName with content @p filehash
+   *
+   * Unlike the file state, also finds versions that have since been replaced or deleted
+   */
+  ActionItemPtr
+  LookupActionForHash(const Name& deviceName, const Buffer& filehash);
+
   /**
    * @brief Lookup up to [limit] actions starting [offset] in decreasing order(by timestamp) and
    * calling visitor(device_name,seqno,action) for each action
@@ -132,6 +145,13 @@ public:
   void
   LookupRecentFileActions(const function<void(const std::string&, int, int)>& visitor, int limit = 5);
 
+  /**
+   * @brief Call visitor(hash) for every distinct file hash of update actions made at or after
+   *        @p since (seconds since the epoch)
+   */
+  void
+  LookupFileHashesSince(const function<void(const Buffer&)>& visitor, time_t since);
+
   //
   inline FileStatePtr
   GetFileState();
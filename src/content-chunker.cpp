@@ -0,0 +1,106 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#include "content-chunker.hpp"
+
+#include <array>
+#include <random>
+
+namespace ndn {
+namespace chronoshare {
+
+namespace {
+
+// Gear values must be the same for all peers, otherwise identical content is cut differently
+const std::array<uint64_t, 256>&
+getGearTable()
+{
+  static const std::array<uint64_t, 256> table = [] {
+    std::array<uint64_t, 256> gear;
+    std::mt19937_64 rng(0x436872536861ULL);
+    for (auto& value : gear) {
+      value = rng();
+    }
+    return gear;
+  }();
+  return table;
+}
+
+// mask selecting @p nBits most significant bits, which depend on the last 64 bytes of input
+uint64_t
+makeMask(int nBits)
+{
+  return nBits <= 0 ? 0 : ~uint64_t(0) << (64 - nBits);
+}
+
+} // namespace
+
+ContentDefinedChunker::ContentDefinedChunker(size_t maxSize)
+  : m_minSize(std::max<size_t>(maxSize / 8, 1))
+  , m_avgSize(std::max<size_t>(maxSize / 2, 1))
+  , m_maxSize(std::max<size_t>(maxSize, 1))
+  , m_offset(0)
+  , m_chunkSize(0)
+  , m_fingerprint(0)
+{
+  int bits = 0;
+  while ((size_t(1) << (bits + 1)) <= m_avgSize) {
+    ++bits;
+  }
+  m_maskS = makeMask(bits + 2);
+  m_maskL = makeMask(bits - 2);
+}
+
+void
+ContentDefinedChunker::update(const uint8_t* buffer, size_t size, std::vector<uint64_t>& boundaries)
+{
+  const auto& gear = getGearTable();
+
+  for (size_t i = 0; i < size; ++i) {
+    m_fingerprint = (m_fingerprint << 1) + gear[buffer[i]];
+    ++m_chunkSize;
+
+    if (m_chunkSize < m_minSize) {
+      continue;
+    }
+
+    uint64_t mask = m_chunkSize < m_avgSize ? m_maskS : m_maskL;
+    if ((m_fingerprint & mask) == 0 || m_chunkSize >= m_maxSize) {
+      m_offset += m_chunkSize;
+      boundaries.push_back(m_offset);
+      m_chunkSize = 0;
+      m_fingerprint = 0;
+    }
+  }
+}
+
+void
+ContentDefinedChunker::finish(std::vector<uint64_t>& boundaries)
+{
+  if (m_chunkSize > 0) {
+    m_offset += m_chunkSize;
+    boundaries.push_back(m_offset);
+    m_chunkSize = 0;
+    m_fingerprint = 0;
+  }
+}
+
+} // namespace chronoshare
+} // namespace ndn
@@ -0,0 +1,77 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#ifndef CHRONOSHARE_SRC_CONTENT_CHUNKER_HPP
+#define CHRONOSHARE_SRC_CONTENT_CHUNKER_HPP
+
+#include "core/chronoshare-common.hpp"
+
+#include <vector>
+
+namespace ndn {
+namespace chronoshare {
+
+/**
+ * @brief Content-defined chunking of a byte stream (FastCDC-style gear hash with normalized
+ *        chunking)
+ *
+ * Chunk boundaries depend only on the bytes around them, so inserting or removing bytes in a
+ * file changes only the chunks near the edit, while all other chunks keep their content and can
+ * be shared with the previous version of the file.
+ *
+ * Chunks are between maxSize / 8 and maxSize bytes, most of them are around maxSize / 2.
+ */
+class ContentDefinedChunker
+{
+public:
+  explicit
+  ContentDefinedChunker(size_t maxSize);
+
+  /**
+   * @brief Feed the next part of the stream
+   *
+   * End offsets (from the beginning of the stream) of chunks completed within the part are
+   * appended to @p boundaries
+   */
+  void
+  update(const uint8_t* buffer, size_t size, std::vector<uint64_t>& boundaries);
+
+  /**
+   * @brief End the stream, the last chunk ends at the end of the stream
+   */
+  void
+  finish(std::vector<uint64_t>& boundaries);
+
+private:
+  size_t m_minSize;
+  size_t m_avgSize;
+  size_t m_maxSize;
+  uint64_t m_maskS; // used until the average size is reached, makes cuts less likely
+  uint64_t m_maskL; // used after the average size is reached, makes cuts more likely
+
+  uint64_t m_offset;
+  size_t m_chunkSize;
+  uint64_t m_fingerprint;
+};
+
+} // namespace chronoshare
+} // namespace ndn
+
+#endif // CHRONOSHARE_SRC_CONTENT_CHUNKER_HPP
@@ -66,6 +66,7 @@ void
 ContentServer::registerPrefix(const Name& forwardingHint)
 {
   // Format for files:   /<forwarding-hint>/<device_name>/<appname>/file/<hash>/<segment>
+  // Format for file manifests: /<forwarding-hint>/<device_name>/<appname>/manifest/<hash>/<segment>
   // Format for actions:
   // /<forwarding-hint>/<device_name>/<appname>/action/<shared-folder>/<action-seq>
 
@@ -100,7 +101,7 @@ ContentServer::filterAndServeImpl(const Name& forwardingHint, const Name& name,
 
   if (name.size() >= 4 && name.get(-4) == m_appName) {
     std::string type = name.get(-3).toUri();
-    if (type == "file") {
+    if (type == "file" || type == "manifest") {
       serve_File(forwardingHint, name, interest);
     }
     else if (type == "action") {
@@ -157,7 +158,10 @@ ContentServer::serve_File_Execute(const Name& forwardingHint, const Name& name,
   // forwardingHint: /<forwarding-hint>
   // interest:       /<forwarding-hint>/<device_name>/<appname>/file/<hash>/<segment>
   // name:           /<device_name>/<appname>/file/<hash>/<segment>
+  //
+  // or the same with "manifest" instead of "file" for the file manifest
 
+  bool isManifest = (name.get(-3).toUri() == "manifest");
   int64_t segment = name.get(-1).toNumber();
   Name deviceName = name.getSubName(0, name.size() - 4);
   Buffer hash(name.get(-2).value(), name.get(-2).value_size());
@@ -190,7 +194,8 @@ ContentServer::serve_File_Execute(const Name& forwardingHint, const Name& name,
   }
 
   if (db) {
-    shared_ptr<Data> data = db->fetchSegment(deviceName, segment);
+    shared_ptr<Data> data = isManifest ? db->fetchManifestSegment(deviceName, segment)
+                                       : db->fetchSegment(deviceName, segment);
     if (data) {
       if (forwardingHint.size() == 0) {
         m_face.put(*data);
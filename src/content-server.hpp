@@ -51,7 +51,7 @@ public:
 
   // the assumption is, when the interest comes in, interest is informs of
   // /some-prefix/topology-independent-name
-  // currently /topology-independent-name must begin with /action or /file
+  // currently /topology-independent-name must begin with /action, /file or /manifest
   // so that ContentServer knows where to look for the content object
   void
   registerPrefix(const Name& prefix);
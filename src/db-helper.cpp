@@ -23,6 +23,11 @@
 
 #include <ndn-cxx/util/digest.hpp>
 
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
 namespace ndn {
 namespace chronoshare {
 
@@ -36,11 +41,63 @@ const std::string INIT_DATABASE = "\
     PRAGMA foreign_keys = ON;      \
 ";
 
+// page cache (in KiB when negative) and memory map size of the databases in WAL mode
+const int WAL_CACHE_SIZE = -16384;
+const sqlite3_int64 WAL_MMAP_SIZE = 256 * 1024 * 1024;
+
+static std::atomic<DbHelper::Durability> defaultDurability(DbHelper::DURABILITY_SAFE);
+
+/**
+ * @brief SQLite connection shared by all DbHelpers of the same database file
+ */
+struct DbHelper::Connection : boost::noncopyable
+{
+  Connection()
+    : db(nullptr)
+    , nPreparedStatements(0)
+  {
+  }
+
+  ~Connection()
+  {
+    for (const auto& cached : statements) {
+      for (sqlite3_stmt* stmt : cached.second) {
+        sqlite3_finalize(stmt);
+      }
+    }
+
+    int res = sqlite3_close(db);
+    if (res != SQLITE_OK) {
+      // complain
+    }
+  }
+
+  sqlite3* db;
+  // statements that are not borrowed, by SQL text
+  std::unordered_map<std::string, std::vector<sqlite3_stmt*>> statements;
+  std::mutex statementsMutex;
+  size_t nPreparedStatements;
+};
+
 DbHelper::DbHelper(const fs::path& path, const std::string& dbname)
 {
+  static std::mutex registryMutex;
+  static std::map<fs::path, std::weak_ptr<Connection>> registry;
+
   fs::create_directories(path);
+  fs::path key = fs::canonical(path) / dbname;
 
-  int res = sqlite3_open((path / dbname).c_str(), &m_db);
+  std::lock_guard<std::mutex> lock(registryMutex);
+  std::weak_ptr<Connection>& entry = registry[key];
+  m_connection = entry.lock();
+  if (m_connection != nullptr) {
+    m_db = m_connection->db;
+    return;
+  }
+
+  m_connection = make_shared<Connection>();
+  int res = sqlite3_open(key.c_str(), &m_connection->db);
+  m_db = m_connection->db;
   if (res != SQLITE_OK) {
     BOOST_THROW_EXCEPTION(Error("Cannot open/create database: [" + (path / dbname).string() + "]"));
   }
@@ -70,14 +127,236 @@ DbHelper::DbHelper(const fs::path& path, const std::string& dbname)
 
   sqlite3_exec(m_db, INIT_DATABASE.c_str(), NULL, NULL, NULL);
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
+
+  applyDurability(m_db, defaultDurability);
+  entry = m_connection;
 }
 
 DbHelper::~DbHelper()
 {
-  int res = sqlite3_close(m_db);
-  if (res != SQLITE_OK) {
-    // complain
+}
+
+size_t
+DbHelper::getPreparedStatementCount() const
+{
+  std::lock_guard<std::mutex> lock(m_connection->statementsMutex);
+  return m_connection->nPreparedStatements;
+}
+
+void
+DbHelper::importLegacyTables(const fs::path& legacyDb, const std::vector<std::string>& tables)
+{
+  if (!fs::exists(legacyDb)) {
+    return;
+  }
+
+  _LOG_DEBUG("Importing " << legacyDb);
+
+  {
+    Statement attach(*this, "ATTACH DATABASE ? AS legacy");
+    attach.bind(1, legacyDb.string(), SQLITE_TRANSIENT);
+    if (attach.step() != SQLITE_DONE) {
+      BOOST_THROW_EXCEPTION(Error("Cannot attach " + legacyDb.string() + ": " + sqlite3_errmsg(m_db)));
+    }
+  }
+
+  bool isImported = true;
+  sqlite3_exec(m_db, "BEGIN TRANSACTION;", 0, 0, 0);
+  for (const auto& table : tables) {
+    // the columns are listed, as the table may have gained columns since the legacy database was
+    // created; tables missing in the legacy database are simply empty
+    std::string columns;
+    {
+      Statement tableInfo(*this, "PRAGMA legacy.table_info(" + table + ")");
+      while (tableInfo.step() == SQLITE_ROW) {
+        columns += (columns.empty() ? "" : ",") + tableInfo.getString(1);
+      }
+    }
+    if (columns.empty()) {
+      continue;
+    }
+
+    std::string sql = "INSERT OR IGNORE INTO main." + table + " (" + columns + ") SELECT " +
+                      columns + " FROM legacy." + table;
+    char* errmsg = nullptr;
+    if (sqlite3_exec(m_db, sql.c_str(), nullptr, nullptr, &errmsg) != SQLITE_OK) {
+      _LOG_ERROR("Cannot import " << table << " from " << legacyDb << ": "
+                 << (errmsg != nullptr ? errmsg : "unknown error"));
+      isImported = false;
+    }
+    sqlite3_free(errmsg);
+  }
+  sqlite3_exec(m_db, isImported ? "END TRANSACTION;" : "ROLLBACK TRANSACTION;", 0, 0, 0);
+  sqlite3_exec(m_db, "DETACH DATABASE legacy;", 0, 0, 0);
+
+  if (isImported) {
+    // the legacy database is removed only after its content is committed
+    for (const char* suffix : {"", "-journal", "-wal", "-shm"}) {
+      boost::system::error_code error;
+      fs::remove(legacyDb.string() + suffix, error);
+    }
+  }
+}
+
+void
+DbHelper::setDefaultDurability(Durability durability)
+{
+  defaultDurability = durability;
+}
+
+DbHelper::Durability
+DbHelper::getDefaultDurability()
+{
+  return defaultDurability;
+}
+
+void
+DbHelper::applyDurability(sqlite3* db, Durability durability)
+{
+  std::string pragmas;
+  switch (durability) {
+  case DURABILITY_ROLLBACK:
+    pragmas = "PRAGMA journal_mode = DELETE; PRAGMA synchronous = FULL;";
+    break;
+  case DURABILITY_SAFE:
+    pragmas = "PRAGMA journal_mode = WAL; PRAGMA synchronous = FULL;";
+    break;
+  case DURABILITY_FAST:
+    pragmas = "PRAGMA journal_mode = WAL; PRAGMA synchronous = NORMAL;";
+    break;
+  }
+  if (durability != DURABILITY_ROLLBACK) {
+    pragmas += " PRAGMA cache_size = " + std::to_string(WAL_CACHE_SIZE) + ";"
+               " PRAGMA mmap_size = " + std::to_string(WAL_MMAP_SIZE) + ";";
   }
+
+  char* errmsg = nullptr;
+  if (sqlite3_exec(db, pragmas.c_str(), nullptr, nullptr, &errmsg) != SQLITE_OK) {
+    // e.g., WAL is not supported by the file system: the database keeps working as it was
+    _LOG_ERROR("Cannot apply durability profile [" << pragmas << "]: "
+               << (errmsg != nullptr ? errmsg : "unknown error"));
+    sqlite3_free(errmsg);
+  }
+}
+
+sqlite3_stmt*
+DbHelper::borrowStatement(const std::string& sql, const std::string*& key)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_connection->statementsMutex);
+    auto statements = m_connection->statements.emplace(sql, std::vector<sqlite3_stmt*>()).first;
+    key = &statements->first;
+    if (!statements->second.empty()) {
+      sqlite3_stmt* stmt = statements->second.back();
+      statements->second.pop_back();
+      return stmt;
+    }
+  }
+
+  sqlite3_stmt* stmt = nullptr;
+  if (sqlite3_prepare_v2(m_db, sql.data(), sql.size(), &stmt, nullptr) != SQLITE_OK) {
+    sqlite3_finalize(stmt);
+    BOOST_THROW_EXCEPTION(Error("Cannot prepare statement [" + sql + "]: " + sqlite3_errmsg(m_db)));
+  }
+
+  std::lock_guard<std::mutex> lock(m_connection->statementsMutex);
+  ++m_connection->nPreparedStatements;
+  return stmt;
+}
+
+void
+DbHelper::returnStatement(const std::string* key, sqlite3_stmt* stmt)
+{
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+
+  std::lock_guard<std::mutex> lock(m_connection->statementsMutex);
+  m_connection->statements[*key].push_back(stmt);
+}
+
+DbHelper::Statement::Statement(DbHelper& helper, const std::string& sql)
+  : m_helper(helper)
+  , m_sql(nullptr)
+  , m_stmt(helper.borrowStatement(sql, m_sql))
+{
+}
+
+DbHelper::Statement::~Statement()
+{
+  m_helper.returnStatement(m_sql, m_stmt);
+}
+
+int
+DbHelper::Statement::bind(int index, const char* value, size_t size, void (*destructor)(void*))
+{
+  return sqlite3_bind_text(m_stmt, index, value, size, destructor);
+}
+
+int
+DbHelper::Statement::bind(int index, const std::string& value, void (*destructor)(void*))
+{
+  return sqlite3_bind_text(m_stmt, index, value.data(), value.size(), destructor);
+}
+
+int
+DbHelper::Statement::bind(int index, const void* buf, size_t size, void (*destructor)(void*))
+{
+  return sqlite3_bind_blob(m_stmt, index, buf, size, destructor);
+}
+
+int
+DbHelper::Statement::bind(int index, const Block& block, void (*destructor)(void*))
+{
+  return sqlite3_bind_blob(m_stmt, index, block.wire(), block.size(), destructor);
+}
+
+int
+DbHelper::Statement::bind(int index, int number)
+{
+  return sqlite3_bind_int(m_stmt, index, number);
+}
+
+int
+DbHelper::Statement::bind(int index, sqlite3_int64 number)
+{
+  return sqlite3_bind_int64(m_stmt, index, number);
+}
+
+std::string
+DbHelper::Statement::getString(int column)
+{
+  return std::string(reinterpret_cast<const char*>(sqlite3_column_text(m_stmt, column)),
+                     sqlite3_column_bytes(m_stmt, column));
+}
+
+Block
+DbHelper::Statement::getBlock(int column)
+{
+  return Block(sqlite3_column_blob(m_stmt, column), sqlite3_column_bytes(m_stmt, column));
+}
+
+const uint8_t*
+DbHelper::Statement::getBlob(int column)
+{
+  return static_cast<const uint8_t*>(sqlite3_column_blob(m_stmt, column));
+}
+
+int
+DbHelper::Statement::getSize(int column)
+{
+  return sqlite3_column_bytes(m_stmt, column);
+}
+
+int
+DbHelper::Statement::getInt(int column)
+{
+  return sqlite3_column_int(m_stmt, column);
+}
+
+int
+DbHelper::Statement::step()
+{
+  return sqlite3_step(m_stmt);
 }
 
 void
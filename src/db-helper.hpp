@@ -23,12 +23,25 @@
 
 #include "core/chronoshare-common.hpp"
 
+#include <ndn-cxx/encoding/block.hpp>
+
 #include <boost/filesystem.hpp>
 #include <sqlite3.h>
 
+#include <vector>
+
 namespace ndn {
 namespace chronoshare {
 
+/**
+ * @brief Base of the classes keeping a SQLite database
+ *
+ * Registers the helper SQL functions on the connection and keeps a cache of prepared statements
+ * keyed by their SQL text, so the same statement is parsed only once per connection.
+ *
+ * All DbHelpers of the same database file share one connection, so the classes keeping their
+ * tables in one database (SyncLog, ActionLog and FileState) can update them in one transaction.
+ */
 class DbHelper
 {
 public:
@@ -41,10 +54,149 @@ public:
     }
   };
 
+  /**
+   * @brief Prepared statement borrowed from the statement cache of a connection
+   *
+   * The statement is prepared when its SQL is used for the first time (or while all statements
+   * with the same SQL are borrowed).  When the handle goes out of scope, the statement is reset,
+   * its bindings are cleared, and it is returned to the cache.
+   *
+   * Has the same interface as util::Sqlite3Statement and converts to sqlite3_stmt*, so it can be
+   * used with the sqlite3_* functions too, except sqlite3_finalize.
+   */
+  class Statement : private boost::noncopyable
+  {
+  public:
+    /**
+     * @throw Error the statement cannot be prepared
+     */
+    Statement(DbHelper& db, const std::string& sql);
+
+    ~Statement();
+
+    int
+    bind(int index, const char* value, size_t size, void (*destructor)(void*));
+
+    int
+    bind(int index, const std::string& value, void (*destructor)(void*));
+
+    int
+    bind(int index, const void* buf, size_t size, void (*destructor)(void*));
+
+    int
+    bind(int index, const Block& block, void (*destructor)(void*));
+
+    int
+    bind(int index, int number);
+
+    int
+    bind(int index, sqlite3_int64 number);
+
+    std::string
+    getString(int column);
+
+    Block
+    getBlock(int column);
+
+    const uint8_t*
+    getBlob(int column);
+
+    int
+    getSize(int column);
+
+    int
+    getInt(int column);
+
+    int
+    step();
+
+    operator sqlite3_stmt*() const
+    {
+      return m_stmt;
+    }
+
+  private:
+    DbHelper& m_helper;
+    const std::string* m_sql; ///< key in the statement cache
+    sqlite3_stmt* m_stmt;
+  };
+
+  /**
+   * @brief How the databases trade the cost of a commit against its durability
+   */
+  enum Durability {
+    /**
+     * @brief Rollback journal with synchronous=FULL, the SQLite defaults
+     */
+    DURABILITY_ROLLBACK,
+    /**
+     * @brief WAL journal with synchronous=FULL
+     *
+     * Every commit is durable, but costs a single fsync of the log instead of several of the
+     * journal and the database, and readers on other connections are not blocked by the writer.
+     */
+    DURABILITY_SAFE,
+    /**
+     * @brief WAL journal with synchronous=NORMAL
+     *
+     * The log is synced only when it is checkpointed, so the last commits may be rolled back
+     * after a power failure, but the database is never corrupted.
+     */
+    DURABILITY_FAST
+  };
+
 public:
+  /**
+   * @brief Open (or create) the database and apply the default durability profile to it
+   *
+   * If the database is already open, its connection is shared.
+   */
   DbHelper(const boost::filesystem::path& path, const std::string& dbname);
   virtual ~DbHelper();
 
+  /**
+   * @brief Set the durability profile of the databases opened afterwards (DURABILITY_SAFE
+   *        unless set)
+   */
+  static void
+  setDefaultDurability(Durability durability);
+
+  static Durability
+  getDefaultDurability();
+
+  /**
+   * @brief Apply @p durability to a connection, including one not opened through DbHelper
+   *
+   * WAL profiles also enlarge the page cache and map the database into memory.  Must not be
+   * called inside a transaction.
+   */
+  static void
+  applyDurability(sqlite3* db, Durability durability);
+
+  /**
+   * @brief Number of statements prepared on the connection since it was opened
+   */
+  size_t
+  getPreparedStatementCount() const;
+
+protected:
+  /**
+   * @brief Copy @p tables from @p legacyDb, the separate database used by a class before it
+   *        moved its tables into a shared one, and remove @p legacyDb once they are committed
+   *
+   * Rows that already exist are kept, and columns missing in @p legacyDb get their default values.
+   * Does nothing if @p legacyDb does not exist.
+   */
+  void
+  importLegacyTables(const boost::filesystem::path& legacyDb, const std::vector<std::string>& tables);
+
+private:
+  sqlite3_stmt*
+  borrowStatement(const std::string& sql, const std::string*& key);
+
+  void
+  returnStatement(const std::string* key, sqlite3_stmt* stmt);
+
 private:
   static void
   hash_xStep(sqlite3_context* context, int argc, sqlite3_value** argv);
@@ -63,6 +215,10 @@ private:
 
 protected:
   sqlite3* m_db;
+
+private:
+  struct Connection;
+  shared_ptr<Connection> m_connection;
 };
 
 typedef shared_ptr<DbHelper> DbHelperPtr;
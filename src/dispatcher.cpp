@@ -27,6 +27,9 @@
 
 #include <boost/lexical_cast.hpp>
 
+#include <algorithm>
+#include <thread>
+
 namespace ndn {
 namespace chronoshare {
 
@@ -39,18 +42,26 @@ static const Name BROADCAST_DOMAIN = "/ndn/multicast";
 
 static const time::seconds DEFAULT_SYNC_INTEREST_INTERVAL = time::seconds(10);
 static const time::seconds DEFAULT_AUTO_DISCOVERY_INTERVAL = time::seconds(60);
+static const time::seconds DEFAULT_GARBAGE_COLLECTION_INTERVAL = time::hours(1);
+static const uint64_t FILL_BATCH = 256;
+static const int MAX_MANIFEST_RETRIES = 3;
 
 Dispatcher::Dispatcher(const std::string& localUserName, const std::string& sharedFolder,
-                       const fs::path& rootDir, Face& face)
+                       const fs::path& rootDir, Face& face, size_t segmentSize)
   : m_face(face)
   , m_rootDir(rootDir)
   , m_ioService(face.getIoService())
   , m_scheduler(m_ioService)
   , m_autoDiscovery(m_scheduler)
-  , m_objectManager(face, m_keyChain, rootDir, CHRONOSHARE_APP.toUri())
+  , m_garbageCollection(m_scheduler)
+  , m_objectManager(face, m_keyChain, rootDir, CHRONOSHARE_APP.toUri(), segmentSize)
   , m_localUserName(localUserName)
+  , m_isInPlaceMaterialization(false)
   , m_sharedFolder(sharedFolder)
 {
+  // segments of large local files are hashed and signed on all cores
+  m_objectManager.setConcurrency(std::thread::hardware_concurrency());
+
   m_syncLog = make_shared<SyncLog>(m_rootDir, localUserName);
   m_actionLog =
     make_shared<ActionLog>(m_face, m_rootDir, m_syncLog, sharedFolder, CHRONOSHARE_APP,
@@ -58,6 +69,7 @@ Dispatcher::Dispatcher(const std::string& localUserName, const std::string& shar
                            ActionLog::OnFileAddedOrChangedCallback(), // don't really need this callback
                            bind(&Dispatcher::Did_ActionLog_ActionApply_Delete, this, _1));
   m_fileState = m_actionLog->GetFileState();
+  m_hashCache = make_shared<HashCache>(m_rootDir);
 
   Name syncPrefix = Name(BROADCAST_DOMAIN);
   syncPrefix.append(CHRONOSHARE_APP);
@@ -90,7 +102,17 @@ Dispatcher::Dispatcher(const std::string& localUserName, const std::string& shar
                               3, true, bind(&Dispatcher::Did_FetchManager_FileSegmentFetch, this, _1, _2,
                                       _3, _4),
                               bind(&Dispatcher::Did_FetchManager_FileFetchComplete, this, _1, _2),
-                              fileTaskDb);
+                              fileTaskDb,
+                              bind(&Dispatcher::Validate_FileSegment, this, _1, _2, _3, _4));
+
+  m_garbageCollector =
+    make_unique<GarbageCollector>(m_ioService, m_rootDir / ".chronoshare", m_actionLog, m_fileState,
+                                  [this] (const Buffer& hash) {
+                                    return m_objectDbMap.find(hash) != m_objectDbMap.end() ||
+                                           m_partialFiles.find(hash) != m_partialFiles.end();
+                                  });
+  m_garbageCollection = m_scheduler.scheduleEvent(DEFAULT_GARBAGE_COLLECTION_INTERVAL,
+                                                  bind(&Dispatcher::CollectGarbage, this));
 
   _LOG_DEBUG("registering prefix discovery in Dispatcher");
   m_autoDiscovery = m_scheduler.scheduleEvent(DEFAULT_AUTO_DISCOVERY_INTERVAL,
@@ -102,6 +124,14 @@ Dispatcher::~Dispatcher()
   _LOG_DEBUG("Enter destructor of dispatcher");
 }
 
+void
+Dispatcher::CollectGarbage()
+{
+  m_garbageCollector->start();
+  m_garbageCollection = m_scheduler.scheduleEvent(DEFAULT_GARBAGE_COLLECTION_INTERVAL,
+                                                  bind(&Dispatcher::CollectGarbage, this));
+}
+
 void
 Dispatcher::DiscoverPrefix()
 {
@@ -207,12 +237,23 @@ Dispatcher::Did_LocalFile_AddOrModify_Execute(fs::path relativeFilePath)
     return;
   }
 
-  FileItemPtr currentFile = m_fileState->LookupFile(relativeFilePath.generic_string());
+  std::string filename = relativeFilePath.generic_string();
+  FileItemPtr currentFile = m_fileState->LookupFile(filename);
+
+  HashCache::FileStat stat;
+  bool hasStat = HashCache::getFileStat(absolutePath, stat);
 
   if (currentFile) {
-    fs::ifstream input(absolutePath);
-    if (*util::Sha256(input).computeDigest() ==
-        Buffer(currentFile->file_hash().c_str(), currentFile->file_hash().size())
+    if (!hasStat) {
+      _LOG_DEBUG("Update inaccessible file: " << absolutePath.string());
+      return;
+    }
+
+    // files that have not changed since they were last hashed are not read again, other files
+    // are hashed only once, while they are turned into segments
+    ConstBufferPtr digest = m_hashCache->lookup(filename, stat);
+    if (digest != nullptr &&
+        *digest == Buffer(currentFile->file_hash().c_str(), currentFile->file_hash().size())
         // The following two are commented out to prevent front end from reporting intermediate files
         // should enable it if there is other way to prevent this
         // && last_write_time(absolutePath) == currentFile->mtime()
@@ -230,19 +271,45 @@ Dispatcher::Did_LocalFile_AddOrModify_Execute(fs::path relativeFilePath)
   }
 
   int seg_num;
+  size_t seg_size;
   ConstBufferPtr hash;
+  ConstBufferPtr manifestDigest;
   _LOG_DEBUG("absolutePath: " << absolutePath << " m_localUserName: " << m_localUserName);
-  tie(hash, seg_num) = m_objectManager.localFileToObjects(absolutePath, m_localUserName);
+  ConstBufferPtr previousHash;
+  Name previousDevice;
+  if (currentFile) {
+    // only the appended part of a grown file needs new segments
+    previousHash = make_shared<Buffer>(currentFile->file_hash().data(), currentFile->file_hash().size());
+    previousDevice = Name(Block(reinterpret_cast<const uint8_t*>(currentFile->device_name().data()),
+                                currentFile->device_name().size()));
+  }
+  try {
+    tie(hash, seg_num, seg_size, manifestDigest) =
+      m_objectManager.localFileToObjects(absolutePath, m_localUserName, previousHash, previousDevice);
+  }
+  catch (const ObjectManager::Error& error) {
+    // the file is published on the notification about its latest change
+    _LOG_ERROR("Cannot publish [" << relativeFilePath << "]: " << error.what());
+    return;
+  }
+  if (hasStat) {
+    m_hashCache->update(absolutePath, filename, stat, *hash);
+  }
+
+  if (currentFile && *hash == Buffer(currentFile->file_hash().c_str(), currentFile->file_hash().size())) {
+    _LOG_ERROR("Got notification about the same file [" << relativeFilePath << "]");
+    return;
+  }
 
   try {
-    m_actionLog->AddLocalActionUpdate(relativeFilePath.generic_string(), *hash,
+    m_actionLog->AddLocalActionUpdate(filename, *hash,
                                       last_write_time(absolutePath),
 #if BOOST_VERSION >= 104900
                                       status(absolutePath).permissions(),
 #else
                                       0,
 #endif
-                                      seg_num);
+                                      seg_num, seg_size, manifestDigest);
 
     // notify SyncCore to propagate the change
     m_core->localStateChangedDelayed();
@@ -269,6 +336,7 @@ Dispatcher::Did_LocalFile_Delete_Execute(fs::path relativeFilePath)
     return;
   }
 
+  m_hashCache->remove(relativeFilePath.generic_string());
   m_actionLog->AddLocalActionDelete(relativeFilePath.generic_string());
   // notify SyncCore to propagate the change
   m_core->localStateChangedDelayed();
@@ -332,7 +400,7 @@ Dispatcher::Did_FetchManager_ActionFetch(const Name& deviceName, const Name& act
     fileNameBase.append(name::Component(hash));
 
     std::string hashStr = toHex(*hash);
-    if (ObjectDb::doesExist(m_rootDir / ".chronoshare", deviceName, hashStr)) {
+    if (ObjectDb::isComplete(m_rootDir / ".chronoshare", deviceName, hashStr)) {
       _LOG_DEBUG("File already exists in the database. No need to refetch, just directly applying "
                  "the action");
       Did_FetchManager_FileFetchComplete(deviceName, fileNameBase);
@@ -342,9 +410,36 @@ Dispatcher::Did_FetchManager_ActionFetch(const Name& deviceName, const Name& act
         _LOG_DEBUG("create ObjectDb for " << toHex(*hash));
         m_objectDbMap[*hash] = make_shared<ObjectDb>(m_rootDir / ".chronoshare", hashStr);
       }
+      m_objectDbMap[*hash]->setSegmentCount(deviceName, action->seg_num());
+      m_fetchActions[fileNameBase] = action;
+
+      // segments can be placed only if their maximum size is known
+      if (m_isInPlaceMaterialization && action->has_seg_size() && action->seg_num() > 0 &&
+          m_partialFiles.find(*hash) == m_partialFiles.end()) {
+        try {
+          m_partialFiles[*hash] =
+            make_shared<PartialFile>(m_rootDir / ".chronoshare" / "partial" / hashStr,
+                                     action->seg_num(), action->seg_size());
+        }
+        catch (const PartialFile::Error& error) {
+          _LOG_ERROR(error.what() << ", saving segments instead");
+        }
+      }
+
+      if (action->has_manifest_digest()) {
+        // file segments can be verified only after the manifest is fetched
+        Name manifestNameBase = Name("/");
+        manifestNameBase.append(deviceName).append(CHRONOSHARE_APP).append("manifest");
+        manifestNameBase.append(name::Component(hash));
 
-      m_fileFetcher->Enqueue(deviceName, fileNameBase, 0, action->seg_num() - 1,
-                             FetchManager::PRIORITY_NORMAL);
+        m_fileFetcher->Enqueue(deviceName, manifestNameBase, 0,
+                               FileManifest::getManifestSegmentCount(action->seg_num()) - 1,
+                               FetchManager::PRIORITY_NORMAL);
+      }
+      else {
+        m_fileFetcher->Enqueue(deviceName, fileNameBase, 0, action->seg_num() - 1,
+                               FetchManager::PRIORITY_NORMAL);
+      }
     }
   }
 }
@@ -397,22 +492,46 @@ Dispatcher::Did_FetchManager_FileSegmentFetch_Execute(Name deviceName,
                                                       shared_ptr<Data> fileSegmentData)
 {
   // fileSegmentBaseName:  /<device_name>/<appname>/file/<hash>
+  //                   or  /<device_name>/<appname>/manifest/<hash>
 
   Buffer hash(fileSegmentBaseName.get(-1).value(), fileSegmentBaseName.get(-1).value_size());
+  bool isManifest = (fileSegmentBaseName.get(-2).toUri() == "manifest");
 
   _LOG_DEBUG("Received segment deviceName: " << deviceName << ", segmentBaseName: " << fileSegmentBaseName
                                              << ", segment: "
                                              << segment);
 
+  if (!isManifest) {
+    // segments are also saved below, so that they can be served to others and the file can be
+    // restored from the database if it cannot be materialized in place
+    auto partial = m_partialFiles.find(hash);
+    if (partial != m_partialFiles.end()) {
+      try {
+        partial->second->writeSegment(segment, fileSegmentData->getContent().value(),
+                                      fileSegmentData->getContent().value_size());
+      }
+      catch (const PartialFile::Error& error) {
+        _LOG_ERROR(error.what() << ", saving segments instead");
+        partial->second->remove();
+        m_partialFiles.erase(partial);
+      }
+    }
+  }
+
   // _LOG_DEBUG("Looking up objectdb for " << hash);
 
   std::map<Buffer, shared_ptr<ObjectDb>>::iterator db = m_objectDbMap.find(hash);
-  if (db != m_objectDbMap.end()) {
-    db->second->saveContentObject(deviceName, segment, *fileSegmentData);
+  if (db == m_objectDbMap.end()) {
+    // fetches are resumed after a restart, while db handles are not
+    _LOG_DEBUG("Reopening db for " << fileSegmentBaseName);
+    db = m_objectDbMap.insert(std::make_pair(hash, make_shared<ObjectDb>(m_rootDir / ".chronoshare",
+                                                                         toHex(hash)))).first;
+  }
+  if (isManifest) {
+    db->second->saveManifestSegment(deviceName, segment, *fileSegmentData);
   }
   else {
-    _LOG_ERROR("no db available for this content object: " << fileSegmentBaseName << ", size: "
-                                                           << fileSegmentData->getContent().size());
+    db->second->saveContentObject(deviceName, segment, *fileSegmentData);
   }
 
   // ObjectDb objectDb(m_rootDir / ".chronoshare", lexical_cast<string>(hash));
@@ -433,10 +552,44 @@ Dispatcher::Did_FetchManager_FileFetchComplete_Execute(Name deviceName, Name fil
 
   _LOG_DEBUG("Finished fetching " << deviceName << ", fileBaseName: " << fileBaseName);
 
+  if (fileBaseName.get(-2).toUri() == "manifest") {
+    Did_FetchManager_ManifestFetchComplete_Execute(deviceName, fileBaseName);
+    return;
+  }
+
+  // file may be fetched in several ranges
+  auto pending = m_pendingFileFetches.find(fileBaseName);
+  if (pending != m_pendingFileFetches.end()) {
+    if (--pending->second > 0) {
+      _LOG_DEBUG(pending->second << " more ranges of " << fileBaseName << " are being fetched");
+      return;
+    }
+    m_pendingFileFetches.erase(pending);
+  }
+
   Buffer hash(fileBaseName.get(-1).value(), fileBaseName.get(-1).value_size());
 
   _LOG_DEBUG("Extracted hash: " << toHex(hash));
 
+  // pending ranges are not known after a restart, when the first resumed range completes
+  auto partial = m_partialFiles.find(hash);
+  if ((partial == m_partialFiles.end() || !partial->second->isComplete()) &&
+      !ObjectDb::isComplete(m_rootDir / ".chronoshare", deviceName, toHex(hash))) {
+    _LOG_DEBUG("Not all segments of " << fileBaseName << " have been received yet");
+    return;
+  }
+
+  m_manifests.erase(fileBaseName);
+  m_fetchActions.erase(fileBaseName);
+
+  PartialFilePtr partialFile;
+  if (partial != m_partialFiles.end()) {
+    partialFile = partial->second;
+    m_partialFiles.erase(partial);
+  }
+  // the file the partial file has been turned into
+  fs::path materializedPath;
+
   if (m_objectDbMap.find(hash) != m_objectDbMap.end()) {
     // remove the db handle
     m_objectDbMap.erase(hash); // to commit write
@@ -453,8 +606,7 @@ Dispatcher::Did_FetchManager_FileFetchComplete_Execute(Name deviceName, Name fil
     try {
       if (fs::exists(filePath) && fs::last_write_time(filePath) == file->mtime() &&
           fs::status(filePath).permissions() == static_cast<fs::perms>(file->mode())) {
-          fs::ifstream input(filePath, std::ios::in | std::ios::binary);
-          if (*util::Sha256(input).computeDigest() == hash) {
+          if (*m_hashCache->getDigest(filePath, file->filename()) == hash) {
             _LOG_DEBUG("Asking to assemble a file, but file already exists on a filesystem");
             continue;
           }
@@ -463,16 +615,62 @@ Dispatcher::Did_FetchManager_FileFetchComplete_Execute(Name deviceName, Name fil
     catch (const fs::filesystem_error& error) {
       _LOG_ERROR("File operations failed on [" << filePath << "](ignoring)");
     }
+    catch (const HashCache::Error& error) {
+      _LOG_ERROR("File operations failed on [" << filePath << "](ignoring)");
+    }
 
-    if (ObjectDb::doesExist(m_rootDir / ".chronoshare", deviceName, toHex(hash))) {
-      bool ok = m_objectManager.objectsToLocalFile(deviceName, hash, filePath);
-      if (ok) {
-        last_write_time(filePath, file->mtime());
+    auto setFileComplete = [&] {
+      last_write_time(filePath, file->mtime());
 #if BOOST_VERSION >= 104900
-        permissions(filePath, static_cast<fs::perms>(file->mode()));
+      permissions(filePath, static_cast<fs::perms>(file->mode()));
 #endif
 
-        m_fileState->SetFileComplete(file->filename());
+      m_fileState->SetFileComplete(file->filename());
+
+      // the content is known, so the file does not need to be hashed when it is cloned or
+      // reported as changed
+      HashCache::FileStat stat;
+      if (HashCache::getFileStat(filePath, stat)) {
+        m_hashCache->update(filePath, file->filename(), stat, hash);
+      }
+    };
+
+    // the same content may already be here, in another file or in a copy assembled just before
+    if (CloneLocalCopy(hash, filePath)) {
+      setFileComplete();
+      continue;
+    }
+
+    if (partialFile != nullptr) {
+      bool ok = false;
+      try {
+        if (materializedPath.empty() && partialFile->isComplete()) {
+          fs::create_directories(filePath.parent_path());
+          partialFile->finalize(filePath);
+          materializedPath = filePath;
+          ok = true;
+        }
+      }
+      catch (const fs::filesystem_error& error) {
+        _LOG_ERROR(error.what());
+      }
+      catch (const PartialFile::Error& error) {
+        _LOG_ERROR(error.what());
+      }
+
+      if (ok) {
+        setFileComplete();
+        continue;
+      }
+      _LOG_ERROR("File cannot be materialized in place: [" << filePath << "], "
+                 << partialFile->getReceivedSegmentCount() << " of "
+                 << partialFile->getSegmentCount() << " segments received, restoring from the database");
+    }
+
+    if (ObjectDb::isComplete(m_rootDir / ".chronoshare", deviceName, toHex(hash))) {
+      bool ok = m_objectManager.objectsToLocalFile(deviceName, hash, filePath);
+      if (ok) {
+        setFileComplete();
       }
       else {
         _LOG_ERROR("Notified about complete fetch, but file cannot be restored from the database: ["
@@ -485,6 +683,281 @@ Dispatcher::Did_FetchManager_FileFetchComplete_Execute(Name deviceName, Name fil
       // should abort for debugging
     }
   }
+
+  if (partialFile != nullptr && materializedPath.empty()) {
+    // no file needs the content anymore, or it cannot be completed
+    partialFile->remove();
+  }
+}
+
+void
+Dispatcher::Did_FetchManager_ManifestFetchComplete_Execute(const Name& deviceName,
+                                                           const Name& manifestBaseName)
+{
+  // manifestBaseName:  /<device_name>/<appname>/manifest/<hash>
+
+  Buffer hash(manifestBaseName.get(-1).value(), manifestBaseName.get(-1).value_size());
+
+  Name fileNameBase = manifestBaseName.getPrefix(-2);
+  fileNameBase.append("file").append(manifestBaseName.get(-1));
+
+  FileManifestPtr manifest = LoadManifest(deviceName, fileNameBase);
+  if (manifest == nullptr) {
+    // a bad segment (e.g., from a cache) would otherwise be loaded again every time
+    auto db = m_objectDbMap.find(hash);
+    if (db != m_objectDbMap.end()) {
+      db->second->removeManifest(deviceName);
+    }
+    else {
+      ObjectDb(m_rootDir / ".chronoshare", toHex(hash)).removeManifest(deviceName);
+    }
+
+    ActionItemPtr action = LookupFileAction(deviceName, hash);
+    if (action == nullptr || ++m_manifestRetries[manifestBaseName] > MAX_MANIFEST_RETRIES) {
+      _LOG_ERROR("Fetched manifest for " << fileNameBase << " does not match the signed action, giving up");
+      m_manifestRetries.erase(manifestBaseName);
+      m_fetchActions.erase(fileNameBase);
+      m_manifests.erase(fileNameBase);
+      m_pendingFileFetches.erase(fileNameBase);
+      m_objectDbMap.erase(hash);
+
+      auto partial = m_partialFiles.find(hash);
+      if (partial != m_partialFiles.end()) {
+        partial->second->remove();
+        m_partialFiles.erase(partial);
+      }
+      return;
+    }
+
+    _LOG_ERROR("Fetched manifest for " << fileNameBase << " does not match the signed action, fetching again");
+    m_fileFetcher->Enqueue(deviceName, manifestBaseName, 0,
+                           FileManifest::getManifestSegmentCount(action->seg_num()) - 1,
+                           FetchManager::PRIORITY_NORMAL, true);
+    return;
+  }
+  m_manifestRetries.erase(manifestBaseName);
+
+  // segments with the same payload as segments of files that are already here (e.g., unchanged
+  // parts of the previous version of the file) do not need to be fetched
+  ConstBufferPtr previousHash;
+  Name previousDevice;
+  LookupPreviousVersion(deviceName, hash, previousHash, previousDevice);
+  std::vector<uint64_t> missing = m_objectManager.reuseLocalSegments(deviceName, hash, *manifest,
+                                                                     previousHash, previousDevice);
+
+  auto partial = m_partialFiles.find(hash);
+  if (partial != m_partialFiles.end()) {
+    if (partial->second->getSegmentCount() != manifest->size()) {
+      _LOG_ERROR("Manifest of " << fileNameBase << " does not match the action, saving segments instead");
+      partial->second->remove();
+      m_partialFiles.erase(partial);
+    }
+    else {
+      try {
+        FillPartialFile(deviceName, hash, *partial->second, missing);
+      }
+      catch (const PartialFile::Error& error) {
+        _LOG_ERROR(error.what() << ", saving segments instead");
+        partial->second->remove();
+        m_partialFiles.erase(partial);
+      }
+    }
+  }
+
+  if (missing.empty()) {
+    Did_FetchManager_FileFetchComplete_Execute(deviceName, fileNameBase);
+    return;
+  }
+
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  for (uint64_t segment : missing) {
+    if (!ranges.empty() && ranges.back().second + 1 == segment) {
+      ranges.back().second = segment;
+    }
+    else {
+      ranges.push_back(std::make_pair(segment, segment));
+    }
+  }
+
+  _LOG_DEBUG("Fetching " << missing.size() << " of " << manifest->size() << " segments of "
+             << fileNameBase << " in " << ranges.size() << " ranges");
+
+  m_pendingFileFetches[fileNameBase] = ranges.size();
+  for (const auto& range : ranges) {
+    m_fileFetcher->Enqueue(deviceName, fileNameBase, range.first, range.second,
+                           FetchManager::PRIORITY_NORMAL);
+  }
+}
+
+void
+Dispatcher::FillPartialFile(const Name& deviceName, const Buffer& hash, PartialFile& partialFile,
+                            std::vector<uint64_t>& missing)
+{
+  // segments reused from local files are copied in place, read FILL_BATCH at a time
+  auto db = m_objectDbMap.find(hash);
+  for (uint64_t begin = 0; begin < partialFile.getSegmentCount() && db != m_objectDbMap.end();
+       begin += FILL_BATCH) {
+    uint64_t end = std::min<uint64_t>(begin + FILL_BATCH, partialFile.getSegmentCount());
+    for (const auto& segment : db->second->fetchSegments(deviceName, begin, end)) {
+      if (partialFile.hasSegment(segment.first) ||
+          std::binary_search(missing.begin(), missing.end(), segment.first)) {
+        continue;
+      }
+      const Block& content = segment.second->getContent();
+      partialFile.writeSegment(segment.first, content.value(), content.value_size());
+    }
+  }
+
+  // segments received before a restart do not need to be fetched again
+  missing.erase(std::remove_if(missing.begin(), missing.end(),
+                               [&partialFile] (uint64_t segment) {
+                                 return partialFile.hasSegment(segment);
+                               }),
+                missing.end());
+}
+
+bool
+Dispatcher::CloneLocalCopy(const Buffer& hash, const fs::path& filePath)
+{
+  FileItemsPtr files = m_fileState->LookupFilesForHash(hash);
+  for (const FileItem& file : *files) {
+    fs::path sourcePath = m_rootDir / file.filename();
+    if (!file.is_complete() || sourcePath == filePath) {
+      continue;
+    }
+
+    HashCache::FileStat before;
+    HashCache::FileStat after;
+    if (!HashCache::getFileStat(sourcePath, before)) {
+      continue;
+    }
+    try {
+      // the file could have been changed locally, it is only hashed again if it has been
+      if (*m_hashCache->getDigest(sourcePath, file.filename()) != hash) {
+        continue;
+      }
+    }
+    catch (const HashCache::Error& error) {
+      continue;
+    }
+
+    // the source must not have been changed since it was checked until it has been copied
+    if (ObjectManager::cloneLocalFile(sourcePath, filePath) &&
+        HashCache::getFileStat(sourcePath, after) && before == after) {
+      _LOG_DEBUG("Cloned " << sourcePath << " to " << filePath);
+      return true;
+    }
+  }
+  return false;
+}
+
+ActionItemPtr
+Dispatcher::LookupFileAction(const Name& deviceName, const Buffer& hash)
+{
+  Name fileNameBase = Name("/");
+  fileNameBase.append(deviceName).append(CHRONOSHARE_APP).append("file");
+  fileNameBase.append(name::Component(hash));
+
+  auto cached = m_fetchActions.find(fileNameBase);
+  if (cached != m_fetchActions.end()) {
+    return cached->second;
+  }
+
+  // fetches resumed after restart
+  ActionItemPtr action = m_actionLog->LookupActionForHash(deviceName, hash);
+  if (action) {
+    m_fetchActions[fileNameBase] = action;
+  }
+  return action;
+}
+
+ConstBufferPtr
+Dispatcher::LookupManifestDigest(const Name& deviceName, const Buffer& hash)
+{
+  ActionItemPtr action = LookupFileAction(deviceName, hash);
+  if (action && action->has_manifest_digest()) {
+    return make_shared<Buffer>(action->manifest_digest().data(), action->manifest_digest().size());
+  }
+  return nullptr;
+}
+
+void
+Dispatcher::LookupPreviousVersion(const Name& deviceName, const Buffer& hash,
+                                  ConstBufferPtr& previousHash, Name& previousDevice)
+{
+  ActionItemPtr action = LookupFileAction(deviceName, hash);
+  if (!action || !action->has_parent_device_name()) {
+    return;
+  }
+
+  Name parentDevice(Block(reinterpret_cast<const uint8_t*>(action->parent_device_name().data()),
+                          action->parent_device_name().size()));
+  ActionItemPtr parent = m_actionLog->LookupAction(parentDevice, action->parent_seq_no());
+  if (parent && parent->action() == ActionItem::UPDATE && parent->has_file_hash()) {
+    previousHash = make_shared<Buffer>(parent->file_hash().data(), parent->file_hash().size());
+    previousDevice = parentDevice;
+  }
+}
+
+FileManifestPtr
+Dispatcher::LoadManifest(const Name& deviceName, const Name& fileNameBase)
+{
+  auto cached = m_manifests.find(fileNameBase);
+  if (cached != m_manifests.end()) {
+    return cached->second;
+  }
+
+  Buffer hash(fileNameBase.get(-1).value(), fileNameBase.get(-1).value_size());
+  ConstBufferPtr manifestDigest = LookupManifestDigest(deviceName, hash);
+  if (manifestDigest == nullptr) {
+    return nullptr;
+  }
+
+  // use the open handle if there is one, as it may have not yet committed segments
+  FileManifestPtr manifest;
+  auto db = m_objectDbMap.find(hash);
+  if (db != m_objectDbMap.end()) {
+    manifest = db->second->fetchManifest(deviceName);
+  }
+  else {
+    manifest = ObjectDb(m_rootDir / ".chronoshare", toHex(hash)).fetchManifest(deviceName);
+  }
+
+  if (manifest == nullptr || *manifest->getRoot() != *manifestDigest) {
+    return nullptr;
+  }
+
+  m_manifests[fileNameBase] = manifest;
+  return manifest;
+}
+
+bool
+Dispatcher::Validate_FileSegment(const Name& deviceName, const Name& baseName, uint64_t segment,
+                                 const Data& data)
+{
+  // manifest segments are checked all together against the digest in the action
+  if (baseName.get(-2).toUri() != "file") {
+    return true;
+  }
+
+  Buffer hash(baseName.get(-1).value(), baseName.get(-1).value_size());
+  ActionItemPtr action = LookupFileAction(deviceName, hash);
+  if (action == nullptr) {
+    _LOG_ERROR("No action published " << baseName << ", rejecting segment " << segment);
+    return false;
+  }
+
+  // files published without manifest
+  if (!action->has_manifest_digest()) {
+    return true;
+  }
+
+  FileManifestPtr manifest = LoadManifest(deviceName, baseName);
+  if (manifest == nullptr) {
+    return false;
+  }
+
+  return manifest->verifySegment(segment, data.getContent().value(), data.getContent().value_size());
 }
 
 } // namespace chronoshare
@@ -27,8 +27,11 @@
 #include "content-server.hpp"
 #include "state-server.hpp"
 #include "fetch-manager.hpp"
+#include "garbage-collector.hpp"
+#include "hash-cache.hpp"
 #include "object-db.hpp"
 #include "object-manager.hpp"
+#include "partial-file.hpp"
 #include "sync-core.hpp"
 
 #include <boost/filesystem.hpp>
@@ -67,10 +70,43 @@ class Dispatcher
 public:
   // sharedFolder is the name to be used in NDN name;
   // rootDir is the shared folder dir in local file system;
+  // segmentSize is the payload size of segments of the files published from this folder
   Dispatcher(const std::string& localUserName, const std::string& sharedFolder,
-             const boost::filesystem::path& rootDir, Face& face);
+             const boost::filesystem::path& rootDir, Face& face,
+             size_t segmentSize = DEFAULT_FILE_SEGMENT_SIZE);
   ~Dispatcher();
 
+  // files published from this folder are cut into content-defined segments
+  void
+  setContentDefinedChunking(bool isEnabled)
+  {
+    m_objectManager.setContentDefinedChunking(isEnabled);
+  }
+
+  // segment payloads are stored compressed, unless they look already compressed
+  void
+  setCompression(bool isEnabled)
+  {
+    m_objectManager.setCompression(isEnabled);
+  }
+
+  // files fetched from other devices are written in place as their segments arrive, instead of
+  // being assembled from the saved segments once complete (segments are still saved, so that
+  // they can be served to others and the file can be assembled if it cannot be materialized)
+  void
+  setInPlaceMaterialization(bool isEnabled)
+  {
+    m_isInPlaceMaterialization = isEnabled;
+  }
+
+  // stored segments of file versions that are neither current nor introduced by an action within
+  // the retention window are periodically removed
+  void
+  setObjectRetention(const time::seconds& retention)
+  {
+    m_garbageCollector->setRetention(retention);
+  }
+
   // ----- Callbacks, they only submit the job to executor and immediately return so that event
   // processing thread won't be blocked for too long -------
 
@@ -168,16 +204,76 @@ private:
   void
   Did_FetchManager_FileFetchComplete_Execute(Name deviceName, Name fileBaseName);
 
+  void
+  Did_FetchManager_ManifestFetchComplete_Execute(const Name& deviceName, const Name& manifestBaseName);
+
+  /**
+   * @brief Check fetched file segment against the manifest of the file
+   */
+  bool
+  Validate_FileSegment(const Name& deviceName, const Name& baseName, uint64_t segment,
+                       const Data& data);
+
   void
   Handle_Prefix_Discovery(const Interest& interest, const Data& data);
 
   void
   DiscoverPrefix();
 
+  void
+  CollectGarbage();
+
   void
   Did_LocalPrefix_Updated(const Name& prefix);
 
 private:
+  /**
+   * @brief Make @p filePath a clone of a complete local file with content @p hash, if there is
+   *        one whose content has not been changed
+   */
+  bool
+  CloneLocalCopy(const Buffer& hash, const boost::filesystem::path& filePath);
+
+  /**
+   * @brief Find the action that started the fetch of file @p hash from @p deviceName
+   *
+   * The file does not need to be in the current file state, it may have been replaced or deleted
+   * since the fetch was started
+   */
+  ActionItemPtr
+  LookupFileAction(const Name& deviceName, const Buffer& hash);
+
+  /**
+   * @brief Find the manifest root in the action that introduced file @p hash from @p deviceName
+   */
+  ConstBufferPtr
+  LookupManifestDigest(const Name& deviceName, const Buffer& hash);
+
+  /**
+   * @brief Find the version of the file that the action introducing file @p hash from
+   *        @p deviceName has replaced
+   *
+   * @p previousHash is left unset if there is no such version
+   */
+  void
+  LookupPreviousVersion(const Name& deviceName, const Buffer& hash,
+                        ConstBufferPtr& previousHash, Name& previousDevice);
+
+  /**
+   * @brief Load manifest of a file and check it against the manifest root in the action
+   * @return nullptr if the manifest is not available or does not match
+   */
+  FileManifestPtr
+  LoadManifest(const Name& deviceName, const Name& fileNameBase);
+
+  /**
+   * @brief Write segments of @p hash that are already available into @p partialFile and
+   *        remove those from @p missing
+   */
+  void
+  FillPartialFile(const Name& deviceName, const Buffer& hash, PartialFile& partialFile,
+                  std::vector<uint64_t>& missing);
+
   void
   AssembleFile_Execute(const Name& deviceName, const Buffer& filehash,
                        const boost::filesystem::path& relativeFilepath);
@@ -189,11 +285,13 @@ private:
   ActionLogPtr m_actionLog;
   FileStatePtr m_fileState;
   FileStatePtr m_fileStateCow;
+  HashCachePtr m_hashCache;
 
   boost::filesystem::path m_rootDir;
   boost::asio::io_service& m_ioService;
   Scheduler m_scheduler;
   util::scheduler::ScopedEventId m_autoDiscovery;
+  util::scheduler::ScopedEventId m_garbageCollection;
 
   ObjectManager m_objectManager;
   Name m_localUserName;
@@ -202,6 +300,23 @@ private:
 
   std::map<Buffer, shared_ptr<ObjectDb>> m_objectDbMap;
 
+  // actions that started fetches of files, keyed by /<device_name>/<appname>/file/<hash>
+  std::map<Name, ActionItemPtr> m_fetchActions;
+
+  // verified manifests of files being fetched, keyed by /<device_name>/<appname>/file/<hash>
+  std::map<Name, FileManifestPtr> m_manifests;
+
+  // number of times a manifest not matching its action has been fetched again,
+  // keyed by /<device_name>/<appname>/manifest/<hash>
+  std::map<Name, int> m_manifestRetries;
+
+  // number of not yet completed fetches of segment ranges, keyed by /<device_name>/<appname>/file/<hash>
+  std::map<Name, size_t> m_pendingFileFetches;
+
+  bool m_isInPlaceMaterialization;
+  // files being written in place, keyed by file hash
+  std::map<Buffer, PartialFilePtr> m_partialFiles;
+
   std::string m_sharedFolder;
   unique_ptr<ContentServer> m_server;
   unique_ptr<StateServer> m_stateServer;
@@ -210,6 +325,8 @@ private:
   FetchManagerPtr m_fileFetcher;
 
   KeyChain m_keyChain;
+
+  unique_ptr<GarbageCollector> m_garbageCollector;
 };
 
 namespace error {
@@ -42,7 +42,8 @@ FetchManager::FetchManager(Face& face, const Mapping& mapping, const Name& broad
                            uint32_t parallelFetches, // = 3
                            bool isSegment,
                            const SegmentCallback& defaultSegmentCallback,
-                           const FinishCallback& defaultFinishCallback, const FetchTaskDbPtr& taskDb)
+                           const FinishCallback& defaultFinishCallback, const FetchTaskDbPtr& taskDb,
+                           const SegmentValidator& segmentValidator)
   : m_face(face)
   , m_mapping(mapping)
   , m_maxParallelFetches(parallelFetches)
@@ -52,6 +53,7 @@ FetchManager::FetchManager(Face& face, const Mapping& mapping, const Name& broad
   , m_defaultSegmentCallback(defaultSegmentCallback)
   , m_defaultFinishCallback(defaultFinishCallback)
   , m_taskDb(taskDb)
+  , m_segmentValidator(segmentValidator)
   , m_broadcastHint(broadcastForwardingHint)
   , m_ioService(m_face.getIoService())
   , m_isSegment(isSegment)
@@ -76,16 +78,17 @@ FetchManager::~FetchManager()
 // Enqueue using default callbacks
 void
 FetchManager::Enqueue(const Name& deviceName, const Name& baseName, uint64_t minSeqNo,
-                      uint64_t maxSeqNo, int priority)
+                      uint64_t maxSeqNo, int priority, bool mustBeFresh)
 {
   Enqueue(deviceName, baseName, m_defaultSegmentCallback, m_defaultFinishCallback, minSeqNo,
-          maxSeqNo, priority);
+          maxSeqNo, priority, mustBeFresh);
 }
 
 void
 FetchManager::Enqueue(const Name& deviceName, const Name& baseName,
                       const SegmentCallback& segmentCallback, const FinishCallback& finishCallback,
-                      uint64_t minSeqNo, uint64_t maxSeqNo, int priority /*PRIORITY_NORMAL*/)
+                      uint64_t minSeqNo, uint64_t maxSeqNo, int priority /*PRIORITY_NORMAL*/,
+                      bool mustBeFresh /*false*/)
 {
   // Assumption for the following code is minSeqNo <= maxSeqNo
   if (minSeqNo > maxSeqNo) {
@@ -107,7 +110,8 @@ FetchManager::Enqueue(const Name& deviceName, const Name& baseName,
     new Fetcher(m_face, m_isSegment, segmentCallback, finishCallback,
                 bind(&FetchManager::DidFetchComplete, this, _1, _2, _3),
                 bind(&FetchManager::DidNoDataTimeout, this, _1), deviceName, baseName, minSeqNo,
-                maxSeqNo, time::seconds(30), forwardingHint);
+                maxSeqNo, time::seconds(30), forwardingHint, m_segmentValidator);
+  fetcher->SetMustBeFresh(mustBeFresh);
 
   switch (priority) {
     case PRIORITY_HIGH:
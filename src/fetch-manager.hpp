@@ -50,6 +50,7 @@ public:
   typedef function<Name(const Name&)> Mapping;
   typedef function<void(Name& deviceName, Name& baseName, uint64_t seq, shared_ptr<Data> data)> SegmentCallback;
   typedef function<void(Name& deviceName, Name& baseName)> FinishCallback;
+  typedef Fetcher::SegmentValidator SegmentValidator;
 
 public:
   FetchManager(Face& face, const Mapping& mapping, const Name& broadcastForwardingHint,
@@ -57,18 +58,19 @@ public:
                bool isSegment = true,
                const SegmentCallback& defaultSegmentCallback = SegmentCallback(),
                const FinishCallback& defaultFinishCallback = FinishCallback(),
-               const FetchTaskDbPtr& taskDb = FetchTaskDbPtr());
+               const FetchTaskDbPtr& taskDb = FetchTaskDbPtr(),
+               const SegmentValidator& segmentValidator = SegmentValidator());
   virtual ~FetchManager();
 
   void
   Enqueue(const Name& deviceName, const Name& baseName, const SegmentCallback& segmentCallback,
           const FinishCallback& finishCallback, uint64_t minSeqNo, uint64_t maxSeqNo,
-          int priority = PRIORITY_NORMAL);
+          int priority = PRIORITY_NORMAL, bool mustBeFresh = false);
 
   // Enqueue using default callbacks
   void
   Enqueue(const Name& deviceName, const Name& baseName, uint64_t minSeqNo, uint64_t maxSeqNo,
-          int priority = PRIORITY_NORMAL);
+          int priority = PRIORITY_NORMAL, bool mustBeFresh = false);
 
 private:
   // Fetch Events
@@ -108,6 +110,7 @@ private:
   SegmentCallback m_defaultSegmentCallback;
   FinishCallback m_defaultFinishCallback;
   FetchTaskDbPtr m_taskDb;
+  SegmentValidator m_segmentValidator;
 
   const Name m_broadcastHint;
   boost::asio::io_service& m_ioService;
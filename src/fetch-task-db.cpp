@@ -24,8 +24,6 @@
 namespace ndn {
 namespace chronoshare {
 
-namespace fs = boost::filesystem;
-
 const std::string INIT_DATABASE = "\
 CREATE TABLE IF NOT EXISTS                                      \n\
   Task(                                                         \n\
@@ -40,40 +38,21 @@ CREATE INDEX identifier ON Task (deviceName, baseName);         \n\
 ";
 
 FetchTaskDb::FetchTaskDb(const boost::filesystem::path& folder, const std::string& tag)
+  : DbHelper(folder / ".chronoshare" / "fetch_tasks", tag)
 {
-  fs::path actualFolder = folder / ".chronoshare" / "fetch_tasks";
-  fs::create_directories(actualFolder);
-
-  int res = sqlite3_open((actualFolder / tag).c_str(), &m_db);
-  if (res != SQLITE_OK) {
-    BOOST_THROW_EXCEPTION(Error("Cannot open database: " + (actualFolder / tag).string()));
-  }
-
   char* errmsg = 0;
-  res = sqlite3_exec(m_db, INIT_DATABASE.c_str(), NULL, NULL, &errmsg);
+  int res = sqlite3_exec(m_db, INIT_DATABASE.c_str(), NULL, NULL, &errmsg);
   if (res != SQLITE_OK && errmsg != 0) {
     sqlite3_free(errmsg);
   }
-  else {
-  }
-}
-
-FetchTaskDb::~FetchTaskDb()
-{
-  int res = sqlite3_close(m_db);
-  if (res != SQLITE_OK) {
-    // _LOG_ERROR
-  }
 }
 
 void
 FetchTaskDb::addTask(const Name& deviceName, const Name& baseName, uint64_t minSeqNo,
                      uint64_t maxSeqNo, int priority)
 {
-  sqlite3_stmt* stmt;
-  sqlite3_prepare_v2(m_db,
-                     "INSERT OR IGNORE INTO Task(deviceName, baseName, minSeqNo, maxSeqNo, priority) VALUES(?, ?, ?, ?, ?)",
-                     -1, &stmt, 0);
+  Statement stmt(*this,
+                 "INSERT OR IGNORE INTO Task(deviceName, baseName, minSeqNo, maxSeqNo, priority) VALUES(?, ?, ?, ?, ?)");
 
   sqlite3_bind_blob(stmt, 1, deviceName.wireEncode().wire(), deviceName.wireEncode().size(),
                     SQLITE_STATIC);
@@ -86,14 +65,12 @@ FetchTaskDb::addTask(const Name& deviceName, const Name& baseName, uint64_t minS
 
   if (res == SQLITE_OK) {
   }
-  sqlite3_finalize(stmt);
 }
 
 void
 FetchTaskDb::deleteTask(const Name& deviceName, const Name& baseName)
 {
-  sqlite3_stmt* stmt;
-  sqlite3_prepare_v2(m_db, "DELETE FROM Task WHERE deviceName = ? AND baseName = ?;", -1, &stmt, 0);
+  Statement stmt(*this, "DELETE FROM Task WHERE deviceName = ? AND baseName = ?;");
 
   sqlite3_bind_blob(stmt, 1, deviceName.wireEncode().wire(), deviceName.wireEncode().size(),
                     SQLITE_STATIC);
@@ -103,14 +80,12 @@ FetchTaskDb::deleteTask(const Name& deviceName, const Name& baseName)
   int res = sqlite3_step(stmt);
   if (res == SQLITE_OK) {
   }
-  sqlite3_finalize(stmt);
 }
 
 void
 FetchTaskDb::foreachTask(const FetchTaskCallback& callback)
 {
-  sqlite3_stmt* stmt;
-  sqlite3_prepare_v2(m_db, "SELECT * FROM Task;", -1, &stmt, 0);
+  Statement stmt(*this, "SELECT * FROM Task;");
   while (sqlite3_step(stmt) == SQLITE_ROW) {
     Name deviceName(Block(sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0)));
     Name baseName(Block(sqlite3_column_blob(stmt, 1), sqlite3_column_bytes(stmt, 1)));
@@ -122,7 +97,6 @@ FetchTaskDb::foreachTask(const FetchTaskCallback& callback)
     callback(deviceName, baseName, minSeqNo, maxSeqNo, priority);
   }
 
-  sqlite3_finalize(stmt);
 }
 
 } // namespace chronoshare
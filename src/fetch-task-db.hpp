@@ -33,7 +33,7 @@
 namespace ndn {
 namespace chronoshare {
 
-class FetchTaskDb
+class FetchTaskDb : public DbHelper
 {
 public:
   class Error : public DbHelper::Error
@@ -49,7 +49,6 @@ public:
 
 public:
   FetchTaskDb(const boost::filesystem::path& folder, const std::string& tag);
-  ~FetchTaskDb();
 
   // task with same deviceName and baseName combination will be added only once
   // if task already exists, this call does nothing
@@ -62,9 +61,6 @@ public:
 
   void
   foreachTask(const FetchTaskCallback& callback);
-
-private:
-  sqlite3* m_db;
 };
 
 typedef shared_ptr<FetchTaskDb> FetchTaskDbPtr;
@@ -30,6 +30,9 @@ namespace chronoshare {
 
 _LOG_INIT(Fetcher);
 
+const int Fetcher::MAX_INVALID_SEGMENT_RETRIES = 3;
+const time::milliseconds Fetcher::INVALID_SEGMENT_RETRY_DELAY = time::milliseconds(500);
+
 Fetcher::Fetcher(Face& face,
                  bool isSegment,
                  const SegmentCallback& segmentCallback,
@@ -37,19 +40,22 @@ Fetcher::Fetcher(Face& face,
                  const OnFetchCompleteCallback& onFetchComplete,
                  const OnFetchFailedCallback& onFetchFailed,
                  const Name& deviceName, const Name& name, int64_t minSeqNo, int64_t maxSeqNo,
-                 time::milliseconds timeout, const Name& forwardingHint)
+                 time::milliseconds timeout, const Name& forwardingHint,
+                 const SegmentValidator& segmentValidator)
   : m_face(face)
 
   , m_segmentCallback(segmentCallback)
   , m_onFetchComplete(onFetchComplete)
   , m_onFetchFailed(onFetchFailed)
   , m_finishCallback(finishCallback)
+  , m_segmentValidator(segmentValidator)
 
   , m_active(false)
   , m_timedwait(false)
   , m_name(name)
   , m_deviceName(deviceName)
   , m_forwardingHint(forwardingHint)
+  , m_mustBeFresh(false)
   , m_maximumNoActivityPeriod(timeout)
 
   , m_minSendSeqNo(minSeqNo - 1)
@@ -68,6 +74,7 @@ Fetcher::Fetcher(Face& face,
   , m_nextScheduledRetry(time::steady_clock::now())
 
   , m_ioService(m_face.getIoService())
+  , m_scheduler(m_ioService)
   , m_isSegment(isSegment)
 {
 }
@@ -83,6 +90,7 @@ Fetcher::RestartPipeline()
   m_minSendSeqNo = m_maxInOrderRecvSeqNo;
   // cout << "Restart: " << m_minSendSeqNo << endl;
   m_lastPositiveActivity = time::steady_clock::now();
+  m_invalidSegmentRetries.clear();
 
   m_ioService.post(bind(&Fetcher::FillPipeline, this));
 }
@@ -121,6 +129,7 @@ Fetcher::FillPipeline()
     }
     Interest interest(name);
     interest.setInterestLifetime(time::seconds(1));  // Alex: this lifetime should be changed to RTO
+    interest.setMustBeFresh(m_mustBeFresh);
     _LOG_DEBUG("interest: " << interest);
     m_face.expressInterest(interest,
                            bind(&Fetcher::OnData, this, m_minSendSeqNo + 1, _1, _2),
@@ -130,7 +139,13 @@ Fetcher::FillPipeline()
 
     m_activePipeline++;
   }
+
+  // segments given up in OnInvalidSegment are not requested again until the pipeline is restarted
+  if (m_active && m_activePipeline == 0 && m_maxInOrderRecvSeqNo < m_maxSeqNo) {
+    OnFetchFailed();
+  }
 }
+
 void
 Fetcher::OnData(uint64_t seqno, const Interest& interest, Data& data)
 {
@@ -139,33 +154,14 @@ Fetcher::OnData(uint64_t seqno, const Interest& interest, Data& data)
 
   shared_ptr<Data> pco = make_shared<Data>(data.wireEncode());
 
-  if (m_forwardingHint == Name()) {
-    // TODO: check verified!!!!
-    if (true) {
-      if (m_segmentCallback != nullptr) {
-        m_segmentCallback(m_deviceName, m_name, seqno, pco);
-      }
-    }
-    else {
-      _LOG_ERROR("Can not verify signature content. Name = " << data.getName());
-      // probably needs to do more in the future
-    }
-    // we don't have to tell FetchManager about this
+  if (!IsValidSegment(seqno, *pco)) {
+    OnInvalidSegment(seqno, interest);
+    return;
   }
-  else {
-    // in this case we don't care whether "data" is verified,  in fact, we expect it is unverified
+  m_invalidSegmentRetries.erase(seqno);
 
-    // we need to verify this pco and apply callback only when verified
-    // TODO: check verified !!!
-    if (true) {
-      if (m_segmentCallback != nullptr) {
-        m_segmentCallback(m_deviceName, m_name, seqno, pco);
-      }
-    }
-    else {
-      _LOG_ERROR("Can not verify signature content. Name = " << pco->getName());
-      // probably needs to do more in the future
-    }
+  if (m_segmentCallback != nullptr) {
+    m_segmentCallback(m_deviceName, m_name, seqno, pco);
   }
 
   m_activePipeline--;
@@ -237,6 +233,59 @@ Fetcher::OnData(uint64_t seqno, const Interest& interest, Data& data)
   }
 }
 
+void
+Fetcher::OnInvalidSegment(uint64_t seqno, const Interest& interest)
+{
+  int retries = ++m_invalidSegmentRetries[seqno];
+  if (retries > MAX_INVALID_SEGMENT_RETRIES) {
+    _LOG_ERROR("Can not verify content, giving up. Name = " << interest.getName());
+
+    m_invalidSegmentRetries.erase(seqno);
+    {
+      std::unique_lock<std::mutex> lock(m_seqNoMutex);
+      m_inActivePipeline.erase(seqno);
+      m_activePipeline--;
+    }
+    // the fetch fails once the rest of the pipeline has drained
+    m_ioService.post(bind(&Fetcher::FillPipeline, this));
+    return;
+  }
+
+  _LOG_ERROR("Can not verify content, asking again. Name = " << interest.getName());
+
+  // the pipeline slot stays occupied by this seqno until the retry is answered
+  Interest retry(interest.getName());
+  retry.setInterestLifetime(interest.getInterestLifetime());
+  retry.setMustBeFresh(true);
+  m_scheduler.scheduleEvent(INVALID_SEGMENT_RETRY_DELAY * (1 << (retries - 1)), [this, seqno, retry] {
+      m_face.expressInterest(retry,
+                             bind(&Fetcher::OnData, this, seqno, _1, _2),
+                             bind(&Fetcher::OnTimeout, this, seqno, _1));
+    });
+}
+
+bool
+Fetcher::IsValidSegment(uint64_t seqno, const Data& data)
+{
+  if (m_segmentValidator == nullptr) {
+    return true;
+  }
+
+  if (m_forwardingHint == Name()) {
+    return m_segmentValidator(m_deviceName, m_name, seqno, data);
+  }
+
+  // with forwarding hint, the actual segment is encapsulated by the responder
+  try {
+    Data segment(data.getContent().blockFromValue());
+    return m_segmentValidator(m_deviceName, m_name, seqno, segment);
+  }
+  catch (const tlv::Error& error) {
+    _LOG_ERROR("Cannot decode encapsulated segment: " << error.what());
+    return false;
+  }
+}
+
 void
 Fetcher::OnTimeout(uint64_t seqno, const Interest& interest)
 {
@@ -263,16 +312,7 @@ Fetcher::OnTimeout(uint64_t seqno, const Interest& interest)
     }
 
     if (done) {
-      {
-        std::unique_lock<std::mutex> lock(m_seqNoMutex);
-        _LOG_DEBUG("Telling that fetch failed");
-        _LOG_DEBUG("Active pipeline size should be zero: " << m_inActivePipeline.size());
-      }
-
-      m_active = false;
-      if (m_onFetchFailed != nullptr) {
-        m_onFetchFailed(std::ref(*this));
-      }
+      OnFetchFailed();
       // this is not valid anymore, but we still should be able finish work
     }
   }
@@ -284,5 +324,20 @@ Fetcher::OnTimeout(uint64_t seqno, const Interest& interest)
   }
 }
 
+void
+Fetcher::OnFetchFailed()
+{
+  {
+    std::unique_lock<std::mutex> lock(m_seqNoMutex);
+    _LOG_DEBUG("Telling that fetch failed");
+    _LOG_DEBUG("Active pipeline size should be zero: " << m_inActivePipeline.size());
+  }
+
+  m_active = false;
+  if (m_onFetchFailed != nullptr) {
+    m_onFetchFailed(std::ref(*this));
+  }
+}
+
 } // namespace chronoshare
 } // namespace ndn
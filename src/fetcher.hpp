@@ -24,7 +24,9 @@
 #include "core/chronoshare-common.hpp"
 
 #include <ndn-cxx/face.hpp>
+#include <ndn-cxx/util/scheduler.hpp>
 
+#include <map>
 #include <set>
 #include <thread>
 #include <mutex>
@@ -42,6 +44,15 @@ public:
   typedef std::function<void(Name& deviceName, Name& baseName)> FinishCallback;
   typedef std::function<void(Fetcher&, const Name& deviceName, const Name& baseName)> OnFetchCompleteCallback;
   typedef std::function<void(Fetcher&)> OnFetchFailedCallback;
+  /**
+   * @brief Check received segment before it is handed to the segment callback
+   *
+   * If forwarding hint is used, @p data is the segment encapsulated by the responder.
+   * Segments that do not pass the check are requested again with an increasing delay; after
+   * MAX_INVALID_SEGMENT_RETRIES attempts the segment is given up and the fetch fails.
+   */
+  typedef std::function<bool(const Name& deviceName, const Name& baseName, uint64_t seq,
+                             const Data& data)> SegmentValidator;
 
   Fetcher(Face& face,
           bool isSegment,
@@ -52,7 +63,8 @@ public:
           const Name& deviceName, const Name& name, int64_t minSeqNo, int64_t maxSeqNo,
           time::milliseconds timeout = time::seconds(30), // this time is not precise, but sets min bound
                                                           // actual time depends on how fast Interests timeout
-          const Name& forwardingHint = Name());
+          const Name& forwardingHint = Name(),
+          const SegmentValidator& segmentValidator = SegmentValidator());
   virtual ~Fetcher();
 
   bool
@@ -70,6 +82,16 @@ public:
   void
   SetForwardingHint(const Name& forwardingHint);
 
+  /**
+   * @brief Request segments only from producers, not from caches (e.g., when cached segments
+   *        have turned out to be bad)
+   */
+  void
+  SetMustBeFresh(bool mustBeFresh)
+  {
+    m_mustBeFresh = mustBeFresh;
+  }
+
   const Name&
   GetForwardingHint() const
   {
@@ -119,10 +141,22 @@ private:
   void
   OnData(uint64_t seqno, const Interest& interest, Data& data);
 
+  bool
+  IsValidSegment(uint64_t seqno, const Data& data);
+
+  void
+  OnInvalidSegment(uint64_t seqno, const Interest& interest);
+
   void
   OnTimeout(uint64_t seqno, const Interest& interest);
 
+  void
+  OnFetchFailed();
+
 public:
+  static const int MAX_INVALID_SEGMENT_RETRIES;
+  static const time::milliseconds INVALID_SEGMENT_RETRY_DELAY;
+
   boost::intrusive::list_member_hook<> m_managerListHook;
 
 private:
@@ -133,6 +167,7 @@ private:
   OnFetchFailedCallback m_onFetchFailed;
 
   FinishCallback m_finishCallback;
+  SegmentValidator m_segmentValidator;
 
   bool m_active;
   bool m_timedwait;
@@ -140,6 +175,7 @@ private:
   Name m_name;
   Name m_deviceName;
   Name m_forwardingHint;
+  bool m_mustBeFresh;
 
   time::milliseconds m_maximumNoActivityPeriod;
 
@@ -147,6 +183,7 @@ private:
   int64_t m_maxInOrderRecvSeqNo;
   std::set<int64_t> m_outOfOrderRecvSeqNo;
   std::set<int64_t> m_inActivePipeline;
+  std::map<int64_t, int> m_invalidSegmentRetries;
 
   // int64_t m_minSeqNo;
   int64_t m_maxSeqNo;
@@ -167,6 +204,7 @@ private:
   std::mutex m_seqNoMutex;
 
   boost::asio::io_service& m_ioService;
+  Scheduler m_scheduler; // delayed requests of invalid segments, cancelled with the fetcher
   bool m_isSegment;
 };
 
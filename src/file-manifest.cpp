@@ -0,0 +1,86 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#include "file-manifest.hpp"
+
+#include <cstring>
+
+namespace ndn {
+namespace chronoshare {
+
+const size_t FileManifest::DIGEST_SIZE;
+const size_t FileManifest::MANIFEST_DIGESTS_PER_SEGMENT;
+
+FileManifest::FileManifest()
+{
+}
+
+void
+FileManifest::addSegment(const uint8_t* payload, size_t size)
+{
+  ConstBufferPtr digest = util::Sha256::computeDigest(payload, size);
+  m_digests.insert(m_digests.end(), digest->begin(), digest->end());
+}
+
+void
+FileManifest::addSegmentDigest(const Buffer& digest)
+{
+  if (digest.size() != DIGEST_SIZE) {
+    BOOST_THROW_EXCEPTION(Error("Segment digest is not a SHA-256 digest"));
+  }
+  m_digests.insert(m_digests.end(), digest.begin(), digest.end());
+}
+
+void
+FileManifest::addManifestSegment(const uint8_t* buffer, size_t size)
+{
+  if (size % DIGEST_SIZE != 0) {
+    BOOST_THROW_EXCEPTION(Error("Manifest segment size is not a multiple of the digest size"));
+  }
+  m_digests.insert(m_digests.end(), buffer, buffer + size);
+}
+
+ConstBufferPtr
+FileManifest::getRoot() const
+{
+  return util::Sha256::computeDigest(m_digests.data(), m_digests.size());
+}
+
+bool
+FileManifest::verifySegment(uint64_t segment, const uint8_t* payload, size_t size) const
+{
+  if (segment >= this->size()) {
+    return false;
+  }
+
+  ConstBufferPtr digest = util::Sha256::computeDigest(payload, size);
+  return std::memcmp(digest->data(), m_digests.data() + segment * DIGEST_SIZE, DIGEST_SIZE) == 0;
+}
+
+Buffer
+FileManifest::getManifestSegment(size_t segment) const
+{
+  size_t begin = std::min(m_digests.size(), segment * MANIFEST_DIGESTS_PER_SEGMENT * DIGEST_SIZE);
+  size_t end = std::min(m_digests.size(), begin + MANIFEST_DIGESTS_PER_SEGMENT * DIGEST_SIZE);
+  return Buffer(m_digests.data() + begin, end - begin);
+}
+
+} // namespace chronoshare
+} // namespace ndn
@@ -0,0 +1,135 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#ifndef CHRONOSHARE_SRC_FILE_MANIFEST_HPP
+#define CHRONOSHARE_SRC_FILE_MANIFEST_HPP
+
+#include "core/chronoshare-common.hpp"
+
+#include <ndn-cxx/encoding/buffer.hpp>
+#include <ndn-cxx/util/digest.hpp>
+
+#include <vector>
+
+namespace ndn {
+namespace chronoshare {
+
+/**
+ * @brief List of SHA-256 digests of file segment payloads
+ *
+ * Only the root of the manifest (SHA-256 of the concatenated segment digests) is carried in
+ * the signed ActionItem.  The manifest itself is published as DigestSha256-signed segments of
+ * MANIFEST_DIGESTS_PER_SEGMENT digests each, so that the file segments do not need to carry
+ * their own asymmetric signature:
+ *
+ *   /<device_name>/<appname>/manifest/<hash>/<segment>
+ */
+class FileManifest
+{
+public:
+  class Error : public std::runtime_error
+  {
+  public:
+    explicit Error(const std::string& what)
+      : std::runtime_error(what)
+    {
+    }
+  };
+
+  static const size_t DIGEST_SIZE = util::Sha256::DIGEST_SIZE;
+  static const size_t MANIFEST_DIGESTS_PER_SEGMENT = 128;
+
+public:
+  FileManifest();
+
+  /**
+   * @brief Append digest of the next file segment payload
+   */
+  void
+  addSegment(const uint8_t* payload, size_t size);
+
+  /**
+   * @brief Append already computed digest of the next file segment payload
+   * @throw Error @p digest is not a SHA-256 digest
+   */
+  void
+  addSegmentDigest(const Buffer& digest);
+
+  /**
+   * @brief Append a manifest segment (e.g., fetched from the network)
+   * @throw Error the segment is not a whole number of digests
+   */
+  void
+  addManifestSegment(const uint8_t* buffer, size_t size);
+
+  /**
+   * @brief Number of file segments covered by the manifest
+   */
+  size_t
+  size() const
+  {
+    return m_digests.size() / DIGEST_SIZE;
+  }
+
+  ConstBufferPtr
+  getRoot() const;
+
+  /**
+   * @brief Get digest of the payload of the file segment @p segment
+   * @pre segment < size()
+   */
+  Buffer
+  getSegmentDigest(uint64_t segment) const
+  {
+    return Buffer(m_digests.data() + segment * DIGEST_SIZE, DIGEST_SIZE);
+  }
+
+  /**
+   * @brief Check payload of the file segment @p segment against the manifest
+   */
+  bool
+  verifySegment(uint64_t segment, const uint8_t* payload, size_t size) const;
+
+  /**
+   * @brief Number of manifest segments needed for a file of @p nFileSegments segments
+   */
+  static size_t
+  getManifestSegmentCount(size_t nFileSegments)
+  {
+    return std::max<size_t>(1, (nFileSegments + MANIFEST_DIGESTS_PER_SEGMENT - 1) /
+                                 MANIFEST_DIGESTS_PER_SEGMENT);
+  }
+
+  /**
+   * @brief Get the payload of the manifest segment @p segment
+   */
+  Buffer
+  getManifestSegment(size_t segment) const;
+
+private:
+  Buffer m_digests;
+};
+
+typedef shared_ptr<FileManifest> FileManifestPtr;
+
+} // namespace chronoshare
+} // namespace ndn
+
+#endif // CHRONOSHARE_SRC_FILE_MANIFEST_HPP
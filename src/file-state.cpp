@@ -51,10 +51,12 @@ CREATE INDEX FileState_type_file_hash ON FileState (type, file_hash);   \n\
 ";
 
 FileState::FileState(const boost::filesystem::path& path)
-  : DbHelper(path / ".chronoshare", "file-state.db")
+  : DbHelper(path / ".chronoshare", "metadata.db")
 {
   sqlite3_exec(m_db, INIT_DATABASE.c_str(), NULL, NULL, NULL);
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
+
+  importLegacyTables(path / ".chronoshare" / "file-state.db", {"FileState"});
 }
 
 FileState::~FileState()
@@ -66,19 +68,17 @@ FileState::UpdateFile(const std::string& filename, sqlite3_int64 version, const
                       const Buffer& device_name, sqlite3_int64 seq_no, time_t atime, time_t mtime,
                       time_t ctime, int mode, int seg_num)
 {
-  sqlite3_stmt* stmt;
-  sqlite3_prepare_v2(m_db, "UPDATE FileState "
-                           "SET "
-                           "device_name=?, seq_no=?, "
-                           "version=?,"
-                           "file_hash=?,"
-                           "file_atime=datetime(?, 'unixepoch'),"
-                           "file_mtime=datetime(?, 'unixepoch'),"
-                           "file_ctime=datetime(?, 'unixepoch'),"
-                           "file_chmod=?, "
-                           "file_seg_num=? "
-                           "WHERE type=0 AND filename=?",
-                     -1, &stmt, 0);
+  Statement stmt(*this, "UPDATE FileState "
+                        "SET "
+                        "device_name=?, seq_no=?, "
+                        "version=?,"
+                        "file_hash=?,"
+                        "file_atime=datetime(?, 'unixepoch'),"
+                        "file_mtime=datetime(?, 'unixepoch'),"
+                        "file_ctime=datetime(?, 'unixepoch'),"
+                        "file_chmod=?, "
+                        "file_seg_num=? "
+                        "WHERE type=0 AND filename=?");
 
   sqlite3_bind_blob(stmt, 1, device_name.buf(), device_name.size(), SQLITE_STATIC);
   sqlite3_bind_int64(stmt, 2, seq_no);
@@ -96,19 +96,15 @@ FileState::UpdateFile(const std::string& filename, sqlite3_int64 version, const
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_ROW && sqlite3_errcode(m_db) != SQLITE_DONE,
                   sqlite3_errmsg(m_db));
 
-  sqlite3_finalize(stmt);
-
   int affected_rows = sqlite3_changes(m_db);
   if (affected_rows == 0) // file didn't exist
   {
-    sqlite3_stmt* stmt;
-    sqlite3_prepare_v2(m_db,
-                       "INSERT INTO FileState "
-                       "(type,filename,version,device_name,seq_no,file_hash,"
-                       "file_atime,file_mtime,file_ctime,file_chmod,file_seg_num) "
-                       "VALUES (0, ?, ?, ?, ?, ?, "
-                       "datetime(?, 'unixepoch'), datetime(?, 'unixepoch'), datetime(?, 'unixepoch'), ?, ?)",
-                       -1, &stmt, 0);
+    Statement stmt(*this,
+                   "INSERT INTO FileState "
+                   "(type,filename,version,device_name,seq_no,file_hash,"
+                   "file_atime,file_mtime,file_ctime,file_chmod,file_seg_num) "
+                   "VALUES (0, ?, ?, ?, ?, ?, "
+                   "datetime(?, 'unixepoch'), datetime(?, 'unixepoch'), datetime(?, 'unixepoch'), ?, ?)");
 
     _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
 
@@ -125,47 +121,38 @@ FileState::UpdateFile(const std::string& filename, sqlite3_int64 version, const
 
     sqlite3_step(stmt);
     _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_DONE, sqlite3_errmsg(m_db));
-    sqlite3_finalize(stmt);
-
-    sqlite3_prepare_v2(m_db,
-                       "UPDATE FileState SET directory=directory_name(filename) WHERE filename=?",
-                       -1, &stmt, 0);
+    Statement updateStmt(*this,
+                         "UPDATE FileState SET directory=directory_name(filename) WHERE filename=?");
     _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
 
-    sqlite3_bind_text(stmt, 1, filename.c_str(), -1, SQLITE_STATIC);
-    sqlite3_step(stmt);
+    sqlite3_bind_text(updateStmt, 1, filename.c_str(), -1, SQLITE_STATIC);
+    sqlite3_step(updateStmt);
     _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_DONE, sqlite3_errmsg(m_db));
-    sqlite3_finalize(stmt);
   }
 }
 
 void
 FileState::DeleteFile(const std::string& filename)
 {
-  sqlite3_stmt* stmt;
-  sqlite3_prepare_v2(m_db, "DELETE FROM FileState WHERE type=0 AND filename=?", -1, &stmt, 0);
+  Statement stmt(*this, "DELETE FROM FileState WHERE type=0 AND filename=?");
   sqlite3_bind_text(stmt, 1, filename.c_str(), -1, SQLITE_STATIC);
 
   _LOG_DEBUG("Delete " << filename);
 
   sqlite3_step(stmt);
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_DONE, sqlite3_errmsg(m_db));
-  sqlite3_finalize(stmt);
 }
 
 void
 FileState::SetFileComplete(const std::string& filename)
 {
-  sqlite3_stmt* stmt;
-  sqlite3_prepare_v2(m_db, "UPDATE FileState SET is_complete=1 WHERE type = 0 AND filename = ?", -1,
-                     &stmt, 0);
+  Statement stmt(*this, "UPDATE FileState SET is_complete=1 WHERE type = 0 AND filename = ?");
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
   sqlite3_bind_text(stmt, 1, filename.c_str(), -1, SQLITE_STATIC);
 
   sqlite3_step(stmt);
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_DONE, sqlite3_errmsg(m_db));
 
-  sqlite3_finalize(stmt);
 }
 
 /**
@@ -174,12 +161,10 @@ FileState::SetFileComplete(const std::string& filename)
 FileItemPtr
 FileState::LookupFile(const std::string& filename)
 {
-  sqlite3_stmt* stmt;
-  sqlite3_prepare_v2(m_db,
-                     "SELECT filename,version,device_name,seq_no,file_hash,strftime('%s', file_mtime),file_chmod,file_seg_num,is_complete "
-                     "       FROM FileState "
-                     "       WHERE type = 0 AND filename = ?",
-                     -1, &stmt, 0);
+  Statement stmt(*this,
+                 "SELECT filename,version,device_name,seq_no,file_hash,strftime('%s', file_mtime),file_chmod,file_seg_num,is_complete "
+                 "       FROM FileState "
+                 "       WHERE type = 0 AND filename = ?");
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
   sqlite3_bind_text(stmt, 1, filename.c_str(), -1, SQLITE_STATIC);
 
@@ -198,7 +183,6 @@ FileState::LookupFile(const std::string& filename)
     retval->set_is_complete(sqlite3_column_int(stmt, 8));
   }
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_DONE, sqlite3_errmsg(m_db));
-  sqlite3_finalize(stmt);
 
   return retval;
 }
@@ -206,12 +190,10 @@ FileState::LookupFile(const std::string& filename)
 FileItemsPtr
 FileState::LookupFilesForHash(const Buffer& hash)
 {
-  sqlite3_stmt* stmt;
-  sqlite3_prepare_v2(m_db,
-                     "SELECT filename,version,device_name,seq_no,file_hash,strftime('%s', file_mtime),file_chmod,file_seg_num,is_complete "
-                     "   FROM FileState "
-                     "   WHERE type = 0 AND file_hash = ?",
-                     -1, &stmt, 0);
+  Statement stmt(*this,
+                 "SELECT filename,version,device_name,seq_no,file_hash,strftime('%s', file_mtime),file_chmod,file_seg_num,is_complete "
+                 "   FROM FileState "
+                 "   WHERE type = 0 AND file_hash = ?");
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
   sqlite3_bind_blob(stmt, 1, hash.buf(), hash.size(), SQLITE_STATIC);
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
@@ -234,22 +216,31 @@ FileState::LookupFilesForHash(const Buffer& hash)
   }
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_DONE, sqlite3_errmsg(m_db));
 
-  sqlite3_finalize(stmt);
-
   return retval;
 }
 
+void
+FileState::LookupFileHashes(const function<void(const Buffer&)>& visitor)
+{
+  Statement stmt(*this, "SELECT DISTINCT file_hash FROM FileState");
+  _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
+
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    visitor(Buffer(sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0)));
+  }
+  _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_DONE, sqlite3_errmsg(m_db));
+
+}
+
 void
 FileState::LookupFilesInFolder(const function<void(const FileItem&)>& visitor,
                                const std::string& folder, int offset /*=0*/, int limit /*=-1*/)
 {
-  sqlite3_stmt* stmt;
-  sqlite3_prepare_v2(m_db,
-                     "SELECT filename,version,device_name,seq_no,file_hash,strftime('%s', file_mtime),file_chmod,file_seg_num,is_complete "
-                     "   FROM FileState "
-                     "   WHERE type = 0 AND directory = ?"
-                     "   LIMIT ? OFFSET ?",
-                     -1, &stmt, 0);
+  Statement stmt(*this,
+                 "SELECT filename,version,device_name,seq_no,file_hash,strftime('%s', file_mtime),file_chmod,file_seg_num,is_complete "
+                 "   FROM FileState "
+                 "   WHERE type = 0 AND directory = ?"
+                 "   LIMIT ? OFFSET ?");
   if (folder.size() == 0)
     sqlite3_bind_null(stmt, 1);
   else
@@ -276,7 +267,6 @@ FileState::LookupFilesInFolder(const function<void(const FileItem&)>& visitor,
 
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_DONE, sqlite3_errmsg(m_db));
 
-  sqlite3_finalize(stmt);
 }
 
 FileItemsPtr
@@ -300,20 +290,20 @@ FileState::LookupFilesInFolderRecursively(const function<void(const FileItem&)>&
   if (limit >= 0)
     limit++;
 
-  sqlite3_stmt* stmt;
+  /// @todo Do something to improve efficiency of this query. Right now it is basically scanning the whole database
+  // there is a small ambiguity with is_prefix matching, but should be ok for now
+  Statement stmt(*this, folder != "" ?
+                        "SELECT filename,version,device_name,seq_no,file_hash,strftime('%s', file_mtime),file_chmod,file_seg_num,is_complete "
+                        "   FROM FileState "
+                        "   WHERE type = 0 AND is_dir_prefix(?, directory)=1 "
+                        "   ORDER BY filename "
+                        "   LIMIT ? OFFSET ?" :
+                        "SELECT filename,version,device_name,seq_no,file_hash,strftime('%s', file_mtime),file_chmod,file_seg_num,is_complete "
+                        "   FROM FileState "
+                        "   WHERE type = 0"
+                        "   ORDER BY filename "
+                        "   LIMIT ? OFFSET ?");
   if (folder != "") {
-    /// @todo Do something to improve efficiency of this query. Right now it is basically scanning the whole database
-
-    sqlite3_prepare_v2(m_db,
-                       "SELECT filename,version,device_name,seq_no,file_hash,strftime('%s', file_mtime),file_chmod,file_seg_num,is_complete "
-                       "   FROM FileState "
-                       "   WHERE type = 0 AND is_dir_prefix(?, directory)=1 "
-                       "   ORDER BY filename "
-                       "   LIMIT ? OFFSET ?",
-                       -1, &stmt,
-                       0); // there is a small ambiguity with is_prefix matching, but should be ok for now
-    _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
-
     sqlite3_bind_text(stmt, 1, folder.c_str(), folder.size(), SQLITE_STATIC);
     _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, sqlite3_errmsg(m_db));
 
@@ -321,13 +311,6 @@ FileState::LookupFilesInFolderRecursively(const function<void(const FileItem&)>&
     sqlite3_bind_int(stmt, 3, offset);
   }
   else {
-    sqlite3_prepare_v2(m_db,
-                       "SELECT filename,version,device_name,seq_no,file_hash,strftime('%s', file_mtime),file_chmod,file_seg_num,is_complete "
-                       "   FROM FileState "
-                       "   WHERE type = 0"
-                       "   ORDER BY filename "
-                       "   LIMIT ? OFFSET ?",
-                       -1, &stmt, 0);
     sqlite3_bind_int(stmt, 1, limit);
     sqlite3_bind_int(stmt, 2, offset);
   }
@@ -356,8 +339,6 @@ FileState::LookupFilesInFolderRecursively(const function<void(const FileItem&)>&
 
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_DONE, sqlite3_errmsg(m_db));
 
-  sqlite3_finalize(stmt);
-
   return (limit == 1);
 }
 
@@ -78,6 +78,12 @@ public:
   FileItemsPtr
   LookupFilesForHash(const Buffer& hash);
 
+  /**
+   * @brief Call visitor(hash) for every distinct content hash of the files in the state
+   */
+  void
+  LookupFileHashes(const function<void(const Buffer&)>& visitor);
+
   /**
    * @brief Lookup all files in the specified folder and call visitor(file) for each file
    */
@@ -0,0 +1,214 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#include "garbage-collector.hpp"
+#include "core/logging.hpp"
+
+#include <set>
+
+namespace ndn {
+namespace chronoshare {
+
+_LOG_INIT(GarbageCollector);
+
+namespace fs = boost::filesystem;
+
+// number of files removed from the store in one io thread job
+const size_t REMOVAL_BATCH_SIZE = 64;
+
+const time::seconds DEFAULT_RETENTION = time::days(30);
+const double DEFAULT_COMPACTION_THRESHOLD = 0.5;
+
+GarbageCollector::GarbageCollector(boost::asio::io_service& ioService, const fs::path& folder,
+                                   ActionLogPtr actionLog, FileStatePtr fileState,
+                                   const IsInUseCallback& isInUse)
+  : m_ioService(ioService)
+  , m_folder(folder)
+  , m_actionLog(actionLog)
+  , m_fileState(fileState)
+  , m_isInUse(isInUse)
+  , m_retention(DEFAULT_RETENTION)
+  , m_compactionThreshold(DEFAULT_COMPACTION_THRESHOLD)
+  , m_isRunning(false)
+  , m_isStopped(false)
+  , m_nextGarbage(0)
+  , m_report()
+  , m_lifetime(make_shared<int>(0))
+{
+}
+
+GarbageCollector::~GarbageCollector()
+{
+  m_isStopped = true;
+  if (m_worker.joinable()) {
+    m_worker.join();
+  }
+}
+
+bool
+GarbageCollector::start(const FinishCallback& onFinish)
+{
+  if (m_isRunning) {
+    return false;
+  }
+
+  m_isRunning = true;
+  m_onFinish = onFinish;
+  m_report = Report();
+  m_garbage.clear();
+  m_nextGarbage = 0;
+
+  std::set<Buffer> live;
+  auto addLive = [&live] (const Buffer& hash) { live.insert(hash); };
+  m_fileState->LookupFileHashes(addLive);
+  m_actionLog->LookupFileHashesSince(addLive,
+                                     time::system_clock::to_time_t(time::system_clock::now() -
+                                                                   m_retention));
+
+  m_store = PackStore::open(m_folder);
+  for (auto& file : m_store->listFiles()) {
+    if (live.find(file.first) == live.end()) {
+      m_garbage.push_back(std::move(file));
+    }
+  }
+
+  _LOG_DEBUG("Collecting garbage: " << live.size() << " live versions, " << m_garbage.size()
+             << " versions to remove");
+
+  post(bind(&GarbageCollector::removeBatch, this));
+  return true;
+}
+
+void
+GarbageCollector::removeBatch()
+{
+  for (size_t i = 0; i < REMOVAL_BATCH_SIZE && m_nextGarbage < m_garbage.size(); ++i) {
+    const auto& file = m_garbage[m_nextGarbage++];
+
+    // the version could have become current again or started being fetched since the
+    // collection started
+    if (!m_fileState->LookupFilesForHash(file.first)->empty() ||
+        (m_isInUse && m_isInUse(file.first))) {
+      continue;
+    }
+    // segments of other files are derived from this version, it can only go after them
+    if (m_store->isBase(file.first)) {
+      continue;
+    }
+
+    auto start = time::steady_clock::now();
+    size_t nSegments = m_store->removeFile(file.first, file.second);
+    recordPause(start);
+
+    ++m_report.nRemovedFiles;
+    m_report.nRemovedSegments += nSegments;
+  }
+
+  if (m_nextGarbage < m_garbage.size()) {
+    post(bind(&GarbageCollector::removeBatch, this));
+    return;
+  }
+
+  auto start = time::steady_clock::now();
+  m_store->flush();
+  recordPause(start);
+  m_garbage.clear();
+
+  m_worker = std::thread(&GarbageCollector::compactPacks, this);
+}
+
+void
+GarbageCollector::compactPacks()
+{
+  try {
+    for (const auto& usage : m_store->getPackUsage()) {
+      if (m_isStopped) {
+        return;
+      }
+      if (usage.liveSize > usage.size * m_compactionThreshold) {
+        continue;
+      }
+
+      _LOG_DEBUG("Compacting pack " << usage.pack << ", " << usage.liveSize << " of "
+                 << usage.size << " bytes live");
+
+      bool isRemoved = false;
+      while (!isRemoved && !m_isStopped) {
+        auto start = time::steady_clock::now();
+        isRemoved = m_store->compactPack(usage.pack);
+        recordPause(start);
+      }
+
+      if (isRemoved) {
+        ++m_report.nCompactedPacks;
+        m_report.nFreedBytes += usage.size - usage.liveSize;
+      }
+    }
+  }
+  catch (const PackStore::Error& e) {
+    _LOG_ERROR("Compaction failed: " << e.what());
+  }
+
+  post(bind(&GarbageCollector::finish, this));
+}
+
+void
+GarbageCollector::finish()
+{
+  m_worker.join();
+  m_store.reset();
+  m_isRunning = false;
+
+  _LOG_DEBUG("Garbage collection finished: removed " << m_report.nRemovedFiles << " versions ("
+             << m_report.nRemovedSegments << " segments), compacted "
+             << m_report.nCompactedPacks << " packs, freed " << m_report.nFreedBytes
+             << " bytes, max pause "
+             << time::duration_cast<time::microseconds>(m_report.maxPause).count()
+             << "us, total pause "
+             << time::duration_cast<time::microseconds>(m_report.totalPause).count() << "us");
+
+  if (m_onFinish) {
+    FinishCallback onFinish;
+    onFinish.swap(m_onFinish);
+    onFinish(m_report);
+  }
+}
+
+void
+GarbageCollector::recordPause(const time::steady_clock::TimePoint& start)
+{
+  time::nanoseconds pause = time::steady_clock::now() - start;
+  m_report.maxPause = std::max(m_report.maxPause, pause);
+  m_report.totalPause += pause;
+}
+
+void
+GarbageCollector::post(const function<void()>& handler)
+{
+  std::weak_ptr<int> lifetime = m_lifetime;
+  m_ioService.post([lifetime, handler] {
+      if (!lifetime.expired()) {
+        handler();
+      }
+    });
+}
+
+} // namespace chronoshare
+} // namespace ndn
@@ -0,0 +1,165 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#ifndef CHRONOSHARE_SRC_GARBAGE_COLLECTOR_HPP
+#define CHRONOSHARE_SRC_GARBAGE_COLLECTOR_HPP
+
+#include "action-log.hpp"
+#include "file-state.hpp"
+#include "pack-store.hpp"
+#include "core/chronoshare-common.hpp"
+
+#include <boost/asio/io_service.hpp>
+#include <boost/filesystem.hpp>
+
+#include <atomic>
+#include <thread>
+
+namespace ndn {
+namespace chronoshare {
+
+/**
+ * @brief Background collection of stored segments of superseded file versions
+ *
+ * A file version (hash) is live if it is the current content of a file in the FileState, or
+ * if an update action within the retention window introduced it (so recent versions can still
+ * be restored).  Versions that segments of other files are derived from are kept until those
+ * files are removed.  Segments of all other versions are removed from the PackStore, in small
+ * batches posted to the io thread, so event processing is never blocked for long.  Then packs
+ * that are mostly garbage are compacted on a worker thread, a bounded batch of records at a
+ * time, which is what actually frees disk space.
+ *
+ * Every call that holds the store (removal of one file, one compaction batch) is timed; the
+ * longest and total of these pauses are reported together with the number of freed bytes.
+ */
+class GarbageCollector : private boost::noncopyable
+{
+public:
+  struct Report
+  {
+    size_t nRemovedFiles;
+    size_t nRemovedSegments;
+    size_t nCompactedPacks;
+    uint64_t nFreedBytes;        ///< size of garbage in the removed packs
+    time::nanoseconds maxPause;  ///< longest time the store was held by the collector
+    time::nanoseconds totalPause;
+  };
+
+  /**
+   * @brief Predicate telling whether a file version is being fetched or assembled
+   */
+  typedef function<bool(const Buffer& hash)> IsInUseCallback;
+
+  typedef function<void(const Report& report)> FinishCallback;
+
+public:
+  /**
+   * @param folder folder of the store (<shared folder>/.chronoshare)
+   * @param isInUse versions for which it returns true are not removed
+   */
+  GarbageCollector(boost::asio::io_service& ioService, const boost::filesystem::path& folder,
+                   ActionLogPtr actionLog, FileStatePtr fileState,
+                   const IsInUseCallback& isInUse = IsInUseCallback());
+
+  /**
+   * @brief Stop the collection in progress, if any, and wait for the worker thread
+   */
+  ~GarbageCollector();
+
+  /**
+   * @brief Set how long versions introduced by update actions are kept after the action
+   */
+  void
+  setRetention(const time::seconds& retention)
+  {
+    m_retention = retention;
+  }
+
+  /**
+   * @brief Set share of live records below which a pack is compacted
+   */
+  void
+  setCompactionThreshold(double threshold)
+  {
+    m_compactionThreshold = threshold;
+  }
+
+  bool
+  isRunning() const
+  {
+    return m_isRunning;
+  }
+
+  /**
+   * @brief Start a collection, unless one is already in progress
+   *
+   * Must be called from the io thread; @p onFinish is called from the io thread as well.
+   *
+   * @return false if a collection is already in progress
+   */
+  bool
+  start(const FinishCallback& onFinish = FinishCallback());
+
+private:
+  void
+  removeBatch();
+
+  void
+  compactPacks();
+
+  void
+  finish();
+
+  void
+  recordPause(const time::steady_clock::TimePoint& start);
+
+  /**
+   * @brief Post @p handler to the io thread, to be skipped if the collector is gone by then
+   */
+  void
+  post(const function<void()>& handler);
+
+private:
+  boost::asio::io_service& m_ioService;
+  boost::filesystem::path m_folder;
+  ActionLogPtr m_actionLog;
+  FileStatePtr m_fileState;
+  IsInUseCallback m_isInUse;
+
+  time::seconds m_retention;
+  double m_compactionThreshold;
+
+  bool m_isRunning;
+  std::atomic<bool> m_isStopped;
+  FinishCallback m_onFinish;
+  PackStorePtr m_store;
+  std::vector<std::pair<Buffer, Name>> m_garbage;
+  size_t m_nextGarbage;
+  Report m_report;
+  std::thread m_worker;
+
+  // expires with the collector, guards handlers posted to the io thread
+  shared_ptr<int> m_lifetime;
+};
+
+} // namespace chronoshare
+} // namespace ndn
+
+#endif // CHRONOSHARE_SRC_GARBAGE_COLLECTOR_HPP
@@ -0,0 +1,174 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#include "hash-cache.hpp"
+#include "core/logging.hpp"
+
+#include <ndn-cxx/util/digest.hpp>
+
+#include <boost/filesystem/fstream.hpp>
+
+#include <sys/stat.h>
+
+namespace ndn {
+namespace chronoshare {
+
+_LOG_INIT(HashCache);
+
+namespace fs = boost::filesystem;
+
+// files modified less than this before their status was read may still change without changing
+// their modification time (e.g., 2 seconds resolution of FAT)
+const int64_t RACY_INTERVAL = time::duration_cast<time::nanoseconds>(time::seconds(2)).count();
+
+const std::string INIT_DATABASE = "\
+                                                                        \n\
+CREATE TABLE IF NOT EXISTS                                              \n\
+  HashCache (                                                           \n\
+    filename    TEXT NOT NULL PRIMARY KEY,                              \n\
+    device      INTEGER NOT NULL,                                       \n\
+    inode       INTEGER NOT NULL,                                       \n\
+    size        INTEGER NOT NULL,                                       \n\
+    mtime       INTEGER NOT NULL,                                       \n\
+    ctime       INTEGER NOT NULL,                                       \n\
+    file_hash   BLOB NOT NULL                                           \n\
+  );                                                                    \n\
+";
+
+static int64_t
+toNanoseconds(const struct timespec& time)
+{
+  return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+HashCache::HashCache(const fs::path& path)
+  : DbHelper(path / ".chronoshare", "hash-cache.db")
+{
+  char* errmsg = 0;
+  int res = sqlite3_exec(m_db, INIT_DATABASE.c_str(), nullptr, nullptr, &errmsg);
+  if (res != SQLITE_OK && errmsg != 0) {
+    std::string error = errmsg;
+    sqlite3_free(errmsg);
+    BOOST_THROW_EXCEPTION(Error("Cannot initialize hash cache: " + error));
+  }
+}
+
+bool
+HashCache::getFileStat(const fs::path& path, FileStat& stat)
+{
+  int64_t now = time::duration_cast<time::nanoseconds>(time::system_clock::now().time_since_epoch()).count();
+
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+
+  stat.device = st.st_dev;
+  stat.inode = st.st_ino;
+  stat.size = st.st_size;
+#ifdef __APPLE__
+  stat.mtime = toNanoseconds(st.st_mtimespec);
+  stat.ctime = toNanoseconds(st.st_ctimespec);
+#else
+  stat.mtime = toNanoseconds(st.st_mtim);
+  stat.ctime = toNanoseconds(st.st_ctim);
+#endif
+  stat.statTime = now;
+  return true;
+}
+
+ConstBufferPtr
+HashCache::getDigest(const fs::path& path, const std::string& filename)
+{
+  FileStat stat;
+  if (!getFileStat(path, stat)) {
+    BOOST_THROW_EXCEPTION(Error("Cannot access " + path.string()));
+  }
+
+  ConstBufferPtr digest = lookup(filename, stat);
+  if (digest != nullptr) {
+    return digest;
+  }
+
+  fs::ifstream input(path, std::ios::in | std::ios::binary);
+  digest = util::Sha256(input).computeDigest();
+
+  update(path, filename, stat, *digest);
+  return digest;
+}
+
+ConstBufferPtr
+HashCache::lookup(const std::string& filename, const FileStat& stat)
+{
+  Statement stmt(*this, "SELECT device, inode, size, mtime, ctime, file_hash FROM HashCache "
+                          "    WHERE filename=?");
+  stmt.bind(1, filename, SQLITE_STATIC);
+  if (stmt.step() != SQLITE_ROW) {
+    return nullptr;
+  }
+
+  FileStat cached{static_cast<uint64_t>(sqlite3_column_int64(stmt, 0)),
+                  static_cast<uint64_t>(sqlite3_column_int64(stmt, 1)),
+                  static_cast<uint64_t>(sqlite3_column_int64(stmt, 2)),
+                  sqlite3_column_int64(stmt, 3), sqlite3_column_int64(stmt, 4), 0};
+  if (cached != stat) {
+    _LOG_TRACE("Status of " << filename << " has changed");
+    return nullptr;
+  }
+
+  return make_shared<Buffer>(stmt.getBlob(5), stmt.getSize(5));
+}
+
+void
+HashCache::update(const fs::path& path, const std::string& filename, const FileStat& stat,
+                  const Buffer& digest)
+{
+  FileStat current;
+  if (!getFileStat(path, current) || current != stat || stat.mtime >= stat.statTime - RACY_INTERVAL) {
+    // the content might not match the digest, or might still change without changing the status
+    remove(filename);
+    return;
+  }
+
+  Statement stmt(*this, "INSERT OR REPLACE INTO HashCache "
+                          "    (filename, device, inode, size, mtime, ctime, file_hash) "
+                          "    VALUES (?, ?, ?, ?, ?, ?, ?)");
+  stmt.bind(1, filename, SQLITE_STATIC);
+  stmt.bind(2, static_cast<sqlite3_int64>(stat.device));
+  stmt.bind(3, static_cast<sqlite3_int64>(stat.inode));
+  stmt.bind(4, static_cast<sqlite3_int64>(stat.size));
+  stmt.bind(5, static_cast<sqlite3_int64>(stat.mtime));
+  stmt.bind(6, static_cast<sqlite3_int64>(stat.ctime));
+  stmt.bind(7, digest.data(), digest.size(), SQLITE_STATIC);
+  if (stmt.step() != SQLITE_DONE) {
+    _LOG_ERROR("Cannot record digest of " << filename << ": " << sqlite3_errmsg(m_db));
+  }
+}
+
+void
+HashCache::remove(const std::string& filename)
+{
+  Statement stmt(*this, "DELETE FROM HashCache WHERE filename=?");
+  stmt.bind(1, filename, SQLITE_STATIC);
+  stmt.step();
+}
+
+} // namespace chronoshare
+} // namespace ndn
@@ -0,0 +1,132 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#ifndef CHRONOSHARE_SRC_HASH_CACHE_HPP
+#define CHRONOSHARE_SRC_HASH_CACHE_HPP
+
+#include "db-helper.hpp"
+#include "core/chronoshare-common.hpp"
+
+#include <ndn-cxx/encoding/buffer.hpp>
+
+#include <boost/filesystem.hpp>
+
+namespace ndn {
+namespace chronoshare {
+
+/**
+ * @brief Persistent cache of SHA-256 digests of local files
+ *
+ * A digest is keyed by the file name and the file status at the time the file was hashed:
+ * device, inode, size, and modification and status change times in nanoseconds.  Any write to
+ * the file, replacing it, or changing its times changes the status, so a digest is only
+ * returned while the file is unchanged and unchanged files are not read again.
+ *
+ * On file systems with coarse timestamps, a file modified while it is being hashed can keep its
+ * modification time.  Digests of files modified shortly before they were hashed are therefore
+ * not recorded, such files are hashed again until they have not been modified for a while.
+ */
+class HashCache : public DbHelper
+{
+public:
+  class Error : public DbHelper::Error
+  {
+  public:
+    explicit Error(const std::string& what)
+      : DbHelper::Error(what)
+    {
+    }
+  };
+
+  struct FileStat
+  {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime; ///< modification time, nanoseconds since the epoch
+    int64_t ctime; ///< status change time, nanoseconds since the epoch
+    int64_t statTime; ///< when the status was read, nanoseconds since the epoch (not compared)
+
+    bool
+    operator==(const FileStat& other) const
+    {
+      return device == other.device && inode == other.inode && size == other.size &&
+             mtime == other.mtime && ctime == other.ctime;
+    }
+
+    bool
+    operator!=(const FileStat& other) const
+    {
+      return !(*this == other);
+    }
+  };
+
+public:
+  // the cache is kept in <path>/.chronoshare/hash-cache.db
+  explicit
+  HashCache(const boost::filesystem::path& path);
+
+  /**
+   * @brief Get status of the file at @p path
+   * @return false if the file does not exist or cannot be accessed
+   */
+  static bool
+  getFileStat(const boost::filesystem::path& path, FileStat& stat);
+
+  /**
+   * @brief Get SHA-256 digest of the file at @p path, hashing the file only if it has changed
+   *        since it was last hashed
+   * @param filename name of the file relative to the shared folder
+   * @throw Error the file cannot be accessed
+   */
+  ConstBufferPtr
+  getDigest(const boost::filesystem::path& path, const std::string& filename);
+
+  /**
+   * @brief Look up digest of @p filename recorded with status @p stat
+   * @return nullptr if there is no trusted digest for this status
+   */
+  ConstBufferPtr
+  lookup(const std::string& filename, const FileStat& stat);
+
+  /**
+   * @brief Record @p digest of the file at @p path, computed from the content it had with
+   *        status @p stat
+   *
+   * Nothing is recorded if the file has been changed since, as its current content might not
+   * match the digest
+   */
+  void
+  update(const boost::filesystem::path& path, const std::string& filename, const FileStat& stat,
+         const Buffer& digest);
+
+  /**
+   * @brief Forget digest of @p filename
+   */
+  void
+  remove(const std::string& filename);
+};
+
+typedef shared_ptr<HashCache> HashCachePtr;
+
+} // namespace chronoshare
+} // namespace ndn
+
+#endif // CHRONOSHARE_SRC_HASH_CACHE_HPP
@@ -0,0 +1,152 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#include "iblt.hpp"
+
+#include <boost/throw_exception.hpp>
+
+#include <algorithm>
+
+namespace ndn {
+namespace chronoshare {
+
+const size_t Iblt::N_HASHES = 3;
+
+// finalizer of MurmurHash3, mixes all bits of the key into all bits of the result
+static uint64_t
+mix(uint64_t key)
+{
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ULL;
+  key ^= key >> 33;
+  return key;
+}
+
+static uint32_t
+checksum(uint64_t key)
+{
+  return static_cast<uint32_t>(mix(key ^ 0x9e3779b97f4a7c15ULL));
+}
+
+Iblt::Iblt(size_t nCells)
+  : m_cells(std::max((nCells + N_HASHES - 1) / N_HASHES, static_cast<size_t>(1)) * N_HASHES,
+            Cell{0, 0, 0})
+{
+}
+
+Iblt::Iblt(std::vector<Cell> cells)
+  : m_cells(std::move(cells))
+{
+  if (m_cells.empty() || m_cells.size() % N_HASHES != 0) {
+    BOOST_THROW_EXCEPTION(Error("Invalid number of IBLT cells: " + std::to_string(m_cells.size())));
+  }
+}
+
+void
+Iblt::insert(uint64_t key)
+{
+  update(key, 1);
+}
+
+void
+Iblt::erase(uint64_t key)
+{
+  update(key, -1);
+}
+
+void
+Iblt::update(uint64_t key, int32_t count)
+{
+  size_t partSize = m_cells.size() / N_HASHES;
+  uint32_t hash = checksum(key);
+  for (size_t i = 0; i < N_HASHES; ++i) {
+    Cell& cell = m_cells[i * partSize + mix(key + i) % partSize];
+    cell.count += count;
+    cell.keySum ^= key;
+    cell.hashSum ^= hash;
+  }
+}
+
+Iblt&
+Iblt::operator-=(const Iblt& other)
+{
+  if (m_cells.size() != other.m_cells.size()) {
+    BOOST_THROW_EXCEPTION(Error("Cannot subtract IBLTs of different sizes"));
+  }
+
+  for (size_t i = 0; i < m_cells.size(); ++i) {
+    m_cells[i].count -= other.m_cells[i].count;
+    m_cells[i].keySum ^= other.m_cells[i].keySum;
+    m_cells[i].hashSum ^= other.m_cells[i].hashSum;
+  }
+  return *this;
+}
+
+bool
+Iblt::listEntries(std::vector<uint64_t>& positive, std::vector<uint64_t>& negative) const
+{
+  Iblt table(*this);
+
+  auto isPure = [] (const Cell& cell) {
+    return (cell.count == 1 || cell.count == -1) && cell.hashSum == checksum(cell.keySum);
+  };
+
+  // peel off the keys of pure cells, which can make other cells pure, until no cell is left
+  //
+  // Every key peeled from a consistent table empties at least one cell for good, so there are at
+  // most as many keys as cells.  A crafted table can hold a key in only some of its cells, whose
+  // peeling makes other cells pure with the opposite sign, which would peel the key back forever.
+  size_t nPeeled = 0;
+  bool isPeeled = true;
+  while (isPeeled) {
+    isPeeled = false;
+    for (const Cell& cell : table.m_cells) {
+      if (!isPure(cell)) {
+        continue;
+      }
+      if (++nPeeled > table.m_cells.size()) {
+        return false;
+      }
+
+      uint64_t key = cell.keySum;
+      if (cell.count == 1) {
+        positive.push_back(key);
+        table.update(key, -1);
+      }
+      else {
+        negative.push_back(key);
+        table.update(key, 1);
+      }
+      isPeeled = true;
+    }
+  }
+
+  for (const Cell& cell : table.m_cells) {
+    if (cell.count != 0 || cell.keySum != 0 || cell.hashSum != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace chronoshare
+} // namespace ndn
@@ -0,0 +1,116 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#ifndef CHRONOSHARE_SRC_IBLT_HPP
+#define CHRONOSHARE_SRC_IBLT_HPP
+
+#include "core/chronoshare-common.hpp"
+
+#include <vector>
+
+namespace ndn {
+namespace chronoshare {
+
+/**
+ * @brief Invertible Bloom lookup table of 64-bit keys
+ *
+ * Every key is added to one cell in each of N_HASHES equal parts of the table.  The table of one
+ * set minus the table of another set holds only the keys in one of the sets and not in the other,
+ * which can be listed as long as there are not many more of them than about 2/3 of the cells.
+ * The size of the table therefore depends on the expected size of the difference, not of the
+ * sets.
+ */
+class Iblt
+{
+public:
+  class Error : public std::runtime_error
+  {
+  public:
+    explicit Error(const std::string& what)
+      : std::runtime_error(what)
+    {
+    }
+  };
+
+  static const size_t N_HASHES;
+
+  struct Cell
+  {
+    int32_t count;
+    uint64_t keySum;
+    uint32_t hashSum;
+  };
+
+  /**
+   * @brief Create an empty table with at least @p nCells cells
+   */
+  explicit
+  Iblt(size_t nCells);
+
+  /**
+   * @brief Create a table from the cells of another one, e.g., received from a peer
+   */
+  explicit
+  Iblt(std::vector<Cell> cells);
+
+  void
+  insert(uint64_t key);
+
+  void
+  erase(uint64_t key);
+
+  /**
+   * @brief Subtract the table of another set with the same number of cells
+   *
+   * @throw Error the tables have different numbers of cells
+   */
+  Iblt&
+  operator-=(const Iblt& other);
+
+  /**
+   * @brief List the keys of the set difference held by the table
+   *
+   * @param[out] positive keys inserted and not erased, e.g., only in the first set after a
+   *                      subtraction
+   * @param[out] negative keys erased and not inserted, e.g., only in the second set
+   * @return false if the keys cannot all be listed, as there are too many for the table size or
+   *         the table is inconsistent
+   */
+  bool
+  listEntries(std::vector<uint64_t>& positive, std::vector<uint64_t>& negative) const;
+
+  const std::vector<Cell>&
+  getCells() const
+  {
+    return m_cells;
+  }
+
+private:
+  void
+  update(uint64_t key, int32_t count);
+
+private:
+  std::vector<Cell> m_cells;
+};
+
+} // namespace chronoshare
+} // namespace ndn
+
+#endif // CHRONOSHARE_SRC_IBLT_HPP
@@ -19,13 +19,9 @@
  */
 
 #include "object-db.hpp"
-#include "db-helper.hpp"
 #include "core/logging.hpp"
 
-#include <iostream>
-#include <sys/stat.h>
-
-#include <ndn-cxx/util/sqlite3-statement.hpp>
+#include <ndn-cxx/util/string-helper.hpp>
 
 namespace ndn {
 namespace chronoshare {
@@ -33,54 +29,18 @@ namespace chronoshare {
 _LOG_INIT(ObjectDb);
 
 namespace fs = boost::filesystem;
-using ndn::util::Sqlite3Statement;
-
-const std::string INIT_DATABASE = R"SQL(
-CREATE TABLE
-   File(
-        device_name     BLOB NOT NULL,
-        segment         INTEGER,
-        content_object  BLOB,
-
-        PRIMARY KEY (device_name, segment)
-    );
-CREATE INDEX device ON File(device_name);
-)SQL";
 
 ObjectDb::ObjectDb(const fs::path& folder, const std::string& hash)
-  : m_lastUsed(time::steady_clock::now())
+  : m_store(PackStore::open(folder))
+  , m_hash(fromHex(hash))
+  , m_lastUsed(time::steady_clock::now())
 {
-  fs::path actualFolder = folder / "objects" / hash.substr(0, 2);
-  fs::create_directories(actualFolder);
-
-  _LOG_DEBUG("Open " << (actualFolder / hash.substr(2, hash.size() - 2)));
-
-  int res = sqlite3_open((actualFolder / hash.substr(2, hash.size() - 2)).c_str(), &m_db);
-  if (res != SQLITE_OK) {
-    BOOST_THROW_EXCEPTION(Error("Cannot open/create database: [" +
-                                (actualFolder / hash.substr(2, hash.size() - 2)).string() + "]"));
-  }
-
-  // Alex: determine if tables initialized. if not, initialize... not sure what is the best way to go...
-  // for now, just attempt to create everything
-
-  char* errmsg = 0;
-  res = sqlite3_exec(m_db, INIT_DATABASE.c_str(), nullptr, nullptr, &errmsg);
-  if (res != SQLITE_OK && errmsg != 0) {
-    sqlite3_free(errmsg);
-  }
-
-  willStartSave();
+  _LOG_DEBUG("Open " << hash << " in " << folder);
 }
 
 ObjectDb::~ObjectDb()
 {
-  didStopSave();
-
-  int res = sqlite3_close(m_db);
-  if (res != SQLITE_OK) {
-    // complain
-  }
+  m_store->flush();
 }
 
 bool
@@ -89,37 +49,20 @@ ObjectDb::doesExist(const boost::filesystem::path& folder, const Name& deviceNam
 {
   BOOST_ASSERT(hash.size() > 2);
 
-  fs::path actualFolder = folder / "objects" / hash.substr(0, 2);
-  bool retval = false;
-
-  sqlite3* db;
-  int res = sqlite3_open((actualFolder / hash.substr(2, hash.size() - 2)).c_str(), &db);
-  if (res == SQLITE_OK) {
-    sqlite3_stmt* stmt;
-    sqlite3_prepare_v2(db,
-                       "SELECT count(*), count(nullif(content_object,0)) FROM File WHERE device_name=?",
-                       -1, &stmt, 0);
-
-    sqlite3_bind_blob(stmt, 1, deviceName.wireEncode().wire(), deviceName.wireEncode().size(),
-                      SQLITE_TRANSIENT);
-
-    int res = sqlite3_step(stmt);
-    if (res == SQLITE_ROW) {
-      int countAll = sqlite3_column_int(stmt, 0);
-      int countNonNull = sqlite3_column_int(stmt, 1);
-
-      _LOG_TRACE("Total segments: " << countAll << ", non-empty segments: " << countNonNull);
-
-      if (countAll > 0 && countAll == countNonNull) {
-        retval = true;
-      }
-    }
+  PackStore::FileStatus status = PackStore::open(folder)->getFileStatus(*fromHex(hash), deviceName);
+  _LOG_TRACE("Total segments: " << status.nSegments);
+  return status.nSegments > 0;
+}
 
-    sqlite3_finalize(stmt);
-  }
+bool
+ObjectDb::isComplete(const boost::filesystem::path& folder, const Name& deviceName,
+                     const std::string& hash)
+{
+  BOOST_ASSERT(hash.size() > 2);
 
-  sqlite3_close(db);
-  return retval;
+  PackStore::FileStatus status = PackStore::open(folder)->getFileStatus(*fromHex(hash), deviceName);
+  _LOG_TRACE("Segments: " << status.nSegments << " of " << status.nTotalSegments);
+  return status.isComplete();
 }
 
 void
@@ -128,17 +71,10 @@ ObjectDb::saveContentObject(const Name& deviceName, sqlite3_int64 segment, const
   // update last used time
   m_lastUsed = time::steady_clock::now();
 
-  Sqlite3Statement stmt(m_db, "INSERT INTO File "
-                                "(device_name, segment, content_object) "
-                                "VALUES (?, ?, ?)");
-
   _LOG_DEBUG("Saving content object for [" << deviceName << ", seqno: " << segment << ", size: "
                                            << data.wireEncode().size()
                                            << "]");
-  stmt.bind(1, deviceName.wireEncode(), SQLITE_STATIC);
-  stmt.bind(2, segment);
-  stmt.bind(3, data.wireEncode(), SQLITE_STATIC);
-  stmt.step();
+  m_store->saveSegment(*m_hash, deviceName, PackStore::FILE_SEGMENT, segment, data, false);
 }
 
 shared_ptr<Data>
@@ -147,34 +83,75 @@ ObjectDb::fetchSegment(const Name& deviceName, sqlite3_int64 segment)
   // update last used time
   m_lastUsed = time::steady_clock::now();
 
-  Sqlite3Statement stmt(m_db, "SELECT content_object FROM File WHERE device_name=? AND segment=?");
-  stmt.bind(1, deviceName.wireEncode(), SQLITE_STATIC);
-  stmt.bind(2, segment);
+  return m_store->fetchSegment(*m_hash, deviceName, PackStore::FILE_SEGMENT, segment);
+}
 
-  if (stmt.step() == SQLITE_ROW) {
-    return make_shared<Data>(stmt.getBlock(0));
-  }
-  else {
-    return nullptr;
-  }
+void
+ObjectDb::saveContentObjects(const Name& deviceName, const PackStore::SegmentBatch& segments)
+{
+  m_lastUsed = time::steady_clock::now();
+
+  _LOG_DEBUG("Saving " << segments.size() << " content objects for [" << deviceName << "]");
+  m_store->saveSegments(*m_hash, deviceName, PackStore::FILE_SEGMENT, segments, false);
 }
 
-const time::steady_clock::TimePoint&
-ObjectDb::getLastUsed() const
+PackStore::SegmentBatch
+ObjectDb::fetchSegments(const Name& deviceName, uint64_t begin, uint64_t end)
 {
-  return m_lastUsed;
+  m_lastUsed = time::steady_clock::now();
+
+  return m_store->fetchSegmentRange(*m_hash, deviceName, PackStore::FILE_SEGMENT, begin, end);
 }
 
 void
-ObjectDb::willStartSave()
+ObjectDb::saveManifestSegment(const Name& deviceName, sqlite3_int64 segment, const Data& data)
+{
+  m_lastUsed = time::steady_clock::now();
+
+  m_store->saveSegment(*m_hash, deviceName, PackStore::MANIFEST_SEGMENT, segment, data, true);
+}
+
+shared_ptr<Data>
+ObjectDb::fetchManifestSegment(const Name& deviceName, sqlite3_int64 segment)
 {
-  sqlite3_exec(m_db, "BEGIN TRANSACTION;", 0, 0, 0);
+  m_lastUsed = time::steady_clock::now();
+
+  return m_store->fetchSegment(*m_hash, deviceName, PackStore::MANIFEST_SEGMENT, segment);
+}
+
+FileManifestPtr
+ObjectDb::fetchManifest(const Name& deviceName)
+{
+  m_lastUsed = time::steady_clock::now();
+
+  FileManifestPtr manifest;
+  for (const auto& data : m_store->fetchSegments(*m_hash, deviceName, PackStore::MANIFEST_SEGMENT)) {
+    if (manifest == nullptr) {
+      manifest = make_shared<FileManifest>();
+    }
+    manifest->addManifestSegment(data->getContent().value(), data->getContent().value_size());
+  }
+  return manifest;
 }
 
 void
-ObjectDb::didStopSave()
+ObjectDb::removeManifest(const Name& deviceName)
 {
-  sqlite3_exec(m_db, "END TRANSACTION;", 0, 0, 0);
+  m_lastUsed = time::steady_clock::now();
+
+  m_store->removeManifest(*m_hash, deviceName);
+}
+
+void
+ObjectDb::setSegmentCount(const Name& deviceName, uint64_t nSegments)
+{
+  m_store->setFileSegmentCount(*m_hash, deviceName, nSegments);
+}
+
+const time::steady_clock::TimePoint&
+ObjectDb::getLastUsed() const
+{
+  return m_lastUsed;
 }
 
 } // namespace chronoshare
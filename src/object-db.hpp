@@ -21,14 +21,12 @@
 #ifndef CHRONOSHARE_SRC_OBJECT_DB_HPP
 #define CHRONOSHARE_SRC_OBJECT_DB_HPP
 
-#include "db-helper.hpp"
+#include "file-manifest.hpp"
+#include "pack-store.hpp"
 #include "core/chronoshare-common.hpp"
 
 #include <sqlite3.h>
 
-#include <ctime>
-#include <vector>
-
 #include <ndn-cxx/face.hpp>
 #include <ndn-cxx/name.hpp>
 
@@ -37,6 +35,11 @@
 namespace ndn {
 namespace chronoshare {
 
+/**
+ * @brief Segments of a single version (hash) of a file
+ *
+ * Segments of all files are kept in the shared PackStore of the folder
+ */
 class ObjectDb
 {
 public:
@@ -50,7 +53,7 @@ public:
   };
 
 public:
-  // database will be create in <folder>/<first-pair-of-hash-bytes>/<rest-of-hash>
+  // segments are stored in pack files in <folder>/objects
   ObjectDb(const boost::filesystem::path& folder, const std::string& hash);
 
   ~ObjectDb();
@@ -61,21 +64,66 @@ public:
   shared_ptr<Data>
   fetchSegment(const Name& deviceName, sqlite3_int64 segment);
 
+  /**
+   * @brief Save several segments at once
+   */
+  void
+  saveContentObjects(const Name& deviceName, const PackStore::SegmentBatch& segments);
+
+  /**
+   * @brief Get stored segments from @p begin up to (not including) @p end with a single range
+   *        scan, instead of a query per segment
+   *
+   * Segments that are not stored are skipped, so segment numbers need to be checked
+   */
+  PackStore::SegmentBatch
+  fetchSegments(const Name& deviceName, uint64_t begin, uint64_t end);
+
+  void
+  saveManifestSegment(const Name& deviceName, sqlite3_int64 segment, const Data& data);
+
+  shared_ptr<Data>
+  fetchManifestSegment(const Name& deviceName, sqlite3_int64 segment);
+
+  /**
+   * @brief Assemble manifest from all stored manifest segments
+   * @return nullptr if no manifest segments are stored for @p deviceName
+   */
+  FileManifestPtr
+  fetchManifest(const Name& deviceName);
+
+  /**
+   * @brief Remove all stored manifest segments, e.g., if they do not match the signed action
+   */
+  void
+  removeManifest(const Name& deviceName);
+
+  /**
+   * @brief Record number of segments of the whole file published by @p deviceName
+   */
+  void
+  setSegmentCount(const Name& deviceName, uint64_t nSegments);
+
   const time::steady_clock::TimePoint&
   getLastUsed() const;
 
+  /**
+   * @brief Check if any file segments of @p hash from @p deviceName are stored
+   *
+   * Looked up in the completeness index of the store, no database query is made
+   */
   static bool
   doesExist(const boost::filesystem::path& folder, const Name& deviceName, const std::string& hash);
 
-private:
-  void
-  willStartSave();
-
-  void
-  didStopSave();
+  /**
+   * @brief Check if all file segments of @p hash from @p deviceName are stored
+   */
+  static bool
+  isComplete(const boost::filesystem::path& folder, const Name& deviceName, const std::string& hash);
 
 private:
-  sqlite3* m_db;
+  PackStorePtr m_store;
+  shared_ptr<Buffer> m_hash;
   time::steady_clock::TimePoint m_lastUsed;
 };
 
@@ -19,14 +19,30 @@
  */
 
 #include "object-manager.hpp"
+#include "content-chunker.hpp"
 #include "object-db.hpp"
+#include "pack-store.hpp"
 #include "core/logging.hpp"
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
 
 #include <boost/filesystem/fstream.hpp>
 #include <boost/lexical_cast.hpp>
 
+#include <ndn-cxx/encoding/tlv.hpp>
 #include <ndn-cxx/util/string-helper.hpp>
 
 namespace ndn {
@@ -37,89 +53,718 @@ _LOG_INIT(Object.Manager);
 namespace fs = boost::filesystem;
 using util::Sha256;
 
-const int MAX_FILE_SEGMENT_SIZE = 1024;
+const size_t MIN_FILE_SEGMENT_SIZE = 256;
+const size_t MAX_BUFFERED_FILE_SIZE = 64 * 1024 * 1024;
+const size_t READ_BLOCK_SIZE = 64 * 1024;
+const size_t WRITE_BATCH = 64;
+const size_t SAVE_BATCH = 256;
+const uint64_t MIN_DERIVED_SEGMENTS = 16;
 
 ObjectManager::ObjectManager(Face& face, KeyChain& keyChain,
-                             const fs::path& folder, const std::string& appName)
+                             const fs::path& folder, const std::string& appName,
+                             size_t segmentSize)
   : m_face(face)
   , m_keyChain(keyChain)
   , m_folder(folder / ".chronoshare")
   , m_appName(appName)
+  , m_segmentSize(std::max(segmentSize, MIN_FILE_SEGMENT_SIZE))
+  , m_nThreads(1)
+  , m_isContentDefinedChunking(false)
+  , m_segmentOverhead(0)
 {
   fs::create_directories(m_folder);
+  m_packStore = PackStore::open(m_folder);
 }
 
 ObjectManager::~ObjectManager()
 {
 }
 
+size_t
+ObjectManager::getEffectiveSegmentSize(const Name& deviceName)
+{
+  if (m_overheadDeviceName.empty() || m_overheadDeviceName != deviceName) {
+    // Create an empty segment with the largest possible name to learn how much space the name,
+    // the signature, and the TLV headers take
+    shared_ptr<Data> probe = makeSegment(deviceName, "file", Buffer(util::Sha256::DIGEST_SIZE),
+                                         std::numeric_limits<uint64_t>::max(), nullptr, 0);
+
+    // content TLV header grows by at most 4 bytes, outer Data header by at most 2 bytes
+    m_segmentOverhead = probe->wireEncode().size() + 6;
+    m_overheadDeviceName = deviceName;
+  }
+
+  if (m_segmentOverhead + MIN_FILE_SEGMENT_SIZE >= MAX_NDN_PACKET_SIZE) {
+    return MIN_FILE_SEGMENT_SIZE;
+  }
+  return std::min(m_segmentSize, MAX_NDN_PACKET_SIZE - m_segmentOverhead);
+}
+
+namespace {
+
+struct FileSegment
+{
+  shared_ptr<Data> data;
+};
+
+// number of segments each worker may be ahead of the commit point
+const size_t SEGMENTS_PER_THREAD = 64;
+
+/**
+ * @brief Create segments [0, nSegments) on @p nThreads worker threads and commit them in
+ *        segment order on the calling thread
+ *
+ * At most nThreads * SEGMENTS_PER_THREAD created, but not yet committed segments are kept in
+ * memory.  Exception thrown by either @p make or @p commit stops the workers and is rethrown.
+ */
+void
+processSegmentsInParallel(uint64_t nSegments, size_t nThreads,
+                          const std::function<FileSegment(uint64_t segment)>& make,
+                          const std::function<void(uint64_t segment, const FileSegment&)>& commit)
+{
+  const uint64_t window = nThreads * SEGMENTS_PER_THREAD;
+  std::vector<FileSegment> slots(window);
+  std::vector<bool> isReady(window, false);
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  uint64_t nextSegment = 0;
+  uint64_t nCommitted = 0;
+  bool isStopped = false;
+  std::exception_ptr error;
+
+  auto worker = [&] {
+    while (true) {
+      uint64_t segment;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] {
+            return isStopped || nextSegment >= nSegments || nextSegment < nCommitted + window;
+          });
+        if (isStopped || nextSegment >= nSegments) {
+          return;
+        }
+        segment = nextSegment++;
+      }
+
+      FileSegment result;
+      try {
+        result = make(segment);
+      }
+      catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+        isStopped = true;
+        cv.notify_all();
+        return;
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      slots[segment % window] = std::move(result);
+      isReady[segment % window] = true;
+      cv.notify_all();
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < nThreads; ++i) {
+    workers.emplace_back(worker);
+  }
+
+  try {
+    for (uint64_t segment = 0; segment < nSegments; ++segment) {
+      FileSegment result;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return isReady[segment % window] || isStopped; });
+        if (!isReady[segment % window]) {
+          break; // a worker has failed
+        }
+        result = std::move(slots[segment % window]);
+        isReady[segment % window] = false;
+        nCommitted = segment + 1;
+      }
+      cv.notify_all();
+
+      commit(segment, result);
+    }
+  }
+  catch (...) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!error) {
+      error = std::current_exception();
+    }
+    isStopped = true;
+    cv.notify_all();
+  }
+
+  for (auto& thread : workers) {
+    thread.join();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+// writes all @p slices at @p offset, continuing after partial writes
+bool
+writeSlices(int fd, std::vector<struct iovec>& slices, uint64_t offset)
+{
+  size_t first = 0;
+  while (first < slices.size()) {
+    ssize_t n = ::pwritev(fd, slices.data() + first, slices.size() - first, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return false;
+    }
+    offset += n;
+
+    size_t nWritten = n;
+    while (first < slices.size() && nWritten >= slices[first].iov_len) {
+      nWritten -= slices[first].iov_len;
+      ++first;
+    }
+    if (first < slices.size()) {
+      if (n == 0) {
+        return false;
+      }
+      slices[first].iov_base = static_cast<uint8_t*>(slices[first].iov_base) + nWritten;
+      slices[first].iov_len -= nWritten;
+    }
+  }
+  return true;
+}
+
+bool
+copyFileContent(int sourceFd, int fd, uint64_t size)
+{
+  uint64_t nCopied = 0;
+
+#ifdef __linux__
+#ifdef FICLONE
+  // copy-on-write clone, the copy takes no space until either file is modified
+  if (::ioctl(fd, FICLONE, sourceFd) == 0) {
+    return true;
+  }
+#endif // FICLONE
+
+#ifdef SYS_copy_file_range
+  // in-kernel copy, which some file systems also turn into a clone
+  while (nCopied < size) {
+    ssize_t n = ::syscall(SYS_copy_file_range, sourceFd, nullptr, fd, nullptr, size - nCopied, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    nCopied += n;
+  }
+  if (nCopied == size) {
+    return true;
+  }
+  // file offsets have been advanced by what has been copied, the rest is copied below
+#endif // SYS_copy_file_range
+#endif // __linux__
+
+  Buffer block(READ_BLOCK_SIZE);
+  while (true) {
+    ssize_t nRead = ::read(sourceFd, block.data(), block.size());
+    if (nRead < 0 && errno == EINTR) {
+      continue;
+    }
+    if (nRead < 0) {
+      return false;
+    }
+    if (nRead == 0) {
+      return nCopied == size;
+    }
+
+    std::vector<struct iovec> slices(1);
+    slices[0].iov_base = block.data();
+    slices[0].iov_len = nRead;
+    if (!writeSlices(fd, slices, nCopied)) {
+      return false;
+    }
+    nCopied += nRead;
+  }
+}
+
+/**
+ * @brief File written next to its destination, which replaces the destination only once it is
+ *        complete
+ *
+ * The descriptor is closed and the file is removed on destruction, unless it has been committed
+ */
+class TemporaryFile : private boost::noncopyable
+{
+public:
+  explicit
+  TemporaryFile(const fs::path& file)
+    : m_file(file)
+    , m_path(file.parent_path() / ("." + file.filename().string() + ".chronoshare-tmp"))
+    , m_fd(::open(m_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644))
+  {
+  }
+
+  ~TemporaryFile()
+  {
+    if (m_fd >= 0) {
+      ::close(m_fd);
+      boost::system::error_code ec;
+      fs::remove(m_path, ec);
+    }
+  }
+
+  int
+  getFd() const
+  {
+    return m_fd;
+  }
+
+  const fs::path&
+  getPath() const
+  {
+    return m_path;
+  }
+
+  /**
+   * @brief Sync the content and replace the destination
+   *
+   * The directory is synced as well, so that the replacement survives a crash
+   *
+   * @return false if the destination cannot be replaced
+   */
+  bool
+  commit()
+  {
+    if (::fsync(m_fd) != 0) {
+      return false;
+    }
+    ::close(m_fd);
+    m_fd = -1;
+
+    boost::system::error_code ec;
+    fs::rename(m_path, m_file, ec);
+    if (ec) {
+      fs::remove(m_path, ec);
+      return false;
+    }
+
+    int dirFd = ::open(m_file.parent_path().c_str(), O_RDONLY | O_DIRECTORY);
+    if (dirFd < 0) {
+      return false;
+    }
+    bool isSynced = ::fsync(dirFd) == 0;
+    ::close(dirFd);
+    return isSynced;
+  }
+
+private:
+  fs::path m_file;
+  fs::path m_path;
+  int m_fd;
+};
+
+} // namespace
+
+void
+ObjectManager::setCompression(bool isEnabled)
+{
+  m_packStore->setCompression(isEnabled);
+}
+
 // /<devicename>/<appname>/file/<hash>/<segment>
-std::tuple<ConstBufferPtr /*object-db name*/, size_t /* number of segments*/>
-ObjectManager::localFileToObjects(const fs::path& file, const Name& deviceName)
+std::tuple<ConstBufferPtr /*object-db name*/, size_t /* number of segments*/, size_t /*segment size*/,
+           ConstBufferPtr /*manifest root*/>
+ObjectManager::localFileToObjects(const fs::path& file, const Name& deviceName,
+                                  ConstBufferPtr previousHash, const Name& previousDevice)
 {
-  fs::ifstream input1(file, std::ios::in | std::ios::binary);
-  Sha256 fileHash(input1);
-  ObjectDb fileDb(m_folder, fileHash.toString());
+  const size_t segmentSize = getEffectiveSegmentSize(deviceName);
 
+  // Segment names, and so their DigestSha256 signatures, embed the hash of the whole file, so
+  // Data packets can only be created once the file has been fully digested.  Everything else is
+  // done in the single hashing pass: segment boundaries and payload digests (the manifest) are
+  // computed for the whole file, and the beginning of the file is kept in memory (up to
+  // MAX_BUFFERED_FILE_SIZE).  Only payloads of the segments of a larger file that did not fit
+  // into the buffer are read again, to be put into their Data packets.
   fs::ifstream iff(file, std::ios::in | std::ios::binary);
-  sqlite3_int64 segment = 0;
-  while (iff.good() && !iff.eof()) {
-    char buf[MAX_FILE_SEGMENT_SIZE];
-    iff.read(buf, MAX_FILE_SEGMENT_SIZE);
-    if (iff.gcount() == 0) {
-      // stupid streams...
+  Sha256 fileHash;
+  Sha256 segmentHash;
+  FileManifest manifest;
+  Buffer buffered;
+  uint64_t fileSize = 0;
+
+  // end offsets of the segments
+  std::vector<uint64_t> boundaries;
+  unique_ptr<ContentDefinedChunker> chunker;
+  if (m_isContentDefinedChunking) {
+    chunker = make_unique<ContentDefinedChunker>(segmentSize);
+  }
+
+  // feeds bytes [offset, offset + size) of the file into the digests of their segments
+  auto digestSegments = [&] (const uint8_t* data, uint64_t offset, size_t size) {
+    uint64_t end = offset + size;
+    if (chunker == nullptr) {
+      while ((boundaries.size() + 1) * segmentSize <= end) {
+        boundaries.push_back((boundaries.size() + 1) * segmentSize);
+      }
+    }
+
+    uint64_t position = offset;
+    while (manifest.size() < boundaries.size() && boundaries[manifest.size()] <= end) {
+      uint64_t boundary = boundaries[manifest.size()];
+      segmentHash.update(data + (position - offset), boundary - position);
+      manifest.addSegmentDigest(*segmentHash.computeDigest());
+      segmentHash.reset();
+      position = boundary;
+    }
+    segmentHash.update(data + (position - offset), end - position);
+  };
+
+  boost::system::error_code ec;
+  buffered.reserve(std::min<uint64_t>(fs::file_size(file, ec), MAX_BUFFERED_FILE_SIZE));
+
+  Buffer block(std::max(segmentSize, READ_BLOCK_SIZE));
+  while (iff.good()) {
+    iff.read(reinterpret_cast<char*>(block.data()), block.size());
+    size_t nRead = iff.gcount();
+    if (nRead == 0) {
       break;
     }
+    fileHash.update(block.data(), nRead);
+    if (chunker != nullptr) {
+      chunker->update(block.data(), nRead, boundaries);
+    }
+    digestSegments(block.data(), fileSize, nRead);
 
-    Name name = Name("/");
-    name.append(deviceName)
-      .append(m_appName)
-      .append("file")
-      .append(name::Component(fileHash.computeDigest()))
-      .appendSegment(segment);
+    // buffer must be a prefix of the file
+    if (buffered.size() == fileSize && buffered.size() + nRead <= MAX_BUFFERED_FILE_SIZE) {
+      buffered.insert(buffered.end(), block.data(), block.data() + nRead);
+    }
+    fileSize += nRead;
+  }
+  iff.close();
 
-    shared_ptr<Data> data = make_shared<Data>();
-    data->setName(name);
-    data->setFreshnessPeriod(time::seconds(60));
-    data->setContent(reinterpret_cast<const uint8_t*>(&buf), iff.gcount());
-    m_keyChain.sign(*data);
-    m_face.put(*data);
+  if (chunker != nullptr) {
+    chunker->finish(boundaries);
+  }
+  else if (boundaries.empty() || boundaries.back() < fileSize) {
+    boundaries.push_back(fileSize);
+  }
+  if (boundaries.empty()) {
+    // empty file still has one (empty) segment
+    boundaries.push_back(fileSize);
+  }
+  // the last segment
+  digestSegments(block.data(), fileSize, 0);
 
-    fileDb.saveContentObject(deviceName, segment, *data);
+  ConstBufferPtr digest = fileHash.computeDigest();
+  const uint64_t nSegments = boundaries.size();
 
-    segment++;
+  if (previousHash != nullptr && *previousHash == *digest) {
+    // content did not change, segments and manifest of the previous version are already there
+    _LOG_DEBUG("File " << file << " has the same content as its previous version");
+    return std::make_tuple(digest, nSegments, segmentSize, manifest.getRoot());
   }
-  if (segment == 0) // handle empty files
-  {
-    Name name = Name("/");
-    name.append(m_appName)
-      .append("file")
-      .append(name::Component(fileHash.computeDigest()))
-      .append(deviceName)
-      .appendSegment(0);
-
-    shared_ptr<Data> data = make_shared<Data>();
-    data->setName(name);
-    data->setFreshnessPeriod(time::seconds(0));
-    data->setContent(0, 0);
-    m_keyChain.sign(*data);
+
+  ObjectDb fileDb(m_folder, fileHash.toString());
+
+  int fd = -1;
+  if (buffered.size() < fileSize) {
+    _LOG_DEBUG("File " << file << " exceeds the buffer, reading remaining part from offset " << buffered.size());
+    fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+      BOOST_THROW_EXCEPTION(Error("Cannot open file " + file.string()));
+    }
+  }
+
+  // returns payload of the segment, which either points into the buffered part of the file
+  // or is read into @p payload
+  auto readFileSegment = [&] (uint64_t segment, Buffer& payload, size_t& size) -> const uint8_t* {
+    uint64_t begin = segment == 0 ? 0 : boundaries[segment - 1];
+    size = boundaries[segment] - begin;
+
+    const uint8_t* source = payload.data();
+    if (boundaries[segment] <= buffered.size()) {
+      source = buffered.data() + begin;
+    }
+    else {
+      // pread does not move the file offset, so workers can share the descriptor
+      payload.resize(size);
+      size_t nRead = 0;
+      while (nRead < payload.size()) {
+        ssize_t n = ::pread(fd, payload.data() + nRead, payload.size() - nRead, begin + nRead);
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        if (n < 0) {
+          BOOST_THROW_EXCEPTION(Error("Cannot read file " + file.string()));
+        }
+        if (n == 0) {
+          break;
+        }
+        nRead += n;
+      }
+      payload.resize(nRead);
+      source = payload.data();
+      size = nRead;
+    }
+    return source;
+  };
+
+  // runs on the worker threads when segments are created in parallel
+  auto makeFileSegment = [&] (uint64_t segment) {
+    Buffer payload;
+    size_t size = 0;
+    const uint8_t* source = readFileSegment(segment, payload, size);
+
+    // a segment that has been read again must still be what has been hashed into the file
+    // digest and the manifest
+    if (boundaries[segment] > buffered.size() &&
+        (size != boundaries[segment] - (segment == 0 ? 0 : boundaries[segment - 1]) ||
+         *Sha256::computeDigest(source, size) != manifest.getSegmentDigest(segment))) {
+      BOOST_THROW_EXCEPTION(Error("File " + file.string() + " changed while it was being read"));
+    }
+
+    FileSegment result;
+    result.data = makeSegment(deviceName, "file", *digest, segment, source, size);
+    return result;
+  };
+
+  // segments are saved SAVE_BATCH at a time
+  PackStore::SegmentBatch batch;
+  auto commitFileSegment = [&] (uint64_t segment, const FileSegment& result) {
+    m_face.put(*result.data);
+    batch.push_back(std::make_pair(segment, result.data));
+    if (batch.size() == SAVE_BATCH || segment + 1 == nSegments) {
+      fileDb.saveContentObjects(deviceName, batch);
+      batch.clear();
+    }
+  };
+
+  try {
+    // A file that has been appended to starts with the same segments as its previous version.
+    // These segments are derived from the previous version, and only the segments after them are
+    // created, stored, and put.
+    uint64_t nDerived = 0;
+    if (previousHash != nullptr) {
+      nDerived = derivePreviousSegments(deviceName, *digest, nSegments,
+                                        *previousHash, previousDevice,
+                                        [&manifest] (uint64_t segment) {
+                                          return make_shared<Buffer>(manifest.getSegmentDigest(segment));
+                                        });
+    }
+
+    size_t nThreads = static_cast<size_t>(std::min<uint64_t>(m_nThreads, nSegments - nDerived));
+    if (nThreads > 1) {
+      processSegmentsInParallel(nSegments - nDerived, nThreads,
+                                [&] (uint64_t i) { return makeFileSegment(nDerived + i); },
+                                [&] (uint64_t i, const FileSegment& result) {
+                                  commitFileSegment(nDerived + i, result);
+                                });
+    }
+    else {
+      for (uint64_t segment = nDerived; segment < nSegments; ++segment) {
+        commitFileSegment(segment, makeFileSegment(segment));
+      }
+    }
+  }
+  catch (...) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    throw;
+  }
+  if (fd >= 0) {
+    ::close(fd);
+  }
+  fileDb.setSegmentCount(deviceName, nSegments);
+
+  // the only thing that needs a real signature is the action carrying the manifest root
+  for (size_t i = 0; i < FileManifest::getManifestSegmentCount(manifest.size()); ++i) {
+    Buffer payload = manifest.getManifestSegment(i);
+    shared_ptr<Data> data = makeSegment(deviceName, "manifest", *digest, i, payload.data(), payload.size());
     m_face.put(*data);
 
-    fileDb.saveContentObject(deviceName, 0, *data);
+    fileDb.saveManifestSegment(deviceName, i, *data);
+  }
+
+  return std::make_tuple(digest, nSegments, segmentSize, manifest.getRoot());
+}
+
+shared_ptr<Data>
+ObjectManager::makeSegment(const Name& deviceName, const std::string& type, const Buffer& fileHash,
+                           uint64_t segment, const uint8_t* payload, size_t size) const
+{
+  Name name = Name("/");
+  name.append(deviceName)
+    .append(m_appName)
+    .append(type)
+    .append(name::Component(fileHash))
+    .appendSegment(segment);
+
+  shared_ptr<Data> data = make_shared<Data>();
+  data->setName(name);
+  data->setFreshnessPeriod(time::seconds(60));
+  data->setContent(payload, size);
+
+  // segments are authenticated through the manifest, a digest is enough.  This is what
+  // KeyChain::sign(data, signingWithSha256()) does, but KeyChain is not thread-safe.
+  data->setSignature(Signature(SignatureInfo(tlv::DigestSha256)));
+  EncodingBuffer encoder;
+  data->wireEncode(encoder, true);
+  ConstBufferPtr signature = Sha256::computeDigest(encoder.buf(), encoder.size());
+  data->wireEncode(encoder, Block(tlv::SignatureValue, signature));
+
+  return data;
+}
+
+std::vector<uint64_t>
+ObjectManager::reuseLocalSegments(const Name& deviceName, const Buffer& fileHash,
+                                  const FileManifest& manifest,
+                                  ConstBufferPtr previousHash, const Name& previousDevice)
+{
+  ObjectDb fileDb(m_folder, toHex(fileHash));
+  fileDb.setSegmentCount(deviceName, manifest.size());
+
+  uint64_t nDerived = 0;
+  if (previousHash != nullptr && *previousHash != fileHash) {
+    nDerived = derivePreviousSegments(deviceName, fileHash, manifest.size(),
+                                      *previousHash, previousDevice,
+                                      [&manifest] (uint64_t segment) {
+                                        return make_shared<Buffer>(manifest.getSegmentDigest(segment));
+                                      });
+  }
+
+  // segments stored before, found with a single range scan
+  std::vector<bool> isStored(manifest.size(), false);
+  for (const auto& location : m_packStore->locateSegments(fileHash, deviceName, PackStore::FILE_SEGMENT)) {
+    if (location.segment < isStored.size()) {
+      isStored[location.segment] = true;
+    }
+  }
+
+  std::vector<uint64_t> missing;
+  PackStore::SegmentBatch batch;
+  for (uint64_t segment = nDerived; segment < manifest.size(); ++segment) {
+    if (isStored[segment]) {
+      continue;
+    }
+
+    auto payload = m_packStore->fetchChunk(manifest.getSegmentDigest(segment));
+    if (payload == nullptr) {
+      missing.push_back(segment);
+      continue;
+    }
+
+    batch.push_back(std::make_pair(segment, makeSegment(deviceName, "file", fileHash, segment,
+                                                        payload->data(), payload->size())));
+    if (batch.size() == SAVE_BATCH) {
+      fileDb.saveContentObjects(deviceName, batch);
+      batch.clear();
+    }
+  }
+  if (!batch.empty()) {
+    fileDb.saveContentObjects(deviceName, batch);
+  }
+
+  _LOG_DEBUG("Reused " << (manifest.size() - missing.size()) << " of " << manifest.size()
+             << " segments of " << toHex(fileHash));
+  return missing;
+}
+
+uint64_t
+ObjectManager::derivePreviousSegments(const Name& deviceName, const Buffer& fileHash,
+                                      uint64_t nSegments,
+                                      const Buffer& previousHash, const Name& previousDevice,
+                                      const std::function<ConstBufferPtr(uint64_t)>& getSegmentDigest)
+{
+  std::vector<PackStore::DerivedRange> existing = m_packStore->getDerivedRanges(fileHash, deviceName);
+  if (!existing.empty()) {
+    return existing.back().end;
+  }
+  if (m_packStore->getFileStatus(fileHash, deviceName).nSegments > 0 ||
+      !m_packStore->getFileStatus(previousHash, previousDevice).isComplete()) {
+    return 0;
+  }
+
+  FileManifestPtr previous = ObjectDb(m_folder, toHex(previousHash)).fetchManifest(previousDevice);
+  if (previous == nullptr) {
+    return 0;
+  }
 
-    segment++;
+  uint64_t nCommon = 0;
+  uint64_t maxCommon = std::min<uint64_t>(nSegments, previous->size());
+  while (nCommon < maxCommon && *getSegmentDigest(nCommon) == previous->getSegmentDigest(nCommon)) {
+    ++nCommon;
+  }
+  if (nCommon < MIN_DERIVED_SEGMENTS) {
+    return 0;
   }
 
-  return std::make_tuple(fileHash.computeDigest(), segment);
+  // derived ranges of the previous version refer to the files where the segments are stored,
+  // the rest of the common part is stored by the previous version itself
+  std::vector<PackStore::DerivedRange> ranges;
+  for (PackStore::DerivedRange& range : m_packStore->getDerivedRanges(previousHash, previousDevice)) {
+    if (range.begin >= nCommon) {
+      break;
+    }
+    range.end = std::min(range.end, nCommon);
+    ranges.push_back(std::move(range));
+  }
+  uint64_t begin = ranges.empty() ? 0 : ranges.back().end;
+  if (begin < nCommon) {
+    // only digest-signed segments can be renamed
+    shared_ptr<Data> probe = m_packStore->fetchSegment(previousHash, previousDevice,
+                                                       PackStore::FILE_SEGMENT, begin);
+    if (probe != nullptr && probe->getSignature().getType() == tlv::DigestSha256) {
+      ranges.push_back({begin, nCommon, previousHash, previousDevice});
+    }
+  }
+
+  // Each range must be at least twice as large as all ranges after it, smaller ranges are
+  // created and stored again.  This keeps the number of ranges logarithmic in the file size,
+  // and a file that keeps growing stores each of its segments only a logarithmic number of times.
+  size_t nKept = ranges.size();
+  uint64_t nAfter = 0;
+  for (size_t i = ranges.size(); i > 0; --i) {
+    uint64_t size = ranges[i - 1].end - ranges[i - 1].begin;
+    if (size < 2 * nAfter) {
+      nKept = i - 1;
+    }
+    nAfter += size;
+  }
+  ranges.resize(nKept);
+
+  uint64_t nDerived = ranges.empty() ? 0 : ranges.back().end;
+  if (nDerived < MIN_DERIVED_SEGMENTS ||
+      !m_packStore->deriveSegments(fileHash, deviceName, ranges)) {
+    return 0;
+  }
+
+  _LOG_DEBUG("Derived " << nDerived << " of " << nSegments << " segments of " << toHex(fileHash)
+             << " from " << toHex(previousHash) << " (" << ranges.size() << " ranges)");
+  return nDerived;
 }
 
 bool
 ObjectManager::objectsToLocalFile(/*in*/ const Name& deviceName, /*in*/ const Buffer& fileHash,
                                   /*out*/ const fs::path& file)
 {
-  std::string hashStr = toHex(fileHash);
-  if (!ObjectDb::doesExist(m_folder, deviceName, hashStr)) {
-    _LOG_ERROR("ObjectDb for [" << m_folder << ", " << deviceName << ", " << hashStr
+  // packs are not removed by compaction while the located segments are read
+  PackStore::ReadLock readLock(*m_packStore);
+
+  // a single ordered range scan instead of a query per segment
+  std::vector<PackStore::SegmentLocation> locations =
+    m_packStore->locateSegments(fileHash, deviceName, PackStore::FILE_SEGMENT);
+  if (locations.empty() || locations.back().segment + 1 != locations.size()) {
+    _LOG_ERROR("ObjectDb for [" << m_folder << ", " << deviceName << ", " << toHex(fileHash)
                                 << "] does not exist or not all segments are available");
     return false;
   }
@@ -128,16 +773,57 @@ ObjectManager::objectsToLocalFile(/*in*/ const Name& deviceName, /*in*/ const Bu
     create_directories(file.parent_path());
   }
 
-  fs::ofstream off(file, std::ios::out | std::ios::binary);
-  ObjectDb fileDb(m_folder, hashStr);
+  // the file is replaced only when it is completely written
+  TemporaryFile tmpFile(file);
+  int fd = tmpFile.getFd();
+  if (fd < 0) {
+    _LOG_ERROR("Cannot create " << tmpFile.getPath());
+    return false;
+  }
 
-  sqlite3_int64 segment = 0;
-  auto data = fileDb.fetchSegment(deviceName, 0);
-  while (data != nullptr) {
-    off.write(reinterpret_cast<const char*>(data->getContent().value()), data->getContent().value_size());
+#ifdef __linux__
+  // wire size of a segment is an upper bound of its payload size, the rest is truncated below.
+  // Failure (e.g., not supported by the file system) is not a problem
+  uint64_t maxFileSize = 0;
+  for (const auto& location : locations) {
+    maxFileSize += location.size;
+  }
+  if (maxFileSize > 0) {
+    ::fallocate(fd, 0, 0, maxFileSize);
+  }
+#endif
 
-    ++segment;
-    data = fileDb.fetchSegment(deviceName, segment);
+  // payloads are written straight from the read buffers, WRITE_BATCH segments per system call
+  std::vector<Buffer> buffers(WRITE_BATCH);
+  std::vector<struct iovec> slices;
+  uint64_t fileSize = 0;
+  uint64_t writeOffset = 0;
+  bool isOk = true;
+  for (size_t i = 0; i < locations.size() && isOk; ++i) {
+    const uint8_t* payload = nullptr;
+    size_t payloadSize = 0;
+    if (!m_packStore->readPayload(locations[i], buffers[slices.size()], payload, payloadSize)) {
+      _LOG_ERROR("Cannot read segment " << locations[i].segment << " of " << toHex(fileHash));
+      isOk = false;
+      break;
+    }
+
+    struct iovec slice;
+    slice.iov_base = const_cast<uint8_t*>(payload);
+    slice.iov_len = payloadSize;
+    slices.push_back(slice);
+    fileSize += payloadSize;
+
+    if (slices.size() == WRITE_BATCH || i + 1 == locations.size()) {
+      isOk = writeSlices(fd, slices, writeOffset);
+      writeOffset = fileSize;
+      slices.clear();
+    }
+  }
+
+  if (!isOk || ::ftruncate(fd, fileSize) != 0 || !tmpFile.commit()) {
+    _LOG_ERROR("Cannot write " << file);
+    return false;
   }
 
   // permission and timestamp should be assigned somewhere else(ObjectManager has no idea about that)
@@ -145,5 +831,46 @@ ObjectManager::objectsToLocalFile(/*in*/ const Name& deviceName, /*in*/ const Bu
   return true;
 }
 
+bool
+ObjectManager::cloneLocalFile(const fs::path& source, const fs::path& file)
+{
+  int sourceFd = ::open(source.c_str(), O_RDONLY);
+  if (sourceFd < 0) {
+    _LOG_ERROR("Cannot open " << source);
+    return false;
+  }
+  struct stat sourceStat;
+  if (::fstat(sourceFd, &sourceStat) != 0) {
+    ::close(sourceFd);
+    return false;
+  }
+
+  boost::system::error_code ec;
+  fs::create_directories(file.parent_path(), ec);
+
+  // the file is replaced only when it is completely written
+  fs::path tmpFile = file.parent_path() / ("." + file.filename().string() + ".chronoshare-tmp");
+  int fd = ::open(tmpFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    _LOG_ERROR("Cannot create " << tmpFile);
+    ::close(sourceFd);
+    return false;
+  }
+
+  bool isOk = copyFileContent(sourceFd, fd, sourceStat.st_size) && ::fsync(fd) == 0;
+  ::close(fd);
+  ::close(sourceFd);
+
+  if (isOk) {
+    fs::rename(tmpFile, file, ec);
+  }
+  if (!isOk || ec) {
+    _LOG_ERROR("Cannot copy " << source << " to " << file);
+    fs::remove(tmpFile, ec);
+    return false;
+  }
+  return true;
+}
+
 } // namespace chronoshare
 } // namespace ndn
@@ -21,6 +21,7 @@
 #ifndef CHRONOSHARE_SRC_OBJECT_MANAGER_HPP
 #define CHRONOSHARE_SRC_OBJECT_MANAGER_HPP
 
+#include "file-manifest.hpp"
 #include "core/chronoshare-common.hpp"
 
 #include <boost/filesystem.hpp>
@@ -29,16 +30,39 @@
 #include <ndn-cxx/security/key-chain.hpp>
 #include <ndn-cxx/util/digest.hpp>
 
+#include <functional>
+
 // everything related to managing object files
 
 namespace ndn {
 namespace chronoshare {
 
+class ObjectDb;
+class PackStore;
+
+/**
+ * @brief Default payload size of file segments
+ *
+ * The actual size is further limited, so that a signed segment never exceeds MAX_NDN_PACKET_SIZE
+ */
+const size_t DEFAULT_FILE_SEGMENT_SIZE = 8192;
+
 class ObjectManager
 {
+public:
+  class Error : public std::runtime_error
+  {
+  public:
+    explicit Error(const std::string& what)
+      : std::runtime_error(what)
+    {
+    }
+  };
+
 public:
   ObjectManager(Face& face, KeyChain& keyChain,
-                const boost::filesystem::path& folder, const std::string& appName);
+                const boost::filesystem::path& folder, const std::string& appName,
+                size_t segmentSize = DEFAULT_FILE_SEGMENT_SIZE);
 
   virtual
   ~ObjectManager();
@@ -46,20 +70,176 @@ public:
   /**
    * @brief Creates and saves local file in a local database file
    *
-   * Format: /<appname>/file/<hash>/<devicename>/<segment>
+   * The file digest, segment boundaries, and the manifest are computed in a single pass over
+   * the file, while its first 64 MB are buffered.  Data packets can only be created once the
+   * file digest is known, as it is part of their names; payloads of segments beyond the buffer
+   * are then read again and checked against the manifest.
+   *
+   * Segments are either of the same size or content-defined (see setContentDefinedChunking).
+   *
+   * When concurrency is above 1, segments are read, hashed, and signed by a pool of worker
+   * threads, while Data packets are still put and saved in segment order by the calling thread.
+   *
+   * Segments are signed with DigestSha256 only.  They are authenticated through the file
+   * manifest, whose root is expected to be carried in the signed action.
+   *
+   * Format: /<devicename>/<appname>/file/<hash>/<segment>
+   *         /<devicename>/<appname>/manifest/<hash>/<segment>
+   *
+   * If the file starts with the same segments as its previous version @p previousHash (as it
+   * does when data were appended to it), these segments are derived from the previous version
+   * instead of being created, stored, and put again; see PackStore::deriveSegments.  If its
+   * content is the same as that of @p previousHash, the file is only hashed: nothing is put
+   * or stored.
+   *
+   * @return file hash, number of segments, the payload size used for the segments and
+   *         the manifest root
+   * @throw Error the file cannot be read, or it changed while it was being read
    */
-  std::tuple<ConstBufferPtr /*object-db name*/, size_t /* number of segments*/>
-  localFileToObjects(const boost::filesystem::path& file, const Name& deviceName);
+  std::tuple<ConstBufferPtr /*object-db name*/, size_t /* number of segments*/, size_t /*segment size*/,
+             ConstBufferPtr /*manifest root*/>
+  localFileToObjects(const boost::filesystem::path& file, const Name& deviceName,
+                     ConstBufferPtr previousHash = nullptr, const Name& previousDevice = Name());
 
+  /**
+   * @brief Assembles file from segments stored in a local database file
+   *
+   * Segments are simply concatenated, so files published with any segment size can be assembled.
+   * Segment locations are looked up with a single range scan, payloads are written straight from
+   * the pack files into a preallocated temporary file, which then atomically replaces @p file.
+   *
+   * @return false if not all segments are available or the file cannot be written
+   */
   bool
   objectsToLocalFile(/*in*/ const Name& deviceName, /*in*/ const Buffer& hash,
                      /*out*/ const boost::filesystem::path& file);
 
+  /**
+   * @brief Make @p file a copy of a local file @p source with the same content
+   *
+   * The copy shares storage with @p source (FICLONE) where the file system supports it, or is
+   * copied within the kernel (copy_file_range); otherwise the content is read and written.  The
+   * copy replaces @p file only when it is completely written.
+   *
+   * @return false if @p source cannot be read or the copy cannot be written
+   */
+  static bool
+  cloneLocalFile(const boost::filesystem::path& source, const boost::filesystem::path& file);
+
+  /**
+   * @brief Get the configured segment size
+   */
+  size_t
+  getSegmentSize() const
+  {
+    return m_segmentSize;
+  }
+
+  /**
+   * @brief Set number of threads used to create segments of local files
+   *
+   * 1 (the default) creates all segments on the calling thread
+   */
+  void
+  setConcurrency(size_t nThreads)
+  {
+    m_nThreads = std::max<size_t>(nThreads, 1);
+  }
+
+  size_t
+  getConcurrency() const
+  {
+    return m_nThreads;
+  }
+
+  /**
+   * @brief Enable or disable content-defined chunking of local files
+   *
+   * By default, files are cut into segments of the same size.  With content-defined chunking,
+   * segments (of up to the segment size) end where the content says so, so a small edit changes
+   * only a few segments, while the rest can be reused from the previous version of the file.
+   */
+  void
+  setContentDefinedChunking(bool isEnabled)
+  {
+    m_isContentDefinedChunking = isEnabled;
+  }
+
+  bool
+  isContentDefinedChunking() const
+  {
+    return m_isContentDefinedChunking;
+  }
+
+  /**
+   * @brief Enable or disable compression of segment payloads in the segment store of the folder
+   *
+   * Applies to all segments saved in the folder afterwards, including fetched ones
+   */
+  void
+  setCompression(bool isEnabled);
+
+  /**
+   * @brief Create segments of a remote file from identical payloads already stored locally
+   *
+   * Segments are named and digest-signed the same way as segments of local files and saved in
+   * the local database file.  Their payloads are authenticated by @p manifest.  Segments the
+   * file has in common with the beginning of its previous version @p previousHash are derived
+   * from that version.
+   *
+   * @return numbers of segments that are not available locally and need to be fetched
+   */
+  std::vector<uint64_t>
+  reuseLocalSegments(const Name& deviceName, const Buffer& fileHash, const FileManifest& manifest,
+                     ConstBufferPtr previousHash = nullptr, const Name& previousDevice = Name());
+
+private:
+  /**
+   * @brief Get the largest segment payload (not above the configured segment size) that
+   *        keeps signed segments of @p deviceName within MAX_NDN_PACKET_SIZE
+   */
+  size_t
+  getEffectiveSegmentSize(const Name& deviceName);
+
+  /**
+   * @brief Create DigestSha256-signed segment
+   *
+   * Does not use the KeyChain, so it is safe to call from several threads at once
+   */
+  shared_ptr<Data>
+  makeSegment(const Name& deviceName, const std::string& type, const Buffer& fileHash,
+              uint64_t segment, const uint8_t* payload, size_t size) const;
+
+  /**
+   * @brief Derive the segments that file @p fileHash has in common with the beginning of its
+   *        previous version
+   *
+   * The previous version must be completely stored and have a manifest.  Nothing is derived if
+   * fewer than MIN_DERIVED_SEGMENTS segments are in common, or if the file already has segments.
+   *
+   * @param getSegmentDigest returns payload digest of a segment of the file, it is called for
+   *                         segments 0, 1, ... until a segment differs from the previous version
+   * @return number of segments at the beginning of the file that are derived
+   */
+  uint64_t
+  derivePreviousSegments(const Name& deviceName, const Buffer& fileHash, uint64_t nSegments,
+                         const Buffer& previousHash, const Name& previousDevice,
+                         const std::function<ConstBufferPtr(uint64_t segment)>& getSegmentDigest);
+
 private:
   Face& m_face;
   KeyChain& m_keyChain;
   boost::filesystem::path m_folder;
   std::string m_appName;
+  size_t m_segmentSize;
+  size_t m_nThreads;
+  bool m_isContentDefinedChunking;
+
+  // keeps the segment store of the folder open
+  shared_ptr<PackStore> m_packStore;
+
+  Name m_overheadDeviceName;
+  size_t m_segmentOverhead;
 };
 
 typedef shared_ptr<ObjectManager> ObjectManagerPtr;
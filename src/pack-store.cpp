@@ -0,0 +1,1557 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#include "pack-store.hpp"
+#include "core/logging.hpp"
+
+#include <ndn-cxx/encoding/encoding-buffer.hpp>
+#include <ndn-cxx/util/digest.hpp>
+#include <ndn-cxx/util/sqlite3-statement.hpp>
+#include <ndn-cxx/util/string-helper.hpp>
+
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ndn {
+namespace chronoshare {
+
+_LOG_INIT(PackStore);
+
+namespace fs = boost::filesystem;
+using util::Sqlite3Statement;
+
+// new pack file is started once the current one reaches this size
+const uint64_t MAX_PACK_SIZE = 256 * 1024 * 1024;
+
+// index updates are committed at least every MAX_PENDING_UPDATES segments
+const size_t MAX_PENDING_UPDATES = 1024;
+
+// number of records moved by one compaction step
+const size_t COMPACTION_BATCH_SIZE = 256;
+
+// smaller payloads are not worth sharing, the content-less packet would take as much space
+const size_t MIN_CHUNK_SIZE = 256;
+
+// payloads are compressed only if the first ENTROPY_PROBE_SIZE bytes have lower entropy (in bits
+// per byte), already compressed or encrypted content is close to 8
+const size_t ENTROPY_PROBE_SIZE = 4096;
+const double MAX_COMPRESSIBLE_ENTROPY = 7.2;
+
+const std::string INIT_DATABASE = R"SQL(
+CREATE TABLE IF NOT EXISTS
+   Segment(
+        file_hash       BLOB NOT NULL,
+        device_name     BLOB NOT NULL,
+        type            INTEGER NOT NULL,
+        segment         INTEGER NOT NULL,
+        pack            INTEGER NOT NULL,
+        offset          INTEGER NOT NULL,
+        size            INTEGER NOT NULL,
+
+        content_digest  BLOB,
+        shell           BLOB,
+
+        PRIMARY KEY (file_hash, device_name, type, segment)
+    ) WITHOUT ROWID;
+
+CREATE TABLE IF NOT EXISTS
+   File(
+        file_hash       BLOB NOT NULL,
+        device_name     BLOB NOT NULL,
+        n_segments      INTEGER NOT NULL,
+        n_total         INTEGER NOT NULL,
+
+        PRIMARY KEY (file_hash, device_name)
+    ) WITHOUT ROWID;
+
+CREATE TABLE IF NOT EXISTS
+   Chunk(
+        digest          BLOB NOT NULL PRIMARY KEY,
+        pack            INTEGER NOT NULL,
+        offset          INTEGER NOT NULL,
+        size            INTEGER NOT NULL,
+        refcount        INTEGER NOT NULL,
+
+        raw_size        INTEGER
+    ) WITHOUT ROWID;
+
+CREATE TABLE IF NOT EXISTS
+   DerivedRange(
+        file_hash       BLOB NOT NULL,
+        device_name     BLOB NOT NULL,
+        begin_segment   INTEGER NOT NULL,
+        end_segment     INTEGER NOT NULL,
+        base_hash       BLOB NOT NULL,
+        base_device     BLOB NOT NULL,
+
+        PRIMARY KEY (file_hash, device_name, begin_segment)
+    ) WITHOUT ROWID;
+
+CREATE INDEX IF NOT EXISTS Segment_pack ON Segment (pack);
+CREATE INDEX IF NOT EXISTS Chunk_pack ON Chunk (pack);
+)SQL";
+
+// Segment table of the indexes created before payloads were shared
+const std::string UPGRADE_SEGMENT_TABLE = R"SQL(
+ALTER TABLE Segment ADD COLUMN content_digest BLOB;
+ALTER TABLE Segment ADD COLUMN shell BLOB;
+)SQL";
+
+// Chunk table of the indexes created before payloads were compressed
+const std::string UPGRADE_CHUNK_TABLE = R"SQL(
+ALTER TABLE Chunk ADD COLUMN raw_size INTEGER;
+)SQL";
+
+// File table of the indexes created before the completeness index
+const std::string BUILD_FILE_TABLE = R"SQL(
+INSERT INTO File (file_hash, device_name, n_segments, n_total)
+    SELECT file_hash, device_name, count(*), 0 FROM Segment WHERE type=0
+        GROUP BY file_hash, device_name;
+)SQL";
+
+// For shared payloads, pack, offset, and size are those of the chunk; raw size is not NULL if
+// the chunk is compressed
+const std::string SELECT_SEGMENT = R"SQL(
+SELECT Segment.pack, Segment.offset, Segment.size, Segment.shell,
+       Chunk.pack, Chunk.offset, Chunk.size, Segment.segment, Chunk.raw_size
+    FROM Segment LEFT JOIN Chunk ON Segment.content_digest = Chunk.digest
+)SQL";
+
+static std::string
+makeFileKey(const Buffer& fileHash, const Name& deviceName)
+{
+  const Block& device = deviceName.wireEncode();
+  std::string key(reinterpret_cast<const char*>(fileHash.data()), fileHash.size());
+  key.append(reinterpret_cast<const char*>(device.wire()), device.size());
+  return key;
+}
+
+static std::string
+toKey(const Buffer& fileHash)
+{
+  return std::string(reinterpret_cast<const char*>(fileHash.data()), fileHash.size());
+}
+
+/**
+ * @brief Make segment of file @p fileHash from the same segment of another file
+ * @return nullptr if @p base is not signed with DigestSha256 and cannot be signed again
+ */
+static shared_ptr<Data>
+makeDerivedSegment(const Data& base, const Buffer& fileHash)
+{
+  const Name& baseName = base.getName();
+  if (baseName.size() < 2 || base.getSignature().getType() != tlv::DigestSha256) {
+    _LOG_ERROR("Cannot derive segment from " << baseName);
+    return nullptr;
+  }
+
+  // /<device_name>/<appname>/file/<hash>/<segment>
+  auto data = make_shared<Data>(base);
+  data->setName(baseName.getPrefix(-2).append(name::Component(fileHash)).append(baseName.get(-1)));
+
+  data->setSignature(Signature(SignatureInfo(tlv::DigestSha256)));
+  EncodingBuffer encoder;
+  data->wireEncode(encoder, true);
+  ConstBufferPtr signature = util::Sha256::computeDigest(encoder.buf(), encoder.size());
+  data->wireEncode(encoder, Block(tlv::SignatureValue, signature));
+  return data;
+}
+
+static bool
+isCompressible(const uint8_t* payload, size_t size)
+{
+  size_t probeSize = std::min(size, ENTROPY_PROBE_SIZE);
+  std::array<size_t, 256> counts{};
+  for (size_t i = 0; i < probeSize; ++i) {
+    ++counts[payload[i]];
+  }
+
+  double entropy = 0;
+  for (size_t count : counts) {
+    if (count > 0) {
+      double p = static_cast<double>(count) / probeSize;
+      entropy -= p * std::log2(p);
+    }
+  }
+  return entropy < MAX_COMPRESSIBLE_ENTROPY;
+}
+
+static void
+compressPayload(const uint8_t* payload, size_t size, std::vector<char>& compressed)
+{
+  namespace io = boost::iostreams;
+
+  compressed.clear();
+  io::filtering_ostream out;
+  out.push(io::zlib_compressor(io::zlib::best_speed));
+  out.push(io::back_inserter(compressed));
+  out.write(reinterpret_cast<const char*>(payload), size);
+  out.reset(); // flushes the compressor
+}
+
+static bool
+decompressPayload(const uint8_t* compressed, size_t size, uint8_t* payload, size_t rawSize)
+{
+  namespace io = boost::iostreams;
+
+  try {
+    io::filtering_istream in;
+    in.push(io::zlib_decompressor());
+    in.push(io::array_source(reinterpret_cast<const char*>(compressed), size));
+    in.read(reinterpret_cast<char*>(payload), rawSize);
+    return static_cast<size_t>(in.gcount()) == rawSize;
+  }
+  catch (const io::zlib_error& error) {
+    _LOG_ERROR("Corrupted compressed payload: " << error.what());
+    return false;
+  }
+}
+
+shared_ptr<PackStore>
+PackStore::open(const fs::path& folder)
+{
+  static std::mutex registryMutex;
+  static std::map<fs::path, std::weak_ptr<PackStore>> registry;
+  // stores by the paths they have been asked for, so an open store is found without touching
+  // the file system
+  static std::map<fs::path, std::weak_ptr<PackStore>> aliases;
+
+  {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    auto alias = aliases.find(folder);
+    if (alias != aliases.end()) {
+      shared_ptr<PackStore> store = alias->second.lock();
+      if (store != nullptr) {
+        return store;
+      }
+    }
+  }
+
+  fs::create_directories(folder);
+  fs::path key = fs::canonical(folder);
+
+  std::lock_guard<std::mutex> lock(registryMutex);
+  std::weak_ptr<PackStore>& entry = registry[key];
+  shared_ptr<PackStore> store = entry.lock();
+  if (store == nullptr) {
+    store = make_shared<PackStore>(key);
+    entry = store;
+  }
+  aliases[folder] = store;
+  return store;
+}
+
+PackStore::PackStore(const fs::path& folder)
+  : DbHelper(folder / "objects", "index.db")
+  , m_folder(folder / "objects")
+  , m_currentPack(0)
+  , m_appendFd(-1)
+  , m_appendOffset(0)
+  , m_nReaders(0)
+  , m_isInTransaction(false)
+  , m_nPendingUpdates(0)
+  , m_isCompressionEnabled(false)
+{
+  char* errmsg = 0;
+  int res = sqlite3_exec(m_db, INIT_DATABASE.c_str(), nullptr, nullptr, &errmsg);
+  if (res != SQLITE_OK && errmsg != 0) {
+    std::string error = errmsg;
+    sqlite3_free(errmsg);
+    BOOST_THROW_EXCEPTION(Error("Cannot initialize pack index: " + error));
+  }
+
+  res = sqlite3_exec(m_db, UPGRADE_SEGMENT_TABLE.c_str(), nullptr, nullptr, &errmsg);
+  if (res != SQLITE_OK && errmsg != 0) {
+    // columns already exist
+    sqlite3_free(errmsg);
+  }
+
+  res = sqlite3_exec(m_db, UPGRADE_CHUNK_TABLE.c_str(), nullptr, nullptr, &errmsg);
+  if (res != SQLITE_OK && errmsg != 0) {
+    // column already exists
+    sqlite3_free(errmsg);
+  }
+
+  // continue appending to the last pack file
+  for (uint64_t pack : listPacks()) {
+    m_currentPack = std::max(m_currentPack, pack);
+  }
+  openPackForAppend(m_currentPack);
+
+  loadFileIndex();
+  loadDerivedRanges();
+  migrateLegacyDatabases();
+}
+
+PackStore::~PackStore()
+{
+  commitIndexUpdate();
+
+  if (m_appendFd >= 0) {
+    ::close(m_appendFd);
+  }
+  for (const auto& fd : m_readFds) {
+    ::close(fd.second);
+  }
+}
+
+void
+PackStore::saveSegment(const Buffer& fileHash, const Name& deviceName, SegmentType type,
+                       uint64_t segment, const Data& data, bool replace)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  insertSegment(fileHash, deviceName, type, segment, data, replace);
+}
+
+void
+PackStore::saveSegments(const Buffer& fileHash, const Name& deviceName, SegmentType type,
+                        const SegmentBatch& segments, bool replace)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (const auto& segment : segments) {
+    if (segment.second != nullptr) {
+      insertSegment(fileHash, deviceName, type, segment.first, *segment.second, replace);
+    }
+  }
+}
+
+shared_ptr<Data>
+PackStore::fetchSegment(const Buffer& fileHash, const Name& deviceName, SegmentType type,
+                        uint64_t segment)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  SegmentBatch segments;
+  readStoredSegments(fileHash, deviceName, type, segment, segment + 1, segments);
+  if (!segments.empty()) {
+    return segments.front().second;
+  }
+  if (type != FILE_SEGMENT) {
+    return nullptr;
+  }
+
+  const DerivedRange* range = findDerivedRange(makeFileKey(fileHash, deviceName), segment);
+  if (range == nullptr) {
+    return nullptr;
+  }
+  readStoredSegments(range->baseHash, range->baseDevice, type, segment, segment + 1, segments);
+  if (segments.empty()) {
+    _LOG_ERROR("Base segment " << segment << " of " << toHex(range->baseHash) << " is missing");
+    return nullptr;
+  }
+  return makeDerivedSegment(*segments.front().second, fileHash);
+}
+
+std::vector<shared_ptr<Data>>
+PackStore::fetchSegments(const Buffer& fileHash, const Name& deviceName, SegmentType type)
+{
+  std::vector<shared_ptr<Data>> result;
+  for (auto& segment : fetchSegmentRange(fileHash, deviceName, type,
+                                         0, std::numeric_limits<sqlite3_int64>::max())) {
+    result.push_back(std::move(segment.second));
+  }
+  return result;
+}
+
+PackStore::SegmentBatch
+PackStore::fetchSegmentRange(const Buffer& fileHash, const Name& deviceName, SegmentType type,
+                             uint64_t begin, uint64_t end)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  SegmentBatch segments;
+  readStoredSegments(fileHash, deviceName, type, begin, end, segments);
+
+  auto derived = m_derived.find(makeFileKey(fileHash, deviceName));
+  if (type == FILE_SEGMENT && derived != m_derived.end()) {
+    for (const DerivedRange& range : derived->second) {
+      if (range.end <= begin || range.begin >= end) {
+        continue;
+      }
+      size_t first = segments.size();
+      readStoredSegments(range.baseHash, range.baseDevice, type,
+                         std::max(range.begin, begin), std::min(range.end, end), segments);
+      for (size_t i = first; i < segments.size(); ++i) {
+        segments[i].second = makeDerivedSegment(*segments[i].second, fileHash);
+      }
+    }
+
+    std::stable_sort(segments.begin(), segments.end(),
+                     [] (const SegmentBatch::value_type& a, const SegmentBatch::value_type& b) {
+                       return a.first < b.first;
+                     });
+    segments.erase(std::unique(segments.begin(), segments.end(),
+                               [] (const SegmentBatch::value_type& a, const SegmentBatch::value_type& b) {
+                                 return a.first == b.first;
+                               }),
+                   segments.end());
+    segments.erase(std::remove_if(segments.begin(), segments.end(),
+                                  [] (const SegmentBatch::value_type& segment) {
+                                    return segment.second == nullptr;
+                                  }),
+                   segments.end());
+  }
+  return segments;
+}
+
+void
+PackStore::readStoredSegments(const Buffer& fileHash, const Name& deviceName, SegmentType type,
+                              uint64_t begin, uint64_t end, SegmentBatch& segments)
+{
+  Statement stmt(*this, SELECT_SEGMENT + "WHERE file_hash=? AND device_name=? AND type=? "
+                                         "      AND segment>=? AND segment<? ORDER BY segment");
+  stmt.bind(1, fileHash.data(), fileHash.size(), SQLITE_STATIC);
+  stmt.bind(2, deviceName.wireEncode(), SQLITE_STATIC);
+  stmt.bind(3, static_cast<int>(type));
+  stmt.bind(4, static_cast<sqlite3_int64>(begin));
+  stmt.bind(5, static_cast<sqlite3_int64>(end));
+
+  while (stmt.step() == SQLITE_ROW) {
+    auto data = readSegment(stmt);
+    if (data != nullptr) {
+      segments.push_back(std::make_pair(sqlite3_column_int64(stmt, 7), data));
+    }
+  }
+}
+
+std::vector<PackStore::SegmentLocation>
+PackStore::locateSegments(const Buffer& fileHash, const Name& deviceName, SegmentType type)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  std::vector<SegmentLocation> locations;
+  locateStoredSegments(fileHash, deviceName, type, 0, std::numeric_limits<sqlite3_int64>::max(), locations);
+
+  // derived segments have the same payload as their base segments
+  auto derived = m_derived.find(makeFileKey(fileHash, deviceName));
+  if (type == FILE_SEGMENT && derived != m_derived.end()) {
+    for (const DerivedRange& range : derived->second) {
+      locateStoredSegments(range.baseHash, range.baseDevice, type, range.begin, range.end, locations);
+    }
+
+    auto isBefore = [] (const SegmentLocation& a, const SegmentLocation& b) {
+      return a.segment < b.segment;
+    };
+    std::stable_sort(locations.begin(), locations.end(), isBefore);
+    locations.erase(std::unique(locations.begin(), locations.end(),
+                                [] (const SegmentLocation& a, const SegmentLocation& b) {
+                                  return a.segment == b.segment;
+                                }),
+                    locations.end());
+  }
+  return locations;
+}
+
+void
+PackStore::locateStoredSegments(const Buffer& fileHash, const Name& deviceName, SegmentType type,
+                                uint64_t begin, uint64_t end, std::vector<SegmentLocation>& locations)
+{
+  Statement stmt(*this, SELECT_SEGMENT + "WHERE file_hash=? AND device_name=? AND type=? "
+                                         "      AND segment>=? AND segment<? ORDER BY segment");
+  stmt.bind(1, fileHash.data(), fileHash.size(), SQLITE_STATIC);
+  stmt.bind(2, deviceName.wireEncode(), SQLITE_STATIC);
+  stmt.bind(3, static_cast<int>(type));
+  stmt.bind(4, static_cast<sqlite3_int64>(begin));
+  stmt.bind(5, static_cast<sqlite3_int64>(end));
+
+  while (stmt.step() == SQLITE_ROW) {
+    SegmentLocation location;
+    location.segment = sqlite3_column_int64(stmt, 7);
+    if (sqlite3_column_type(stmt, 3) == SQLITE_NULL) {
+      location.pack = sqlite3_column_int64(stmt, 0);
+      location.offset = sqlite3_column_int64(stmt, 1);
+      location.size = sqlite3_column_int64(stmt, 2);
+      location.isPayloadOnly = false;
+      location.rawSize = 0;
+    }
+    else if (sqlite3_column_type(stmt, 4) != SQLITE_NULL) {
+      location.pack = sqlite3_column_int64(stmt, 4);
+      location.offset = sqlite3_column_int64(stmt, 5);
+      location.size = sqlite3_column_int64(stmt, 6);
+      location.isPayloadOnly = true;
+      location.rawSize = sqlite3_column_type(stmt, 8) == SQLITE_NULL ? 0 : sqlite3_column_int64(stmt, 8);
+    }
+    else {
+      _LOG_ERROR("Shared payload of a segment is missing");
+      break;
+    }
+    locations.push_back(location);
+  }
+}
+
+bool
+PackStore::readLocatedRecord(const SegmentLocation& location, uint8_t* buffer)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  try {
+    return readRecord(location.pack, location.offset, location.size, buffer);
+  }
+  catch (const Error& e) {
+    // e.g., the pack has been compacted and removed since the segment was located without ReadLock
+    _LOG_ERROR(e.what());
+    return false;
+  }
+}
+
+bool
+PackStore::readPayload(const SegmentLocation& location, Buffer& buffer,
+                       const uint8_t*& payload, size_t& payloadSize)
+{
+  if (location.rawSize != 0) {
+    Buffer compressed(location.size);
+    if (!readLocatedRecord(location, compressed.data())) {
+      return false;
+    }
+
+    if (buffer.size() < location.rawSize) {
+      buffer.resize(location.rawSize);
+    }
+    payload = buffer.data();
+    payloadSize = location.rawSize;
+    return decompressPayload(compressed.data(), compressed.size(), buffer.data(), location.rawSize);
+  }
+
+  if (buffer.size() < location.size) {
+    buffer.resize(location.size);
+  }
+
+  if (!readLocatedRecord(location, buffer.data())) {
+    return false;
+  }
+
+  if (location.isPayloadOnly) {
+    payload = buffer.data();
+    payloadSize = location.size;
+    return true;
+  }
+
+  // find Content element of the Data packet
+  const uint8_t* begin = buffer.data();
+  const uint8_t* end = buffer.data() + location.size;
+  uint32_t type = 0;
+  uint64_t length = 0;
+  if (!tlv::readType(begin, end, type) || type != tlv::Data ||
+      !tlv::readVarNumber(begin, end, length) || length > static_cast<uint64_t>(end - begin)) {
+    return false;
+  }
+  end = begin + length;
+
+  while (begin != end) {
+    if (!tlv::readType(begin, end, type) || !tlv::readVarNumber(begin, end, length) ||
+        length > static_cast<uint64_t>(end - begin)) {
+      return false;
+    }
+    if (type == tlv::Content) {
+      payload = begin;
+      payloadSize = length;
+      return true;
+    }
+    begin += length;
+  }
+
+  // no Content element means empty payload
+  payload = buffer.data();
+  payloadSize = 0;
+  return true;
+}
+
+shared_ptr<Buffer>
+PackStore::fetchChunk(const Buffer& digest)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  Statement stmt(*this, "SELECT pack, offset, size, raw_size FROM Chunk "
+                          "WHERE digest=? AND refcount > 0");
+  stmt.bind(1, digest.data(), digest.size(), SQLITE_STATIC);
+
+  if (stmt.step() != SQLITE_ROW) {
+    return nullptr;
+  }
+  return readChunk(sqlite3_column_int64(stmt, 0), sqlite3_column_int64(stmt, 1),
+                   sqlite3_column_int64(stmt, 2),
+                   sqlite3_column_type(stmt, 3) == SQLITE_NULL ? 0 : sqlite3_column_int64(stmt, 3));
+}
+
+size_t
+PackStore::countSegments(const Buffer& fileHash, const Name& deviceName, SegmentType type)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  Statement stmt(*this, "SELECT count(*) FROM Segment "
+                          "WHERE file_hash=? AND device_name=? AND type=?");
+  stmt.bind(1, fileHash.data(), fileHash.size(), SQLITE_STATIC);
+  stmt.bind(2, deviceName.wireEncode(), SQLITE_STATIC);
+  stmt.bind(3, static_cast<int>(type));
+
+  if (stmt.step() != SQLITE_ROW) {
+    return 0;
+  }
+  size_t nSegments = sqlite3_column_int64(stmt, 0);
+
+  auto derived = m_derived.find(makeFileKey(fileHash, deviceName));
+  if (type == FILE_SEGMENT && derived != m_derived.end()) {
+    for (const DerivedRange& range : derived->second) {
+      nSegments += range.end - range.begin;
+    }
+  }
+  return nSegments;
+}
+
+PackStore::FileStatus
+PackStore::getFileStatus(const Buffer& fileHash, const Name& deviceName)
+{
+  std::string key = makeFileKey(fileHash, deviceName);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto file = m_files.find(key);
+  if (file == m_files.end()) {
+    return FileStatus{0, 0};
+  }
+  return file->second;
+}
+
+void
+PackStore::setFileSegmentCount(const Buffer& fileHash, const Name& deviceName, uint64_t nSegments)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  std::string key = makeFileKey(fileHash, deviceName);
+  auto file = m_files.find(key);
+  if (file != m_files.end() && file->second.nTotalSegments == nSegments) {
+    return;
+  }
+  FileStatus& status = m_files[key];
+  status.nTotalSegments = nSegments;
+
+  beginIndexUpdate();
+  Statement stmt(*this, "INSERT OR REPLACE INTO File (file_hash, device_name, n_segments, n_total) "
+                          "VALUES (?, ?, ?, ?)");
+  stmt.bind(1, fileHash.data(), fileHash.size(), SQLITE_STATIC);
+  stmt.bind(2, deviceName.wireEncode(), SQLITE_STATIC);
+  stmt.bind(3, static_cast<sqlite3_int64>(status.nSegments));
+  stmt.bind(4, static_cast<sqlite3_int64>(status.nTotalSegments));
+  if (stmt.step() != SQLITE_DONE) {
+    BOOST_THROW_EXCEPTION(Error(sqlite3_errmsg(m_db)));
+  }
+
+  if (++m_nPendingUpdates >= MAX_PENDING_UPDATES) {
+    commitIndexUpdate();
+  }
+}
+
+std::vector<std::pair<Buffer, Name>>
+PackStore::listFiles()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  std::vector<std::pair<Buffer, Name>> files;
+  Statement stmt(*this, "SELECT file_hash, device_name FROM File");
+  while (stmt.step() == SQLITE_ROW) {
+    files.push_back(std::make_pair(Buffer(stmt.getBlob(0), stmt.getSize(0)), Name(stmt.getBlock(1))));
+  }
+  return files;
+}
+
+size_t
+PackStore::removeFile(const Buffer& fileHash, const Name& deviceName)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  beginIndexUpdate();
+
+  {
+    Statement stmt(*this, "SELECT content_digest FROM Segment "
+                            "WHERE file_hash=? AND device_name=? AND content_digest IS NOT NULL");
+    stmt.bind(1, fileHash.data(), fileHash.size(), SQLITE_STATIC);
+    stmt.bind(2, deviceName.wireEncode(), SQLITE_STATIC);
+    while (stmt.step() == SQLITE_ROW) {
+      releaseChunk(Buffer(stmt.getBlob(0), stmt.getSize(0)));
+    }
+  }
+
+  // records stay in their packs as garbage until the packs are compacted
+  size_t nRemoved = 0;
+  {
+    Statement stmt(*this, "DELETE FROM Segment WHERE file_hash=? AND device_name=?");
+    stmt.bind(1, fileHash.data(), fileHash.size(), SQLITE_STATIC);
+    stmt.bind(2, deviceName.wireEncode(), SQLITE_STATIC);
+    if (stmt.step() != SQLITE_DONE) {
+      BOOST_THROW_EXCEPTION(Error(sqlite3_errmsg(m_db)));
+    }
+    nRemoved = sqlite3_changes(m_db);
+  }
+  {
+    Statement stmt(*this, "DELETE FROM File WHERE file_hash=? AND device_name=?");
+    stmt.bind(1, fileHash.data(), fileHash.size(), SQLITE_STATIC);
+    stmt.bind(2, deviceName.wireEncode(), SQLITE_STATIC);
+    if (stmt.step() != SQLITE_DONE) {
+      BOOST_THROW_EXCEPTION(Error(sqlite3_errmsg(m_db)));
+    }
+  }
+  {
+    Statement stmt(*this, "DELETE FROM DerivedRange WHERE file_hash=? AND device_name=?");
+    stmt.bind(1, fileHash.data(), fileHash.size(), SQLITE_STATIC);
+    stmt.bind(2, deviceName.wireEncode(), SQLITE_STATIC);
+    if (stmt.step() != SQLITE_DONE) {
+      BOOST_THROW_EXCEPTION(Error(sqlite3_errmsg(m_db)));
+    }
+  }
+
+  std::string key = makeFileKey(fileHash, deviceName);
+  auto derived = m_derived.find(key);
+  if (derived != m_derived.end()) {
+    for (const DerivedRange& range : derived->second) {
+      auto base = m_nDerivedFromBase.find(toKey(range.baseHash));
+      if (base != m_nDerivedFromBase.end() && --base->second == 0) {
+        m_nDerivedFromBase.erase(base);
+      }
+    }
+    m_derived.erase(derived);
+  }
+  m_files.erase(key);
+
+  m_nPendingUpdates += nRemoved;
+  if (m_nPendingUpdates >= MAX_PENDING_UPDATES) {
+    commitIndexUpdate();
+  }
+  return nRemoved;
+}
+
+size_t
+PackStore::removeManifest(const Buffer& fileHash, const Name& deviceName)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  beginIndexUpdate();
+
+  // manifest segments are always stored whole and are not counted in the completeness index
+  Statement stmt(*this, "DELETE FROM Segment WHERE file_hash=? AND device_name=? AND type=?");
+  stmt.bind(1, fileHash.data(), fileHash.size(), SQLITE_STATIC);
+  stmt.bind(2, deviceName.wireEncode(), SQLITE_STATIC);
+  stmt.bind(3, static_cast<int>(MANIFEST_SEGMENT));
+  if (stmt.step() != SQLITE_DONE) {
+    BOOST_THROW_EXCEPTION(Error(sqlite3_errmsg(m_db)));
+  }
+  size_t nRemoved = sqlite3_changes(m_db);
+
+  m_nPendingUpdates += nRemoved;
+  if (m_nPendingUpdates >= MAX_PENDING_UPDATES) {
+    commitIndexUpdate();
+  }
+  return nRemoved;
+}
+
+bool
+PackStore::deriveSegments(const Buffer& fileHash, const Name& deviceName,
+                          const std::vector<DerivedRange>& ranges)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  std::string key = makeFileKey(fileHash, deviceName);
+  auto file = m_files.find(key);
+  if ((file != m_files.end() && file->second.nSegments > 0) || m_derived.count(key) > 0) {
+    return false;
+  }
+
+  beginIndexUpdate();
+  FileStatus& status = m_files[key];
+  std::vector<DerivedRange>& derived = m_derived[key];
+  for (const DerivedRange& range : ranges) {
+    if (range.begin >= range.end) {
+      continue;
+    }
+
+    Statement stmt(*this, "INSERT INTO DerivedRange "
+                            "(file_hash, device_name, begin_segment, end_segment, base_hash, base_device) "
+                            "VALUES (?, ?, ?, ?, ?, ?)");
+    stmt.bind(1, fileHash.data(), fileHash.size(), SQLITE_STATIC);
+    stmt.bind(2, deviceName.wireEncode(), SQLITE_STATIC);
+    stmt.bind(3, static_cast<sqlite3_int64>(range.begin));
+    stmt.bind(4, static_cast<sqlite3_int64>(range.end));
+    stmt.bind(5, range.baseHash.data(), range.baseHash.size(), SQLITE_STATIC);
+    stmt.bind(6, range.baseDevice.wireEncode(), SQLITE_STATIC);
+    if (stmt.step() != SQLITE_DONE) {
+      BOOST_THROW_EXCEPTION(Error(sqlite3_errmsg(m_db)));
+    }
+
+    derived.push_back(range);
+    ++m_nDerivedFromBase[toKey(range.baseHash)];
+    status.nSegments += range.end - range.begin;
+  }
+  std::sort(derived.begin(), derived.end(),
+            [] (const DerivedRange& a, const DerivedRange& b) { return a.begin < b.begin; });
+
+  Statement stmt(*this, "INSERT OR REPLACE INTO File (file_hash, device_name, n_segments, n_total) "
+                          "VALUES (?, ?, ?, ?)");
+  stmt.bind(1, fileHash.data(), fileHash.size(), SQLITE_STATIC);
+  stmt.bind(2, deviceName.wireEncode(), SQLITE_STATIC);
+  stmt.bind(3, static_cast<sqlite3_int64>(status.nSegments));
+  stmt.bind(4, static_cast<sqlite3_int64>(status.nTotalSegments));
+  if (stmt.step() != SQLITE_DONE) {
+    BOOST_THROW_EXCEPTION(Error(sqlite3_errmsg(m_db)));
+  }
+
+  m_nPendingUpdates += ranges.size() + 1;
+  if (m_nPendingUpdates >= MAX_PENDING_UPDATES) {
+    commitIndexUpdate();
+  }
+  return true;
+}
+
+std::vector<PackStore::DerivedRange>
+PackStore::getDerivedRanges(const Buffer& fileHash, const Name& deviceName)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  auto derived = m_derived.find(makeFileKey(fileHash, deviceName));
+  if (derived == m_derived.end()) {
+    return {};
+  }
+  return derived->second;
+}
+
+bool
+PackStore::isBase(const Buffer& fileHash)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_nDerivedFromBase.count(toKey(fileHash)) > 0;
+}
+
+const PackStore::DerivedRange*
+PackStore::findDerivedRange(const std::string& fileKey, uint64_t segment) const
+{
+  auto derived = m_derived.find(fileKey);
+  if (derived == m_derived.end()) {
+    return nullptr;
+  }
+
+  // last range that begins at or before the segment
+  auto range = std::upper_bound(derived->second.begin(), derived->second.end(), segment,
+                                [] (uint64_t segment, const DerivedRange& range) {
+                                  return segment < range.begin;
+                                });
+  if (range == derived->second.begin() || segment >= (--range)->end) {
+    return nullptr;
+  }
+  return &*range;
+}
+
+std::vector<PackStore::PackUsage>
+PackStore::getPackUsage()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  std::map<uint64_t, PackUsage> usage;
+  for (uint64_t pack : listPacks()) {
+    if (pack != m_currentPack) {
+      boost::system::error_code ec;
+      usage[pack] = PackUsage{pack, fs::file_size(getPackPath(pack), ec), 0};
+    }
+  }
+
+  for (const char* sql : {"SELECT pack, sum(size) FROM Segment WHERE content_digest IS NULL GROUP BY pack",
+                          "SELECT pack, sum(size) FROM Chunk WHERE refcount > 0 GROUP BY pack"}) {
+    Statement stmt(*this, sql);
+    while (stmt.step() == SQLITE_ROW) {
+      auto pack = usage.find(sqlite3_column_int64(stmt, 0));
+      if (pack != usage.end()) {
+        pack->second.liveSize += sqlite3_column_int64(stmt, 1);
+      }
+    }
+  }
+
+  std::vector<PackUsage> packs;
+  for (const auto& pack : usage) {
+    packs.push_back(pack.second);
+  }
+  return packs;
+}
+
+bool
+PackStore::compactPack(uint64_t pack)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (pack == m_currentPack) {
+    BOOST_THROW_EXCEPTION(Error("Cannot compact " + getPackPath(pack).string() + ", it is being appended to"));
+  }
+
+  // whole segment records first, then shared payloads; moved records no longer match the
+  // queries, so each call picks up where the previous one stopped
+  struct Record
+  {
+    Buffer key;    // file hash of a segment or digest of a payload
+    Buffer device; // empty for payloads
+    int type;
+    sqlite3_int64 segment;
+    uint64_t offset;
+    size_t size;
+  };
+  std::vector<Record> records;
+  {
+    Statement select(*this, "SELECT file_hash, device_name, type, segment, offset, size "
+                              "    FROM Segment WHERE pack=? AND content_digest IS NULL LIMIT ?");
+    select.bind(1, static_cast<sqlite3_int64>(pack));
+    select.bind(2, static_cast<int>(COMPACTION_BATCH_SIZE));
+    while (select.step() == SQLITE_ROW) {
+      records.push_back(Record{Buffer(select.getBlob(0), select.getSize(0)),
+                               Buffer(select.getBlob(1), select.getSize(1)),
+                               select.getInt(2), sqlite3_column_int64(select, 3),
+                               static_cast<uint64_t>(sqlite3_column_int64(select, 4)),
+                               static_cast<size_t>(sqlite3_column_int64(select, 5))});
+    }
+  }
+  if (records.size() < COMPACTION_BATCH_SIZE) {
+    // compressed payloads are moved as they are
+    Statement select(*this, "SELECT digest, offset, size FROM Chunk "
+                              "    WHERE pack=? AND refcount > 0 LIMIT ?");
+    select.bind(1, static_cast<sqlite3_int64>(pack));
+    select.bind(2, static_cast<int>(COMPACTION_BATCH_SIZE - records.size()));
+    while (select.step() == SQLITE_ROW) {
+      records.push_back(Record{Buffer(select.getBlob(0), select.getSize(0)), Buffer(), 0, 0,
+                               static_cast<uint64_t>(sqlite3_column_int64(select, 1)),
+                               static_cast<size_t>(sqlite3_column_int64(select, 2))});
+    }
+  }
+
+  if (!records.empty()) {
+    beginIndexUpdate();
+    for (const Record& record : records) {
+      auto wire = readRecord(pack, record.offset, record.size);
+      if (wire == nullptr) {
+        BOOST_THROW_EXCEPTION(Error("Cannot read record to compact " + getPackPath(pack).string()));
+      }
+      uint64_t newPack = 0;
+      uint64_t newOffset = 0;
+      appendRecord(wire->data(), wire->size(), newPack, newOffset);
+
+      if (!record.device.empty()) {
+        Statement update(*this, "UPDATE Segment SET pack=?, offset=? "
+                                  "    WHERE file_hash=? AND device_name=? AND type=? AND segment=?");
+        update.bind(1, static_cast<sqlite3_int64>(newPack));
+        update.bind(2, static_cast<sqlite3_int64>(newOffset));
+        update.bind(3, record.key.data(), record.key.size(), SQLITE_STATIC);
+        update.bind(4, record.device.data(), record.device.size(), SQLITE_STATIC);
+        update.bind(5, record.type);
+        update.bind(6, record.segment);
+        if (update.step() != SQLITE_DONE) {
+          BOOST_THROW_EXCEPTION(Error(sqlite3_errmsg(m_db)));
+        }
+      }
+      else {
+        Statement update(*this, "UPDATE Chunk SET pack=?, offset=? WHERE digest=?");
+        update.bind(1, static_cast<sqlite3_int64>(newPack));
+        update.bind(2, static_cast<sqlite3_int64>(newOffset));
+        update.bind(3, record.key.data(), record.key.size(), SQLITE_STATIC);
+        if (update.step() != SQLITE_DONE) {
+          BOOST_THROW_EXCEPTION(Error(sqlite3_errmsg(m_db)));
+        }
+      }
+    }
+    // moved records must be on disk and indexed before their old copies can go
+    commitIndexUpdate();
+    return false;
+  }
+
+  // unreferenced payloads must not be brought back by saveChunk once the pack is gone
+  beginIndexUpdate();
+  Statement remove(*this, "DELETE FROM Chunk WHERE pack=?");
+  remove.bind(1, static_cast<sqlite3_int64>(pack));
+  if (remove.step() != SQLITE_DONE) {
+    BOOST_THROW_EXCEPTION(Error(sqlite3_errmsg(m_db)));
+  }
+  commitIndexUpdate();
+
+  // readers may still hold locations of the moved records
+  if (m_nReaders > 0) {
+    _LOG_DEBUG("Compacted " << getPackPath(pack) << ", removing it once it is not read");
+    m_retiredPacks.insert(pack);
+  }
+  else {
+    removePack(pack);
+  }
+  return true;
+}
+
+void
+PackStore::removePack(uint64_t pack)
+{
+  auto fd = m_readFds.find(pack);
+  if (fd != m_readFds.end()) {
+    ::close(fd->second);
+    m_readFds.erase(fd);
+  }
+  boost::system::error_code ec;
+  fs::remove(getPackPath(pack), ec);
+  _LOG_DEBUG("Removed compacted " << getPackPath(pack));
+}
+
+PackStore::ReadLock::ReadLock(PackStore& store)
+  : m_store(store)
+{
+  std::lock_guard<std::mutex> lock(m_store.m_mutex);
+  ++m_store.m_nReaders;
+}
+
+PackStore::ReadLock::~ReadLock()
+{
+  std::lock_guard<std::mutex> lock(m_store.m_mutex);
+  if (--m_store.m_nReaders == 0) {
+    for (uint64_t pack : m_store.m_retiredPacks) {
+      m_store.removePack(pack);
+    }
+    m_store.m_retiredPacks.clear();
+  }
+}
+
+PackStore::Stats
+PackStore::getStats()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  Stats stats{0, 0, 0, 0, 0};
+  {
+    Statement stmt(*this, "SELECT count(*), ifnull(sum(size), 0), "
+                            "       ifnull(sum(CASE WHEN content_digest IS NULL THEN size "
+                            "                       ELSE length(shell) END), 0) "
+                            "    FROM Segment");
+    if (stmt.step() == SQLITE_ROW) {
+      stats.nSegments = sqlite3_column_int64(stmt, 0);
+      stats.logicalSize = sqlite3_column_int64(stmt, 1);
+      stats.storedSize = sqlite3_column_int64(stmt, 2);
+    }
+  }
+  {
+    Statement stmt(*this, "SELECT count(*), ifnull(sum(size), 0), count(raw_size) "
+                            "    FROM Chunk WHERE refcount > 0");
+    if (stmt.step() == SQLITE_ROW) {
+      stats.nChunks = sqlite3_column_int64(stmt, 0);
+      stats.storedSize += sqlite3_column_int64(stmt, 1);
+      stats.nCompressedChunks = sqlite3_column_int64(stmt, 2);
+    }
+  }
+  return stats;
+}
+
+void
+PackStore::flush()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  commitIndexUpdate();
+}
+
+void
+PackStore::insertSegment(const Buffer& fileHash, const Name& deviceName, SegmentType type,
+                         uint64_t segment, const Data& data, bool replace)
+{
+  beginIndexUpdate();
+
+  bool isNew = true;
+  {
+    Statement stmt(*this, "SELECT content_digest FROM Segment "
+                            "WHERE file_hash=? AND device_name=? AND type=? AND segment=?");
+    stmt.bind(1, fileHash.data(), fileHash.size(), SQLITE_STATIC);
+    stmt.bind(2, deviceName.wireEncode(), SQLITE_STATIC);
+    stmt.bind(3, static_cast<int>(type));
+    stmt.bind(4, static_cast<sqlite3_int64>(segment));
+    if (stmt.step() == SQLITE_ROW) {
+      if (!replace) {
+        return;
+      }
+      isNew = false;
+      if (sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+        releaseChunk(Buffer(stmt.getBlob(0), stmt.getSize(0)));
+      }
+    }
+  }
+
+  Block shell;
+  ConstBufferPtr contentDigest;
+  if (type == FILE_SEGMENT) {
+    contentDigest = saveChunk(data, shell);
+  }
+
+  // a replaced whole record stays in its pack as garbage
+  uint64_t pack = 0;
+  uint64_t offset = 0;
+  if (contentDigest == nullptr) {
+    appendRecord(data.wireEncode().wire(), data.wireEncode().size(), pack, offset);
+  }
+
+  Statement stmt(*this, "INSERT OR REPLACE INTO Segment "
+                          "(file_hash, device_name, type, segment, pack, offset, size, "
+                          " content_digest, shell) "
+                          "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)");
+  stmt.bind(1, fileHash.data(), fileHash.size(), SQLITE_STATIC);
+  stmt.bind(2, deviceName.wireEncode(), SQLITE_STATIC);
+  stmt.bind(3, static_cast<int>(type));
+  stmt.bind(4, static_cast<sqlite3_int64>(segment));
+  stmt.bind(5, static_cast<sqlite3_int64>(pack));
+  stmt.bind(6, static_cast<sqlite3_int64>(offset));
+  stmt.bind(7, static_cast<sqlite3_int64>(data.wireEncode().size()));
+  if (contentDigest != nullptr) {
+    stmt.bind(8, contentDigest->data(), contentDigest->size(), SQLITE_STATIC);
+    stmt.bind(9, shell.wire(), shell.size(), SQLITE_STATIC);
+  }
+  else {
+    sqlite3_bind_null(stmt, 8);
+    sqlite3_bind_null(stmt, 9);
+  }
+  if (stmt.step() != SQLITE_DONE) {
+    BOOST_THROW_EXCEPTION(Error(sqlite3_errmsg(m_db)));
+  }
+
+  std::string key = makeFileKey(fileHash, deviceName);
+  if (type == FILE_SEGMENT && isNew && findDerivedRange(key, segment) == nullptr) {
+    FileStatus& status = m_files[key];
+    ++status.nSegments;
+
+    Statement file(*this, "INSERT OR REPLACE INTO File (file_hash, device_name, n_segments, n_total) "
+                            "VALUES (?, ?, ?, ?)");
+    file.bind(1, fileHash.data(), fileHash.size(), SQLITE_STATIC);
+    file.bind(2, deviceName.wireEncode(), SQLITE_STATIC);
+    file.bind(3, static_cast<sqlite3_int64>(status.nSegments));
+    file.bind(4, static_cast<sqlite3_int64>(status.nTotalSegments));
+    if (file.step() != SQLITE_DONE) {
+      BOOST_THROW_EXCEPTION(Error(sqlite3_errmsg(m_db)));
+    }
+  }
+
+  if (++m_nPendingUpdates >= MAX_PENDING_UPDATES) {
+    commitIndexUpdate();
+  }
+}
+
+ConstBufferPtr
+PackStore::saveChunk(const Data& data, Block& shell)
+{
+  const Block& content = data.getContent();
+  if (content.value_size() < MIN_CHUNK_SIZE) {
+    return nullptr;
+  }
+
+  Data shellData(data);
+  shellData.setContent(nullptr, 0);
+  shell = shellData.wireEncode();
+
+  // the signature covers the exact encoding, so sharing is only possible when the packet can
+  // be reassembled bit by bit
+  Data reassembled(shell);
+  reassembled.setContent(content.value(), content.value_size());
+  if (reassembled.wireEncode() != data.wireEncode()) {
+    _LOG_DEBUG("Cannot reassemble " << data.getName() << ", storing whole");
+    return nullptr;
+  }
+
+  ConstBufferPtr digest = util::Sha256::computeDigest(content.value(), content.value_size());
+
+  Statement update(*this, "UPDATE Chunk SET refcount=refcount+1 WHERE digest=?");
+  update.bind(1, digest->data(), digest->size(), SQLITE_STATIC);
+  update.step();
+  if (sqlite3_changes(m_db) > 0) {
+    return digest;
+  }
+
+  // compressed payload is kept only if it saves at least 1/8 of the space
+  std::vector<char> compressed;
+  if (m_isCompressionEnabled && isCompressible(content.value(), content.value_size())) {
+    compressPayload(content.value(), content.value_size(), compressed);
+    if (compressed.size() > content.value_size() - content.value_size() / 8) {
+      compressed.clear();
+    }
+  }
+
+  uint64_t pack = 0;
+  uint64_t offset = 0;
+  if (!compressed.empty()) {
+    appendRecord(reinterpret_cast<const uint8_t*>(compressed.data()), compressed.size(), pack, offset);
+  }
+  else {
+    appendRecord(content.value(), content.value_size(), pack, offset);
+  }
+
+  Statement insert(*this, "INSERT INTO Chunk (digest, pack, offset, size, refcount, raw_size) "
+                            "VALUES (?, ?, ?, ?, 1, ?)");
+  insert.bind(1, digest->data(), digest->size(), SQLITE_STATIC);
+  insert.bind(2, static_cast<sqlite3_int64>(pack));
+  insert.bind(3, static_cast<sqlite3_int64>(offset));
+  if (!compressed.empty()) {
+    insert.bind(4, static_cast<sqlite3_int64>(compressed.size()));
+    insert.bind(5, static_cast<sqlite3_int64>(content.value_size()));
+  }
+  else {
+    insert.bind(4, static_cast<sqlite3_int64>(content.value_size()));
+    sqlite3_bind_null(insert, 5);
+  }
+  if (insert.step() != SQLITE_DONE) {
+    BOOST_THROW_EXCEPTION(Error(sqlite3_errmsg(m_db)));
+  }
+  return digest;
+}
+
+void
+PackStore::releaseChunk(const Buffer& digest)
+{
+  // unreferenced chunks stay in their pack as garbage
+  Statement stmt(*this, "UPDATE Chunk SET refcount=refcount-1 WHERE digest=? AND refcount > 0");
+  stmt.bind(1, digest.data(), digest.size(), SQLITE_STATIC);
+  stmt.step();
+}
+
+void
+PackStore::appendRecord(const uint8_t* buffer, size_t size, uint64_t& pack, uint64_t& offset)
+{
+  if (m_appendOffset > 0 && m_appendOffset + size > MAX_PACK_SIZE) {
+    // data in the old pack must be on disk before the index that references it is committed
+    ::fdatasync(m_appendFd);
+    openPackForAppend(m_currentPack + 1);
+  }
+
+  size_t nWritten = 0;
+  while (nWritten < size) {
+    ssize_t n = ::write(m_appendFd, buffer + nWritten, size - nWritten);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      // partially written record is just unreferenced garbage, continue after it
+      struct stat st;
+      if (::fstat(m_appendFd, &st) == 0) {
+        m_appendOffset = st.st_size;
+      }
+      BOOST_THROW_EXCEPTION(Error("Cannot write to " + getPackPath(m_currentPack).string()));
+    }
+    nWritten += n;
+  }
+
+  pack = m_currentPack;
+  offset = m_appendOffset;
+  m_appendOffset += size;
+}
+
+shared_ptr<Buffer>
+PackStore::readRecord(uint64_t pack, uint64_t offset, size_t size)
+{
+  auto buffer = make_shared<Buffer>(size);
+  if (!readRecord(pack, offset, size, buffer->data())) {
+    return nullptr;
+  }
+  return buffer;
+}
+
+bool
+PackStore::readRecord(uint64_t pack, uint64_t offset, size_t size, uint8_t* buffer)
+{
+  int fd = getReadFd(pack);
+
+  size_t nRead = 0;
+  while (nRead < size) {
+    ssize_t n = ::pread(fd, buffer + nRead, size - nRead, offset + nRead);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      _LOG_ERROR("Cannot read " << size << " bytes at " << offset << " from " << getPackPath(pack));
+      return false;
+    }
+    nRead += n;
+  }
+  return true;
+}
+
+shared_ptr<Buffer>
+PackStore::readChunk(uint64_t pack, uint64_t offset, size_t size, size_t rawSize)
+{
+  auto record = readRecord(pack, offset, size);
+  if (record == nullptr || rawSize == 0) {
+    return record;
+  }
+
+  auto payload = make_shared<Buffer>(rawSize);
+  if (!decompressPayload(record->data(), record->size(), payload->data(), rawSize)) {
+    return nullptr;
+  }
+  return payload;
+}
+
+shared_ptr<Data>
+PackStore::readSegment(sqlite3_stmt* stmt)
+{
+  try {
+    if (sqlite3_column_type(stmt, 3) == SQLITE_NULL) {
+      auto wire = readRecord(sqlite3_column_int64(stmt, 0), sqlite3_column_int64(stmt, 1),
+                             sqlite3_column_int64(stmt, 2));
+      if (wire == nullptr) {
+        return nullptr;
+      }
+      return make_shared<Data>(Block(wire));
+    }
+
+    if (sqlite3_column_type(stmt, 4) == SQLITE_NULL) {
+      _LOG_ERROR("Shared payload of a segment is missing");
+      return nullptr;
+    }
+    auto payload = readChunk(sqlite3_column_int64(stmt, 4), sqlite3_column_int64(stmt, 5),
+                             sqlite3_column_int64(stmt, 6),
+                             sqlite3_column_type(stmt, 8) == SQLITE_NULL ? 0 : sqlite3_column_int64(stmt, 8));
+    if (payload == nullptr) {
+      return nullptr;
+    }
+
+    auto data = make_shared<Data>(Block(reinterpret_cast<const uint8_t*>(sqlite3_column_blob(stmt, 3)),
+                                        sqlite3_column_bytes(stmt, 3)));
+    data->setContent(payload->data(), payload->size());
+    return data;
+  }
+  catch (const tlv::Error& e) {
+    _LOG_ERROR("Corrupted segment record: " << e.what());
+    return nullptr;
+  }
+}
+
+int
+PackStore::getReadFd(uint64_t pack)
+{
+  auto fd = m_readFds.find(pack);
+  if (fd != m_readFds.end()) {
+    return fd->second;
+  }
+
+  int newFd = ::open(getPackPath(pack).c_str(), O_RDONLY);
+  if (newFd < 0) {
+    BOOST_THROW_EXCEPTION(Error("Cannot open " + getPackPath(pack).string()));
+  }
+  m_readFds[pack] = newFd;
+  return newFd;
+}
+
+void
+PackStore::openPackForAppend(uint64_t pack)
+{
+  int fd = ::open(getPackPath(pack).c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd < 0) {
+    BOOST_THROW_EXCEPTION(Error("Cannot open " + getPackPath(pack).string()));
+  }
+
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    BOOST_THROW_EXCEPTION(Error("Cannot stat " + getPackPath(pack).string()));
+  }
+
+  if (static_cast<uint64_t>(st.st_size) >= MAX_PACK_SIZE) {
+    ::close(fd);
+    openPackForAppend(pack + 1);
+    return;
+  }
+
+  if (m_appendFd >= 0) {
+    ::close(m_appendFd);
+  }
+  m_appendFd = fd;
+  m_appendOffset = st.st_size;
+  m_currentPack = pack;
+}
+
+std::vector<uint64_t>
+PackStore::listPacks() const
+{
+  std::vector<uint64_t> packs;
+  for (fs::directory_iterator entry(m_folder), end; entry != end; ++entry) {
+    std::string name = entry->path().filename().string();
+    if (name.size() > 10 && name.compare(0, 5, "pack-") == 0 &&
+        name.compare(name.size() - 5, 5, ".pack") == 0) {
+      try {
+        packs.push_back(boost::lexical_cast<uint64_t>(name.substr(5, name.size() - 10)));
+      }
+      catch (const boost::bad_lexical_cast&) {
+        // not a pack file
+      }
+    }
+  }
+  return packs;
+}
+
+fs::path
+PackStore::getPackPath(uint64_t pack) const
+{
+  return m_folder / ("pack-" + std::to_string(pack) + ".pack");
+}
+
+void
+PackStore::beginIndexUpdate()
+{
+  if (!m_isInTransaction) {
+    sqlite3_exec(m_db, "BEGIN TRANSACTION;", 0, 0, 0);
+    m_isInTransaction = true;
+  }
+}
+
+void
+PackStore::commitIndexUpdate()
+{
+  if (m_isInTransaction) {
+    ::fdatasync(m_appendFd);
+    sqlite3_exec(m_db, "END TRANSACTION;", 0, 0, 0);
+    m_isInTransaction = false;
+    m_nPendingUpdates = 0;
+  }
+}
+
+void
+PackStore::loadFileIndex()
+{
+  {
+    Statement stmt(*this, "SELECT count(*) FROM File");
+    if (stmt.step() == SQLITE_ROW && sqlite3_column_int64(stmt, 0) == 0) {
+      // index created before the File table, or empty
+      char* errmsg = 0;
+      int res = sqlite3_exec(m_db, BUILD_FILE_TABLE.c_str(), nullptr, nullptr, &errmsg);
+      if (res != SQLITE_OK && errmsg != 0) {
+        std::string error = errmsg;
+        sqlite3_free(errmsg);
+        BOOST_THROW_EXCEPTION(Error("Cannot build completeness index: " + error));
+      }
+    }
+  }
+
+  Statement stmt(*this, "SELECT file_hash, device_name, n_segments, n_total FROM File");
+  while (stmt.step() == SQLITE_ROW) {
+    std::string key(reinterpret_cast<const char*>(stmt.getBlob(0)), stmt.getSize(0));
+    key.append(reinterpret_cast<const char*>(stmt.getBlob(1)), stmt.getSize(1));
+
+    FileStatus& status = m_files[key];
+    status.nSegments = sqlite3_column_int64(stmt, 2);
+    status.nTotalSegments = sqlite3_column_int64(stmt, 3);
+  }
+  _LOG_DEBUG("Loaded completeness index of " << m_files.size() << " files");
+}
+
+void
+PackStore::loadDerivedRanges()
+{
+  Statement stmt(*this, "SELECT file_hash, device_name, begin_segment, end_segment, "
+                          "       base_hash, base_device "
+                          "    FROM DerivedRange ORDER BY file_hash, device_name, begin_segment");
+  while (stmt.step() == SQLITE_ROW) {
+    std::string key(reinterpret_cast<const char*>(stmt.getBlob(0)), stmt.getSize(0));
+    key.append(reinterpret_cast<const char*>(stmt.getBlob(1)), stmt.getSize(1));
+
+    DerivedRange range{static_cast<uint64_t>(sqlite3_column_int64(stmt, 2)),
+                       static_cast<uint64_t>(sqlite3_column_int64(stmt, 3)),
+                       Buffer(stmt.getBlob(4), stmt.getSize(4)), Name(stmt.getBlock(5))};
+    ++m_nDerivedFromBase[toKey(range.baseHash)];
+    m_derived[key].push_back(std::move(range));
+  }
+}
+
+void
+PackStore::migrateLegacyDatabases()
+{
+  // <folder>/objects/<first-pair-of-hash-bytes>/<rest-of-hash>
+  std::vector<std::pair<fs::path, shared_ptr<Buffer>>> databases;
+  for (fs::directory_iterator dir(m_folder), end; dir != end; ++dir) {
+    std::string prefix = dir->path().filename().string();
+    if (prefix.size() != 2 || !fs::is_directory(dir->status())) {
+      continue;
+    }
+
+    for (fs::directory_iterator db(dir->path()); db != end; ++db) {
+      if (!fs::is_regular_file(db->status())) {
+        continue;
+      }
+      try {
+        databases.push_back(std::make_pair(db->path(), fromHex(prefix + db->path().filename().string())));
+      }
+      catch (const StringHelperError&) {
+        // journal or an unrelated file
+      }
+    }
+  }
+
+  if (databases.empty()) {
+    return;
+  }
+
+  _LOG_DEBUG("Importing " << databases.size() << " object databases into " << m_folder);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (const auto& db : databases) {
+    if (migrateLegacyDatabase(db.first, *db.second)) {
+      // legacy database is removed only when all its segments are safely in the pack store
+      commitIndexUpdate();
+      fs::remove(db.first);
+
+      boost::system::error_code ec;
+      fs::remove(db.first.parent_path(), ec); // fails unless the directory is empty
+    }
+  }
+  commitIndexUpdate();
+}
+
+bool
+PackStore::migrateLegacyDatabase(const fs::path& dbPath, const Buffer& fileHash)
+{
+  sqlite3* db = nullptr;
+  if (sqlite3_open_v2(dbPath.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+    _LOG_ERROR("Cannot open legacy object database " << dbPath);
+    sqlite3_close(db);
+    return false;
+  }
+
+  bool isOk = true;
+  try {
+    for (auto table : {std::make_pair(FILE_SEGMENT, "File"), std::make_pair(MANIFEST_SEGMENT, "Manifest")}) {
+      Sqlite3Statement hasTable(db, "SELECT count(*) FROM sqlite_master WHERE type='table' AND name=?");
+      hasTable.bind(1, table.second, std::strlen(table.second), SQLITE_STATIC);
+      if (hasTable.step() != SQLITE_ROW || hasTable.getInt(0) == 0) {
+        continue;
+      }
+
+      Sqlite3Statement stmt(db, std::string("SELECT device_name, segment, content_object FROM ") +
+                                  table.second + " WHERE content_object IS NOT NULL");
+      while (stmt.step() == SQLITE_ROW) {
+        Name deviceName(stmt.getBlock(0));
+        Data data(stmt.getBlock(2));
+        insertSegment(fileHash, deviceName, table.first, sqlite3_column_int64(stmt, 1), data, false);
+      }
+    }
+  }
+  catch (const std::exception& e) {
+    _LOG_ERROR("Cannot import legacy object database " << dbPath << ": " << e.what());
+    isOk = false;
+  }
+
+  sqlite3_close(db);
+  return isOk;
+}
+
+} // namespace chronoshare
+} // namespace ndn
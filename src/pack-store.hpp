@@ -0,0 +1,491 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#ifndef CHRONOSHARE_SRC_PACK_STORE_HPP
+#define CHRONOSHARE_SRC_PACK_STORE_HPP
+
+#include "db-helper.hpp"
+#include "core/chronoshare-common.hpp"
+
+#include <ndn-cxx/data.hpp>
+#include <ndn-cxx/name.hpp>
+
+#include <boost/filesystem.hpp>
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
+namespace ndn {
+namespace chronoshare {
+
+/**
+ * @brief Log-structured store of file and manifest segments
+ *
+ * Segments of all files are appended to a small number of pack files
+ * (<folder>/objects/pack-<number>.pack), each segment is stored as its Data wire encoding.
+ * A single SQLite index (<folder>/objects/index.db) maps
+ * (file hash, device name, type, segment number) to (pack, offset, size).
+ *
+ * Payloads of file segments are stored once per distinct content (keyed by SHA-256 of the
+ * payload) and are reference counted, so identical segments of different files or versions
+ * share storage.  For such segments the index only keeps the Data packet without its content,
+ * the packet is reassembled on retrieval.  Segments that would not reassemble to the exact
+ * original encoding are stored whole.
+ *
+ * Optionally (setCompression), shared payloads are stored zlib-compressed, unless an entropy
+ * probe shows they are already compressed or compression does not save enough.  Decompression
+ * is transparent to all readers.
+ *
+ * The index also keeps, per (file hash, device name), the number of stored file segments and
+ * the number of segments of the whole file (the completeness index).  It is loaded into memory
+ * when the store is opened, so existence and completeness checks do not query the database.
+ *
+ * A file can also have derived segments, which are not stored but are the same as the segments
+ * of another (base) file, e.g. the unchanged beginning of the previous version of a file that
+ * has been appended to (see deriveSegments).
+ *
+ * Records of removed files and replaced segments stay in their packs until the packs are
+ * compacted (compactPack), which moves the remaining live records to the current pack and
+ * removes the old pack file.
+ *
+ * Pack data is written before the index entry and is synced to disk before the index is
+ * committed, so the index never references data that is not on disk.
+ *
+ * Object databases of older versions (<folder>/objects/<xx>/<rest-of-hash>) are imported into
+ * the pack store and removed when the store is opened.
+ *
+ * All methods are thread-safe.
+ */
+class PackStore : public DbHelper
+{
+public:
+  class Error : public DbHelper::Error
+  {
+  public:
+    explicit Error(const std::string& what)
+      : DbHelper::Error(what)
+    {
+    }
+  };
+
+  enum SegmentType {
+    FILE_SEGMENT = 0,
+    MANIFEST_SEGMENT = 1
+  };
+
+  /**
+   * @brief Location of a stored segment, as returned by locateSegments
+   */
+  struct SegmentLocation
+  {
+    uint64_t segment;
+    uint64_t pack;
+    uint64_t offset;
+    size_t size;
+    bool isPayloadOnly; ///< whether the record is just the payload or the whole Data packet
+    size_t rawSize;     ///< size of the payload if the record is compressed, 0 otherwise
+  };
+
+  /**
+   * @brief Segments with their segment numbers, in the order of segment numbers
+   */
+  typedef std::vector<std::pair<uint64_t, shared_ptr<Data>>> SegmentBatch;
+
+  /**
+   * @brief Entry of the completeness index
+   */
+  struct FileStatus
+  {
+    uint64_t nSegments;      ///< number of stored file segments
+    uint64_t nTotalSegments; ///< number of segments of the whole file, 0 if not known
+
+    /**
+     * @brief Whether all file segments are stored
+     *
+     * Files with unknown number of segments are considered complete once any segment is stored
+     */
+    bool
+    isComplete() const
+    {
+      return nSegments > 0 && nSegments >= nTotalSegments;
+    }
+  };
+
+  /**
+   * @brief Range of file segments that are the same as the segments of a base file
+   */
+  struct DerivedRange
+  {
+    uint64_t begin; ///< first segment of the range
+    uint64_t end;   ///< segment after the range
+    Buffer baseHash;
+    Name baseDevice;
+  };
+
+  struct PackUsage
+  {
+    uint64_t pack;
+    uint64_t size;     ///< size of the pack file
+    uint64_t liveSize; ///< size of the records in the pack that are still referenced
+  };
+
+  struct Stats
+  {
+    uint64_t nSegments;
+    uint64_t nChunks;      ///< number of distinct stored payloads
+    uint64_t logicalSize;  ///< total size of all stored segments
+    uint64_t storedSize;   ///< size actually taken by the segments in packs and the index
+    uint64_t nCompressedChunks;
+
+    /**
+     * @brief Ratio of logical and stored size, 1 when nothing is deduplicated or compressed
+     */
+    double
+    getDedupRatio() const
+    {
+      return storedSize == 0 ? 1.0 : static_cast<double>(logicalSize) / storedSize;
+    }
+  };
+
+  /**
+   * @brief Keeps pack files from being removed while segments located with locateSegments are
+   *        read
+   *
+   * Must be taken before the segments are located.  Packs compacted while any ReadLock is held
+   * keep their files (and so the records at the located offsets) until the last one is released.
+   */
+  class ReadLock : private boost::noncopyable
+  {
+  public:
+    explicit
+    ReadLock(PackStore& store);
+
+    ~ReadLock();
+
+  private:
+    PackStore& m_store;
+  };
+
+public:
+  /**
+   * @brief Get the store for @p folder, opening it if it is not yet open in this process
+   *
+   * There is at most one open PackStore per folder; it is closed when the last reference is gone
+   */
+  static shared_ptr<PackStore>
+  open(const boost::filesystem::path& folder);
+
+  explicit
+  PackStore(const boost::filesystem::path& folder);
+
+  ~PackStore();
+
+  /**
+   * @brief Append segment to the current pack file
+   * @param replace whether to replace already stored segment with the same key
+   */
+  void
+  saveSegment(const Buffer& fileHash, const Name& deviceName, SegmentType type, uint64_t segment,
+              const Data& data, bool replace);
+
+  /**
+   * @brief Append segments to the current pack file, taking the store lock only once
+   *
+   * Same as calling saveSegment for each of @p segments (null segments are skipped)
+   */
+  void
+  saveSegments(const Buffer& fileHash, const Name& deviceName, SegmentType type,
+               const SegmentBatch& segments, bool replace);
+
+  shared_ptr<Data>
+  fetchSegment(const Buffer& fileHash, const Name& deviceName, SegmentType type, uint64_t segment);
+
+  /**
+   * @brief Get all stored segments of the given type in the order of segment numbers
+   */
+  std::vector<shared_ptr<Data>>
+  fetchSegments(const Buffer& fileHash, const Name& deviceName, SegmentType type);
+
+  /**
+   * @brief Get stored segments from @p begin up to (not including) @p end, using a single range
+   *        scan of the index
+   *
+   * Segments that are not stored are skipped
+   */
+  SegmentBatch
+  fetchSegmentRange(const Buffer& fileHash, const Name& deviceName, SegmentType type,
+                    uint64_t begin, uint64_t end);
+
+  /**
+   * @brief Locate all stored segments of the given type in the order of segment numbers,
+   *        using a single range scan of the index
+   *
+   * The locations stay readable only while a ReadLock taken before this call is held
+   */
+  std::vector<SegmentLocation>
+  locateSegments(const Buffer& fileHash, const Name& deviceName, SegmentType type);
+
+  /**
+   * @brief Read payload of a located segment without decoding the Data packet
+   *
+   * @param buffer scratch space, resized as needed and reused between calls
+   * @param[out] payload points into @p buffer
+   * @return false if the record cannot be read or is malformed
+   */
+  bool
+  readPayload(const SegmentLocation& location, Buffer& buffer,
+              const uint8_t*& payload, size_t& payloadSize);
+
+  /**
+   * @brief Get the stored payload with SHA-256 digest @p digest
+   * @return nullptr if no stored segment has such payload
+   */
+  shared_ptr<Buffer>
+  fetchChunk(const Buffer& digest);
+
+  size_t
+  countSegments(const Buffer& fileHash, const Name& deviceName, SegmentType type);
+
+  /**
+   * @brief Look up file segments of @p fileHash from @p deviceName in the completeness index
+   *
+   * Constant time, does not query the database
+   */
+  FileStatus
+  getFileStatus(const Buffer& fileHash, const Name& deviceName);
+
+  /**
+   * @brief Record number of segments of the whole file in the completeness index
+   */
+  void
+  setFileSegmentCount(const Buffer& fileHash, const Name& deviceName, uint64_t nSegments);
+
+  /**
+   * @brief Record that file segments in @p ranges are the same as the segments of their base
+   *        files, without storing them
+   *
+   * Derived segments are read from the base file, with the file hash in the name replaced and
+   * the DigestSha256 signature recomputed.  Base segments in the ranges must be stored (not
+   * derived themselves) and signed with DigestSha256.
+   *
+   * @return false, and nothing is recorded, if the file already has stored or derived segments
+   */
+  bool
+  deriveSegments(const Buffer& fileHash, const Name& deviceName,
+                 const std::vector<DerivedRange>& ranges);
+
+  /**
+   * @brief Get derived segments of @p fileHash from @p deviceName in the order of segment numbers
+   */
+  std::vector<DerivedRange>
+  getDerivedRanges(const Buffer& fileHash, const Name& deviceName);
+
+  /**
+   * @brief Check if any file has segments derived from the segments of @p fileHash
+   */
+  bool
+  isBase(const Buffer& fileHash);
+
+  Stats
+  getStats();
+
+  /**
+   * @brief List files (file hash and device name) in the completeness index
+   */
+  std::vector<std::pair<Buffer, Name>>
+  listFiles();
+
+  /**
+   * @brief Remove all file and manifest segments of @p fileHash from @p deviceName
+   *
+   * The records stay in their packs until the packs are compacted
+   *
+   * @return number of removed segments
+   */
+  size_t
+  removeFile(const Buffer& fileHash, const Name& deviceName);
+
+  /**
+   * @brief Remove manifest segments of @p fileHash from @p deviceName, keeping the file segments
+   * @return number of removed segments
+   */
+  size_t
+  removeManifest(const Buffer& fileHash, const Name& deviceName);
+
+  /**
+   * @brief Get usage of all pack files except the one being appended to
+   */
+  std::vector<PackUsage>
+  getPackUsage();
+
+  /**
+   * @brief Move a batch of live records of @p pack to the current pack
+   *
+   * Each call holds the store for a bounded time.  Once no live records are left, the pack file
+   * is removed, or, if a ReadLock is held, when the last ReadLock is released.
+   *
+   * @return true if the pack has been removed
+   */
+  bool
+  compactPack(uint64_t pack);
+
+  /**
+   * @brief Enable or disable compression of payloads saved from now on
+   *
+   * Disabled by default; payloads stored compressed are readable either way
+   */
+  void
+  setCompression(bool isEnabled)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_isCompressionEnabled = isEnabled;
+  }
+
+  /**
+   * @brief Sync pack data and commit pending index updates
+   */
+  void
+  flush();
+
+private:
+  void
+  insertSegment(const Buffer& fileHash, const Name& deviceName, SegmentType type, uint64_t segment,
+                const Data& data, bool replace);
+
+  /**
+   * @brief Store payload of @p data as a shared chunk
+   * @return the payload digest, or nullptr if the segment has to be stored whole
+   */
+  ConstBufferPtr
+  saveChunk(const Data& data, Block& shell);
+
+  void
+  releaseChunk(const Buffer& digest);
+
+  void
+  appendRecord(const uint8_t* buffer, size_t size, uint64_t& pack, uint64_t& offset);
+
+  shared_ptr<Buffer>
+  readRecord(uint64_t pack, uint64_t offset, size_t size);
+
+  bool
+  readRecord(uint64_t pack, uint64_t offset, size_t size, uint8_t* buffer);
+
+  /**
+   * @brief Read record of a located segment, failing instead of throwing if its pack is gone
+   */
+  bool
+  readLocatedRecord(const SegmentLocation& location, uint8_t* buffer);
+
+  /**
+   * @brief Read payload of a chunk, decompressing it if @p rawSize is not 0
+   */
+  shared_ptr<Buffer>
+  readChunk(uint64_t pack, uint64_t offset, size_t size, size_t rawSize);
+
+  shared_ptr<Data>
+  readSegment(sqlite3_stmt* stmt);
+
+  /**
+   * @brief Read stored (not derived) segments with numbers in [begin, end) in the order of
+   *        segment numbers, appending them to @p segments
+   */
+  void
+  readStoredSegments(const Buffer& fileHash, const Name& deviceName, SegmentType type,
+                     uint64_t begin, uint64_t end, SegmentBatch& segments);
+
+  /**
+   * @brief Locate stored (not derived) segments with numbers in [begin, end) in the order of
+   *        segment numbers, appending them to @p locations
+   */
+  void
+  locateStoredSegments(const Buffer& fileHash, const Name& deviceName, SegmentType type,
+                       uint64_t begin, uint64_t end, std::vector<SegmentLocation>& locations);
+
+  const DerivedRange*
+  findDerivedRange(const std::string& fileKey, uint64_t segment) const;
+
+  int
+  getReadFd(uint64_t pack);
+
+  void
+  removePack(uint64_t pack);
+
+  void
+  openPackForAppend(uint64_t pack);
+
+  std::vector<uint64_t>
+  listPacks() const;
+
+  boost::filesystem::path
+  getPackPath(uint64_t pack) const;
+
+  void
+  beginIndexUpdate();
+
+  void
+  commitIndexUpdate();
+
+  void
+  loadFileIndex();
+
+  void
+  loadDerivedRanges();
+
+  void
+  migrateLegacyDatabases();
+
+  bool
+  migrateLegacyDatabase(const boost::filesystem::path& dbPath, const Buffer& fileHash);
+
+private:
+  boost::filesystem::path m_folder;
+  std::mutex m_mutex;
+
+  uint64_t m_currentPack;
+  int m_appendFd;
+  uint64_t m_appendOffset;
+  std::map<uint64_t, int> m_readFds;
+
+  // number of ReadLocks and compacted packs whose files are removed when there are none
+  size_t m_nReaders;
+  std::set<uint64_t> m_retiredPacks;
+
+  bool m_isInTransaction;
+  size_t m_nPendingUpdates;
+  bool m_isCompressionEnabled;
+
+  // in-memory copy of the File table, keyed by file hash followed by device name encoding
+  std::unordered_map<std::string, FileStatus> m_files;
+
+  // in-memory copy of the DerivedRange table, keyed the same way, ranges are sorted
+  std::unordered_map<std::string, std::vector<DerivedRange>> m_derived;
+  // number of derived ranges by base file hash
+  std::unordered_map<std::string, size_t> m_nDerivedFromBase;
+};
+
+typedef shared_ptr<PackStore> PackStorePtr;
+
+} // namespace chronoshare
+} // namespace ndn
+
+#endif // CHRONOSHARE_SRC_PACK_STORE_HPP
@@ -0,0 +1,294 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#include "partial-file.hpp"
+#include "core/logging.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace ndn {
+namespace chronoshare {
+
+_LOG_INIT(PartialFile);
+
+namespace fs = boost::filesystem;
+
+// received segments are recorded in the map file at least every FLUSH_INTERVAL segments
+const size_t FLUSH_INTERVAL = 256;
+
+// map file: magic, number of segments, segment size, then uint32_t entry per segment
+const char MAP_MAGIC[8] = {'C', 'S', 'P', 'A', 'R', 'T', '0', '1'};
+const size_t MAP_HEADER_SIZE = sizeof(MAP_MAGIC) + 2 * sizeof(uint64_t);
+
+static bool
+readAll(int fd, uint8_t* buffer, size_t size, uint64_t offset)
+{
+  size_t nRead = 0;
+  while (nRead < size) {
+    ssize_t n = ::pread(fd, buffer + nRead, size - nRead, offset + nRead);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    nRead += n;
+  }
+  return true;
+}
+
+static bool
+writeAll(int fd, const uint8_t* buffer, size_t size, uint64_t offset)
+{
+  size_t nWritten = 0;
+  while (nWritten < size) {
+    ssize_t n = ::pwrite(fd, buffer + nWritten, size - nWritten, offset + nWritten);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    nWritten += n;
+  }
+  return true;
+}
+
+PartialFile::PartialFile(const fs::path& path, uint64_t nSegments, size_t segmentSize)
+  : m_path(path)
+  , m_mapPath(path.string() + ".map")
+  , m_segmentSize(segmentSize)
+  , m_fd(-1)
+  , m_mapFd(-1)
+  , m_sizes(nSegments, 0)
+  , m_nReceived(0)
+{
+  if (nSegments == 0 || segmentSize == 0 || segmentSize >= std::numeric_limits<uint32_t>::max()) {
+    BOOST_THROW_EXCEPTION(Error("Invalid layout of partial file " + path.string()));
+  }
+
+  fs::create_directories(m_path.parent_path());
+
+  m_mapFd = ::open(m_mapPath.c_str(), O_RDWR | O_CREAT, 0644);
+  if (m_mapFd < 0) {
+    BOOST_THROW_EXCEPTION(Error("Cannot open " + m_mapPath.string()));
+  }
+
+  // pick up segments received before, if the file is for the same layout
+  uint8_t header[MAP_HEADER_SIZE];
+  bool isResumed = fs::exists(m_path) && readAll(m_mapFd, header, sizeof(header), 0);
+  if (isResumed) {
+    uint64_t mapSegments = 0;
+    uint64_t mapSegmentSize = 0;
+    std::memcpy(&mapSegments, header + sizeof(MAP_MAGIC), sizeof(uint64_t));
+    std::memcpy(&mapSegmentSize, header + sizeof(MAP_MAGIC) + sizeof(uint64_t), sizeof(uint64_t));
+
+    isResumed = std::memcmp(header, MAP_MAGIC, sizeof(MAP_MAGIC)) == 0 &&
+                mapSegments == nSegments && mapSegmentSize == segmentSize &&
+                readAll(m_mapFd, reinterpret_cast<uint8_t*>(m_sizes.data()),
+                        m_sizes.size() * sizeof(uint32_t), MAP_HEADER_SIZE);
+  }
+  if (isResumed) {
+    for (uint32_t size : m_sizes) {
+      if (size > segmentSize + 1) {
+        isResumed = false;
+        break;
+      }
+      if (size != 0) {
+        ++m_nReceived;
+      }
+    }
+  }
+
+  int flags = O_RDWR | O_CREAT;
+  if (!isResumed) {
+    std::fill(m_sizes.begin(), m_sizes.end(), 0);
+    m_nReceived = 0;
+
+    std::memcpy(header, MAP_MAGIC, sizeof(MAP_MAGIC));
+    uint64_t value = nSegments;
+    std::memcpy(header + sizeof(MAP_MAGIC), &value, sizeof(uint64_t));
+    value = segmentSize;
+    std::memcpy(header + sizeof(MAP_MAGIC) + sizeof(uint64_t), &value, sizeof(uint64_t));
+
+    if (::ftruncate(m_mapFd, 0) != 0 ||
+        !writeAll(m_mapFd, header, sizeof(header), 0) ||
+        ::ftruncate(m_mapFd, MAP_HEADER_SIZE + nSegments * sizeof(uint32_t)) != 0) {
+      close();
+      BOOST_THROW_EXCEPTION(Error("Cannot initialize " + m_mapPath.string()));
+    }
+    flags |= O_TRUNC;
+  }
+  else {
+    _LOG_DEBUG("Resuming " << m_path << " with " << m_nReceived << " of " << nSegments << " segments");
+  }
+
+  // sparse, nothing is allocated until segments are written
+  m_fd = ::open(m_path.c_str(), flags, 0644);
+  if (m_fd < 0 || ::ftruncate(m_fd, nSegments * segmentSize) != 0) {
+    close();
+    BOOST_THROW_EXCEPTION(Error("Cannot create " + m_path.string()));
+  }
+}
+
+PartialFile::~PartialFile()
+{
+  try {
+    flush();
+  }
+  catch (const Error& error) {
+    _LOG_ERROR(error.what());
+  }
+  close();
+}
+
+void
+PartialFile::writeSegment(uint64_t segment, const uint8_t* payload, size_t size)
+{
+  if (m_fd < 0) {
+    BOOST_THROW_EXCEPTION(Error("Partial file " + m_path.string() + " is closed"));
+  }
+  if (segment >= m_sizes.size() || size > m_segmentSize) {
+    BOOST_THROW_EXCEPTION(Error("Segment " + std::to_string(segment) + " does not fit into " +
+                                m_path.string()));
+  }
+
+  if (!writeAll(m_fd, payload, size, segment * m_segmentSize)) {
+    BOOST_THROW_EXCEPTION(Error("Cannot write segment " + std::to_string(segment) + " to " +
+                                m_path.string()));
+  }
+
+  if (m_sizes[segment] == 0) {
+    ++m_nReceived;
+  }
+  m_sizes[segment] = static_cast<uint32_t>(size + 1);
+  m_unflushed.push_back(segment);
+
+  if (m_unflushed.size() >= FLUSH_INTERVAL) {
+    flush();
+  }
+}
+
+void
+PartialFile::flush()
+{
+  if (m_unflushed.empty() || m_fd < 0) {
+    return;
+  }
+
+  // data first, so the map never refers to payloads that are not on disk
+  if (::fdatasync(m_fd) != 0) {
+    BOOST_THROW_EXCEPTION(Error("Cannot sync " + m_path.string()));
+  }
+
+  std::sort(m_unflushed.begin(), m_unflushed.end());
+  for (size_t i = 0; i < m_unflushed.size();) {
+    uint64_t first = m_unflushed[i];
+    uint64_t last = first;
+    for (++i; i < m_unflushed.size() && m_unflushed[i] <= last + 1; ++i) {
+      last = m_unflushed[i];
+    }
+    if (!writeAll(m_mapFd, reinterpret_cast<const uint8_t*>(&m_sizes[first]),
+                  (last - first + 1) * sizeof(uint32_t), MAP_HEADER_SIZE + first * sizeof(uint32_t))) {
+      BOOST_THROW_EXCEPTION(Error("Cannot update " + m_mapPath.string()));
+    }
+  }
+  m_unflushed.clear();
+}
+
+void
+PartialFile::finalize(const fs::path& file)
+{
+  if (!isComplete()) {
+    BOOST_THROW_EXCEPTION(Error("Not all segments of " + m_path.string() + " have been received"));
+  }
+  if (m_fd < 0) {
+    BOOST_THROW_EXCEPTION(Error("Partial file " + m_path.string() + " is closed"));
+  }
+
+  // the map describes segments at their places; it goes first, so an interrupted compaction
+  // cannot be mistaken for received segments
+  m_unflushed.clear();
+  ::close(m_mapFd);
+  m_mapFd = -1;
+  boost::system::error_code ec;
+  fs::remove(m_mapPath, ec);
+
+  uint64_t fileSize = 0;
+  std::vector<uint8_t> buffer;
+  for (uint64_t segment = 0; segment < m_sizes.size(); ++segment) {
+    size_t size = m_sizes[segment] - 1;
+    uint64_t offset = segment * m_segmentSize;
+    if (offset != fileSize && size > 0) {
+      // segments shorter than the segment size, move the rest of the file down
+      buffer.resize(size);
+      if (!readAll(m_fd, buffer.data(), size, offset) ||
+          !writeAll(m_fd, buffer.data(), size, fileSize)) {
+        remove();
+        BOOST_THROW_EXCEPTION(Error("Cannot compact " + m_path.string()));
+      }
+    }
+    fileSize += size;
+  }
+
+  if (::ftruncate(m_fd, fileSize) != 0 || ::fsync(m_fd) != 0) {
+    remove();
+    BOOST_THROW_EXCEPTION(Error("Cannot complete " + m_path.string()));
+  }
+  ::close(m_fd);
+  m_fd = -1;
+
+  fs::rename(m_path, file, ec);
+  if (ec) {
+    fs::remove(m_path, ec);
+    BOOST_THROW_EXCEPTION(Error("Cannot move " + m_path.string() + " to " + file.string()));
+  }
+}
+
+void
+PartialFile::remove()
+{
+  close();
+  m_unflushed.clear();
+
+  boost::system::error_code ec;
+  fs::remove(m_path, ec);
+  fs::remove(m_mapPath, ec);
+}
+
+void
+PartialFile::close()
+{
+  if (m_fd >= 0) {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+  if (m_mapFd >= 0) {
+    ::close(m_mapFd);
+    m_mapFd = -1;
+  }
+}
+
+} // namespace chronoshare
+} // namespace ndn
@@ -0,0 +1,152 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#ifndef CHRONOSHARE_SRC_PARTIAL_FILE_HPP
+#define CHRONOSHARE_SRC_PARTIAL_FILE_HPP
+
+#include "core/chronoshare-common.hpp"
+
+#include <boost/filesystem.hpp>
+
+#include <vector>
+
+namespace ndn {
+namespace chronoshare {
+
+/**
+ * @brief File being materialized in place from segments as they are fetched
+ *
+ * Payload of segment N is written at offset N * segmentSize of a sparse file of
+ * nSegments * segmentSize bytes, so segments can arrive in any order and every payload is
+ * written only once.  Sizes of received segments are kept in a map file next to the data
+ * (<path>.map), so a partially fetched file survives restarts.  The map is only updated after
+ * the data it refers to has been synced, so it never claims segments that could be lost.
+ *
+ * Once all segments have arrived, finalize() moves the file to its destination.  Segments of
+ * files published with fixed-size segments are already in place, so this is a truncate and a
+ * rename; segments of other files are first moved together.
+ */
+class PartialFile : private boost::noncopyable
+{
+public:
+  class Error : public std::runtime_error
+  {
+  public:
+    explicit Error(const std::string& what)
+      : std::runtime_error(what)
+    {
+    }
+  };
+
+public:
+  /**
+   * @brief Open partial file at @p path, or create it if it does not exist yet
+   *
+   * Received segments are kept only if the existing file was created for the same number and
+   * size of segments
+   *
+   * @param segmentSize maximum payload size of the segments
+   */
+  PartialFile(const boost::filesystem::path& path, uint64_t nSegments, size_t segmentSize);
+
+  /**
+   * @brief Flush received segments and close the file
+   */
+  ~PartialFile();
+
+  /**
+   * @brief Write payload of @p segment at its place
+   * @throw Error if @p segment is out of range, @p size is above the segment size,
+   *        or the file cannot be written
+   */
+  void
+  writeSegment(uint64_t segment, const uint8_t* payload, size_t size);
+
+  bool
+  hasSegment(uint64_t segment) const
+  {
+    return segment < m_sizes.size() && m_sizes[segment] != 0;
+  }
+
+  uint64_t
+  getSegmentCount() const
+  {
+    return m_sizes.size();
+  }
+
+  uint64_t
+  getReceivedSegmentCount() const
+  {
+    return m_nReceived;
+  }
+
+  bool
+  isComplete() const
+  {
+    return m_nReceived == m_sizes.size();
+  }
+
+  /**
+   * @brief Sync received segments to disk and record them in the map file
+   */
+  void
+  flush();
+
+  /**
+   * @brief Turn the complete file into @p file, replacing it if it exists
+   *
+   * The partial file and its map are gone afterwards
+   *
+   * @throw Error if not all segments have been received or the file cannot be moved
+   */
+  void
+  finalize(const boost::filesystem::path& file);
+
+  /**
+   * @brief Discard the partial file and its map
+   */
+  void
+  remove();
+
+private:
+  void
+  close();
+
+private:
+  boost::filesystem::path m_path;
+  boost::filesystem::path m_mapPath;
+  size_t m_segmentSize;
+  int m_fd;
+  int m_mapFd;
+
+  // payload size + 1 of each segment, 0 if the segment has not been received
+  std::vector<uint32_t> m_sizes;
+  uint64_t m_nReceived;
+
+  // received segments not yet recorded in the map file
+  std::vector<uint64_t> m_unflushed;
+};
+
+typedef shared_ptr<PartialFile> PartialFilePtr;
+
+} // namespace chronoshare
+} // namespace ndn
+
+#endif // CHRONOSHARE_SRC_PARTIAL_FILE_HPP
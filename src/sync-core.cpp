@@ -33,8 +33,12 @@ _LOG_INIT(Sync.Core);
 
 const int SyncCore::FRESHNESS = 2;
 const std::string SyncCore::RECOVER = "RECOVER";
+const std::string SyncCore::RECONCILE = "RECONCILE";
+const size_t SyncCore::RECONCILE_SKETCH_SIZE = 60;
 const double SyncCore::WAIT = 0.05;
 const double SyncCore::RANDOM_PERCENT = 0.5;
+const time::seconds SyncCore::STATE_LOG_PRUNING_INTERVAL = time::minutes(10);
+const size_t SyncCore::STATE_LOG_PRUNING_BATCH = 1000;
 
 SyncCore::SyncCore(Face& face, SyncLogPtr syncLog, const Name& userName, const Name& localPrefix,
                    const Name& syncPrefix, const StateMsgCallback& callback,
@@ -45,6 +49,7 @@ SyncCore::SyncCore(Face& face, SyncLogPtr syncLog, const Name& userName, const N
   , m_syncInterestEvent(m_scheduler)
   , m_periodicInterestEvent(m_scheduler)
   , m_localStateDelayedEvent(m_scheduler)
+  , m_pruneStateLogEvent(m_scheduler)
   , m_stateMsgCallback(callback)
   , m_syncPrefix(syncPrefix)
   , m_recoverWaitGenerator(
@@ -69,6 +74,9 @@ SyncCore::SyncCore(Face& face, SyncLogPtr syncLog, const Name& userName, const N
 
   m_syncInterestEvent =
     m_scheduler.scheduleEvent(time::milliseconds(100), bind(&SyncCore::sendSyncInterest, this));
+
+  m_pruneStateLogEvent =
+    m_scheduler.scheduleEvent(STATE_LOG_PRUNING_INTERVAL, bind(&SyncCore::pruneStateLog, this));
 }
 
 void
@@ -176,21 +184,47 @@ SyncCore::recover(ConstBufferPtr digest)
   if (!(*digest == *m_rootDigest) && m_log->LookupSyncLog(*digest) <= 0) {
     _LOG_TRACE(m_log->GetLocalName() << ", Recover for received_Digest " << toHex(*digest));
     // unfortunately we still don't recognize this digest
-    // append the unknown digest
-    Name recoverInterest(m_syncPrefix);
-    recoverInterest.append(RECOVER).append(name::Component(digest));
+    BufferPtr sketch = serializeMsg(*m_log->GetStateSketch(*m_rootDigest, RECONCILE_SKETCH_SIZE));
+
+    // the sketch is carried by both the Interest and the Data name, so in small groups the whole
+    // state, of about the size of ours, is cheaper
+    BufferPtr state = serializeGZipMsg(*m_log->FindStateDifferences(Buffer(1), *m_rootDigest));
+    if (2 * sketch->size() >= state->size()) {
+      sendRecoverInterest(digest);
+      return;
+    }
 
-    _LOG_DEBUG("[" << m_log->GetLocalName() << "] >>> send RECOVER Interests for " << toHex(*digest));
+    // append the unknown digest and the sketch of our state
+    Name reconcileInterest(m_syncPrefix);
+    reconcileInterest.append(RECONCILE)
+      .append(name::Component(digest))
+      .append(name::Component(sketch));
 
-    m_face.expressInterest(recoverInterest,
+    _LOG_DEBUG("[" << m_log->GetLocalName() << "] >>> send RECONCILE Interests for "
+                   << toHex(*digest));
+
+    m_face.expressInterest(reconcileInterest,
                            bind(&SyncCore::handleRecoverData, this, _1, _2),
-                           bind(&SyncCore::handleRecoverInterestTimeout, this, _1));
+                           bind(&SyncCore::handleReconcileInterestTimeout, this, _1));
   }
   else {
     // we already learned the digest; cheers!
   }
 }
 
+void
+SyncCore::sendRecoverInterest(ConstBufferPtr digest)
+{
+  Name recoverInterest(m_syncPrefix);
+  recoverInterest.append(RECOVER).append(name::Component(digest));
+
+  _LOG_DEBUG("[" << m_log->GetLocalName() << "] >>> send RECOVER Interests for " << toHex(*digest));
+
+  m_face.expressInterest(recoverInterest,
+                         bind(&SyncCore::handleRecoverData, this, _1, _2),
+                         bind(&SyncCore::handleRecoverInterestTimeout, this, _1));
+}
+
 void
 SyncCore::handleInterest(const InterestFilter& filter, const Interest& interest)
 {
@@ -206,6 +240,10 @@ SyncCore::handleInterest(const InterestFilter& filter, const Interest& interest)
     // this is recovery interest
     handleRecoverInterest(name);
   }
+  else if (size == prefixSize + 3 && name.get(m_syncPrefix.size()).toUri() == RECONCILE) {
+    // this is recovery interest with the sketch of the sender's state
+    handleReconcileInterest(name);
+  }
 }
 
 void
@@ -288,6 +326,53 @@ SyncCore::handleRecoverInterest(const Name& name)
   }
 }
 
+void
+SyncCore::handleReconcileInterest(const Name& name)
+{
+  _LOG_DEBUG("[" << m_log->GetLocalName() << "] <<<<< handle RECONCILE Interest with name " << name);
+
+  ConstBufferPtr digest = make_shared<Buffer>(name.get(-2).value(), name.get(-2).value_size());
+  // as for RECOVER, only the peers that know the digest unknown to the sender reply
+  if (m_log->LookupSyncLog(*digest) <= 0) {
+    _LOG_DEBUG("we don't recognize this digest, can not help");
+    return;
+  }
+
+  shared_ptr<SyncStateSketch> sketch =
+    deserializeMsg<SyncStateSketch>(Buffer(name.get(-1).value(), name.get(-1).value_size()));
+  if (!sketch) {
+    _LOG_ERROR("Misformed state sketch");
+    return;
+  }
+
+  SyncStateMsgPtr msg;
+  try {
+    msg = m_log->FindStateDifferences(*sketch, *m_rootDigest);
+  }
+  catch (const SyncLog::Error& e) {
+    _LOG_ERROR("Misformed state sketch: " << e.what());
+    return;
+  }
+
+  if (msg == nullptr) {
+    // the states differ too much for the sketch, reply everything as for RECOVER
+    _LOG_DEBUG("Cannot decode state sketch, replying the whole state");
+    msg = m_log->FindStateDifferences(Buffer(1), *m_rootDigest);
+  }
+
+  BufferPtr syncData = serializeGZipMsg(*msg);
+  shared_ptr<Data> data = make_shared<Data>();
+  data->setName(name);
+  data->setFreshnessPeriod(time::seconds(FRESHNESS));
+  data->setContent(reinterpret_cast<const uint8_t*>(syncData->buf()), syncData->size());
+  m_keyChain.sign(*data);
+  m_face.put(*data);
+
+  _LOG_TRACE("[" << m_log->GetLocalName() << "] publishes " << msg->state_size()
+                 << " entries missing in the sketch of " << toHex(*digest));
+  _LOG_TRACE(msg);
+}
+
 void
 SyncCore::handleSyncInterestTimeout(const Interest& interest)
 {
@@ -303,6 +388,17 @@ SyncCore::handleRecoverInterestTimeout(const Interest& interest)
   // re-expressed
 }
 
+void
+SyncCore::handleReconcileInterestTimeout(const Interest& interest)
+{
+  // peers of older versions only answer RECOVER Interests
+  const Name& name = interest.getName();
+  ConstBufferPtr digest = make_shared<Buffer>(name.get(-2).value(), name.get(-2).value_size());
+  if (!(*digest == *m_rootDigest) && m_log->LookupSyncLog(*digest) <= 0) {
+    sendRecoverInterest(digest);
+  }
+}
+
 void
 SyncCore::handleSyncData(const Interest& interest, Data& data)
 {
@@ -354,36 +450,18 @@ SyncCore::handleStateData(const Buffer& content)
   _LOG_TRACE("[" << m_log->GetLocalName() << "]"
                  << " receives Msg ");
   _LOG_TRACE(msg);
-  int size = msg->state_size();
-  int index = 0;
-  while (index < size) {
-    SyncState state = msg->state(index);
-    std::string devStr = state.name();
-    Name deviceName(Block((const unsigned char*)devStr.c_str(), devStr.size()));
-    if (state.type() == SyncState::UPDATE) {
-      sqlite3_int64 seqno = state.seq();
-      m_log->UpdateDeviceSeqNo(deviceName, seqno);
-      if (state.has_locator()) {
-        std::string locStr = state.locator();
-        Name locatorName(Block((const unsigned char*)locStr.c_str(), locStr.size()));
-        m_log->UpdateLocator(deviceName, locatorName);
-
-        _LOG_TRACE("self: " << m_log->GetLocalName() << ", device: " << deviceName << " < == > "
-                            << locatorName);
-      }
-    }
-    else {
+  for (const SyncState& state : msg->state()) {
+    if (state.type() != SyncState::UPDATE) {
       _LOG_ERROR("Receive SYNC DELETE, but we don't support it yet");
-      deregister(deviceName);
+      const std::string& devStr = state.name();
+      deregister(Name(Block((const unsigned char*)devStr.c_str(), devStr.size())));
     }
-    index++;
   }
 
-  // find the actuall difference and invoke callback on the actual difference
-  ConstBufferPtr oldDigest = m_rootDigest;
-  m_rootDigest = m_log->RememberStateInStateLog();
-  // get diff with both new SeqNo and old SeqNo
-  SyncStateMsgPtr diff = m_log->FindStateDifferences(*oldDigest, *m_rootDigest, true);
+  // the message is applied and the new state remembered in one transaction; the actual
+  // difference, with both new SeqNo and old SeqNo, comes from the applied entries
+  SyncStateMsgPtr diff = make_shared<SyncStateMsg>();
+  m_rootDigest = m_log->ApplyStateMsg(*msg, *diff);
 
   if (diff->state_size() > 0) {
     m_stateMsgCallback(diff);
@@ -397,6 +475,25 @@ SyncCore::deregister(const Name& name)
   // TODO: handle deregistering
 }
 
+void
+SyncCore::pruneStateLog()
+{
+  size_t nPruned = 0;
+  try {
+    nPruned = m_log->PruneStateLog(STATE_LOG_PRUNING_BATCH);
+  }
+  catch (const SyncLog::Error& e) {
+    _LOG_ERROR("Cannot prune sync log: " << e.what());
+  }
+
+  // a full batch means that more states have expired; they are removed in small batches so that
+  // sync Interests and Data are not held up
+  time::milliseconds delay = nPruned < STATE_LOG_PRUNING_BATCH ?
+    time::milliseconds(STATE_LOG_PRUNING_INTERVAL) : time::milliseconds(100);
+  m_pruneStateLogEvent =
+    m_scheduler.scheduleEvent(delay, bind(&SyncCore::pruneStateLog, this));
+}
+
 sqlite3_int64
 SyncCore::seq(const Name& name)
 {
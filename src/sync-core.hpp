@@ -103,8 +103,12 @@ public:
 
   static const int FRESHNESS; // seconds
   static const std::string RECOVER;
+  static const std::string RECONCILE;
+  static const size_t RECONCILE_SKETCH_SIZE; // cells
   static const double WAIT;           // seconds;
   static const double RANDOM_PERCENT; // seconds;
+  static const time::seconds STATE_LOG_PRUNING_INTERVAL;
+  static const size_t STATE_LOG_PRUNING_BATCH;
 
   class Error : public boost::exception, public std::runtime_error
   {
@@ -167,9 +171,20 @@ private:
   void
   sendPeriodicSyncInterest(const time::seconds& interval);
 
+  /**
+   * @brief Ask the peers that know @p digest for the entries of their state we do not have
+   *
+   * A RECONCILE Interest carries a sketch of our state, from which the peers find the entries
+   * missing in it.  If no peer answers, e.g., as all are of older versions, a RECOVER Interest
+   * asks for their whole state.  A RECOVER Interest is sent right away if the whole state is
+   * smaller than the sketch would be on the wire.
+   */
   void
   recover(ConstBufferPtr digest);
 
+  void
+  sendRecoverInterest(ConstBufferPtr digest);
+
   void
   handleInterest(const InterestFilter& filter, const Interest& interest);
 
@@ -179,12 +194,18 @@ private:
   void
   handleRecoverInterest(const Name& name);
 
+  void
+  handleReconcileInterest(const Name& name);
+
   void
   handleSyncInterestTimeout(const Interest& interest);
 
   void
   handleRecoverInterestTimeout(const Interest& interest);
 
+  void
+  handleReconcileInterestTimeout(const Interest& interest);
+
   void
   handleSyncData(const Interest& interest, Data& data);
 
@@ -197,6 +218,12 @@ private:
   void
   deregister(const Name& name);
 
+  /**
+   * @brief Remove a batch of expired states from the sync log and schedule the next batch
+   */
+  void
+  pruneStateLog();
+
 private:
   Face& m_face;
 
@@ -206,6 +233,7 @@ private:
   util::scheduler::ScopedEventId m_syncInterestEvent;
   util::scheduler::ScopedEventId m_periodicInterestEvent;
   util::scheduler::ScopedEventId m_localStateDelayedEvent;
+  util::scheduler::ScopedEventId m_pruneStateLogEvent;
 
   StateMsgCallback m_stateMsgCallback;
 
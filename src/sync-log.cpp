@@ -21,14 +21,14 @@
 #include "sync-log.hpp"
 #include "core/logging.hpp"
 
-#include <ndn-cxx/util/sqlite3-statement.hpp>
+#include <ndn-cxx/util/digest.hpp>
 #include <ndn-cxx/util/string-helper.hpp>
 
+#include <algorithm>
+
 namespace ndn {
 namespace chronoshare {
 
-using util::Sqlite3Statement;
-
 _LOG_INIT(Sync.Log);
 
 // static void
@@ -67,7 +67,8 @@ CREATE INDEX SyncNodes_device_name ON SyncNodes (device_name);         \n\
 CREATE TABLE SyncLog(                                                  \n\
         state_id    INTEGER PRIMARY KEY AUTOINCREMENT,                 \n\
         state_hash  BLOB NOT NULL UNIQUE,                              \n\
-        last_update TIMESTAMP NOT NULL                                 \n\
+        last_update TIMESTAMP NOT NULL,                                \n\
+        prev_state_id INTEGER                                          \n\
     );                                                                 \n\
                                                                        \n\
 CREATE TABLE                                                            \n\
@@ -81,7 +82,7 @@ CREATE TABLE                                                            \n\
     );                                                                  \n\
                                                                         \n\
 CREATE INDEX SyncStateNodes_device_id ON SyncStateNodes (device_id);    \n\
-CREATE INDEX SyncStateNodes_state_id  ON SyncStateNodes (state_id);     \n\
+CREATE INDEX SyncStateNodes_state_id_device_id ON SyncStateNodes (state_id, device_id); \n\
 CREATE INDEX SyncStateNodes_seq_no    ON SyncStateNodes (seq_no);       \n\
                                                                         \n\
 CREATE TRIGGER SyncLogGuard_trigger                                     \n\
@@ -96,16 +97,41 @@ CREATE TRIGGER SyncLogGuard_trigger                                     \n\
     END;                                                                \n\
 ";
 
+// brings databases created before the state history was delta-encoded to the schema above
+const std::string UPGRADE_DATABASE = "\
+CREATE INDEX IF NOT EXISTS SyncStateNodes_state_id_device_id ON SyncStateNodes (state_id, device_id); \n\
+DROP INDEX IF EXISTS SyncStateNodes_state_id;                           \n\
+ALTER TABLE SyncLog ADD COLUMN prev_state_id INTEGER;                   \n\
+";
+
+const int SyncLog::STATE_CHECKPOINT_INTERVAL = 256;
+const time::seconds SyncLog::DEFAULT_STATE_RETENTION = time::days(30);
+const size_t SyncLog::DEFAULT_MAX_STATES = 10000;
+
 SyncLog::SyncLog(const boost::filesystem::path& path, const Name& localName)
-  : DbHelper(path / ".chronoshare", "sync-log.db")
+  : DbHelper(path / ".chronoshare", "metadata.db")
   , m_localName(localName)
+  , m_isStale(true)
+  , m_lastStateId(0)
+  , m_nDeltasSinceCheckpoint(0)
+  , m_stateRetention(DEFAULT_STATE_RETENTION)
+  , m_maxStates(DEFAULT_MAX_STATES)
 {
   sqlite3_exec(m_db, INIT_DATABASE.c_str(), NULL, NULL, NULL);
   _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, "DB Constructor: " << sqlite3_errmsg(m_db));
 
+  // fails once the database has been upgraded
+  sqlite3_exec(m_db, UPGRADE_DATABASE.c_str(), NULL, NULL, NULL);
+
+  importLegacyTables(path / ".chronoshare" / "sync-log.db", {"SyncNodes", "SyncLog", "SyncStateNodes"});
+  compactStateLog();
+
+  // a rolled back transaction can revert seq_no updates already copied into m_nodes
+  sqlite3_rollback_hook(m_db, &SyncLog::onRollback, this);
+
   UpdateDeviceSeqNo(localName, 0);
 
-  Sqlite3Statement stmt(m_db, "SELECT device_id, seq_no FROM SyncNodes WHERE device_name=?");
+  Statement stmt(*this, "SELECT device_id, seq_no FROM SyncNodes WHERE device_name=?");
   stmt.bind(1, m_localName.wireEncode(), SQLITE_STATIC);
 
   if (sqlite3_step(stmt) == SQLITE_ROW) {
@@ -116,20 +142,129 @@ SyncLog::SyncLog(const boost::filesystem::path& path, const Name& localName)
   }
 }
 
-sqlite3_int64
-SyncLog::GetNextLocalSeqNo()
+SyncLog::~SyncLog()
+{
+  // the connection can be shared with other DbHelpers and outlive this object
+  sqlite3_rollback_hook(m_db, nullptr, nullptr);
+}
+
+void
+SyncLog::onRollback(void* self)
+{
+  // the database cannot be used from the hook, so the copies are reloaded on the next access
+  static_cast<SyncLog*>(self)->m_isStale = true;
+}
+
+void
+SyncLog::loadIfStale()
+{
+  if (!m_isStale) {
+    return;
+  }
+  m_isStale = false;
+
+  m_nodes.clear();
+  m_nodesById.clear();
+  m_stateDigest.reset();
+  m_states.clear();
+  m_stateIds.clear();
+  // the changes since the last state are unknown, so the next state is a checkpoint, unless the
+  // current state is already in the log
+  m_lastStateId = 0;
+  m_changedDevices.clear();
+
+  {
+    Statement stmt(*this, "SELECT device_name, device_id, seq_no, last_known_locator FROM SyncNodes");
+    while (stmt.step() == SQLITE_ROW) {
+      Buffer deviceName(stmt.getBlob(0), stmt.getSize(0));
+      sqlite3_int64 deviceId = sqlite3_column_int64(stmt, 1);
+      Node node = {deviceId, sqlite3_column_int64(stmt, 2), Buffer(stmt.getBlob(3), stmt.getSize(3))};
+      m_nodesById[deviceId] = m_nodes.insert(std::make_pair(deviceName, node)).first;
+    }
+  }
+
+  {
+    Statement stmt(*this, "SELECT state_id, state_hash, prev_state_id FROM SyncLog");
+    while (stmt.step() == SQLITE_ROW) {
+      sqlite3_int64 stateId = sqlite3_column_int64(stmt, 0);
+      m_stateIds[Buffer(stmt.getBlob(1), stmt.getSize(1))] = stateId;
+      m_states[stateId].prevStateId = sqlite3_column_int64(stmt, 2); // 0 if NULL
+    }
+  }
+
+  Statement stmt(*this, "SELECT state_id, device_id, seq_no FROM SyncStateNodes "
+                        "ORDER BY state_id, device_id");
+  auto state = m_states.end();
+  while (stmt.step() == SQLITE_ROW) {
+    sqlite3_int64 stateId = sqlite3_column_int64(stmt, 0);
+    if (state == m_states.end() || state->first != stateId) {
+      state = m_states.find(stateId);
+      if (state == m_states.end()) {
+        continue;
+      }
+    }
+    state->second.nodes.push_back(std::make_pair(sqlite3_column_int64(stmt, 1),
+                                                 sqlite3_column_int64(stmt, 2)));
+  }
+}
+
+void
+SyncLog::rememberSeqNo(const Buffer& deviceName, sqlite3_int64 deviceId, sqlite3_int64 seqNo)
+{
+  Nodes::iterator node = m_nodes.find(deviceName);
+  if (node == m_nodes.end()) {
+    node = m_nodes.insert(std::make_pair(deviceName, Node{deviceId, seqNo})).first;
+    m_nodesById[deviceId] = node;
+  }
+  else if (node->second.seqNo < seqNo) {
+    node->second.seqNo = seqNo;
+  }
+  else {
+    return;
+  }
+
+  m_stateDigest.reset();
+  m_changedDevices.insert(node->second.deviceId);
+}
+
+ConstBufferPtr
+SyncLog::getStateDigest()
 {
-  Sqlite3Statement stmt_seq(m_db, "SELECT seq_no FROM SyncNodes WHERE device_id = ?");
-  stmt_seq.bind(1, m_localDeviceId);
+  loadIfStale();
 
-  if (sqlite3_step(stmt_seq) != SQLITE_ROW) {
-    BOOST_THROW_EXCEPTION(Error("Impossible thing in SyncLog::GetNextLocalSeqNo"));
+  if (m_stateDigest != nullptr) {
+    return m_stateDigest;
   }
 
-  _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_DONE,
-                  "DB GetNextLocalSeqNo: " << sqlite3_errmsg(m_db));
+  if (m_nodes.empty()) {
+    // same as the ``hash'' aggregate over no rows
+    m_stateDigest = make_shared<Buffer>(1);
+    return m_stateDigest;
+  }
 
-  sqlite3_int64 seq_no = stmt_seq.getInt(0) + 1;
+  util::Sha256 digest;
+  for (const auto& node : m_nodes) {
+    digest.update(node.first.buf(), node.first.size());
+    digest.update(reinterpret_cast<const uint8_t*>(&node.second.seqNo), sizeof(sqlite3_int64));
+  }
+  m_stateDigest = digest.computeDigest();
+  return m_stateDigest;
+}
+
+sqlite3_int64
+SyncLog::GetNextLocalSeqNo()
+{
+  sqlite3_int64 seq_no = 0;
+  {
+    WriteLock lock(m_stateUpdateMutex);
+    loadIfStale();
+
+    auto node = m_nodesById.find(m_localDeviceId);
+    if (node == m_nodesById.end()) {
+      BOOST_THROW_EXCEPTION(Error("Impossible thing in SyncLog::GetNextLocalSeqNo"));
+    }
+    seq_no = node->second->second.seqNo + 1;
+  }
 
   UpdateDeviceSeqNo(m_localDeviceId, seq_no);
 
@@ -140,126 +275,503 @@ ConstBufferPtr
 SyncLog::RememberStateInStateLog()
 {
   WriteLock lock(m_stateUpdateMutex);
+  loadIfStale();
 
-  int res = sqlite3_exec(m_db, "BEGIN TRANSACTION;", 0, 0, 0);
-
-  res += sqlite3_exec(m_db, "\
-INSERT INTO SyncLog                                                \
-    (state_hash, last_update)                                      \
-    SELECT                                                         \
-       hash(device_name, seq_no), datetime('now')                  \
-    FROM (SELECT * FROM SyncNodes                                  \
-              ORDER BY device_name);                               \
-",
-                      0, 0, 0);
+  sqlite3_exec(m_db, "BEGIN TRANSACTION;", 0, 0, 0);
 
-  _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK, "DbError: " << sqlite3_errmsg(m_db));
+  ConstBufferPtr retval;
+  try {
+    retval = rememberState();
+  }
+  catch (const Error&) {
+    sqlite3_exec(m_db, "ROLLBACK TRANSACTION;", 0, 0, 0);
+    throw;
+  }
 
-  if (res != SQLITE_OK) {
+  if (sqlite3_exec(m_db, "COMMIT;", 0, 0, 0) != SQLITE_OK) {
     sqlite3_exec(m_db, "ROLLBACK TRANSACTION;", 0, 0, 0);
-    BOOST_THROW_EXCEPTION(Error(sqlite3_errmsg(m_db)));
+    BOOST_THROW_EXCEPTION(Error("Some error with rememberStateInStateLog"));
   }
 
-  sqlite3_int64 rowId = sqlite3_last_insert_rowid(m_db);
+  return retval;
+}
 
-  sqlite3_stmt* insertStmt;
-  res += sqlite3_prepare(m_db, "\
-INSERT INTO SyncStateNodes                              \
-      (state_id, device_id, seq_no)                     \
-      SELECT ?, device_id, seq_no                       \
-            FROM SyncNodes;                             \
-",
-                         -1, &insertStmt, 0);
+ConstBufferPtr
+SyncLog::rememberState()
+{
+  ConstBufferPtr retval = getStateDigest();
+
+  // seq_nos never decrease, so a known digest means that nothing has changed since that state
+  auto knownState = m_stateIds.find(*retval);
+  bool isKnownState = knownState != m_stateIds.end();
+  sqlite3_int64 stateId = isKnownState ? knownState->second : 0;
+  State state;
+  bool isCheckpoint = m_lastStateId == 0 || m_nDeltasSinceCheckpoint + 1 >= STATE_CHECKPOINT_INTERVAL;
+  int res = SQLITE_OK;
+
+  if (isKnownState) {
+    Statement updateStmt(*this, "UPDATE SyncLog SET last_update=datetime('now') WHERE state_id=?");
+    updateStmt.bind(1, stateId);
+    if (updateStmt.step() != SQLITE_DONE) {
+      res = SQLITE_ERROR;
+    }
+  }
+  else {
+    {
+      Statement insertStmt(*this, "INSERT INTO SyncLog (state_hash, last_update, prev_state_id) "
+                                  "VALUES (?, datetime('now'), ?)");
+      res += insertStmt.bind(1, retval->buf(), retval->size(), SQLITE_STATIC);
+      if (!isCheckpoint) {
+        res += insertStmt.bind(2, m_lastStateId);
+      }
 
-  res += sqlite3_bind_int64(insertStmt, 1, rowId);
-  sqlite3_step(insertStmt);
+      if (res != SQLITE_OK || insertStmt.step() != SQLITE_DONE) {
+        _LOG_ERROR("DbError: " << sqlite3_errmsg(m_db));
+        BOOST_THROW_EXCEPTION(Error(sqlite3_errmsg(m_db)));
+      }
+    }
 
-  _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_DONE, "DbError: " << sqlite3_errmsg(m_db));
+    stateId = sqlite3_last_insert_rowid(m_db);
+
+    // a checkpoint records the seq_nos of all devices, other states only those changed since the
+    // previous state
+    state.prevStateId = isCheckpoint ? 0 : m_lastStateId;
+    if (isCheckpoint) {
+      for (const auto& node : m_nodes) {
+        state.nodes.push_back(std::make_pair(node.second.deviceId, node.second.seqNo));
+      }
+      std::sort(state.nodes.begin(), state.nodes.end());
+    }
+    else {
+      for (sqlite3_int64 deviceId : m_changedDevices) {
+        state.nodes.push_back(std::make_pair(deviceId, m_nodesById[deviceId]->second.seqNo));
+      }
+    }
+
+    Statement insertStmt(*this, "INSERT INTO SyncStateNodes (state_id, device_id, seq_no) "
+                                "VALUES (?,?,?)");
+    for (const auto& node : state.nodes) {
+      insertStmt.bind(1, stateId);
+      insertStmt.bind(2, node.first);
+      insertStmt.bind(3, node.second);
+      if (insertStmt.step() != SQLITE_DONE) {
+        res = SQLITE_ERROR;
+      }
+      sqlite3_reset(insertStmt);
+    }
+  }
+
+  _LOG_DEBUG_COND(res != SQLITE_OK, "DbError: " << sqlite3_errmsg(m_db));
   if (res != SQLITE_OK) {
-    sqlite3_exec(m_db, "ROLLBACK TRANSACTION;", 0, 0, 0);
     BOOST_THROW_EXCEPTION(Error(sqlite3_errmsg(m_db)));
   }
-  sqlite3_finalize(insertStmt);
 
-  sqlite3_stmt* getHashStmt;
-  res += sqlite3_prepare(m_db, "\
-SELECT state_hash FROM SyncLog WHERE state_id = ?\
-",
-                         -1, &getHashStmt, 0);
-  res += sqlite3_bind_int64(getHashStmt, 1, rowId);
+  // a rollback of the transaction reloads the copies
+  if (!isKnownState) {
+    m_states[stateId] = std::move(state);
+    m_stateIds[*retval] = stateId;
+    m_lastStateId = stateId;
+    m_nDeltasSinceCheckpoint = isCheckpoint ? 0 : m_nDeltasSinceCheckpoint + 1;
+  }
+  else if (stateId != m_lastStateId) {
+    // e.g., after a restart; the next states are deltas from that state
+    m_lastStateId = stateId;
+    m_nDeltasSinceCheckpoint = countDeltasSinceCheckpoint(stateId);
+  }
+  m_changedDevices.clear();
+
+  return retval;
+}
+
+ConstBufferPtr
+SyncLog::ApplyStateMsg(const SyncStateMsg& msg, SyncStateMsg& diff)
+{
+  WriteLock lock(m_stateUpdateMutex);
+  loadIfStale();
+
+  // devices whose seq_no increased, with their old seq_no, in the order of the message
+  std::vector<std::pair<Nodes::iterator, sqlite3_int64>> changes;
+  std::set<sqlite3_int64> changedDevices;
+
+  sqlite3_exec(m_db, "BEGIN TRANSACTION;", 0, 0, 0);
+
+  ConstBufferPtr retval;
+  try {
+    Statement insertStmt(*this, "INSERT INTO SyncNodes (device_name, seq_no) VALUES (?,?)");
+    Statement updateStmt(*this, "UPDATE SyncNodes SET seq_no=? WHERE device_id=?");
+    Statement locatorStmt(*this, "UPDATE SyncNodes SET last_known_locator=?,last_update=datetime("
+                                 "'now', 'localtime') WHERE device_id=?");
+
+    for (const SyncState& state : msg.state()) {
+      if (state.type() != SyncState::UPDATE) {
+        continue;
+      }
 
-  BufferPtr retval;
-  int stepRes = sqlite3_step(getHashStmt);
-  if (stepRes == SQLITE_ROW) {
-    retval = make_shared<Buffer>(static_cast<const uint8_t*>(sqlite3_column_blob(getHashStmt, 0)),
-                                 sqlite3_column_bytes(getHashStmt, 0));
+      Buffer deviceName(state.name().data(), state.name().size());
+      sqlite3_int64 seqNo = state.seq();
+      auto node = m_nodes.find(deviceName);
+      if (node == m_nodes.end()) {
+        insertStmt.bind(1, deviceName.buf(), deviceName.size(), SQLITE_STATIC);
+        insertStmt.bind(2, seqNo);
+        if (insertStmt.step() != SQLITE_DONE) {
+          BOOST_THROW_EXCEPTION(Error("Some error with ApplyStateMsg: " +
+                                      std::string(sqlite3_errmsg(m_db))));
+        }
+        sqlite3_reset(insertStmt);
+
+        rememberSeqNo(deviceName, sqlite3_last_insert_rowid(m_db), seqNo);
+        node = m_nodes.find(deviceName);
+        changes.push_back(std::make_pair(node, 0));
+        changedDevices.insert(node->second.deviceId);
+      }
+      else if (node->second.seqNo < seqNo) {
+        updateStmt.bind(1, seqNo);
+        updateStmt.bind(2, node->second.deviceId);
+        if (updateStmt.step() != SQLITE_DONE) {
+          BOOST_THROW_EXCEPTION(Error("Some error with ApplyStateMsg: " +
+                                      std::string(sqlite3_errmsg(m_db))));
+        }
+        sqlite3_reset(updateStmt);
+
+        if (changedDevices.insert(node->second.deviceId).second) {
+          changes.push_back(std::make_pair(node, node->second.seqNo));
+        }
+        rememberSeqNo(deviceName, node->second.deviceId, seqNo);
+      }
+
+      if (state.has_locator() &&
+          (node->second.locator.size() != state.locator().size() ||
+           !std::equal(node->second.locator.begin(), node->second.locator.end(),
+                       reinterpret_cast<const uint8_t*>(state.locator().data())))) {
+        const std::string& locator = state.locator();
+        locatorStmt.bind(1, static_cast<const void*>(locator.data()), locator.size(), SQLITE_STATIC);
+        locatorStmt.bind(2, node->second.deviceId);
+        if (locatorStmt.step() != SQLITE_DONE) {
+          BOOST_THROW_EXCEPTION(Error("Some error with ApplyStateMsg: " +
+                                      std::string(sqlite3_errmsg(m_db))));
+        }
+        sqlite3_reset(locatorStmt);
+
+        node->second.locator = Buffer(locator.data(), locator.size());
+      }
+    }
+
+    retval = rememberState();
   }
-  else {
+  catch (const Error&) {
     sqlite3_exec(m_db, "ROLLBACK TRANSACTION;", 0, 0, 0);
+    throw;
+  }
 
-    _LOG_ERROR("DbError: " << sqlite3_errmsg(m_db));
-    BOOST_THROW_EXCEPTION(Error("Not a valid hash in rememberStateInStateLog"));
+  if (sqlite3_exec(m_db, "COMMIT;", 0, 0, 0) != SQLITE_OK) {
+    sqlite3_exec(m_db, "ROLLBACK TRANSACTION;", 0, 0, 0);
+    BOOST_THROW_EXCEPTION(Error("Some error with ApplyStateMsg"));
+  }
+
+  for (const auto& change : changes) {
+    SyncState* state = diff.add_state();
+    const Buffer& deviceName = change.first->first;
+    state->set_name(reinterpret_cast<const char*>(deviceName.buf()), deviceName.size());
+    const Buffer& locator = change.first->second.locator;
+    if (!locator.empty()) {
+      state->set_locator(reinterpret_cast<const char*>(locator.buf()), locator.size());
+    }
+    state->set_type(SyncState::UPDATE);
+    state->set_old_seq(change.second);
+    state->set_seq(change.first->second.seqNo);
+  }
+
+  return retval;
+}
+
+void
+SyncLog::compactStateLog()
+{
+  // States of databases created before the history was delta-encoded are all full snapshots.
+  // Every STATE_CHECKPOINT_INTERVAL-th of consecutive snapshots is kept and the others are
+  // reduced to the changes from the previous state.
+  std::vector<std::pair<sqlite3_int64, sqlite3_int64>> deltas; // (state, previous state)
+  {
+    Statement stmt(*this, "SELECT state_id, prev_state_id IS NULL FROM SyncLog ORDER BY state_id");
+    sqlite3_int64 prevStateId = 0;
+    int nSnapshots = 0;
+    while (stmt.step() == SQLITE_ROW) {
+      sqlite3_int64 stateId = sqlite3_column_int64(stmt, 0);
+      if (stmt.getInt(1) == 0) {
+        nSnapshots = 0;
+      }
+      else if (nSnapshots++ % STATE_CHECKPOINT_INTERVAL != 0) {
+        deltas.push_back(std::make_pair(stateId, prevStateId));
+      }
+      prevStateId = stateId;
+    }
+  }
+
+  if (deltas.empty()) {
+    return;
+  }
+
+  _LOG_DEBUG("Reducing " << deltas.size() << " state snapshots to deltas");
+
+  int res = sqlite3_exec(m_db, "BEGIN TRANSACTION;", 0, 0, 0);
+  // from the newest, so that the previous state is still a snapshot
+  for (auto delta = deltas.rbegin(); delta != deltas.rend(); ++delta) {
+    Statement deleteStmt(*this, "\
+DELETE FROM SyncStateNodes                                                      \
+    WHERE state_id=?1 AND                                                       \
+          seq_no=(SELECT seq_no FROM SyncStateNodes prev                        \
+                     WHERE prev.state_id=?2 AND                                 \
+                           prev.device_id=SyncStateNodes.device_id)             \
+");
+    res += deleteStmt.bind(1, delta->first);
+    res += deleteStmt.bind(2, delta->second);
+    if (deleteStmt.step() != SQLITE_DONE) {
+      res = SQLITE_ERROR;
+    }
+
+    Statement updateStmt(*this, "UPDATE SyncLog SET prev_state_id=? WHERE state_id=?");
+    res += updateStmt.bind(1, delta->second);
+    res += updateStmt.bind(2, delta->first);
+    if (updateStmt.step() != SQLITE_DONE) {
+      res = SQLITE_ERROR;
+    }
   }
-  sqlite3_finalize(getHashStmt);
-  res += sqlite3_exec(m_db, "COMMIT;", 0, 0, 0);
 
   if (res != SQLITE_OK) {
+    _LOG_ERROR("Cannot reduce state snapshots to deltas: " << sqlite3_errmsg(m_db));
     sqlite3_exec(m_db, "ROLLBACK TRANSACTION;", 0, 0, 0);
-    BOOST_THROW_EXCEPTION(Error("Some error with rememberStateInStateLog"));
+    return;
   }
+  sqlite3_exec(m_db, "COMMIT;", 0, 0, 0);
 
-  return retval;
+  // return the space of the deleted rows to the file system
+  sqlite3_exec(m_db, "VACUUM;", 0, 0, 0);
 }
 
-sqlite3_int64
-SyncLog::LookupSyncLog(const std::string& stateHash)
+int
+SyncLog::countDeltasSinceCheckpoint(sqlite3_int64 stateId)
 {
-  return LookupSyncLog(*fromHex(stateHash));
+  int nDeltas = 0;
+  for (auto state = m_states.find(stateId);
+       state != m_states.end() && state->second.prevStateId != 0;
+       state = m_states.find(state->second.prevStateId)) {
+    ++nDeltas;
+  }
+  return nDeltas;
 }
 
-sqlite3_int64
-SyncLog::LookupSyncLog(const Buffer& stateHash)
+void
+SyncLog::SetStateRetention(const time::seconds& maxAge, size_t maxStates)
+{
+  WriteLock lock(m_stateUpdateMutex);
+  m_stateRetention = maxAge;
+  m_maxStates = maxStates;
+}
+
+size_t
+SyncLog::PruneStateLog(size_t batchSize)
 {
-  sqlite3_stmt* stmt;
-  int res = sqlite3_prepare(m_db, "SELECT state_id FROM SyncLog WHERE state_hash = ?", -1, &stmt, 0);
+  WriteLock lock(m_stateUpdateMutex);
+  loadIfStale();
 
-  if (res != SQLITE_OK) {
-    BOOST_THROW_EXCEPTION(Error("Cannot prepare statement"));
+  // the current state and the last one in the log are needed for the next sync data
+  sqlite3_int64 currentStateId = 0;
+  auto currentState = m_stateIds.find(*getStateDigest());
+  if (currentState != m_stateIds.end()) {
+    currentStateId = currentState->second;
+  }
+
+  std::map<sqlite3_int64, Buffer> expired; // state_id -> state_hash
+  {
+    Statement stmt(*this, "\
+SELECT state_id, state_hash FROM SyncLog                                        \
+    WHERE state_id < (SELECT max(state_id) FROM SyncLog) AND                    \
+          (last_update < datetime('now', ?1) OR                                 \
+           state_id <= (SELECT state_id FROM SyncLog                            \
+                           ORDER BY state_id DESC LIMIT 1 OFFSET ?2))           \
+    ORDER BY state_id                                                           \
+    LIMIT ?3                                                                    \
+");
+    stmt.bind(1, "-" + std::to_string(m_stateRetention.count()) + " seconds", SQLITE_TRANSIENT);
+    stmt.bind(2, static_cast<sqlite3_int64>(m_maxStates));
+    stmt.bind(3, static_cast<sqlite3_int64>(batchSize));
+    while (stmt.step() == SQLITE_ROW) {
+      sqlite3_int64 stateId = sqlite3_column_int64(stmt, 0);
+      if (stateId != currentStateId && stateId != m_lastStateId) {
+        expired[stateId] = Buffer(stmt.getBlob(1), stmt.getSize(1));
+      }
+    }
+  }
+
+  if (expired.empty()) {
+    return 0;
+  }
+
+  // the kept states whose delta is relative to an expired state are rebuilt before any state is
+  // removed, and become checkpoints
+  std::map<sqlite3_int64, SeqVector> checkpoints;
+  for (const auto& state : m_states) {
+    if (state.second.prevStateId != 0 && expired.count(state.second.prevStateId) > 0 &&
+        expired.count(state.first) == 0) {
+      checkpoints[state.first] = getState(state.first);
+    }
+  }
+
+  _LOG_DEBUG("Pruning " << expired.size() << " states, " << checkpoints.size()
+                        << " states become checkpoints");
+
+  int res = sqlite3_exec(m_db, "BEGIN TRANSACTION;", 0, 0, 0);
+  for (const auto& checkpoint : checkpoints) {
+    Statement deleteStmt(*this, "DELETE FROM SyncStateNodes WHERE state_id=?");
+    res += deleteStmt.bind(1, checkpoint.first);
+    if (deleteStmt.step() != SQLITE_DONE) {
+      res = SQLITE_ERROR;
+    }
+
+    Statement insertStmt(*this, "INSERT INTO SyncStateNodes (state_id, device_id, seq_no) "
+                                "VALUES (?,?,?)");
+    for (const auto& node : checkpoint.second) {
+      insertStmt.bind(1, checkpoint.first);
+      insertStmt.bind(2, node.first);
+      insertStmt.bind(3, node.second);
+      if (insertStmt.step() != SQLITE_DONE) {
+        res = SQLITE_ERROR;
+      }
+      sqlite3_reset(insertStmt);
+    }
+
+    Statement updateStmt(*this, "UPDATE SyncLog SET prev_state_id=NULL WHERE state_id=?");
+    res += updateStmt.bind(1, checkpoint.first);
+    if (updateStmt.step() != SQLITE_DONE) {
+      res = SQLITE_ERROR;
+    }
+  }
+
+  for (const auto& state : expired) {
+    Statement deleteNodesStmt(*this, "DELETE FROM SyncStateNodes WHERE state_id=?");
+    res += deleteNodesStmt.bind(1, state.first);
+    if (deleteNodesStmt.step() != SQLITE_DONE) {
+      res = SQLITE_ERROR;
+    }
+
+    Statement deleteStmt(*this, "DELETE FROM SyncLog WHERE state_id=?");
+    res += deleteStmt.bind(1, state.first);
+    if (deleteStmt.step() != SQLITE_DONE) {
+      res = SQLITE_ERROR;
+    }
   }
 
-  res = sqlite3_bind_blob(stmt, 1, stateHash.buf(), stateHash.size(), SQLITE_STATIC);
   if (res != SQLITE_OK) {
-    BOOST_THROW_EXCEPTION(Error("Cannot bind"));
+    _LOG_ERROR("Cannot prune the state log: " << sqlite3_errmsg(m_db));
+    sqlite3_exec(m_db, "ROLLBACK TRANSACTION;", 0, 0, 0);
+    BOOST_THROW_EXCEPTION(Error("Some error with PruneStateLog"));
   }
 
-  sqlite3_int64 row = 0; // something bad
+  if (sqlite3_exec(m_db, "COMMIT;", 0, 0, 0) != SQLITE_OK) {
+    sqlite3_exec(m_db, "ROLLBACK TRANSACTION;", 0, 0, 0);
+    BOOST_THROW_EXCEPTION(Error("Some error with PruneStateLog"));
+  }
 
-  if (sqlite3_step(stmt) == SQLITE_ROW) {
-    row = sqlite3_column_int64(stmt, 0);
+  for (const auto& state : expired) {
+    m_stateIds.erase(state.second);
+    m_states.erase(state.first);
+  }
+  for (auto& checkpoint : checkpoints) {
+    State& state = m_states[checkpoint.first];
+    state.prevStateId = 0;
+    state.nodes = std::move(checkpoint.second);
   }
+  m_nDeltasSinceCheckpoint = countDeltasSinceCheckpoint(m_lastStateId);
 
-  sqlite3_finalize(stmt);
+  return expired.size();
+}
+
+SyncLog::SeqVector
+SyncLog::getState(const Buffer& stateHash)
+{
+  auto stateId = m_stateIds.find(stateHash);
+  if (stateId == m_stateIds.end()) {
+    return SeqVector();
+  }
+  return getState(stateId->second);
+}
+
+SyncLog::SeqVector
+SyncLog::getState(sqlite3_int64 stateId)
+{
+  // the chain of states back to the nearest checkpoint, whose deltas are applied oldest first
+  std::vector<const State*> chain;
+  for (sqlite3_int64 id = stateId; id != 0;) {
+    auto state = m_states.find(id);
+    if (state == m_states.end()) {
+      // the chain can only be broken if the database was modified behind our back
+      return SeqVector();
+    }
+    chain.push_back(&state->second);
+    id = state->second.prevStateId;
+  }
+
+  if (chain.empty()) {
+    return SeqVector();
+  }
+
+  SeqVector seqs = chain.back()->nodes;
+  for (auto delta = chain.rbegin() + 1; delta != chain.rend(); ++delta) {
+    size_t nSeqs = seqs.size();
+    for (const auto& node : (*delta)->nodes) {
+      auto seq = std::lower_bound(seqs.begin(), seqs.begin() + nSeqs, node,
+                                  [] (const SeqVector::value_type& a, const SeqVector::value_type& b) {
+                                    return a.first < b.first;
+                                  });
+      if (seq != seqs.begin() + nSeqs && seq->first == node.first) {
+        seq->second = node.second;
+      }
+      else {
+        // a device that was not known in the previous state
+        seqs.push_back(node);
+      }
+    }
+    std::inplace_merge(seqs.begin(), seqs.begin() + nSeqs, seqs.end());
+  }
+  return seqs;
+}
 
-  return row;
+sqlite3_int64
+SyncLog::LookupSyncLog(const std::string& stateHash)
+{
+  return LookupSyncLog(*fromHex(stateHash));
+}
+
+sqlite3_int64
+SyncLog::LookupSyncLog(const Buffer& stateHash)
+{
+  WriteLock lock(m_stateUpdateMutex);
+  loadIfStale();
+
+  auto stateId = m_stateIds.find(stateHash);
+  return stateId != m_stateIds.end() ? stateId->second : 0;
 }
 
 void
 SyncLog::UpdateDeviceSeqNo(const Name& name, sqlite3_int64 seqNo)
 {
-  sqlite3_stmt* stmt;
+  WriteLock lock(m_stateUpdateMutex);
+  loadIfStale();
+
   // update is performed using trigger
-  int res =
-    sqlite3_prepare(m_db, "INSERT INTO SyncNodes (device_name, seq_no) VALUES (?,?);", -1, &stmt, 0);
+  Statement stmt(*this, "INSERT INTO SyncNodes (device_name, seq_no) VALUES (?,?);");
 
-  res +=
+  int res =
     sqlite3_bind_blob(stmt, 1, name.wireEncode().wire(), name.wireEncode().size(), SQLITE_STATIC);
   res += sqlite3_bind_int64(stmt, 2, seqNo);
-  sqlite3_step(stmt);
 
-  if (res != SQLITE_OK) {
+  if (res != SQLITE_OK || sqlite3_step(stmt) != SQLITE_DONE) {
     BOOST_THROW_EXCEPTION(Error("Some error with UpdateDeviceSeqNo(name)"));
   }
-  sqlite3_finalize(stmt);
+
+  // the row id is only meaningful if the trigger has not turned the insert into an update
+  rememberSeqNo(Buffer(name.wireEncode().wire(), name.wireEncode().size()),
+                sqlite3_last_insert_rowid(m_db), seqNo);
 }
 
 void
@@ -271,48 +783,37 @@ SyncLog::UpdateLocalSeqNo(sqlite3_int64 seqNo)
 void
 SyncLog::UpdateDeviceSeqNo(sqlite3_int64 deviceId, sqlite3_int64 seqNo)
 {
-  sqlite3_stmt* stmt;
+  WriteLock lock(m_stateUpdateMutex);
+  loadIfStale();
+
   // update is performed using trigger
-  int res = sqlite3_prepare(m_db, "UPDATE SyncNodes SET seq_no=MAX(seq_no,?) WHERE device_id=?;",
-                            -1, &stmt, 0);
+  Statement stmt(*this, "UPDATE SyncNodes SET seq_no=MAX(seq_no,?) WHERE device_id=?;");
 
-  res += sqlite3_bind_int64(stmt, 1, seqNo);
+  int res = sqlite3_bind_int64(stmt, 1, seqNo);
   res += sqlite3_bind_int64(stmt, 2, deviceId);
-  sqlite3_step(stmt);
 
-  if (res != SQLITE_OK) {
+  if (res != SQLITE_OK || sqlite3_step(stmt) != SQLITE_DONE) {
+    _LOG_DEBUG("DB UpdateDeviceSeqNo: " << sqlite3_errmsg(m_db));
     BOOST_THROW_EXCEPTION(Error("Some error with UpdateDeviceSeqNo(id)"));
   }
 
-  _LOG_DEBUG_COND(sqlite3_errcode(m_db) != SQLITE_OK,
-                  "DB UpdateDeviceSeqNo: " << sqlite3_errmsg(m_db));
-
-  sqlite3_finalize(stmt);
+  auto node = m_nodesById.find(deviceId);
+  if (node != m_nodesById.end()) {
+    rememberSeqNo(node->second->first, deviceId, seqNo);
+  }
 }
 
 Name
 SyncLog::LookupLocator(const Name& deviceName)
 {
-  sqlite3_stmt* stmt;
-  sqlite3_prepare_v2(m_db, "SELECT last_known_locator FROM SyncNodes WHERE device_name=?;", -1,
-                     &stmt, 0);
-  sqlite3_bind_blob(stmt, 1, deviceName.wireEncode().wire(), deviceName.wireEncode().size(),
-                    SQLITE_STATIC);
-  int res = sqlite3_step(stmt);
-  Name locator;
-  switch (res) {
-    case SQLITE_ROW: {
-      locator = Name(Block(sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0)));
-    }
-    case SQLITE_DONE:
-      break;
-    default:
-      BOOST_THROW_EXCEPTION(Error("Error in LookupLocator()"));
-  }
-
-  sqlite3_finalize(stmt);
+  WriteLock lock(m_stateUpdateMutex);
+  loadIfStale();
 
-  return locator;
+  auto node = m_nodes.find(Buffer(deviceName.wireEncode().wire(), deviceName.wireEncode().size()));
+  if (node == m_nodes.end() || node->second.locator.empty()) {
+    return Name();
+  }
+  return Name(Block(node->second.locator.buf(), node->second.locator.size()));
 }
 
 Name
@@ -324,22 +825,26 @@ SyncLog::LookupLocalLocator()
 void
 SyncLog::UpdateLocator(const Name& deviceName, const Name& locator)
 {
-  sqlite3_stmt* stmt;
-  sqlite3_prepare_v2(m_db, "UPDATE SyncNodes SET last_known_locator=?,last_update=datetime('now', "
-                           "'localtime') WHERE device_name=?;",
-                     -1, &stmt, 0);
+  Statement stmt(*this, "UPDATE SyncNodes SET last_known_locator=?,last_update=datetime('now', "
+                        "'localtime') WHERE device_name=?;");
 
   sqlite3_bind_blob(stmt, 1, locator.wireEncode().wire(), locator.wireEncode().size(), SQLITE_STATIC);
   sqlite3_bind_blob(stmt, 2, deviceName.wireEncode().wire(), deviceName.wireEncode().size(),
                     SQLITE_STATIC);
 
+  WriteLock lock(m_stateUpdateMutex);
+  loadIfStale();
+
   int res = sqlite3_step(stmt);
 
   if (res != SQLITE_OK && res != SQLITE_DONE) {
     BOOST_THROW_EXCEPTION(Error("Error in UpdateLoactor()"));
   }
 
-  sqlite3_finalize(stmt);
+  auto node = m_nodes.find(Buffer(deviceName.wireEncode().wire(), deviceName.wireEncode().size()));
+  if (node != m_nodes.end()) {
+    node->second.locator = Buffer(locator.wireEncode().wire(), locator.wireEncode().size());
+  }
 }
 
 void
@@ -358,113 +863,189 @@ SyncLog::FindStateDifferences(const std::string& oldHash, const std::string& new
 SyncStateMsgPtr
 SyncLog::FindStateDifferences(const Buffer& oldHash, const Buffer& newHash, bool includeOldSeq)
 {
-  sqlite3_stmt* stmt;
-
-  int res = sqlite3_prepare_v2(m_db, "\
-SELECT sn.device_name, sn.last_known_locator, s_old.seq_no, s_new.seq_no\
-    FROM (SELECT *                                                      \
-            FROM SyncStateNodes                                         \
-            WHERE state_id=(SELECT state_id                             \
-                                FROM SyncLog                            \
-                                WHERE state_hash=:old_hash)) s_old      \
-    LEFT JOIN (SELECT *                                                 \
-                FROM SyncStateNodes                                     \
-                WHERE state_id=(SELECT state_id                         \
-                                    FROM SyncLog                        \
-                                    WHERE state_hash=:new_hash)) s_new  \
-                                                                        \
-        ON s_old.device_id = s_new.device_id                            \
-    JOIN SyncNodes sn ON sn.device_id = s_old.device_id                 \
-                                                                        \
-    WHERE s_new.seq_no IS NULL OR                                       \
-          s_old.seq_no != s_new.seq_no                                  \
-                                                                        \
-UNION ALL                                                               \
-                                                                        \
-SELECT sn.device_name, sn.last_known_locator, s_old.seq_no, s_new.seq_no\
-    FROM (SELECT *                                                      \
-            FROM SyncStateNodes                                         \
-            WHERE state_id=(SELECT state_id                             \
-                                FROM SyncLog                            \
-                                WHERE state_hash=:new_hash )) s_new     \
-    LEFT JOIN (SELECT *                                                 \
-                FROM SyncStateNodes                                     \
-                WHERE state_id=(SELECT state_id                         \
-                                    FROM SyncLog                        \
-                                    WHERE state_hash=:old_hash)) s_old  \
-                                                                        \
-        ON s_old.device_id = s_new.device_id                            \
-    JOIN SyncNodes sn ON sn.device_id = s_new.device_id                 \
-                                                                        \
-    WHERE s_old.seq_no IS NULL                                          \
-",
-                               -1, &stmt, 0);
-
-  if (res != SQLITE_OK) {
-    BOOST_THROW_EXCEPTION(Error("Some error with FindStateDifferences"));
-  }
+  WriteLock lock(m_stateUpdateMutex);
+  loadIfStale();
 
-  res += sqlite3_bind_blob(stmt, 1, oldHash.buf(), oldHash.size(), SQLITE_STATIC);
-  res += sqlite3_bind_blob(stmt, 2, newHash.buf(), newHash.size(), SQLITE_STATIC);
+  // unknown states are empty
+  SeqVector oldState = getState(oldHash);
+  SeqVector newState = getState(newHash);
 
   SyncStateMsgPtr msg = make_shared<SyncStateMsg>();
 
-  // sqlite3_trace(m_db, xTrace, NULL);
+  auto addState = [&] (sqlite3_int64 deviceId, const sqlite3_int64* oldSeqNo,
+                       const sqlite3_int64* newSeqNo) {
+    auto node = m_nodesById.find(deviceId);
+    if (node == m_nodesById.end()) {
+      return;
+    }
 
-  while (sqlite3_step(stmt) == SQLITE_ROW) {
     SyncState* state = msg->add_state();
 
     // set name
-    state->set_name(reinterpret_cast<const char*>(sqlite3_column_blob(stmt, 0)),
-                    sqlite3_column_bytes(stmt, 0));
+    const Buffer& deviceName = node->second->first;
+    state->set_name(reinterpret_cast<const char*>(deviceName.buf()), deviceName.size());
 
     // locator is optional, so must check if it is null
-    if (sqlite3_column_type(stmt, 1) == SQLITE_BLOB) {
-      state->set_locator(reinterpret_cast<const char*>(sqlite3_column_blob(stmt, 1)),
-                         sqlite3_column_bytes(stmt, 1));
+    const Buffer& locator = node->second->second.locator;
+    if (!locator.empty()) {
+      state->set_locator(reinterpret_cast<const char*>(locator.buf()), locator.size());
     }
 
     // set old seq
     if (includeOldSeq) {
-      if (sqlite3_column_type(stmt, 2) == SQLITE_NULL) {
-        // old seq is zero; we always have an initial action of zero seq
-        // other's do not need to fetch this action
-        state->set_old_seq(0);
-      }
-      else {
-        sqlite3_int64 oldSeqNo = sqlite3_column_int64(stmt, 2);
-        state->set_old_seq(oldSeqNo);
-      }
+      // old seq is zero if unknown; we always have an initial action of zero seq
+      // other's do not need to fetch this action
+      state->set_old_seq(oldSeqNo != nullptr ? *oldSeqNo : 0);
     }
 
     // set new seq
-    if (sqlite3_column_type(stmt, 3) == SQLITE_NULL) {
+    if (newSeqNo == nullptr) {
       state->set_type(SyncState::DELETE);
     }
     else {
-      sqlite3_int64 newSeqNo = sqlite3_column_int64(stmt, 3);
       state->set_type(SyncState::UPDATE);
-      state->set_seq(newSeqNo);
+      state->set_seq(*newSeqNo);
+    }
+  };
+
+  // both are sorted by device_id
+  auto oldNode = oldState.begin();
+  auto newNode = newState.begin();
+  while (oldNode != oldState.end() || newNode != newState.end()) {
+    if (newNode == newState.end() || (oldNode != oldState.end() && oldNode->first < newNode->first)) {
+      addState(oldNode->first, &oldNode->second, nullptr);
+      ++oldNode;
+    }
+    else if (oldNode == oldState.end() || newNode->first < oldNode->first) {
+      addState(newNode->first, nullptr, &newNode->second);
+      ++newNode;
     }
+    else {
+      if (oldNode->second != newNode->second) {
+        addState(oldNode->first, &oldNode->second, &newNode->second);
+      }
+      ++oldNode;
+      ++newNode;
+    }
+  }
 
-    // std::cout << sqlite3_column_text (stmt, 0) <<
-    //   ": from "  << sqlite3_column_int64 (stmt, 1) <<
-    //   " to "     << sqlite3_column_int64 (stmt, 2) <<
-    //   std::endl;
+  return msg;
+}
+
+// key of a (device_name, seq_no) entry in state sketches, the same on all peers
+static uint64_t
+sketchKey(const Buffer& deviceName, sqlite3_int64 seqNo)
+{
+  uint8_t seq[sizeof(uint64_t)];
+  for (size_t i = 0; i < sizeof(seq); ++i) {
+    seq[i] = static_cast<uint8_t>(static_cast<uint64_t>(seqNo) >> (8 * (sizeof(seq) - 1 - i)));
   }
-  sqlite3_finalize(stmt);
 
-  // sqlite3_trace(m_db, NULL, NULL);
+  util::Sha256 digest;
+  digest.update(deviceName.buf(), deviceName.size());
+  digest.update(seq, sizeof(seq));
+  ConstBufferPtr hash = digest.computeDigest();
 
+  uint64_t key = 0;
+  for (size_t i = 0; i < sizeof(key); ++i) {
+    key = (key << 8) | (*hash)[i];
+  }
+  return key;
+}
+
+Iblt
+SyncLog::buildSketch(const SeqVector& state, size_t nCells,
+                     std::unordered_map<uint64_t, SeqVector::value_type>* entries)
+{
+  Iblt sketch(nCells);
+  for (const auto& node : state) {
+    auto device = m_nodesById.find(node.first);
+    if (device == m_nodesById.end()) {
+      continue;
+    }
+
+    uint64_t key = sketchKey(device->second->first, node.second);
+    sketch.insert(key);
+    if (entries != nullptr) {
+      (*entries)[key] = node;
+    }
+  }
+  return sketch;
+}
+
+shared_ptr<SyncStateSketch>
+SyncLog::GetStateSketch(const Buffer& stateHash, size_t nCells)
+{
+  WriteLock lock(m_stateUpdateMutex);
+  loadIfStale();
+
+  Iblt sketch = buildSketch(getState(stateHash), nCells);
+
+  auto msg = make_shared<SyncStateSketch>();
+  for (const auto& cell : sketch.getCells()) {
+    msg->add_count(cell.count);
+    msg->add_key_sum(cell.keySum);
+    msg->add_hash_sum(cell.hashSum);
+  }
+  return msg;
+}
+
+SyncStateMsgPtr
+SyncLog::FindStateDifferences(const SyncStateSketch& sketch, const Buffer& newHash)
+{
+  if (sketch.count_size() != sketch.key_sum_size() || sketch.count_size() != sketch.hash_sum_size() ||
+      sketch.count_size() == 0 || sketch.count_size() % Iblt::N_HASHES != 0) {
+    BOOST_THROW_EXCEPTION(Error("Malformed state sketch"));
+  }
+
+  std::vector<Iblt::Cell> cells;
+  cells.reserve(sketch.count_size());
+  for (int i = 0; i < sketch.count_size(); ++i) {
+    cells.push_back(Iblt::Cell{sketch.count(i), sketch.key_sum(i), sketch.hash_sum(i)});
+  }
+  Iblt peerSketch(std::move(cells));
+
+  WriteLock lock(m_stateUpdateMutex);
+  loadIfStale();
+
+  std::unordered_map<uint64_t, SeqVector::value_type> entries;
+  Iblt difference = buildSketch(getState(newHash), peerSketch.getCells().size(), &entries);
+  difference -= peerSketch;
+
+  // entries only in our state are positive, those only in the peer's state are negative
+  std::vector<uint64_t> missing;
+  std::vector<uint64_t> unknown;
+  if (!difference.listEntries(missing, unknown)) {
+    _LOG_DEBUG("Cannot decode state sketch of " << peerSketch.getCells().size() << " cells");
+    return nullptr;
+  }
+
+  SyncStateMsgPtr msg = make_shared<SyncStateMsg>();
+  for (uint64_t key : missing) {
+    auto entry = entries.find(key);
+    if (entry == entries.end()) {
+      // cannot be ours, the sketch is corrupted
+      return nullptr;
+    }
+    const auto& node = *m_nodesById[entry->second.first];
+
+    SyncState* state = msg->add_state();
+    state->set_name(reinterpret_cast<const char*>(node.first.buf()), node.first.size());
+    if (!node.second.locator.empty()) {
+      state->set_locator(reinterpret_cast<const char*>(node.second.locator.buf()),
+                         node.second.locator.size());
+    }
+    state->set_type(SyncState::UPDATE);
+    state->set_seq(entry->second.second);
+  }
   return msg;
 }
 
 sqlite3_int64
 SyncLog::SeqNo(const Name& name)
 {
-  sqlite3_stmt* stmt;
+  Statement stmt(*this, "SELECT seq_no FROM SyncNodes WHERE device_name=?;");
   sqlite3_int64 seq = -1;
-  sqlite3_prepare_v2(m_db, "SELECT seq_no FROM SyncNodes WHERE device_name=?;", -1, &stmt, 0);
 
   sqlite3_bind_blob(stmt, 1, name.wireEncode().wire(), name.wireEncode().size(), SQLITE_STATIC);
 
@@ -478,8 +1059,7 @@ SyncLog::SeqNo(const Name& name)
 sqlite3_int64
 SyncLog::LogSize()
 {
-  sqlite3_stmt* stmt;
-  sqlite3_prepare_v2(m_db, "SELECT count(*) FROM SyncLog", -1, &stmt, 0);
+  Statement stmt(*this, "SELECT count(*) FROM SyncLog");
 
   sqlite3_int64 retval = -1;
   if (sqlite3_step(stmt) == SQLITE_ROW) {
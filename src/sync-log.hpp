@@ -22,12 +22,17 @@
 #define CHRONOSHARE_SRC_SYNC_LOG_HPP
 
 #include "db-helper.hpp"
+#include "iblt.hpp"
 #include "sync-state.pb.h"
 #include "core/chronoshare-common.hpp"
 
 #include <ndn-cxx/name.hpp>
+#include <ndn-cxx/util/time.hpp>
 
+#include <atomic>
 #include <map>
+#include <set>
+#include <unordered_map>
 
 // @todo Replace with std::thread
 #include <boost/thread.hpp>
@@ -41,6 +46,24 @@ typedef shared_ptr<SyncStateMsg> SyncStateMsgPtr;
 class SyncLog : public DbHelper
 {
 public:
+  /**
+   * @brief Maximum number of states between two checkpoints in the state log
+   *
+   * A checkpoint records the seq_nos of all devices, the other states only the seq_nos changed
+   * since the previous state.
+   */
+  static const int STATE_CHECKPOINT_INTERVAL;
+
+  /**
+   * @brief Default age after which states that have not been seen again are pruned
+   */
+  static const time::seconds DEFAULT_STATE_RETENTION;
+
+  /**
+   * @brief Default maximum number of states kept in the state log
+   */
+  static const size_t DEFAULT_MAX_STATES;
+
   class Error : public DbHelper::Error
   {
   public:
@@ -53,6 +76,8 @@ public:
 
   SyncLog(const boost::filesystem::path& path, const Name& localName);
 
+  ~SyncLog();
+
   /**
    * @brief Get local username
    */
@@ -84,10 +109,29 @@ public:
   // done
   /**
    * Create an 1ntry in SyncLog and SyncStateNodes corresponding to the current state of SyncNodes
+   *
+   * SyncStateNodes gets the seq_nos changed since the previous state, or all of them if the state
+   * is a checkpoint.  If the state is already known, only its last_update is refreshed.
+   *
+   * The digest of the state is not computed by the database, but taken from the in-memory copy of
+   * SyncNodes, where it is cached until the next seq_no change.
    */
   ConstBufferPtr
   RememberStateInStateLog();
 
+  /**
+   * @brief Apply the seq_nos and locators of a sync state message, and remember the new state in
+   *        the state log, all in one transaction
+   *
+   * DELETE entries are ignored.
+   *
+   * @param[out] diff gets an UPDATE with the old seq_no (0 for a new device) and the new one for
+   *                  every device whose seq_no increased
+   * @return digest of the new state, as returned by RememberStateInStateLog
+   */
+  ConstBufferPtr
+  ApplyStateMsg(const SyncStateMsg& msg, SyncStateMsg& diff);
+
   // done
   sqlite3_int64
   LookupSyncLog(const std::string& stateHash);
@@ -104,6 +148,47 @@ public:
   SyncStateMsgPtr
   FindStateDifferences(const Buffer& oldHash, const Buffer& newHash, bool includeOldSeq = false);
 
+  /**
+   * @brief Sketch of the (device, seq_no) entries of the state with @p stateHash
+   *
+   * A peer that does not know the state can find from the sketch the entries of its own state
+   * that are missing in this one (see FindStateDifferences).  The sketch has about @p nCells
+   * cells, and can be decoded if the states differ in up to about 2/3 as many entries.
+   */
+  shared_ptr<SyncStateSketch>
+  GetStateSketch(const Buffer& stateHash, size_t nCells);
+
+  /**
+   * @brief Entries of the state with @p newHash that are missing in the state sketched by a peer
+   *
+   * @return the missing entries, or nullptr if the states differ in too many entries for the
+   *         sketch
+   * @throw Error the sketch is malformed
+   */
+  SyncStateMsgPtr
+  FindStateDifferences(const SyncStateSketch& sketch, const Buffer& newHash);
+
+  /**
+   * @brief Set how long and how many states are kept by PruneStateLog
+   *
+   * A state expires when it has not been seen for @p maxAge, or when it is older than the
+   * @p maxStates newest states.
+   */
+  void
+  SetStateRetention(const time::seconds& maxAge, size_t maxStates);
+
+  /**
+   * @brief Remove up to @p batchSize expired states from the state log
+   *
+   * The latest state is always kept.  States whose delta is relative to a removed state become
+   * checkpoints.  Removed digests are unknown to LookupSyncLog, so peers still in such a state are
+   * answered through recovery.
+   *
+   * @return number of removed states; more states may have expired if it is @p batchSize
+   */
+  size_t
+  PruneStateLog(size_t batchSize);
+
   //-------- only used in test -----------------
   sqlite3_int64
   SeqNo(const Name& name);
@@ -115,6 +200,84 @@ protected:
   void
   UpdateDeviceSeqNo(sqlite3_int64 deviceId, sqlite3_int64 seqNo);
 
+private:
+  /**
+   * @brief Reload the in-memory copies of SyncNodes and of the state log if a rollback could have
+   *        reverted them
+   *
+   * Must be called with m_stateUpdateMutex locked.
+   */
+  void
+  loadIfStale();
+
+  /**
+   * @brief Record in the in-memory copy of SyncNodes that the seq_no of a device was updated
+   *
+   * Must be called with m_stateUpdateMutex locked.
+   */
+  void
+  rememberSeqNo(const Buffer& deviceName, sqlite3_int64 deviceId, sqlite3_int64 seqNo);
+
+  /**
+   * @brief Digest of the current state, the same as the ``hash'' SQL aggregate over SyncNodes
+   *        ordered by device_name
+   *
+   * Must be called with m_stateUpdateMutex locked.
+   */
+  ConstBufferPtr
+  getStateDigest();
+
+  /**
+   * @brief Body of RememberStateInStateLog, to be called within a transaction
+   *
+   * The in-memory copies are updated right away, and reloaded if the transaction is rolled back.
+   * Must be called with m_stateUpdateMutex locked.
+   */
+  ConstBufferPtr
+  rememberState();
+
+  static void
+  onRollback(void* self);
+
+  /**
+   * @brief Reduce the full snapshots of the state log kept by older versions to deltas
+   */
+  void
+  compactStateLog();
+
+  // (device_id, seq_no) pairs sorted by device_id
+  typedef std::vector<std::pair<sqlite3_int64, sqlite3_int64>> SeqVector;
+
+  /**
+   * @brief Seq_nos of the devices in the state with @p stateHash
+   *
+   * The state is rebuilt in memory from the nearest checkpoint.  Unknown states are empty.
+   * Must be called with m_stateUpdateMutex locked.
+   */
+  SeqVector
+  getState(const Buffer& stateHash);
+
+  SeqVector
+  getState(sqlite3_int64 stateId);
+
+  /**
+   * @brief Number of deltas between the state @p stateId and its checkpoint
+   *
+   * Must be called with m_stateUpdateMutex locked.
+   */
+  int
+  countDeltasSinceCheckpoint(sqlite3_int64 stateId);
+
+  /**
+   * @brief IBLT of the (device_name, seq_no) entries of @p state
+   *
+   * @param[out] entries if not null, gets the entry of every key
+   * Must be called with m_stateUpdateMutex locked.
+   */
+  Iblt
+  buildSketch(const SeqVector& state, size_t nCells,
+              std::unordered_map<uint64_t, SeqVector::value_type>* entries = nullptr);
+
 protected:
   Name m_localName;
 
@@ -124,6 +287,46 @@ protected:
   typedef boost::unique_lock<Mutex> WriteLock;
 
   Mutex m_stateUpdateMutex;
+
+private:
+  struct Node
+  {
+    sqlite3_int64 deviceId;
+    sqlite3_int64 seqNo;
+    Buffer locator; // empty if unknown
+  };
+
+  // copy of SyncNodes keyed by the wire encoding of device_name, which orders the devices in the
+  // same way as ``ORDER BY device_name''
+  typedef std::map<Buffer, Node> Nodes;
+
+  Nodes m_nodes;
+  std::unordered_map<sqlite3_int64, Nodes::iterator> m_nodesById;
+  // digest of m_nodes, reset whenever a seq_no changes
+  ConstBufferPtr m_stateDigest;
+  /**
+   * @brief State of the state log, as recorded in SyncStateNodes
+   */
+  struct State
+  {
+    sqlite3_int64 prevStateId; // 0 for a checkpoint
+    SeqVector nodes;           // all seq_nos for a checkpoint, or those changed since prevStateId
+  };
+
+  // copy of the state log, which SyncLog and SyncStateNodes only persist
+  std::map<sqlite3_int64, State> m_states;
+  std::map<Buffer, sqlite3_int64> m_stateIds;
+
+  // set by the rollback hook; the database could have been reverted to a state not in the copies
+  std::atomic<bool> m_isStale;
+
+  // last state in the state log and the devices changed since, which make its delta
+  sqlite3_int64 m_lastStateId;
+  int m_nDeltasSinceCheckpoint;
+  std::set<sqlite3_int64> m_changedDevices;
+
+  time::seconds m_stateRetention;
+  size_t m_maxStates;
 };
 
 typedef shared_ptr<SyncLog> SyncLogPtr;
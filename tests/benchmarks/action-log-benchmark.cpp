@@ -0,0 +1,267 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#define BOOST_TEST_MAIN 1
+#define BOOST_TEST_DYN_LINK 1
+#define BOOST_TEST_MODULE ChronoShare ActionLog Benchmark
+
+#include "action-log.hpp"
+
+#include "test-common.hpp"
+
+#include <boost/test/unit_test.hpp>
+
+#include <ndn-cxx/util/dummy-client-face.hpp>
+#include <ndn-cxx/util/string-helper.hpp>
+
+#include <chrono>
+#include <iostream>
+
+namespace ndn {
+namespace chronoshare {
+namespace tests {
+
+namespace fs = boost::filesystem;
+
+const int N_CHANGES = 200;
+
+/**
+ * @brief VFS on top of the default one, counting the syncs of the files and directories
+ */
+class SyncCountingVfs
+{
+public:
+  SyncCountingVfs()
+  {
+    sqlite3_vfs* real = sqlite3_vfs_find(nullptr);
+    m_vfs = *real;
+    m_vfs.szOsFile = sizeof(File) + real->szOsFile;
+    m_vfs.zName = "sync-counting";
+    m_vfs.pAppData = real;
+    m_vfs.xOpen = &SyncCountingVfs::open;
+    m_vfs.xDelete = [] (sqlite3_vfs* vfs, const char* name, int syncDir) {
+      nSyncs += syncDir != 0;
+      sqlite3_vfs* real = static_cast<sqlite3_vfs*>(vfs->pAppData);
+      return real->xDelete(real, name, syncDir);
+    };
+    sqlite3_vfs_register(&m_vfs, 1);
+  }
+
+  ~SyncCountingVfs()
+  {
+    sqlite3_vfs_unregister(&m_vfs);
+  }
+
+private:
+  struct File
+  {
+    sqlite3_file base;
+    sqlite3_file* real;
+  };
+
+  static sqlite3_file*
+  real(sqlite3_file* file)
+  {
+    return reinterpret_cast<File*>(file)->real;
+  }
+
+  static int
+  open(sqlite3_vfs* vfs, const char* name, sqlite3_file* file, int flags, int* outFlags)
+  {
+    static const sqlite3_io_methods METHODS = {
+      3,
+      [] (sqlite3_file* f) { return real(f)->pMethods->xClose(real(f)); },
+      [] (sqlite3_file* f, void* buf, int n, sqlite3_int64 offset) {
+        return real(f)->pMethods->xRead(real(f), buf, n, offset);
+      },
+      [] (sqlite3_file* f, const void* buf, int n, sqlite3_int64 offset) {
+        return real(f)->pMethods->xWrite(real(f), buf, n, offset);
+      },
+      [] (sqlite3_file* f, sqlite3_int64 size) { return real(f)->pMethods->xTruncate(real(f), size); },
+      [] (sqlite3_file* f, int syncFlags) {
+        ++nSyncs;
+        return real(f)->pMethods->xSync(real(f), syncFlags);
+      },
+      [] (sqlite3_file* f, sqlite3_int64* size) { return real(f)->pMethods->xFileSize(real(f), size); },
+      [] (sqlite3_file* f, int lock) { return real(f)->pMethods->xLock(real(f), lock); },
+      [] (sqlite3_file* f, int lock) { return real(f)->pMethods->xUnlock(real(f), lock); },
+      [] (sqlite3_file* f, int* isReserved) {
+        return real(f)->pMethods->xCheckReservedLock(real(f), isReserved);
+      },
+      [] (sqlite3_file* f, int op, void* arg) { return real(f)->pMethods->xFileControl(real(f), op, arg); },
+      [] (sqlite3_file* f) { return real(f)->pMethods->xSectorSize(real(f)); },
+      [] (sqlite3_file* f) { return real(f)->pMethods->xDeviceCharacteristics(real(f)); },
+      [] (sqlite3_file* f, int region, int size, int isExtend, void volatile** p) {
+        return real(f)->pMethods->xShmMap(real(f), region, size, isExtend, p);
+      },
+      [] (sqlite3_file* f, int offset, int n, int flags) {
+        return real(f)->pMethods->xShmLock(real(f), offset, n, flags);
+      },
+      [] (sqlite3_file* f) { real(f)->pMethods->xShmBarrier(real(f)); },
+      [] (sqlite3_file* f, int deleteFlag) { return real(f)->pMethods->xShmUnmap(real(f), deleteFlag); },
+      [] (sqlite3_file* f, sqlite3_int64 offset, int n, void** p) {
+        return real(f)->pMethods->xFetch(real(f), offset, n, p);
+      },
+      [] (sqlite3_file* f, sqlite3_int64 offset, void* p) {
+        return real(f)->pMethods->xUnfetch(real(f), offset, p);
+      },
+    };
+
+    File* counting = reinterpret_cast<File*>(file);
+    counting->real = reinterpret_cast<sqlite3_file*>(counting + 1);
+    sqlite3_vfs* realVfs = static_cast<sqlite3_vfs*>(vfs->pAppData);
+    int res = realVfs->xOpen(realVfs, name, counting->real, flags, outFlags);
+    counting->base.pMethods = counting->real->pMethods != nullptr ? &METHODS : nullptr;
+    return res;
+  }
+
+public:
+  static size_t nSyncs;
+
+private:
+  sqlite3_vfs m_vfs;
+};
+
+size_t SyncCountingVfs::nSyncs = 0;
+
+class ActionLogBenchmarkFixture : public IdentityManagementFixture
+{
+public:
+  ActionLogBenchmarkFixture()
+    : face(m_io, m_keyChain, {false, false})
+    , tmpdir(fs::path(UNIT_TEST_CONFIG_PATH) / "ActionLogBenchmark")
+    , hash(fromHex("2ff304769cdb0125ac039e6fe7575f8576dceffc62618a431715aaf6eea2bf1c"))
+  {
+    if (exists(tmpdir)) {
+      remove_all(tmpdir);
+    }
+  }
+
+  ~ActionLogBenchmarkFixture()
+  {
+    DbHelper::setDefaultDurability(DbHelper::DURABILITY_SAFE);
+    remove_all(tmpdir);
+  }
+
+  template<class ChangeFunc>
+  void
+  measure(const std::string& label, const ChangeFunc& change)
+  {
+    SyncCountingVfs::nSyncs = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < N_CHANGES; ++i) {
+      change(i);
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << label << ": " << static_cast<double>(SyncCountingVfs::nSyncs) / N_CHANGES
+              << " fsyncs and " << elapsed.count() / N_CHANGES << " us per local file change"
+              << std::endl;
+  }
+
+public:
+  util::DummyClientFace face;
+  fs::path tmpdir;
+  shared_ptr<Buffer> hash;
+};
+
+BOOST_FIXTURE_TEST_SUITE(ActionLogBenchmark, ActionLogBenchmarkFixture)
+
+BOOST_AUTO_TEST_CASE(LocalChange)
+{
+  SyncCountingVfs vfs;
+
+  for (auto durability : {DbHelper::DURABILITY_ROLLBACK, DbHelper::DURABILITY_SAFE}) {
+    DbHelper::setDefaultDurability(durability);
+    std::string profile = durability == DbHelper::DURABILITY_ROLLBACK ? "rollback journal" : "WAL";
+
+    // the statements a new file used to be committed with, when the sync log, the action log
+    // and the file state were separate databases
+    fs::path separate = tmpdir / ("separate-" + std::to_string(durability));
+    DbHelper syncLog(separate, "sync-log.db");
+    DbHelper actionLog(separate, "action-log.db");
+    DbHelper fileState(separate, "file-state.db");
+    DbHelper::Statement(syncLog, "CREATE TABLE SyncNodes (device_name BLOB, seq_no INTEGER)").step();
+    DbHelper::Statement(syncLog, "INSERT INTO SyncNodes VALUES (?, 0)").step();
+    DbHelper::Statement(actionLog, "CREATE TABLE ActionLog (seq_no INTEGER PRIMARY KEY, filename TEXT, "
+                                   "directory TEXT, file_hash BLOB)").step();
+    DbHelper::Statement(fileState, "CREATE TABLE FileState (filename TEXT PRIMARY KEY, directory TEXT, "
+                                   "file_hash BLOB, is_complete INTEGER)").step();
+
+    measure(profile + ", separate databases", [&] (int i) {
+        std::string filename = "file-" + std::to_string(i);
+
+        DbHelper::Statement(actionLog, "BEGIN TRANSACTION").step();
+        {
+          DbHelper::Statement stmt(syncLog, "UPDATE SyncNodes SET seq_no=?");
+          stmt.bind(1, i + 1);
+          stmt.step();
+        }
+        {
+          DbHelper::Statement stmt(actionLog, "INSERT INTO ActionLog (seq_no, filename, file_hash) "
+                                              "VALUES (?, ?, ?)");
+          stmt.bind(1, i + 1);
+          stmt.bind(2, filename, SQLITE_STATIC);
+          stmt.bind(3, hash->buf(), hash->size(), SQLITE_STATIC);
+          stmt.step();
+        }
+        // applied by the trigger of ActionLog
+        for (const char* sql : {"UPDATE FileState SET file_hash=? WHERE filename=?",
+                                "INSERT INTO FileState (file_hash, filename) VALUES (?, ?)",
+                                "UPDATE FileState SET directory=directory_name(filename) WHERE filename=?"}) {
+          DbHelper::Statement stmt(fileState, sql);
+          if (std::string(sql).find("directory") == std::string::npos) {
+            stmt.bind(1, hash->buf(), hash->size(), SQLITE_STATIC);
+            stmt.bind(2, filename, SQLITE_STATIC);
+          }
+          else {
+            stmt.bind(1, filename, SQLITE_STATIC);
+          }
+          stmt.step();
+        }
+        {
+          DbHelper::Statement stmt(actionLog, "UPDATE ActionLog SET directory=directory_name(filename) "
+                                              "WHERE seq_no=?");
+          stmt.bind(1, i + 1);
+          stmt.step();
+        }
+        DbHelper::Statement(actionLog, "END TRANSACTION").step();
+
+        DbHelper::Statement stmt(fileState, "UPDATE FileState SET is_complete=1 WHERE filename=?");
+        stmt.bind(1, filename, SQLITE_STATIC);
+        stmt.step();
+      });
+
+    fs::path unified = tmpdir / ("unified-" + std::to_string(durability));
+    auto log = make_shared<SyncLog>(unified, Name("/benchmark/device"));
+    ActionLog action(face, unified, log, "benchmark", name::Component("benchmark"),
+                     ActionLog::OnFileAddedOrChangedCallback(), ActionLog::OnFileRemovedCallback());
+
+    measure(profile + ", one database", [&] (int i) {
+        action.AddLocalActionUpdate("file-" + std::to_string(i), *hash, std::time(nullptr), 0644, 1);
+      });
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace tests
+} // namespace chronoshare
+} // namespace ndn
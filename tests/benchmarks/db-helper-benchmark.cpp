@@ -0,0 +1,154 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#define BOOST_TEST_MAIN 1
+#define BOOST_TEST_DYN_LINK 1
+#define BOOST_TEST_MODULE ChronoShare DbHelper Benchmark
+
+#include "db-helper.hpp"
+
+#include "test-common.hpp"
+
+#include <boost/test/unit_test.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+namespace ndn {
+namespace chronoshare {
+namespace tests {
+
+namespace fs = boost::filesystem;
+
+const int N_ROWS = 10000;
+const size_t N_LOOKUPS = 100000;
+
+class DbHelperBenchmarkFixture
+{
+public:
+  DbHelperBenchmarkFixture()
+    : tmpdir(fs::path(UNIT_TEST_CONFIG_PATH) / "DbHelperBenchmark")
+  {
+    if (exists(tmpdir)) {
+      remove_all(tmpdir);
+    }
+    db = make_shared<DbHelper>(tmpdir, "benchmark.db");
+
+    DbHelper::Statement(*db, "CREATE TABLE Test (id INTEGER PRIMARY KEY, value BLOB)").step();
+    DbHelper::Statement(*db, "BEGIN TRANSACTION").step();
+    std::vector<uint8_t> value(32, 'x');
+    for (int i = 0; i < N_ROWS; ++i) {
+      DbHelper::Statement stmt(*db, "INSERT INTO Test VALUES (?, ?)");
+      stmt.bind(1, i);
+      stmt.bind(2, value.data(), value.size(), SQLITE_STATIC);
+      stmt.step();
+    }
+    DbHelper::Statement(*db, "END TRANSACTION").step();
+  }
+
+  ~DbHelperBenchmarkFixture()
+  {
+    db.reset();
+    remove_all(tmpdir);
+  }
+
+  template<class LookupFunc>
+  void
+  measure(const std::string& label, const LookupFunc& lookup)
+  {
+    std::mt19937 rng(0);
+    std::uniform_int_distribution<int> id(0, N_ROWS - 1);
+
+    size_t nFound = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < N_LOOKUPS; ++i) {
+      if (lookup(id(rng))) {
+        ++nFound;
+      }
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+    BOOST_CHECK_EQUAL(nFound, N_LOOKUPS);
+    std::cout << label << ": " << N_LOOKUPS << " point lookups, "
+              << (elapsed.count() / N_LOOKUPS) << " us/lookup" << std::endl;
+  }
+
+public:
+  fs::path tmpdir;
+  DbHelperPtr db;
+};
+
+BOOST_FIXTURE_TEST_SUITE(DbHelperBenchmark, DbHelperBenchmarkFixture)
+
+BOOST_AUTO_TEST_CASE(PointLookup)
+{
+  // a query in ActionLog, FileState or SyncLog, as they were written before the statement cache
+  sqlite3* handle = nullptr;
+  sqlite3_open((tmpdir / "benchmark.db").c_str(), &handle);
+  measure("prepared per call", [handle] (int id) {
+      sqlite3_stmt* stmt;
+      sqlite3_prepare_v2(handle, "SELECT value FROM Test WHERE id=?", -1, &stmt, 0);
+      sqlite3_bind_int(stmt, 1, id);
+      bool isFound = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_bytes(stmt, 0) > 0;
+      sqlite3_finalize(stmt);
+      return isFound;
+    });
+  sqlite3_close(handle);
+
+  measure("statement cache", [this] (int id) {
+      DbHelper::Statement stmt(*db, "SELECT value FROM Test WHERE id=?");
+      stmt.bind(1, id);
+      return stmt.step() == SQLITE_ROW && stmt.getSize(0) > 0;
+    });
+}
+
+BOOST_AUTO_TEST_CASE(SmallCommits)
+{
+  const size_t N_COMMITS = 1000;
+
+  for (auto durability : {DbHelper::DURABILITY_ROLLBACK, DbHelper::DURABILITY_SAFE,
+                          DbHelper::DURABILITY_FAST}) {
+    DbHelper::setDefaultDurability(durability);
+    DbHelper commitDb(tmpdir, "commits-" + std::to_string(durability) + ".db");
+    DbHelper::Statement(commitDb, "CREATE TABLE Test (id INTEGER PRIMARY KEY, value INTEGER)").step();
+
+    // a local change: one row in its own transaction, as ActionLog and SyncLog commit them
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < N_COMMITS; ++i) {
+      DbHelper::Statement stmt(commitDb, "INSERT INTO Test (value) VALUES (?)");
+      stmt.bind(1, static_cast<int>(i));
+      BOOST_CHECK_EQUAL(stmt.step(), SQLITE_DONE);
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+    static const char* const NAMES[] = {"rollback journal", "WAL, synchronous=FULL",
+                                        "WAL, synchronous=NORMAL"};
+    std::cout << NAMES[durability] << ": " << N_COMMITS << " single-row commits, "
+              << elapsed.count() / N_COMMITS << " us/commit" << std::endl;
+  }
+  DbHelper::setDefaultDurability(DbHelper::DURABILITY_SAFE);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace tests
+} // namespace chronoshare
+} // namespace ndn
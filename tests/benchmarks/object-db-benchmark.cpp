@@ -0,0 +1,407 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#define BOOST_TEST_MAIN 1
+#define BOOST_TEST_DYN_LINK 1
+#define BOOST_TEST_MODULE ChronoShare ObjectDb Benchmark
+
+#include "object-db.hpp"
+
+#include "test-common.hpp"
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <ndn-cxx/security/signing-helpers.hpp>
+#include <ndn-cxx/util/sqlite3-statement.hpp>
+#include <ndn-cxx/util/string-helper.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <random>
+
+namespace ndn {
+namespace chronoshare {
+namespace tests {
+
+namespace fs = boost::filesystem;
+
+const size_t N_FILES = 1000;
+const size_t N_SEGMENTS = 16;
+const size_t N_READS = 10000;
+
+class ObjectDbBenchmarkFixture : public IdentityManagementFixture
+{
+public:
+  ObjectDbBenchmarkFixture()
+    : tmpdir(fs::path(UNIT_TEST_CONFIG_PATH) / "ObjectDbBenchmark")
+    , deviceName("/benchmark/device")
+  {
+    if (exists(tmpdir)) {
+      remove_all(tmpdir);
+    }
+    fs::create_directories(tmpdir);
+
+    for (size_t i = 0; i < N_FILES; ++i) {
+      hashes.push_back(toHex(*util::Sha256::computeDigest(reinterpret_cast<const uint8_t*>(&i), sizeof(i))));
+    }
+  }
+
+  ~ObjectDbBenchmarkFixture()
+  {
+    remove_all(tmpdir);
+  }
+
+  /**
+   * @brief Create object databases in the layout used before the pack store,
+   *        one SQLite database per file hash
+   */
+  void
+  createLegacyDatabases()
+  {
+    std::vector<uint8_t> payload(8192, 'x');
+    for (const auto& hash : hashes) {
+      fs::path path = tmpdir / "objects" / hash.substr(0, 2) / hash.substr(2);
+      fs::create_directories(path.parent_path());
+
+      sqlite3* db;
+      sqlite3_open(path.c_str(), &db);
+      sqlite3_exec(db, "CREATE TABLE File(device_name BLOB NOT NULL, segment INTEGER, content_object BLOB, "
+                       "PRIMARY KEY (device_name, segment)); BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+      for (size_t segment = 0; segment < N_SEGMENTS; ++segment) {
+        Data data(Name(deviceName).append(hash).appendSegment(segment));
+        data.setContent(payload.data(), payload.size());
+        m_keyChain.sign(data, signingWithSha256());
+
+        util::Sqlite3Statement stmt(db, "INSERT INTO File VALUES (?, ?, ?)");
+        stmt.bind(1, deviceName.wireEncode(), SQLITE_STATIC);
+        stmt.bind(2, static_cast<int>(segment));
+        stmt.bind(3, data.wireEncode(), SQLITE_STATIC);
+        stmt.step();
+      }
+      sqlite3_exec(db, "END TRANSACTION;", nullptr, nullptr, nullptr);
+      sqlite3_close(db);
+    }
+  }
+
+  template<class ReadFunc>
+  void
+  measure(const std::string& label, const ReadFunc& read)
+  {
+    std::mt19937 rng(0);
+    std::uniform_int_distribution<size_t> file(0, N_FILES - 1);
+    std::uniform_int_distribution<int> segment(0, N_SEGMENTS - 1);
+
+    size_t nFound = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < N_READS; ++i) {
+      if (read(hashes[file(rng)], segment(rng))) {
+        ++nFound;
+      }
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+    BOOST_CHECK_EQUAL(nFound, N_READS);
+    std::cout << label << ": " << N_READS << " random segment reads from " << N_FILES << " files, "
+              << (elapsed.count() / N_READS) << " us/read" << std::endl;
+  }
+
+public:
+  fs::path tmpdir;
+  Name deviceName;
+  std::vector<std::string> hashes;
+};
+
+BOOST_FIXTURE_TEST_SUITE(ObjectDbBenchmark, ObjectDbBenchmarkFixture)
+
+BOOST_AUTO_TEST_CASE(RandomSegmentRead)
+{
+  createLegacyDatabases();
+
+  // what ObjectDb used to do for every request: open the database of the hash and query it
+  measure("per-file databases", [this] (const std::string& hash, int segment) {
+      sqlite3* db;
+      sqlite3_open((tmpdir / "objects" / hash.substr(0, 2) / hash.substr(2)).c_str(), &db);
+      bool isFound = false;
+      {
+        util::Sqlite3Statement stmt(db, "SELECT content_object FROM File WHERE device_name=? AND segment=?");
+        stmt.bind(1, deviceName.wireEncode(), SQLITE_STATIC);
+        stmt.bind(2, segment);
+        if (stmt.step() == SQLITE_ROW) {
+          isFound = make_shared<Data>(stmt.getBlock(0)) != nullptr;
+        }
+      }
+      sqlite3_close(db);
+      return isFound;
+    });
+
+  auto start = std::chrono::steady_clock::now();
+  PackStorePtr store = PackStore::open(tmpdir);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << "migration of " << N_FILES << " databases: " << elapsed.count() << " s" << std::endl;
+
+  measure("pack store", [this] (const std::string& hash, int segment) {
+      return ObjectDb(tmpdir, hash).fetchSegment(deviceName, segment) != nullptr;
+    });
+}
+
+BOOST_AUTO_TEST_CASE(Compression)
+{
+  const size_t N_PAYLOADS = 4096;
+  const size_t PAYLOAD_SIZE = 8192;
+
+  // log-like text and incompressible content
+  std::mt19937 rng(0);
+  std::string text;
+  while (text.size() < N_PAYLOADS * PAYLOAD_SIZE) {
+    text += "2017-04-01T12:" + std::to_string(rng() % 60) + ":" + std::to_string(rng() % 60) +
+            " INFO fetcher: segment " + std::to_string(rng() % 100000) + " of file " +
+            std::to_string(rng() % 100) + " received\n";
+  }
+  std::string noise(N_PAYLOADS * PAYLOAD_SIZE, 0);
+  for (auto& byte : noise) {
+    byte = static_cast<char>(rng());
+  }
+
+  for (const auto& content : {std::make_pair("text", &text), std::make_pair("random", &noise)}) {
+    std::vector<Data> segments;
+    for (size_t i = 0; i < N_PAYLOADS; ++i) {
+      segments.emplace_back(Name(deviceName).append(content.first).appendSegment(i));
+      segments.back().setContent(reinterpret_cast<const uint8_t*>(content.second->data()) + i * PAYLOAD_SIZE,
+                                 PAYLOAD_SIZE);
+      m_keyChain.sign(segments.back(), signingWithSha256());
+    }
+
+    for (bool isCompressed : {false, true}) {
+      fs::path folder = tmpdir / (std::string(content.first) + (isCompressed ? "-compressed" : "-raw"));
+      PackStorePtr store = PackStore::open(folder);
+      store->setCompression(isCompressed);
+      ConstBufferPtr hash = util::Sha256::computeDigest(reinterpret_cast<const uint8_t*>(content.first),
+                                                        std::strlen(content.first));
+
+      auto start = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < N_PAYLOADS; ++i) {
+        store->saveSegment(*hash, deviceName, PackStore::FILE_SEGMENT, i, segments[i], false);
+      }
+      store->flush();
+      std::chrono::duration<double> saveTime = std::chrono::steady_clock::now() - start;
+
+      start = std::chrono::steady_clock::now();
+      size_t nFetched = store->fetchSegments(*hash, deviceName, PackStore::FILE_SEGMENT).size();
+      std::chrono::duration<double> fetchTime = std::chrono::steady_clock::now() - start;
+      BOOST_CHECK_EQUAL(nFetched, N_PAYLOADS);
+
+      PackStore::Stats stats = store->getStats();
+      std::cout << content.first << (isCompressed ? ", compressed: " : ", raw: ")
+                << stats.storedSize / 1048576.0 << " MB stored of " << stats.logicalSize / 1048576.0
+                << " MB, " << stats.nCompressedChunks << " payloads compressed, save "
+                << saveTime.count() << " s, fetch " << fetchTime.count() << " s" << std::endl;
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(SequentialAccess)
+{
+  const size_t N_SEQUENTIAL = 8192;
+  const size_t BATCH_SIZE = 256;
+
+  std::vector<uint8_t> payload(8192, 'x');
+  PackStore::SegmentBatch segments;
+  for (size_t i = 0; i < N_SEQUENTIAL; ++i) {
+    payload[0] = static_cast<uint8_t>(i);
+    payload[1] = static_cast<uint8_t>(i >> 8);
+    auto data = make_shared<Data>(Name(deviceName).append("sequential").appendSegment(i));
+    data->setContent(payload.data(), payload.size());
+    m_keyChain.sign(*data, signingWithSha256());
+    segments.push_back(std::make_pair(i, data));
+  }
+
+  for (bool isBatched : {false, true}) {
+    std::string hash = hashes[isBatched ? 1 : 0];
+    ObjectDb db(tmpdir / (isBatched ? "batched" : "single"), hash);
+
+    auto start = std::chrono::steady_clock::now();
+    if (isBatched) {
+      for (size_t i = 0; i < N_SEQUENTIAL; i += BATCH_SIZE) {
+        db.saveContentObjects(deviceName, PackStore::SegmentBatch(segments.begin() + i,
+                                                                  segments.begin() + i + BATCH_SIZE));
+      }
+    }
+    else {
+      for (const auto& segment : segments) {
+        db.saveContentObject(deviceName, segment.first, *segment.second);
+      }
+    }
+    std::chrono::duration<double, std::micro> saveTime = std::chrono::steady_clock::now() - start;
+
+    size_t nFetched = 0;
+    start = std::chrono::steady_clock::now();
+    if (isBatched) {
+      for (size_t i = 0; i < N_SEQUENTIAL; i += BATCH_SIZE) {
+        nFetched += db.fetchSegments(deviceName, i, i + BATCH_SIZE).size();
+      }
+    }
+    else {
+      for (size_t i = 0; i < N_SEQUENTIAL; ++i) {
+        nFetched += db.fetchSegment(deviceName, i) != nullptr;
+      }
+    }
+    std::chrono::duration<double, std::micro> fetchTime = std::chrono::steady_clock::now() - start;
+    BOOST_CHECK_EQUAL(nFetched, N_SEQUENTIAL);
+
+    std::cout << (isBatched ? "batches of " + std::to_string(BATCH_SIZE) : std::string("one at a time"))
+              << ": " << N_SEQUENTIAL << " sequential segments, save "
+              << saveTime.count() / N_SEQUENTIAL << " us/segment, fetch "
+              << fetchTime.count() / N_SEQUENTIAL << " us/segment" << std::endl;
+  }
+}
+
+BOOST_AUTO_TEST_CASE(ExistenceCheck)
+{
+  const size_t N_OBJECTS = 100000;
+
+  std::vector<ConstBufferPtr> objects;
+  {
+    PackStorePtr store = PackStore::open(tmpdir);
+    for (size_t i = 0; i < N_OBJECTS; ++i) {
+      objects.push_back(util::Sha256::computeDigest(reinterpret_cast<const uint8_t*>(&i), sizeof(i)));
+
+      Data data(Name(deviceName).append(name::Component(*objects.back())).appendSegment(0));
+      data.setContent(reinterpret_cast<const uint8_t*>(&i), sizeof(i));
+      m_keyChain.sign(data, signingWithSha256());
+      store->saveSegment(*objects.back(), deviceName, PackStore::FILE_SEGMENT, 0, data, false);
+      store->setFileSegmentCount(*objects.back(), deviceName, 1);
+    }
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  PackStorePtr store = PackStore::open(tmpdir);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << "opening store with " << N_OBJECTS << " objects: " << elapsed.count() << " s" << std::endl;
+
+  auto check = [&] (const std::string& label, const std::function<bool(const Buffer&)>& doesExist) {
+    std::mt19937 rng(0);
+    std::uniform_int_distribution<size_t> object(0, N_OBJECTS - 1);
+
+    size_t nFound = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < N_READS; ++i) {
+      if (doesExist(*objects[object(rng)])) {
+        ++nFound;
+      }
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+    BOOST_CHECK_EQUAL(nFound, N_READS);
+    std::cout << label << ": " << N_READS << " random checks of " << N_OBJECTS << " objects, "
+              << (elapsed.count() / N_READS) << " us/check" << std::endl;
+  };
+
+  // what ObjectDb::doesExist used to do: count segments of the file in the index
+  check("segment count", [&] (const Buffer& hash) {
+      return store->countSegments(hash, deviceName, PackStore::FILE_SEGMENT) > 0;
+    });
+
+  check("completeness index", [&] (const Buffer& hash) {
+      return store->getFileStatus(hash, deviceName).isComplete();
+    });
+
+  check("ObjectDb::isComplete", [&] (const Buffer& hash) {
+      return ObjectDb::isComplete(tmpdir, deviceName, toHex(hash));
+    });
+}
+
+BOOST_AUTO_TEST_CASE(GarbageCollection)
+{
+  const size_t N_VERSIONS = 4;
+
+  // every file is modified a few times, only the last version is live
+  std::vector<std::vector<ConstBufferPtr>> versions(N_FILES);
+  {
+    PackStorePtr store = PackStore::open(tmpdir);
+    std::vector<uint8_t> payload(8192);
+    for (size_t i = 0; i < N_FILES; ++i) {
+      for (size_t version = 0; version < N_VERSIONS; ++version) {
+        size_t id = i * N_VERSIONS + version;
+        versions[i].push_back(util::Sha256::computeDigest(reinterpret_cast<const uint8_t*>(&id), sizeof(id)));
+        for (size_t segment = 0; segment < N_SEGMENTS; ++segment) {
+          std::fill(payload.begin(), payload.end(), static_cast<uint8_t>(segment));
+          std::memcpy(payload.data(), &id, sizeof(id));
+          Data data(Name(deviceName).append(name::Component(*versions[i].back())).appendSegment(segment));
+          data.setContent(payload.data(), payload.size());
+          m_keyChain.sign(data, signingWithSha256());
+          store->saveSegment(*versions[i].back(), deviceName, PackStore::FILE_SEGMENT, segment, data, false);
+        }
+      }
+    }
+  }
+  // start appending to a new pack
+  fs::ofstream(tmpdir / "objects" / "pack-1.pack");
+
+  PackStorePtr store = PackStore::open(tmpdir);
+  std::chrono::nanoseconds maxPause(0);
+  std::chrono::nanoseconds totalPause(0);
+  auto timed = [&] (const std::function<void()>& f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::nanoseconds pause = std::chrono::steady_clock::now() - start;
+    maxPause = std::max(maxPause, pause);
+    totalPause += pause;
+  };
+
+  size_t nRemovedSegments = 0;
+  for (size_t i = 0; i < N_FILES; ++i) {
+    for (size_t version = 0; version + 1 < N_VERSIONS; ++version) {
+      timed([&] { nRemovedSegments += store->removeFile(*versions[i][version], deviceName); });
+    }
+  }
+  timed([&] { store->flush(); });
+  BOOST_CHECK_EQUAL(nRemovedSegments, N_FILES * (N_VERSIONS - 1) * N_SEGMENTS);
+
+  std::cout << "removal of " << N_FILES * (N_VERSIONS - 1) << " versions: max pause "
+            << std::chrono::duration<double, std::milli>(maxPause).count() << " ms, total "
+            << std::chrono::duration<double>(totalPause).count() << " s" << std::endl;
+
+  auto usage = store->getPackUsage();
+  BOOST_REQUIRE_EQUAL(usage.size(), 1);
+
+  maxPause = totalPause = std::chrono::nanoseconds(0);
+  bool isRemoved = false;
+  while (!isRemoved) {
+    timed([&] { isRemoved = store->compactPack(usage[0].pack); });
+  }
+
+  std::cout << "compaction: " << (usage[0].size - usage[0].liveSize) / 1048576.0 << " MB freed of "
+            << usage[0].size / 1048576.0 << " MB, max pause "
+            << std::chrono::duration<double, std::milli>(maxPause).count() << " ms, total "
+            << std::chrono::duration<double>(totalPause).count() << " s" << std::endl;
+
+  BOOST_CHECK_EQUAL(store->fetchSegments(*versions[0].back(), deviceName, PackStore::FILE_SEGMENT).size(),
+                    N_SEGMENTS);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace tests
+} // namespace chronoshare
+} // namespace ndn
@@ -0,0 +1,208 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#define BOOST_TEST_MAIN 1
+#define BOOST_TEST_DYN_LINK 1
+#define BOOST_TEST_MODULE ChronoShare ObjectManager Benchmark
+
+#include "object-manager.hpp"
+#include "object-db.hpp"
+
+#include "test-common.hpp"
+
+#include <boost/test/unit_test.hpp>
+
+#include <ndn-cxx/util/dummy-client-face.hpp>
+#include <ndn-cxx/util/string-helper.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+
+namespace ndn {
+namespace chronoshare {
+namespace tests {
+
+namespace fs = boost::filesystem;
+
+class ObjectManagerBenchmarkFixture : public IdentityManagementFixture
+{
+public:
+  ObjectManagerBenchmarkFixture()
+    : face(m_io, m_keyChain, {false, false})
+    , tmpdir(fs::path(UNIT_TEST_CONFIG_PATH) / "ObjectManagerBenchmark")
+  {
+    if (exists(tmpdir)) {
+      remove_all(tmpdir);
+    }
+    fs::create_directories(tmpdir);
+  }
+
+  ~ObjectManagerBenchmarkFixture()
+  {
+    remove_all(tmpdir);
+  }
+
+  fs::path
+  makeFile(const std::string& name, size_t size)
+  {
+    fs::path file = tmpdir / name;
+    fs::ofstream os(file, std::ios::out | std::ios::binary);
+
+    std::mt19937 rng(size);
+    std::vector<char> block(64 * 1024);
+    for (size_t written = 0; written < size; written += block.size()) {
+      for (auto& c : block) {
+        c = static_cast<char>(rng());
+      }
+      os.write(block.data(), std::min(block.size(), size - written));
+    }
+    return file;
+  }
+
+public:
+  util::DummyClientFace face;
+  fs::path tmpdir;
+};
+
+BOOST_FIXTURE_TEST_SUITE(ObjectManagerBenchmark, ObjectManagerBenchmarkFixture)
+
+BOOST_AUTO_TEST_CASE(LocalFileToObjects)
+{
+  Name deviceName("/benchmark/device");
+
+  for (size_t size : {1 << 20, 16 << 20, 128 << 20}) {
+    // a fresh object folder for every run, so that all segments are actually inserted
+    ObjectManager manager(face, m_keyChain, tmpdir / std::to_string(size), "benchmark");
+    fs::path file = makeFile("file-" + std::to_string(size), size);
+
+    auto start = std::chrono::steady_clock::now();
+    auto objects = manager.localFileToObjects(file, deviceName);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    face.sentData.clear();
+
+    std::cout << "localFileToObjects: " << (size >> 20) << " MB, "
+              << std::get<1>(objects) << " segments, "
+              << elapsed.count() << " s, "
+              << (size / 1048576.0 / elapsed.count()) << " MB/s" << std::endl;
+  }
+}
+
+BOOST_AUTO_TEST_CASE(ObjectsToLocalFile)
+{
+  Name deviceName("/benchmark/device");
+
+  for (size_t size : {1 << 20, 16 << 20, 128 << 20}) {
+    ObjectManager manager(face, m_keyChain, tmpdir / ("restore-" + std::to_string(size)), "benchmark");
+    fs::path file = makeFile("restore-file-" + std::to_string(size), size);
+    auto objects = manager.localFileToObjects(file, deviceName);
+    face.sentData.clear();
+
+    auto start = std::chrono::steady_clock::now();
+    manager.objectsToLocalFile(deviceName, *std::get<0>(objects), tmpdir / "restored");
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << "objectsToLocalFile: " << (size >> 20) << " MB, "
+              << std::get<1>(objects) << " segments, "
+              << elapsed.count() << " s, "
+              << (size / 1048576.0 / elapsed.count()) << " MB/s" << std::endl;
+  }
+}
+
+BOOST_AUTO_TEST_CASE(LocalFileToObjectsConcurrency)
+{
+  Name deviceName("/benchmark/device");
+  const size_t size = 128 << 20;
+  fs::path file = makeFile("file-concurrency", size);
+
+  // 1, 2, 4, ... up to the number of cores
+  size_t maxThreads = std::max(1U, std::thread::hardware_concurrency());
+  std::vector<size_t> threadCounts;
+  for (size_t nThreads = 1; nThreads < maxThreads; nThreads *= 2) {
+    threadCounts.push_back(nThreads);
+  }
+  threadCounts.push_back(maxThreads);
+
+  for (size_t nThreads : threadCounts) {
+    ObjectManager manager(face, m_keyChain, tmpdir / ("threads-" + std::to_string(nThreads)), "benchmark");
+    manager.setConcurrency(nThreads);
+
+    auto start = std::chrono::steady_clock::now();
+    manager.localFileToObjects(file, deviceName);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    face.sentData.clear();
+
+    std::cout << "localFileToObjects: " << (size >> 20) << " MB, "
+              << nThreads << " threads, "
+              << elapsed.count() << " s, "
+              << (size / 1048576.0 / elapsed.count()) << " MB/s" << std::endl;
+  }
+}
+
+BOOST_AUTO_TEST_CASE(InsertIntoLargeFile)
+{
+  Name deviceName("/benchmark/device");
+  Name senderName("/benchmark/sender");
+  const size_t size = 100 << 20;
+
+  fs::path version1 = makeFile("version1", size);
+  fs::path version2 = tmpdir / "version2";
+  {
+    // the same content with one byte inserted in the middle
+    fs::ifstream is(version1, std::ios::in | std::ios::binary);
+    fs::ofstream os(version2, std::ios::out | std::ios::binary);
+    std::vector<char> buffer(size / 2);
+    is.read(buffer.data(), buffer.size());
+    os.write(buffer.data(), buffer.size());
+    os.put('x');
+    os << is.rdbuf();
+  }
+
+  for (bool isContentDefined : {false, true}) {
+    std::string mode = isContentDefined ? "cdc" : "fixed";
+    ObjectManager receiver(face, m_keyChain, tmpdir / ("receiver-" + mode), "benchmark");
+    ObjectManager sender(face, m_keyChain, tmpdir / ("sender-" + mode), "benchmark");
+    receiver.setContentDefinedChunking(isContentDefined);
+    sender.setContentDefinedChunking(isContentDefined);
+
+    receiver.localFileToObjects(version1, deviceName);
+    auto start = std::chrono::steady_clock::now();
+    auto objects = sender.localFileToObjects(version2, senderName);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    face.sentData.clear();
+
+    FileManifestPtr manifest = ObjectDb(tmpdir / ("sender-" + mode) / ".chronoshare",
+                                        toHex(*std::get<0>(objects))).fetchManifest(senderName);
+    auto missing = receiver.reuseLocalSegments(senderName, *std::get<0>(objects), *manifest);
+
+    std::cout << "1-byte insert into " << (size >> 20) << " MB file, " << mode << " segments: "
+              << missing.size() << " of " << manifest->size() << " segments to fetch, "
+              << "publishing took " << elapsed.count() << " s" << std::endl;
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace tests
+} // namespace chronoshare
+} // namespace ndn
@@ -0,0 +1,224 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#define BOOST_TEST_MAIN 1
+#define BOOST_TEST_DYN_LINK 1
+#define BOOST_TEST_MODULE ChronoShare SyncLog Benchmark
+
+#include "sync-log.hpp"
+
+#include "test-common.hpp"
+
+#include <boost/test/unit_test.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+namespace ndn {
+namespace chronoshare {
+namespace tests {
+
+namespace fs = boost::filesystem;
+
+const int N_DEVICES = 1000;
+const int N_STATES = 300;
+// sync interests carry the digests of peers that are a few states behind
+const int N_RECENT_STATES = 50;
+const size_t N_REPLIES = 1000;
+// the queries on full snapshots take too long to run as many
+const size_t N_LEGACY_REPLIES = 20;
+
+// the state log and the query answering sync interests before the state log was kept in memory
+const std::string LEGACY_DATABASE = "\
+CREATE TABLE SyncNodes(device_id INTEGER PRIMARY KEY AUTOINCREMENT, device_name BLOB NOT NULL,   \
+                       seq_no INTEGER NOT NULL, last_known_locator BLOB);                        \
+CREATE INDEX SyncNodes_device_name ON SyncNodes (device_name);                                   \
+CREATE TABLE SyncLog(state_id INTEGER PRIMARY KEY AUTOINCREMENT, state_hash BLOB NOT NULL UNIQUE, \
+                     last_update TIMESTAMP NOT NULL);                                             \
+CREATE TABLE SyncStateNodes(id INTEGER PRIMARY KEY AUTOINCREMENT, state_id INTEGER NOT NULL,     \
+                            device_id INTEGER NOT NULL, seq_no INTEGER NOT NULL);                \
+CREATE INDEX SyncStateNodes_device_id ON SyncStateNodes (device_id);                             \
+CREATE INDEX SyncStateNodes_state_id  ON SyncStateNodes (state_id);                              \
+CREATE INDEX SyncStateNodes_seq_no    ON SyncStateNodes (seq_no);                                \
+";
+
+const std::string LEGACY_FIND_STATE_DIFFERENCES = "\
+SELECT sn.device_name, sn.last_known_locator, s_old.seq_no, s_new.seq_no\
+    FROM (SELECT * FROM SyncStateNodes                                  \
+            WHERE state_id=(SELECT state_id FROM SyncLog                \
+                                WHERE state_hash=:old_hash)) s_old      \
+    LEFT JOIN (SELECT * FROM SyncStateNodes                             \
+                WHERE state_id=(SELECT state_id FROM SyncLog            \
+                                    WHERE state_hash=:new_hash)) s_new  \
+        ON s_old.device_id = s_new.device_id                            \
+    JOIN SyncNodes sn ON sn.device_id = s_old.device_id                 \
+    WHERE s_new.seq_no IS NULL OR s_old.seq_no != s_new.seq_no          \
+UNION ALL                                                               \
+SELECT sn.device_name, sn.last_known_locator, s_old.seq_no, s_new.seq_no\
+    FROM (SELECT * FROM SyncStateNodes                                  \
+            WHERE state_id=(SELECT state_id FROM SyncLog                \
+                                WHERE state_hash=:new_hash)) s_new      \
+    LEFT JOIN (SELECT * FROM SyncStateNodes                             \
+                WHERE state_id=(SELECT state_id FROM SyncLog            \
+                                    WHERE state_hash=:old_hash)) s_old  \
+        ON s_old.device_id = s_new.device_id                            \
+    JOIN SyncNodes sn ON sn.device_id = s_new.device_id                 \
+    WHERE s_old.seq_no IS NULL                                          \
+";
+
+class SyncLogBenchmarkFixture
+{
+public:
+  SyncLogBenchmarkFixture()
+    : tmpdir(fs::path(UNIT_TEST_CONFIG_PATH) / "SyncLogBenchmark")
+  {
+    if (exists(tmpdir)) {
+      remove_all(tmpdir);
+    }
+
+    log = make_shared<SyncLog>(tmpdir / "log", Name("/device").appendNumber(0));
+    legacy = make_shared<DbHelper>(tmpdir / "legacy", "sync-log.db");
+    sqlite3_exec(getDb(*legacy), LEGACY_DATABASE.c_str(), 0, 0, 0);
+    sqlite3_exec(getDb(*legacy), "BEGIN TRANSACTION", 0, 0, 0);
+
+    std::vector<Name> devices;
+    for (int device = 0; device < N_DEVICES; ++device) {
+      devices.push_back(Name("/device").appendNumber(device));
+      log->UpdateDeviceSeqNo(devices.back(), 1);
+      log->UpdateLocator(devices.back(), Name("/locator").appendNumber(device));
+
+      DbHelper::Statement stmt(*legacy, "INSERT INTO SyncNodes (device_id, device_name, seq_no, "
+                                        "last_known_locator) VALUES (?, ?, 1, ?)");
+      stmt.bind(1, device + 1);
+      stmt.bind(2, devices.back().wireEncode(), SQLITE_TRANSIENT);
+      stmt.bind(3, Name("/locator").appendNumber(device).wireEncode(), SQLITE_TRANSIENT);
+      stmt.step();
+    }
+
+    std::mt19937 rng(0);
+    std::uniform_int_distribution<int> device(0, N_DEVICES - 1);
+    for (int state = 0; state < N_STATES; ++state) {
+      if (state > 0) {
+        int changed = device(rng);
+        log->UpdateDeviceSeqNo(devices[changed], state + 1);
+
+        DbHelper::Statement stmt(*legacy, "UPDATE SyncNodes SET seq_no=? WHERE device_id=?");
+        stmt.bind(1, state + 1);
+        stmt.bind(2, changed + 1);
+        stmt.step();
+      }
+      digests.push_back(log->RememberStateInStateLog());
+
+      // every state was a full snapshot
+      {
+        DbHelper::Statement stmt(*legacy, "INSERT INTO SyncLog (state_hash, last_update) "
+                                          "VALUES (?, datetime('now'))");
+        stmt.bind(1, digests.back()->buf(), digests.back()->size(), SQLITE_STATIC);
+        stmt.step();
+      }
+      DbHelper::Statement stmt(*legacy, "INSERT INTO SyncStateNodes (state_id, device_id, seq_no) "
+                                        "SELECT ?, device_id, seq_no FROM SyncNodes");
+      stmt.bind(1, static_cast<sqlite3_int64>(sqlite3_last_insert_rowid(getDb(*legacy))));
+      stmt.step();
+    }
+    sqlite3_exec(getDb(*legacy), "END TRANSACTION", 0, 0, 0);
+  }
+
+  ~SyncLogBenchmarkFixture()
+  {
+    log.reset();
+    legacy.reset();
+    remove_all(tmpdir);
+  }
+
+  /**
+   * @brief Answer sync interests with random recent digests, @p findDifferences returning the
+   *        number of differing devices
+   */
+  template<class FindFunc>
+  void
+  measure(const std::string& label, size_t nReplies, const FindFunc& findDifferences)
+  {
+    std::mt19937 rng(0);
+    std::uniform_int_distribution<int> state(N_STATES - N_RECENT_STATES, N_STATES - 2);
+
+    size_t nDifferences = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < nReplies; ++i) {
+      int oldState = state(rng);
+      size_t nFound = findDifferences(*digests[oldState], *digests.back());
+      BOOST_CHECK_GT(nFound, 0);
+      nDifferences += nFound;
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << label << ": " << N_DEVICES << " devices, "
+              << static_cast<double>(nDifferences) / nReplies << " differences and "
+              << elapsed.count() / nReplies << " us per sync interest reply" << std::endl;
+  }
+
+  static sqlite3*
+  getDb(DbHelper& db)
+  {
+    DbHelper::Statement stmt(db, "SELECT 1");
+    return sqlite3_db_handle(stmt);
+  }
+
+public:
+  fs::path tmpdir;
+  shared_ptr<SyncLog> log;
+  DbHelperPtr legacy;
+  std::vector<ConstBufferPtr> digests;
+};
+
+BOOST_FIXTURE_TEST_SUITE(SyncLogBenchmark, SyncLogBenchmarkFixture)
+
+BOOST_AUTO_TEST_CASE(FindStateDifferences)
+{
+  measure("SQL over full snapshots", N_LEGACY_REPLIES, [this] (const Buffer& oldHash, const Buffer& newHash) {
+      DbHelper::Statement stmt(*legacy, LEGACY_FIND_STATE_DIFFERENCES);
+      stmt.bind(1, oldHash.buf(), oldHash.size(), SQLITE_STATIC);
+      stmt.bind(2, newHash.buf(), newHash.size(), SQLITE_STATIC);
+
+      SyncStateMsg msg;
+      while (stmt.step() == SQLITE_ROW) {
+        SyncState* state = msg.add_state();
+        state->set_name(reinterpret_cast<const char*>(stmt.getBlob(0)), stmt.getSize(0));
+        state->set_locator(reinterpret_cast<const char*>(stmt.getBlob(1)), stmt.getSize(1));
+        state->set_type(SyncState::UPDATE);
+        state->set_seq(sqlite3_column_int64(stmt, 3));
+      }
+      return static_cast<size_t>(msg.state_size());
+    });
+
+  measure("in-memory state index", N_REPLIES, [this] (const Buffer& oldHash, const Buffer& newHash) {
+      if (log->LookupSyncLog(oldHash) <= 0) {
+        return size_t(0);
+      }
+      return static_cast<size_t>(log->FindStateDifferences(oldHash, newHash)->state_size());
+    });
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace tests
+} // namespace chronoshare
+} // namespace ndn
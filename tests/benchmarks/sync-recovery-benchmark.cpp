@@ -0,0 +1,161 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#define BOOST_TEST_MAIN 1
+#define BOOST_TEST_DYN_LINK 1
+#define BOOST_TEST_MODULE ChronoShare Sync Recovery Benchmark
+
+#include "sync-core.hpp"
+
+#include "test-common.hpp"
+
+#include <boost/test/unit_test.hpp>
+
+#include <chrono>
+#include <iostream>
+
+namespace ndn {
+namespace chronoshare {
+namespace tests {
+
+namespace fs = boost::filesystem;
+
+// the responder knows newer seq_nos of a few devices than the peer that recovers
+const int N_DIVERGED_DEVICES = 3;
+const size_t N_REPLIES = 20;
+
+const Name SYNC_PREFIX("/ndn/multicast/chronoshare/shared-folder");
+
+class SyncRecoveryBenchmarkFixture
+{
+public:
+  SyncRecoveryBenchmarkFixture()
+    : tmpdir(fs::path(UNIT_TEST_CONFIG_PATH) / "SyncRecoveryBenchmark")
+  {
+    if (exists(tmpdir)) {
+      remove_all(tmpdir);
+    }
+  }
+
+  ~SyncRecoveryBenchmarkFixture()
+  {
+    remove_all(tmpdir);
+  }
+
+  static Name
+  deviceName(int device)
+  {
+    return Name("/ndn/edu/ucla").append("user-" + std::to_string(device)).append("laptop");
+  }
+
+  /**
+   * @brief Compare the bytes and the time of the replies to RECOVER and RECONCILE Interests
+   *        in a group of @p nDevices devices
+   */
+  void
+  measure(int nDevices)
+  {
+    fs::path dir = tmpdir / std::to_string(nDevices);
+    SyncLog requester(dir / "requester", deviceName(0));
+    SyncLog responder(dir / "responder", deviceName(1));
+
+    for (int device = 0; device < nDevices; ++device) {
+      Name locator = Name("/ndn/edu/ucla/hub").appendNumber(device % 16);
+      for (SyncLog* log : {&requester, &responder}) {
+        log->UpdateDeviceSeqNo(deviceName(device), device % 100 + 1);
+        log->UpdateLocator(deviceName(device), locator);
+      }
+    }
+    for (int device = 2; device < 2 + N_DIVERGED_DEVICES; ++device) {
+      responder.UpdateDeviceSeqNo(deviceName(device), 1000);
+    }
+
+    ConstBufferPtr requesterDigest = requester.RememberStateInStateLog();
+    ConstBufferPtr responderDigest = responder.RememberStateInStateLog();
+
+    // RECOVER: the responder replies its whole state
+    size_t recoverInterest = 0;
+    size_t recoverData = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < N_REPLIES; ++i) {
+      Name name(SYNC_PREFIX);
+      name.append(SyncCore::RECOVER).append(name::Component(responderDigest));
+
+      SyncStateMsgPtr msg = responder.FindStateDifferences(Buffer(1), *responderDigest);
+      BOOST_CHECK_EQUAL(msg->state_size(), nDevices);
+      BufferPtr content = serializeGZipMsg(*msg);
+
+      recoverInterest = name.wireEncode().size();
+      recoverData = name.wireEncode().size() + content->size();
+    }
+    std::chrono::duration<double, std::micro> recoverTime = std::chrono::steady_clock::now() - start;
+
+    // RECONCILE: the requester sends the sketch of its state, the responder replies the entries
+    // missing in it
+    size_t reconcileInterest = 0;
+    size_t reconcileData = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < N_REPLIES; ++i) {
+      shared_ptr<SyncStateSketch> sketch =
+        requester.GetStateSketch(*requesterDigest, SyncCore::RECONCILE_SKETCH_SIZE);
+      Name name(SYNC_PREFIX);
+      name.append(SyncCore::RECONCILE)
+        .append(name::Component(responderDigest))
+        .append(name::Component(serializeMsg(*sketch)));
+
+      SyncStateMsgPtr msg = responder.FindStateDifferences(*sketch, *responderDigest);
+      BOOST_REQUIRE(msg != nullptr);
+      BOOST_CHECK_EQUAL(msg->state_size(), N_DIVERGED_DEVICES);
+      BufferPtr content = serializeGZipMsg(*msg);
+
+      reconcileInterest = name.wireEncode().size();
+      reconcileData = name.wireEncode().size() + content->size();
+    }
+    std::chrono::duration<double, std::micro> reconcileTime =
+      std::chrono::steady_clock::now() - start;
+
+    // signatures and the other fields of the packets are the same for both
+    std::cout << nDevices << " devices, " << N_DIVERGED_DEVICES << " diverged:" << std::endl
+              << "  RECOVER:   " << recoverInterest << " bytes of Interest name, "
+              << recoverData << " bytes of Data name and content, "
+              << recoverTime.count() / N_REPLIES << " us per reply" << std::endl
+              << "  RECONCILE: " << reconcileInterest << " bytes of Interest name, "
+              << reconcileData << " bytes of Data name and content, "
+              << reconcileTime.count() / N_REPLIES << " us per sketch and reply" << std::endl;
+  }
+
+public:
+  fs::path tmpdir;
+};
+
+BOOST_FIXTURE_TEST_SUITE(SyncRecoveryBenchmark, SyncRecoveryBenchmarkFixture)
+
+BOOST_AUTO_TEST_CASE(BytesOnTheWire)
+{
+  for (int nDevices : {100, 1000, 5000}) {
+    measure(nDevices);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace tests
+} // namespace chronoshare
+} // namespace ndn
@@ -0,0 +1,139 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#define BOOST_TEST_MAIN 1
+#define BOOST_TEST_DYN_LINK 1
+#define BOOST_TEST_MODULE ChronoShare Sync State Apply Benchmark
+
+#include "sync-log.hpp"
+
+#include "test-common.hpp"
+
+#include <boost/test/unit_test.hpp>
+
+#include <chrono>
+#include <iostream>
+
+namespace ndn {
+namespace chronoshare {
+namespace tests {
+
+namespace fs = boost::filesystem;
+
+const int N_ENTRIES = 1000;
+
+class SyncStateApplyBenchmarkFixture
+{
+public:
+  SyncStateApplyBenchmarkFixture()
+    : tmpdir(fs::path(UNIT_TEST_CONFIG_PATH) / "SyncStateApplyBenchmark")
+  {
+    if (exists(tmpdir)) {
+      remove_all(tmpdir);
+    }
+  }
+
+  ~SyncStateApplyBenchmarkFixture()
+  {
+    remove_all(tmpdir);
+  }
+
+  /**
+   * @brief State message with @p seqNo for N_ENTRIES devices, as in a reply to a recovery
+   */
+  static SyncStateMsg
+  makeStateMsg(sqlite3_int64 seqNo)
+  {
+    SyncStateMsg msg;
+    for (int device = 0; device < N_ENTRIES; ++device) {
+      Name name = Name("/ndn/edu/ucla").append("user-" + std::to_string(device)).append("laptop");
+      Name locator = Name("/ndn/edu/ucla/hub").appendNumber(device % 16);
+
+      SyncState* state = msg.add_state();
+      state->set_name(reinterpret_cast<const char*>(name.wireEncode().wire()),
+                      name.wireEncode().size());
+      state->set_locator(reinterpret_cast<const char*>(locator.wireEncode().wire()),
+                         locator.wireEncode().size());
+      state->set_type(SyncState::UPDATE);
+      state->set_seq(seqNo);
+    }
+    return msg;
+  }
+
+  /**
+   * @brief Apply a message with new devices, then one with newer seq_nos of the same devices, with
+   *        @p apply returning the number of changed devices
+   */
+  template<class ApplyFunc>
+  void
+  measure(const std::string& label, const ApplyFunc& apply)
+  {
+    SyncLog log(tmpdir / label, Name("/ndn/edu/ucla/lijing"));
+    log.RememberStateInStateLog();
+
+    for (sqlite3_int64 seqNo : {1, 2}) {
+      SyncStateMsg msg = makeStateMsg(seqNo);
+
+      auto start = std::chrono::steady_clock::now();
+      int nChanged = apply(log, msg);
+      std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+      BOOST_CHECK_EQUAL(nChanged, N_ENTRIES);
+      std::cout << label << ": " << N_ENTRIES << (seqNo == 1 ? " new devices" : " newer seq_nos")
+                << " applied in " << elapsed.count() << " ms" << std::endl;
+    }
+  }
+
+public:
+  fs::path tmpdir;
+};
+
+BOOST_FIXTURE_TEST_SUITE(SyncStateApplyBenchmark, SyncStateApplyBenchmarkFixture)
+
+BOOST_AUTO_TEST_CASE(ApplyStateMsg)
+{
+  // how SyncCore applied state messages before: a transaction for every update, and the
+  // difference found between the old and the new state in the state log
+  measure("transaction per entry", [] (SyncLog& log, const SyncStateMsg& msg) {
+      ConstBufferPtr oldDigest = log.RememberStateInStateLog();
+      for (const SyncState& state : msg.state()) {
+        Name deviceName(Block(reinterpret_cast<const uint8_t*>(state.name().data()),
+                              state.name().size()));
+        Name locator(Block(reinterpret_cast<const uint8_t*>(state.locator().data()),
+                           state.locator().size()));
+        log.UpdateDeviceSeqNo(deviceName, state.seq());
+        log.UpdateLocator(deviceName, locator);
+      }
+      ConstBufferPtr newDigest = log.RememberStateInStateLog();
+      return log.FindStateDifferences(*oldDigest, *newDigest, true)->state_size();
+    });
+
+  measure("single transaction", [] (SyncLog& log, const SyncStateMsg& msg) {
+      SyncStateMsg diff;
+      log.ApplyStateMsg(msg, diff);
+      return diff.state_size();
+    });
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace tests
+} // namespace chronoshare
+} // namespace ndn
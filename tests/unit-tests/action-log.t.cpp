@@ -51,6 +51,31 @@ public:
   shared_ptr<SyncLog> syncLog;
 };
 
+/**
+ * @brief Counts the commits on the connection of the metadata database
+ */
+class CommitCounter : public DbHelper
+{
+public:
+  explicit CommitCounter(const fs::path& path)
+    : DbHelper(path / ".chronoshare", "metadata.db")
+    , nCommits(0)
+  {
+    sqlite3_commit_hook(m_db, [] (void* self) {
+        ++static_cast<CommitCounter*>(self)->nCommits;
+        return 0;
+      }, this);
+  }
+
+  ~CommitCounter()
+  {
+    sqlite3_commit_hook(m_db, nullptr, nullptr);
+  }
+
+public:
+  int nCommits;
+};
+
 BOOST_FIXTURE_TEST_SUITE(TestActionLog, TestActionLogFixture)
 
 BOOST_AUTO_TEST_CASE(UpdateAction)
@@ -191,7 +216,16 @@ BOOST_AUTO_TEST_CASE(DeleteAction)
 
   BOOST_CHECK_EQUAL(data->getName(), "/lijing/test-chronoshare/action/top-secret/%02");
 
-  ActionItemPtr action = actionLog->LookupAction(Name("/lijing/test-chronoshare/action/top-secret").appendNumber(2));
+  // the deleted version can still be found by its content
+  ActionItemPtr action = actionLog->LookupActionForHash(localName,
+                                          *fromHex("2ff304769cdb0125ac039e6fe7575f8576dceffc62618a431715aaf6eea2bf1c"));
+  BOOST_REQUIRE(action != nullptr);
+  BOOST_CHECK_EQUAL(action->action(), ActionItem::UPDATE);
+  BOOST_CHECK_EQUAL(action->version(), 0);
+  BOOST_CHECK(actionLog->LookupActionForHash(Name("/zhenkai"),
+                                             *fromHex("2ff304769cdb0125ac039e6fe7575f8576dceffc62618a431715aaf6eea2bf1c")) == nullptr);
+
+  action = actionLog->LookupAction(Name("/lijing/test-chronoshare/action/top-secret").appendNumber(2));
   BOOST_CHECK(action != nullptr);
 
   if (action) {
@@ -239,6 +273,31 @@ BOOST_AUTO_TEST_CASE(DeleteAction)
   BOOST_CHECK_EQUAL(action->action(), ActionItem::DELETE);
 }
 
+BOOST_AUTO_TEST_CASE(LocalActionInOneCommit)
+{
+  auto actionLog = std::make_shared<ActionLog>(forwarder.addFace(), tmpdir, syncLog,
+                                               "top-secret", name::Component("test-chronoshare"),
+                                               ActionLog::OnFileAddedOrChangedCallback(),
+                                               ActionLog::OnFileRemovedCallback());
+  CommitCounter counter(tmpdir);
+
+  // sequence number, action and file state
+  actionLog->AddLocalActionUpdate("file.txt",
+                                  *fromHex("2ff304769cdb0125ac039e6fe7575f8576dceffc62618a431715aaf6eea2bf1c"),
+                                  std::time(nullptr), 0755, 10);
+  BOOST_CHECK_EQUAL(counter.nCommits, 1);
+  BOOST_CHECK_EQUAL(syncLog->SeqNo(localName), 1);
+  FileItemPtr file = actionLog->GetFileState()->LookupFile("file.txt");
+  BOOST_REQUIRE(file != nullptr);
+  BOOST_CHECK(file->is_complete());
+
+  counter.nCommits = 0;
+  actionLog->AddLocalActionDelete("file.txt");
+  BOOST_CHECK_EQUAL(counter.nCommits, 1);
+  BOOST_CHECK_EQUAL(syncLog->SeqNo(localName), 2);
+  BOOST_CHECK(actionLog->GetFileState()->LookupFile("file.txt") == nullptr);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 } // namespace tests
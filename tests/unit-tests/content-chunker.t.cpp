@@ -0,0 +1,107 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#include "content-chunker.hpp"
+
+#include "test-common.hpp"
+
+#include <random>
+#include <set>
+
+namespace ndn {
+namespace chronoshare {
+namespace tests {
+
+BOOST_AUTO_TEST_SUITE(TestContentChunker)
+
+static std::vector<uint64_t>
+cut(const std::vector<uint8_t>& content, size_t maxSize, size_t blockSize)
+{
+  ContentDefinedChunker chunker(maxSize);
+  std::vector<uint64_t> boundaries;
+  for (size_t offset = 0; offset < content.size(); offset += blockSize) {
+    chunker.update(content.data() + offset, std::min(blockSize, content.size() - offset), boundaries);
+  }
+  chunker.finish(boundaries);
+  return boundaries;
+}
+
+BOOST_AUTO_TEST_CASE(Boundaries)
+{
+  std::mt19937 rng(42);
+  std::vector<uint8_t> content(1024 * 1024);
+  for (auto& byte : content) {
+    byte = static_cast<uint8_t>(rng());
+  }
+
+  auto boundaries = cut(content, 8192, 4096);
+  BOOST_REQUIRE(!boundaries.empty());
+  BOOST_CHECK_EQUAL(boundaries.back(), content.size());
+
+  uint64_t begin = 0;
+  for (size_t i = 0; i < boundaries.size(); ++i) {
+    BOOST_CHECK_LE(boundaries[i] - begin, 8192);
+    if (i + 1 < boundaries.size()) {
+      BOOST_CHECK_GE(boundaries[i] - begin, 1024);
+    }
+    begin = boundaries[i];
+  }
+
+  // boundaries do not depend on how the stream is fed
+  auto otherBoundaries = cut(content, 8192, 777);
+  BOOST_CHECK_EQUAL_COLLECTIONS(boundaries.begin(), boundaries.end(),
+                                otherBoundaries.begin(), otherBoundaries.end());
+
+  ContentDefinedChunker empty(8192);
+  std::vector<uint64_t> emptyBoundaries;
+  empty.finish(emptyBoundaries);
+  BOOST_CHECK(emptyBoundaries.empty());
+}
+
+BOOST_AUTO_TEST_CASE(Insertion)
+{
+  std::mt19937 rng(7);
+  std::vector<uint8_t> content(1024 * 1024);
+  for (auto& byte : content) {
+    byte = static_cast<uint8_t>(rng());
+  }
+  std::vector<uint8_t> edited(content);
+  edited.insert(edited.begin() + edited.size() / 3, 0x5a);
+
+  auto original = cut(content, 8192, 4096);
+  auto shifted = cut(edited, 8192, 4096);
+
+  // all boundaries after the edit move by exactly one byte
+  std::set<uint64_t> originalSet(original.begin(), original.end());
+  size_t nChanged = 0;
+  for (uint64_t boundary : shifted) {
+    uint64_t unshifted = boundary > edited.size() / 3 ? boundary - 1 : boundary;
+    if (originalSet.count(unshifted) == 0) {
+      ++nChanged;
+    }
+  }
+  BOOST_CHECK_LE(nChanged, 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace tests
+} // namespace chronoshare
+} // namespace ndn
@@ -0,0 +1,236 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#include "db-helper.hpp"
+
+#include "test-common.hpp"
+
+namespace ndn {
+namespace chronoshare {
+namespace tests {
+
+namespace fs = boost::filesystem;
+
+class TestDbHelperFixture
+{
+public:
+  TestDbHelperFixture()
+  {
+    tmpdir = fs::unique_path(UNIT_TEST_CONFIG_PATH) / "TestDbHelper";
+    if (exists(tmpdir)) {
+      remove_all(tmpdir);
+    }
+    db = make_shared<DbHelper>(tmpdir, "test.db");
+  }
+
+  ~TestDbHelperFixture()
+  {
+    db.reset();
+    remove_all(tmpdir);
+  }
+
+public:
+  fs::path tmpdir;
+  DbHelperPtr db;
+};
+
+class LegacyImporter : public DbHelper
+{
+public:
+  using DbHelper::DbHelper;
+  using DbHelper::importLegacyTables;
+};
+
+BOOST_FIXTURE_TEST_SUITE(TestDbHelper, TestDbHelperFixture)
+
+BOOST_AUTO_TEST_CASE(StatementReuse)
+{
+  {
+    DbHelper::Statement stmt(*db, "CREATE TABLE Test (value INTEGER)");
+    BOOST_CHECK_EQUAL(stmt.step(), SQLITE_DONE);
+  }
+  BOOST_CHECK_EQUAL(db->getPreparedStatementCount(), 1);
+
+  for (int i = 0; i < 10; ++i) {
+    DbHelper::Statement stmt(*db, "INSERT INTO Test VALUES (?)");
+    stmt.bind(1, i);
+    BOOST_CHECK_EQUAL(stmt.step(), SQLITE_DONE);
+  }
+  BOOST_CHECK_EQUAL(db->getPreparedStatementCount(), 2);
+
+  // a statement left in the middle of a result set is reset when it is returned
+  for (int i = 0; i < 3; ++i) {
+    DbHelper::Statement stmt(*db, "SELECT value FROM Test WHERE value >= ? ORDER BY value");
+    stmt.bind(1, i);
+    BOOST_REQUIRE_EQUAL(stmt.step(), SQLITE_ROW);
+    BOOST_CHECK_EQUAL(stmt.getInt(0), i);
+  }
+  BOOST_CHECK_EQUAL(db->getPreparedStatementCount(), 3);
+
+  // bindings do not leak into the next use
+  DbHelper::Statement stmt(*db, "SELECT count(*) FROM Test WHERE value >= ?");
+  BOOST_REQUIRE_EQUAL(stmt.step(), SQLITE_ROW);
+  BOOST_CHECK_EQUAL(stmt.getInt(0), 0);
+}
+
+BOOST_AUTO_TEST_CASE(NestedStatements)
+{
+  DbHelper::Statement(*db, "CREATE TABLE Test (value INTEGER)").step();
+  for (int i = 0; i < 3; ++i) {
+    DbHelper::Statement stmt(*db, "INSERT INTO Test VALUES (?)");
+    stmt.bind(1, i);
+    stmt.step();
+  }
+
+  // the same SQL used while it is already borrowed gets a statement of its own
+  const std::string sql = "SELECT value FROM Test ORDER BY value";
+  int nPairs = 0;
+  {
+    DbHelper::Statement outer(*db, sql);
+    while (outer.step() == SQLITE_ROW) {
+      DbHelper::Statement inner(*db, sql);
+      while (inner.step() == SQLITE_ROW) {
+        ++nPairs;
+      }
+    }
+  }
+  BOOST_CHECK_EQUAL(nPairs, 9);
+  size_t nPrepared = db->getPreparedStatementCount();
+
+  // both statements are cached afterwards
+  {
+    DbHelper::Statement outer(*db, sql);
+    DbHelper::Statement inner(*db, sql);
+  }
+  BOOST_CHECK_EQUAL(db->getPreparedStatementCount(), nPrepared);
+}
+
+BOOST_AUTO_TEST_CASE(InvalidStatement)
+{
+  BOOST_CHECK_THROW(DbHelper::Statement(*db, "SELECT FROM"), DbHelper::Error);
+  BOOST_CHECK_THROW(DbHelper::Statement(*db, "SELECT * FROM NoSuchTable"), DbHelper::Error);
+}
+
+BOOST_AUTO_TEST_CASE(Durability)
+{
+  auto getPragma = [] (DbHelper& db, const std::string& pragma) {
+    DbHelper::Statement stmt(db, "PRAGMA " + pragma);
+    BOOST_REQUIRE_EQUAL(stmt.step(), SQLITE_ROW);
+    return stmt.getString(0);
+  };
+
+  BOOST_CHECK_EQUAL(DbHelper::getDefaultDurability(), DbHelper::DURABILITY_SAFE);
+  BOOST_CHECK_EQUAL(getPragma(*db, "journal_mode"), "wal");
+  BOOST_CHECK_EQUAL(getPragma(*db, "synchronous"), "2"); // FULL
+
+  DbHelper::setDefaultDurability(DbHelper::DURABILITY_FAST);
+  DbHelper fast(tmpdir, "fast.db");
+  DbHelper::setDefaultDurability(DbHelper::DURABILITY_ROLLBACK);
+  DbHelper rollback(tmpdir, "rollback.db");
+  DbHelper::setDefaultDurability(DbHelper::DURABILITY_SAFE);
+
+  BOOST_CHECK_EQUAL(getPragma(fast, "journal_mode"), "wal");
+  BOOST_CHECK_EQUAL(getPragma(fast, "synchronous"), "1"); // NORMAL
+  BOOST_CHECK_EQUAL(getPragma(rollback, "journal_mode"), "delete");
+  BOOST_CHECK_EQUAL(getPragma(rollback, "synchronous"), "2");
+}
+
+BOOST_AUTO_TEST_CASE(ReadWhileWriting)
+{
+  DbHelper::Statement(*db, "CREATE TABLE Test (value INTEGER)").step();
+  DbHelper::Statement(*db, "INSERT INTO Test VALUES (1)").step();
+
+  DbHelper::Statement(*db, "BEGIN TRANSACTION").step();
+  DbHelper::Statement(*db, "INSERT INTO Test VALUES (2)").step();
+
+  // another connection (e.g., of another process) reads the last committed state instead of
+  // failing with SQLITE_BUSY
+  sqlite3* reader = nullptr;
+  BOOST_REQUIRE_EQUAL(sqlite3_open((tmpdir / "test.db").c_str(), &reader), SQLITE_OK);
+  auto count = [reader] {
+    sqlite3_stmt* stmt = nullptr;
+    sqlite3_prepare_v2(reader, "SELECT count(*) FROM Test", -1, &stmt, nullptr);
+    int result = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : -1;
+    sqlite3_finalize(stmt);
+    return result;
+  };
+  BOOST_CHECK_EQUAL(count(), 1);
+
+  DbHelper::Statement(*db, "END TRANSACTION").step();
+  BOOST_CHECK_EQUAL(count(), 2);
+  sqlite3_close(reader);
+}
+
+BOOST_AUTO_TEST_CASE(SharedConnection)
+{
+  DbHelper::Statement(*db, "CREATE TABLE Test (value INTEGER)").step();
+
+  DbHelper other(tmpdir / ".", "test.db");
+  DbHelper::Statement(other, "BEGIN TRANSACTION").step();
+  DbHelper::Statement(other, "INSERT INTO Test VALUES (1)").step();
+  {
+    // uncommitted changes are visible, as the connection is the same
+    DbHelper::Statement stmt(*db, "SELECT count(*) FROM Test");
+    BOOST_REQUIRE_EQUAL(stmt.step(), SQLITE_ROW);
+    BOOST_CHECK_EQUAL(stmt.getInt(0), 1);
+  }
+  DbHelper::Statement(*db, "ROLLBACK TRANSACTION").step();
+
+  // and so is the statement cache
+  BOOST_CHECK_EQUAL(other.getPreparedStatementCount(), db->getPreparedStatementCount());
+
+  DbHelper separate(tmpdir, "other.db");
+  BOOST_CHECK_EQUAL(separate.getPreparedStatementCount(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(ImportLegacyTables)
+{
+  {
+    DbHelper legacy(tmpdir, "legacy.db");
+    DbHelper::Statement(legacy, "CREATE TABLE Test (id INTEGER PRIMARY KEY, value TEXT)").step();
+    DbHelper::Statement(legacy, "INSERT INTO Test VALUES (1, 'legacy'), (2, 'legacy')").step();
+  }
+
+  LegacyImporter importer(tmpdir, "test.db");
+  DbHelper::Statement(importer, "CREATE TABLE Test (id INTEGER PRIMARY KEY, value TEXT)").step();
+  DbHelper::Statement(importer, "CREATE TABLE Other (id INTEGER PRIMARY KEY)").step();
+  DbHelper::Statement(importer, "INSERT INTO Test VALUES (2, 'current')").step();
+
+  importer.importLegacyTables(tmpdir / "legacy.db", {"Test", "Other"});
+  BOOST_CHECK(!fs::exists(tmpdir / "legacy.db"));
+
+  DbHelper::Statement stmt(importer, "SELECT id, value FROM Test ORDER BY id");
+  BOOST_REQUIRE_EQUAL(stmt.step(), SQLITE_ROW);
+  BOOST_CHECK_EQUAL(stmt.getInt(0), 1);
+  BOOST_CHECK_EQUAL(stmt.getString(1), "legacy");
+  BOOST_REQUIRE_EQUAL(stmt.step(), SQLITE_ROW);
+  BOOST_CHECK_EQUAL(stmt.getInt(0), 2);
+  BOOST_CHECK_EQUAL(stmt.getString(1), "current");
+  BOOST_CHECK_EQUAL(stmt.step(), SQLITE_DONE);
+
+  // nothing to import anymore
+  BOOST_CHECK_NO_THROW(importer.importLegacyTables(tmpdir / "legacy.db", {"Test"}));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace tests
+} // namespace chronoshare
+} // namespace ndn
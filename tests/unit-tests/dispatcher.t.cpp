@@ -112,6 +112,43 @@ BOOST_AUTO_TEST_CASE(DispatcherTest)
   BOOST_CHECK(*fileHash1 == *fileHash2);
 }
 
+BOOST_AUTO_TEST_CASE(InPlaceMaterialization)
+{
+  Dispatcher d1(user1, folder, dir1, face1);
+  Dispatcher d2(user2, folder, dir2, face2);
+  d2.setInPlaceMaterialization(true);
+
+  advanceClocks(time::milliseconds(10), 1000);
+
+  fs::path filename("a_letter_to_trump.txt");
+  std::string words = "Segments land where they belong, there is nothing to assemble.";
+
+  fs::path abf = dir1 / filename;
+
+  std::ofstream ofs;
+  ofs.open(abf.string().c_str());
+  for (int i = 0; i < 5000; i++) {
+    ofs << words;
+  }
+  ofs.close();
+
+  d1.Did_LocalFile_AddOrModify(filename);
+
+  advanceClocks(time::milliseconds(10), 1000);
+
+  fs::path ef = dir2 / filename;
+  BOOST_REQUIRE_MESSAGE(fs::exists(ef), user1 << " failed to notify " << user2 << " about "
+                                              << filename.string());
+  BOOST_CHECK(*digestFromFile(abf) == *digestFromFile(ef));
+
+  // the partial file has become the file
+  fs::path partialDir = dir2 / ".chronoshare" / "partial";
+  BOOST_CHECK(!fs::exists(partialDir) || fs::is_empty(partialDir));
+
+  // segments are saved as well, so the file can be served from here
+  BOOST_CHECK(ObjectDb::isComplete(dir2 / ".chronoshare", Name(user1), toHex(*digestFromFile(abf))));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 } // namespace tests
@@ -173,6 +173,121 @@ BOOST_FIXTURE_TEST_CASE(TestFetcher, FetcherTestData)
   // TODO add tests that other callbacks got called
 }
 
+BOOST_FIXTURE_TEST_CASE(TestFetcherValidator, FetcherTestData)
+{
+  Name baseName("/fetchtest");
+  Name deviceName("/device");
+
+  // first response for segments 3 and 7 is corrupted
+  std::set<uint32_t> corrupted = {3, 7};
+  size_t nRejected = 0;
+
+  face.onSendInterest.connect([&, this] (const Interest& interest) {
+      uint32_t requestedSeqNo = interest.getName().at(-1).toNumber();
+
+      auto data = make_shared<Data>();
+      Name name(baseName);
+      name.appendSegment(requestedSeqNo);
+
+      data->setName(name);
+      data->setFreshnessPeriod(time::seconds(300));
+      std::string content = to_string(requestedSeqNo);
+      if (corrupted.erase(requestedSeqNo) > 0) {
+        content = "999";
+      }
+      data->setContent(reinterpret_cast<const uint8_t*>(content.data()), content.size());
+      m_keyChain.sign(*data);
+      m_io.post([data, this] { face.receive(*data); });
+    });
+
+  auto validator = [&] (const Name&, const Name&, uint64_t seqno, const Data& data) {
+    std::string content(reinterpret_cast<const char*>(data.getContent().value()),
+                        data.getContent().value_size());
+    bool isValid = (content == to_string(seqno));
+    if (!isValid) {
+      ++nRejected;
+    }
+    return isValid;
+  };
+
+  Fetcher fetcher(face, true, bind(&FetcherTestData::onData, this, _1, _2, _3, _4),
+                  bind(&FetcherTestData::finish, this, _1, _2),
+                  bind(&FetcherTestData::onComplete, this, _1),
+                  bind(&FetcherTestData::onFail, this, _1), deviceName, Name("/fetchtest"), 0, 9,
+                  time::seconds(5), Name(), validator);
+
+  fetcher.RestartPipeline();
+  this->advanceClocks(time::milliseconds(50), 100);
+
+  BOOST_CHECK_EQUAL(m_done, true);
+  BOOST_CHECK_EQUAL(m_failed, false);
+  BOOST_CHECK_EQUAL(nRejected, 2);
+  BOOST_CHECK_EQUAL(recvData.size(), 10);
+  BOOST_CHECK_EQUAL_COLLECTIONS(recvData.begin(), recvData.end(), recvContent.begin(), recvContent.end());
+}
+
+BOOST_FIXTURE_TEST_CASE(TestFetcherValidatorGivesUp, FetcherTestData)
+{
+  Name baseName("/fetchtest");
+  Name deviceName("/device");
+
+  // segment 4 is always corrupted
+  size_t nRequested = 0;
+  size_t nRejected = 0;
+
+  face.onSendInterest.connect([&, this] (const Interest& interest) {
+      uint32_t requestedSeqNo = interest.getName().at(-1).toNumber();
+
+      auto data = make_shared<Data>();
+      Name name(baseName);
+      name.appendSegment(requestedSeqNo);
+
+      data->setName(name);
+      data->setFreshnessPeriod(time::seconds(300));
+      std::string content = to_string(requestedSeqNo);
+      if (requestedSeqNo == 4) {
+        ++nRequested;
+        content = "999";
+      }
+      data->setContent(reinterpret_cast<const uint8_t*>(content.data()), content.size());
+      m_keyChain.sign(*data);
+      m_io.post([data, this] { face.receive(*data); });
+    });
+
+  auto validator = [&] (const Name&, const Name&, uint64_t seqno, const Data& data) {
+    std::string content(reinterpret_cast<const char*>(data.getContent().value()),
+                        data.getContent().value_size());
+    bool isValid = (content == to_string(seqno));
+    if (!isValid) {
+      ++nRejected;
+    }
+    return isValid;
+  };
+
+  Fetcher fetcher(face, true, bind(&FetcherTestData::onData, this, _1, _2, _3, _4),
+                  bind(&FetcherTestData::finish, this, _1, _2),
+                  bind(&FetcherTestData::onComplete, this, _1),
+                  bind(&FetcherTestData::onFail, this, _1), deviceName, Name("/fetchtest"), 0, 9,
+                  time::seconds(30), Name(), validator);
+
+  fetcher.RestartPipeline();
+
+  // retries are delayed
+  this->advanceClocks(time::milliseconds(50), 4);
+  BOOST_CHECK_EQUAL(nRequested, 1);
+  BOOST_CHECK_EQUAL(m_failed, false);
+
+  this->advanceClocks(time::milliseconds(50), 200);
+
+  BOOST_CHECK_EQUAL(m_done, false);
+  BOOST_CHECK_EQUAL(m_failed, true);
+  BOOST_CHECK_EQUAL(fetcher.IsActive(), false);
+  BOOST_CHECK_EQUAL(nRequested, Fetcher::MAX_INVALID_SEGMENT_RETRIES + 1);
+  BOOST_CHECK_EQUAL(nRejected, Fetcher::MAX_INVALID_SEGMENT_RETRIES + 1);
+  BOOST_CHECK_EQUAL(recvData.size(), 9);
+  BOOST_CHECK_EQUAL(recvData.count(4), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 } // namespace tests
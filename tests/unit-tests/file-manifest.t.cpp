@@ -0,0 +1,86 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#include "file-manifest.hpp"
+
+#include "test-common.hpp"
+
+namespace ndn {
+namespace chronoshare {
+namespace tests {
+
+BOOST_AUTO_TEST_SUITE(TestFileManifest)
+
+BOOST_AUTO_TEST_CASE(Basic)
+{
+  std::vector<std::string> segments = {"segment 0", "segment 1", "last"};
+
+  FileManifest manifest;
+  for (const auto& segment : segments) {
+    manifest.addSegment(reinterpret_cast<const uint8_t*>(segment.data()), segment.size());
+  }
+  BOOST_CHECK_EQUAL(manifest.size(), 3);
+
+  BOOST_CHECK(manifest.verifySegment(1, reinterpret_cast<const uint8_t*>(segments[1].data()),
+                                     segments[1].size()));
+  BOOST_CHECK(!manifest.verifySegment(0, reinterpret_cast<const uint8_t*>(segments[1].data()),
+                                      segments[1].size()));
+  BOOST_CHECK(!manifest.verifySegment(3, reinterpret_cast<const uint8_t*>(segments[1].data()),
+                                      segments[1].size()));
+
+  // root is a digest over concatenated segment digests
+  util::Sha256 root;
+  for (const auto& segment : segments) {
+    auto digest = util::Sha256::computeDigest(reinterpret_cast<const uint8_t*>(segment.data()),
+                                              segment.size());
+    root.update(digest->data(), digest->size());
+  }
+  BOOST_CHECK(*manifest.getRoot() == *root.computeDigest());
+}
+
+BOOST_AUTO_TEST_CASE(ManifestSegments)
+{
+  FileManifest manifest;
+  for (uint32_t i = 0; i < 2 * FileManifest::MANIFEST_DIGESTS_PER_SEGMENT + 1; ++i) {
+    manifest.addSegment(reinterpret_cast<const uint8_t*>(&i), sizeof(i));
+  }
+
+  size_t nSegments = FileManifest::getManifestSegmentCount(manifest.size());
+  BOOST_CHECK_EQUAL(nSegments, 3);
+  BOOST_CHECK_EQUAL(FileManifest::getManifestSegmentCount(0), 1);
+  BOOST_CHECK_EQUAL(FileManifest::getManifestSegmentCount(1), 1);
+
+  FileManifest restored;
+  for (size_t i = 0; i < nSegments; ++i) {
+    Buffer segment = manifest.getManifestSegment(i);
+    restored.addManifestSegment(segment.data(), segment.size());
+  }
+  BOOST_CHECK_EQUAL(restored.size(), manifest.size());
+  BOOST_CHECK(*restored.getRoot() == *manifest.getRoot());
+
+  uint8_t garbage[FileManifest::DIGEST_SIZE - 1] = {0};
+  BOOST_CHECK_THROW(restored.addManifestSegment(garbage, sizeof(garbage)), FileManifest::Error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace tests
+} // namespace chronoshare
+} // namespace ndn
@@ -0,0 +1,142 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#include "hash-cache.hpp"
+
+#include "test-common.hpp"
+
+#include <ndn-cxx/util/digest.hpp>
+
+#include <boost/filesystem/fstream.hpp>
+
+#include <ctime>
+
+namespace ndn {
+namespace chronoshare {
+namespace tests {
+
+namespace fs = boost::filesystem;
+
+class TestHashCacheFixture
+{
+public:
+  TestHashCacheFixture()
+    : nWrites(0)
+  {
+    tmpdir = fs::unique_path(UNIT_TEST_CONFIG_PATH) / "TestHashCache";
+    if (exists(tmpdir)) {
+      remove_all(tmpdir);
+    }
+    fs::create_directories(tmpdir);
+  }
+
+  ~TestHashCacheFixture()
+  {
+    remove_all(tmpdir);
+  }
+
+  /**
+   * @brief Write @p content to @p filename, dated over a minute ago unless @p isRecent
+   *
+   * Every write is dated differently, so modification times change even with coarse timestamps
+   */
+  void
+  write(const std::string& filename, const std::string& content, bool isRecent = false)
+  {
+    fs::ofstream(tmpdir / filename, std::ios::out | std::ios::binary | std::ios::trunc) << content;
+    if (!isRecent) {
+      fs::last_write_time(tmpdir / filename, std::time(nullptr) - 60 - nWrites++);
+    }
+  }
+
+  ConstBufferPtr
+  digest(const std::string& content)
+  {
+    return util::Sha256::computeDigest(reinterpret_cast<const uint8_t*>(content.data()), content.size());
+  }
+
+public:
+  fs::path tmpdir;
+  int nWrites;
+};
+
+BOOST_FIXTURE_TEST_SUITE(TestHashCache, TestHashCacheFixture)
+
+BOOST_AUTO_TEST_CASE(SkipUnchanged)
+{
+  write("file", "content");
+  HashCache::FileStat stat;
+  BOOST_REQUIRE(HashCache::getFileStat(tmpdir / "file", stat));
+  BOOST_CHECK_EQUAL(stat.size, 7);
+  BOOST_CHECK(!HashCache::getFileStat(tmpdir / "missing", stat));
+  BOOST_CHECK_THROW(HashCache(tmpdir).getDigest(tmpdir / "missing", "missing"), HashCache::Error);
+
+  {
+    HashCache cache(tmpdir);
+    BOOST_REQUIRE(HashCache::getFileStat(tmpdir / "file", stat));
+    BOOST_CHECK(cache.lookup("file", stat) == nullptr);
+    BOOST_CHECK(*cache.getDigest(tmpdir / "file", "file") == *digest("content"));
+  }
+
+  // persisted
+  HashCache cache(tmpdir);
+  ConstBufferPtr cached = cache.lookup("file", stat);
+  BOOST_REQUIRE(cached != nullptr);
+  BOOST_CHECK(*cached == *digest("content"));
+
+  // any change of the status invalidates the digest
+  write("file", "changed");
+  HashCache::FileStat newStat;
+  BOOST_REQUIRE(HashCache::getFileStat(tmpdir / "file", newStat));
+  BOOST_CHECK(newStat != stat);
+  BOOST_CHECK(cache.lookup("file", newStat) == nullptr);
+  BOOST_CHECK(*cache.getDigest(tmpdir / "file", "file") == *digest("changed"));
+  BOOST_CHECK(cache.lookup("file", newStat) != nullptr);
+
+  cache.remove("file");
+  BOOST_CHECK(cache.lookup("file", newStat) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(UntrustedDigests)
+{
+  HashCache cache(tmpdir);
+
+  // just modified, could still change without changing the status
+  write("recent", "content", true);
+  BOOST_CHECK(*cache.getDigest(tmpdir / "recent", "recent") == *digest("content"));
+  HashCache::FileStat stat;
+  BOOST_REQUIRE(HashCache::getFileStat(tmpdir / "recent", stat));
+  BOOST_CHECK(cache.lookup("recent", stat) == nullptr);
+
+  // changed after the status was read
+  write("file", "content");
+  BOOST_REQUIRE(HashCache::getFileStat(tmpdir / "file", stat));
+  write("file", "changed");
+  cache.update(tmpdir / "file", "file", stat, *digest("content"));
+  BOOST_CHECK(cache.lookup("file", stat) == nullptr);
+  BOOST_REQUIRE(HashCache::getFileStat(tmpdir / "file", stat));
+  BOOST_CHECK(cache.lookup("file", stat) == nullptr);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace tests
+} // namespace chronoshare
+} // namespace ndn
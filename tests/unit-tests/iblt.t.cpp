@@ -0,0 +1,152 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#include "iblt.hpp"
+
+#include "test-common.hpp"
+
+#include <algorithm>
+#include <random>
+
+namespace ndn {
+namespace chronoshare {
+namespace tests {
+
+BOOST_AUTO_TEST_SUITE(TestIblt)
+
+BOOST_AUTO_TEST_CASE(SetDifference)
+{
+  std::mt19937_64 rng(42);
+  Iblt a(96);
+  Iblt b(96);
+  BOOST_CHECK_EQUAL(a.getCells().size(), 96);
+
+  // large common part
+  for (int i = 0; i < 5000; ++i) {
+    uint64_t key = rng();
+    a.insert(key);
+    b.insert(key);
+  }
+
+  std::vector<uint64_t> onlyA;
+  std::vector<uint64_t> onlyB;
+  for (int i = 0; i < 20; ++i) {
+    onlyA.push_back(rng());
+    a.insert(onlyA.back());
+  }
+  for (int i = 0; i < 15; ++i) {
+    onlyB.push_back(rng());
+    b.insert(onlyB.back());
+  }
+
+  // the sets themselves are too large to be listed
+  std::vector<uint64_t> positive;
+  std::vector<uint64_t> negative;
+  BOOST_CHECK(!a.listEntries(positive, negative));
+
+  Iblt difference(a);
+  difference -= b;
+  positive.clear();
+  negative.clear();
+  BOOST_REQUIRE(difference.listEntries(positive, negative));
+
+  std::sort(onlyA.begin(), onlyA.end());
+  std::sort(onlyB.begin(), onlyB.end());
+  std::sort(positive.begin(), positive.end());
+  std::sort(negative.begin(), negative.end());
+  BOOST_CHECK_EQUAL_COLLECTIONS(positive.begin(), positive.end(), onlyA.begin(), onlyA.end());
+  BOOST_CHECK_EQUAL_COLLECTIONS(negative.begin(), negative.end(), onlyB.begin(), onlyB.end());
+
+  // erasing keys is the same as subtracting them
+  for (uint64_t key : onlyB) {
+    a.erase(key);
+  }
+  for (uint64_t key : onlyB) {
+    b.erase(key);
+    b.erase(key);
+  }
+  positive.clear();
+  negative.clear();
+  a -= b;
+  BOOST_REQUIRE(a.listEntries(positive, negative));
+  std::sort(positive.begin(), positive.end());
+  BOOST_CHECK_EQUAL_COLLECTIONS(positive.begin(), positive.end(), onlyA.begin(), onlyA.end());
+  BOOST_CHECK(negative.empty());
+}
+
+BOOST_AUTO_TEST_CASE(TooLargeDifference)
+{
+  std::mt19937_64 rng(42);
+  Iblt a(30);
+  for (int i = 0; i < 100; ++i) {
+    a.insert(rng());
+  }
+
+  std::vector<uint64_t> positive;
+  std::vector<uint64_t> negative;
+  BOOST_CHECK(!a.listEntries(positive, negative));
+}
+
+BOOST_AUTO_TEST_CASE(InconsistentTable)
+{
+  // a key in only one of its cells, e.g., in a crafted table received from a peer
+  Iblt a(12);
+  a.insert(42);
+  std::vector<Iblt::Cell> cells = a.getCells();
+  bool isKept = false;
+  for (auto& cell : cells) {
+    if (cell.count != 0) {
+      if (isKept) {
+        cell = Iblt::Cell{0, 0, 0};
+      }
+      isKept = true;
+    }
+  }
+
+  std::vector<uint64_t> positive;
+  std::vector<uint64_t> negative;
+  BOOST_CHECK(!Iblt(cells).listEntries(positive, negative));
+  BOOST_CHECK_LE(positive.size() + negative.size(), cells.size() + 1);
+}
+
+BOOST_AUTO_TEST_CASE(Cells)
+{
+  BOOST_CHECK_EQUAL(Iblt(1).getCells().size(), Iblt::N_HASHES);
+  BOOST_CHECK_EQUAL(Iblt(100).getCells().size(), 102);
+
+  Iblt a(12);
+  a.insert(1);
+  Iblt b(a.getCells());
+  b.erase(1);
+  std::vector<uint64_t> positive;
+  std::vector<uint64_t> negative;
+  BOOST_CHECK(b.listEntries(positive, negative));
+  BOOST_CHECK(positive.empty() && negative.empty());
+
+  BOOST_CHECK_THROW(Iblt(std::vector<Iblt::Cell>(10)), Iblt::Error);
+  BOOST_CHECK_THROW(Iblt(std::vector<Iblt::Cell>()), Iblt::Error);
+  BOOST_CHECK_THROW(a -= Iblt(15), Iblt::Error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace tests
+} // namespace chronoshare
+} // namespace ndn
@@ -71,7 +71,8 @@ BOOST_AUTO_TEST_CASE(Basic)
     ObjectDb object(tmpdir, "abcdef");
 
     BOOST_CHECK_EQUAL(ObjectDb::doesExist(tmpdir, "/my-device", "abcdef"), true);
-    BOOST_CHECK(exists(tmpdir / "objects" / "ab" / "cdef"));
+    BOOST_CHECK(exists(tmpdir / "objects" / "index.db"));
+    BOOST_CHECK(exists(tmpdir / "objects" / "pack-0.pack"));
     BOOST_CHECK_EQUAL(object.getLastUsed(), time::steady_clock::now());
 
     advanceClocks(time::hours(1));
@@ -91,6 +92,38 @@ BOOST_AUTO_TEST_CASE(Basic)
   }
 }
 
+BOOST_AUTO_TEST_CASE(SegmentRange)
+{
+  PackStore::SegmentBatch batch;
+  for (uint64_t segment : {0, 1, 2, 4, 5}) {
+    auto data = make_shared<Data>(Name("/hello/world").appendSegment(segment));
+    data->setContent(Name("/some/content").appendSegment(segment).wireEncode());
+    m_keyChain.sign(*data);
+    batch.push_back(std::make_pair(segment, data));
+  }
+  batch.push_back(std::make_pair(6, nullptr));
+
+  ObjectDb object(tmpdir, "abcdef");
+  object.saveContentObjects("/my-device", batch);
+  BOOST_CHECK(ObjectDb::doesExist(tmpdir, "/my-device", "abcdef"));
+  BOOST_REQUIRE(object.fetchSegment("/my-device", 4) != nullptr);
+  BOOST_CHECK_EQUAL(*object.fetchSegment("/my-device", 4), *batch[3].second);
+
+  // missing segments are skipped
+  auto segments = object.fetchSegments("/my-device", 1, 6);
+  BOOST_REQUIRE_EQUAL(segments.size(), 4);
+  std::vector<uint64_t> numbers;
+  for (size_t i = 0; i < segments.size(); ++i) {
+    numbers.push_back(segments[i].first);
+    BOOST_CHECK_EQUAL(*segments[i].second, *batch[i + 1].second);
+  }
+  std::vector<uint64_t> expected{1, 2, 4, 5};
+  BOOST_CHECK_EQUAL_COLLECTIONS(numbers.begin(), numbers.end(), expected.begin(), expected.end());
+
+  BOOST_CHECK(object.fetchSegments("/my-device", 6, 100).empty());
+  BOOST_CHECK(object.fetchSegments("/other-device", 0, 100).empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 } // namespace tests
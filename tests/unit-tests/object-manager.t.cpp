@@ -19,11 +19,14 @@
  */
 
 #include "object-manager.hpp"
+#include "object-db.hpp"
 
 #include "test-common.hpp"
 
 #include <ndn-cxx/util/dummy-client-face.hpp>
 
+#include <random>
+
 namespace ndn {
 namespace chronoshare {
 namespace tests {
@@ -42,7 +45,7 @@ public:
     if (exists(tmpdir)) {
       remove_all(tmpdir);
     }
-    manager = make_unique<ObjectManager>(face, m_keyChain, tmpdir, "test-chronoshare");
+    manager = make_unique<ObjectManager>(face, m_keyChain, tmpdir, "test-chronoshare", 1024);
   }
 
 public:
@@ -74,6 +77,324 @@ BOOST_AUTO_TEST_CASE(FromFileToFile)
   }
 }
 
+BOOST_AUTO_TEST_CASE(MultiSegmentFile)
+{
+  Name deviceName("/device");
+
+  fs::create_directories(tmpdir);
+  fs::path origFile = tmpdir / "multi-segment.bin";
+  std::string content;
+  {
+    fs::ofstream os(origFile, std::ios::out | std::ios::binary);
+    for (int i = 0; i < 10 * 1024 + 17; ++i) {
+      content.push_back(static_cast<char>(i * 7 % 251));
+    }
+    os << content;
+  }
+
+  auto objects = manager->localFileToObjects(origFile, deviceName);
+  BOOST_CHECK_EQUAL(std::get<1>(objects), 11);
+
+  ConstBufferPtr digest = digestFromFile(origFile);
+  BOOST_CHECK_EQUAL_COLLECTIONS(std::get<0>(objects)->begin(), std::get<0>(objects)->end(),
+                                digest->begin(), digest->end());
+
+  BOOST_REQUIRE(manager->objectsToLocalFile(deviceName, *std::get<0>(objects), tmpdir / "restored.bin"));
+
+  fs::ifstream is(tmpdir / "restored.bin", std::ios::in | std::ios::binary);
+  std::string restored((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+  BOOST_CHECK(restored == content);
+}
+
+BOOST_AUTO_TEST_CASE(RestoreReplacesFile)
+{
+  Name deviceName("/device");
+  fs::path origFile = fs::path("tests") / "unit-tests" / "object-manager.t.cpp";
+  fs::path restoredFile = tmpdir / "restored" / "test.cpp";
+
+  auto objects = manager->localFileToObjects(origFile, deviceName);
+
+  fs::create_directories(restoredFile.parent_path());
+  fs::ofstream(restoredFile) << std::string(100000, 'x');
+
+  BOOST_REQUIRE(manager->objectsToLocalFile(deviceName, *std::get<0>(objects), restoredFile));
+  BOOST_CHECK_EQUAL(fs::file_size(restoredFile), fs::file_size(origFile));
+  BOOST_CHECK(*digestFromFile(restoredFile) == *std::get<0>(objects));
+
+  // only the restored file, no leftovers
+  BOOST_CHECK_EQUAL(std::distance(fs::directory_iterator(restoredFile.parent_path()),
+                                  fs::directory_iterator()), 1);
+
+  // unknown device, nothing to restore from
+  BOOST_CHECK(!manager->objectsToLocalFile("/other-device", *std::get<0>(objects), restoredFile));
+  BOOST_CHECK_EQUAL(fs::file_size(restoredFile), fs::file_size(origFile));
+}
+
+BOOST_AUTO_TEST_CASE(DigestSignedSegmentsAndManifest)
+{
+  Name deviceName("/device");
+
+  auto objects = manager->localFileToObjects(fs::path("tests") / "unit-tests" / "object-manager.t.cpp", deviceName);
+
+  // 3 file segments and one manifest segment
+  BOOST_REQUIRE_EQUAL(face.sentData.size(), 4);
+  for (const auto& data : face.sentData) {
+    BOOST_CHECK_EQUAL(data.getSignature().getType(), tlv::DigestSha256);
+  }
+  BOOST_CHECK_EQUAL(face.sentData.back().getName().get(-3), name::Component("manifest"));
+
+  ObjectDb db(tmpdir / ".chronoshare", toHex(*std::get<0>(objects)));
+  FileManifestPtr manifest = db.fetchManifest(deviceName);
+  BOOST_REQUIRE(manifest != nullptr);
+  BOOST_CHECK_EQUAL(manifest->size(), std::get<1>(objects));
+  BOOST_CHECK(*manifest->getRoot() == *std::get<3>(objects));
+
+  for (uint64_t segment = 0; segment < std::get<1>(objects); ++segment) {
+    auto data = db.fetchSegment(deviceName, segment);
+    BOOST_REQUIRE(data != nullptr);
+    BOOST_CHECK(manifest->verifySegment(segment, data->getContent().value(), data->getContent().value_size()));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(ParallelSegments)
+{
+  Name deviceName("/device");
+  ObjectManager parallelManager(face, m_keyChain, tmpdir / "parallel", "test-chronoshare", 1024);
+  parallelManager.setConcurrency(4);
+  BOOST_CHECK_EQUAL(parallelManager.getConcurrency(), 4);
+
+  fs::create_directories(tmpdir);
+  fs::path origFile = tmpdir / "parallel.bin";
+  {
+    fs::ofstream os(origFile, std::ios::out | std::ios::binary);
+    for (int i = 0; i < 1000 * 1024 + 3; ++i) {
+      os.put(static_cast<char>(i * 13 % 241));
+    }
+  }
+
+  auto serial = manager->localFileToObjects(origFile, deviceName);
+  std::vector<Data> serialData = face.sentData;
+  face.sentData.clear();
+
+  auto parallel = parallelManager.localFileToObjects(origFile, deviceName);
+  BOOST_CHECK_EQUAL(std::get<1>(parallel), 1001);
+  BOOST_CHECK(*std::get<0>(parallel) == *std::get<0>(serial));
+  BOOST_CHECK(*std::get<3>(parallel) == *std::get<3>(serial));
+
+  // same packets, put in the same order
+  BOOST_REQUIRE_EQUAL(face.sentData.size(), serialData.size());
+  for (size_t i = 0; i < serialData.size(); ++i) {
+    BOOST_CHECK_EQUAL(face.sentData[i].getName(), serialData[i].getName());
+    BOOST_CHECK(face.sentData[i].wireEncode() == serialData[i].wireEncode());
+  }
+
+  BOOST_REQUIRE(parallelManager.objectsToLocalFile(deviceName, *std::get<0>(parallel), tmpdir / "restored.bin"));
+  BOOST_CHECK_EQUAL(fs::file_size(tmpdir / "restored.bin"), fs::file_size(origFile));
+  BOOST_CHECK(*digestFromFile(tmpdir / "restored.bin") == *std::get<0>(parallel));
+}
+
+BOOST_AUTO_TEST_CASE(ContentDefinedChunking)
+{
+  Name deviceName("/device");
+  Name senderName("/sender");
+
+  fs::create_directories(tmpdir);
+  fs::path version1 = tmpdir / "version1.bin";
+  fs::path version2 = tmpdir / "version2.bin";
+  {
+    std::mt19937 rng(3);
+    std::string content(4 * 1024 * 1024, '\0');
+    for (auto& c : content) {
+      c = static_cast<char>(rng());
+    }
+    fs::ofstream(version1, std::ios::out | std::ios::binary) << content;
+    content.insert(content.size() / 2, 1, 'x');
+    fs::ofstream(version2, std::ios::out | std::ios::binary) << content;
+  }
+
+  for (bool isContentDefined : {false, true}) {
+    fs::path receiverDir = tmpdir / (isContentDefined ? "receiver-cdc" : "receiver-fixed");
+    fs::path senderDir = tmpdir / (isContentDefined ? "sender-cdc" : "sender-fixed");
+
+    // receiver already has the first version, sender publishes the second one
+    ObjectManager receiver(face, m_keyChain, receiverDir, "test-chronoshare");
+    ObjectManager sender(face, m_keyChain, senderDir, "test-chronoshare");
+    receiver.setContentDefinedChunking(isContentDefined);
+    sender.setContentDefinedChunking(isContentDefined);
+
+    receiver.localFileToObjects(version1, deviceName);
+    auto objects = sender.localFileToObjects(version2, senderName);
+    BOOST_CHECK(*digestFromFile(version2) == *std::get<0>(objects));
+
+    FileManifestPtr manifest = ObjectDb(senderDir / ".chronoshare", toHex(*std::get<0>(objects)))
+                                 .fetchManifest(senderName);
+    BOOST_REQUIRE(manifest != nullptr);
+
+    auto missing = receiver.reuseLocalSegments(senderName, *std::get<0>(objects), *manifest);
+    BOOST_TEST_MESSAGE((isContentDefined ? "content-defined: " : "fixed-size: ")
+                       << missing.size() << " of " << manifest->size() << " segments to fetch");
+
+    if (isContentDefined) {
+      // only segments around the inserted byte
+      BOOST_CHECK_LE(missing.size(), 3);
+    }
+    else {
+      // everything after the inserted byte
+      BOOST_CHECK_GE(missing.size(), manifest->size() / 2 - 1);
+    }
+
+    // reused segments are stored for the sender's file and match the manifest
+    ObjectDb db(receiverDir / ".chronoshare", toHex(*std::get<0>(objects)));
+    for (uint64_t segment = 0; segment < manifest->size(); ++segment) {
+      auto data = db.fetchSegment(senderName, segment);
+      if (std::find(missing.begin(), missing.end(), segment) != missing.end()) {
+        BOOST_CHECK(data == nullptr);
+      }
+      else {
+        BOOST_REQUIRE(data != nullptr);
+        BOOST_CHECK(manifest->verifySegment(segment, data->getContent().value(),
+                                            data->getContent().value_size()));
+      }
+    }
+    face.sentData.clear();
+  }
+}
+
+BOOST_AUTO_TEST_CASE(AppendedFile)
+{
+  Name deviceName("/device");
+  Name senderName("/sender");
+
+  fs::create_directories(tmpdir);
+  fs::path file = tmpdir / "log.bin";
+  std::mt19937 rng(5);
+  auto append = [&] (size_t size) {
+    std::string content(size, '\0');
+    for (auto& c : content) {
+      c = static_cast<char>(rng());
+    }
+    fs::ofstream(file, std::ios::out | std::ios::binary | std::ios::app) << content;
+  };
+  auto countPutFileSegments = [this] {
+    return std::count_if(face.sentData.begin(), face.sentData.end(), [] (const Data& data) {
+        return data.getName().get(-3) == name::Component("file");
+      });
+  };
+
+  append(64 * 1024);
+  auto previous = manager->localFileToObjects(file, deviceName);
+  BOOST_CHECK_EQUAL(std::get<1>(previous), 64);
+
+  // the unchanged beginning is not created and put again; small derived ranges are merged by
+  // creating their segments again, so the third append puts the segments of all three
+  for (int i = 0; i < 3; ++i) {
+    face.sentData.clear();
+    append(4 * 1024);
+    auto objects = manager->localFileToObjects(file, deviceName, std::get<0>(previous), deviceName);
+    BOOST_CHECK(*digestFromFile(file) == *std::get<0>(objects));
+    BOOST_CHECK_EQUAL(std::get<1>(objects), 68 + 4 * i);
+    BOOST_CHECK_EQUAL(countPutFileSegments(), i < 2 ? 4 : 12);
+
+    BOOST_CHECK(manager->objectsToLocalFile(deviceName, *std::get<0>(objects), tmpdir / "restored.bin"));
+    BOOST_CHECK(*digestFromFile(tmpdir / "restored.bin") == *std::get<0>(objects));
+    previous = objects;
+  }
+
+  // receiver with the first 64 KiB derives the same segments from its copy
+  fs::path receiverDir = tmpdir / "receiver";
+  fs::create_directories(receiverDir);
+  fs::path receiverFile = receiverDir / "log.bin";
+  {
+    fs::ifstream is(file, std::ios::in | std::ios::binary);
+    std::string content(64 * 1024, '\0');
+    is.read(&content[0], content.size());
+    fs::ofstream(receiverFile, std::ios::out | std::ios::binary) << content;
+  }
+  ObjectManager receiver(face, m_keyChain, receiverDir, "test-chronoshare", 1024);
+  auto base = receiver.localFileToObjects(receiverFile, senderName);
+
+  FileManifestPtr manifest = ObjectDb(tmpdir / ".chronoshare", toHex(*std::get<0>(previous)))
+                               .fetchManifest(deviceName);
+  BOOST_REQUIRE(manifest != nullptr);
+  auto missing = receiver.reuseLocalSegments(deviceName, *std::get<0>(previous), *manifest,
+                                             std::get<0>(base), senderName);
+  BOOST_CHECK_EQUAL(missing.size(), 12);
+
+  ObjectDb db(receiverDir / ".chronoshare", toHex(*std::get<0>(previous)));
+  for (uint64_t segment = 0; segment < 64; ++segment) {
+    auto data = db.fetchSegment(deviceName, segment);
+    BOOST_REQUIRE(data != nullptr);
+    BOOST_CHECK(manifest->verifySegment(segment, data->getContent().value(),
+                                        data->getContent().value_size()));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(CloneLocalFile)
+{
+  fs::create_directories(tmpdir);
+  fs::path source = tmpdir / "source.bin";
+  {
+    std::mt19937 rng(7);
+    std::string content(3 * 1024 * 1024 + 5, '\0');
+    for (auto& c : content) {
+      c = static_cast<char>(rng());
+    }
+    fs::ofstream(source, std::ios::out | std::ios::binary) << content;
+  }
+  fs::path copy = tmpdir / "dir" / "copy.bin";
+  BOOST_CHECK(ObjectManager::cloneLocalFile(source, copy));
+  BOOST_CHECK(*digestFromFile(copy) == *digestFromFile(source));
+
+  // existing file is replaced
+  fs::ofstream(copy, std::ios::out | std::ios::binary) << "other content, which is longer";
+  fs::path empty = tmpdir / "empty.bin";
+  fs::ofstream(empty, std::ios::out | std::ios::binary);
+  BOOST_CHECK(ObjectManager::cloneLocalFile(empty, copy));
+  BOOST_CHECK_EQUAL(fs::file_size(copy), 0);
+
+  BOOST_CHECK(!ObjectManager::cloneLocalFile(tmpdir / "does-not-exist", copy));
+  BOOST_CHECK(exists(copy));
+}
+
+BOOST_AUTO_TEST_CASE(MixedSegmentSizes)
+{
+  Name deviceName("/device");
+  Name otherDeviceName("/other-device");
+  ObjectManager largeSegmentManager(face, m_keyChain, tmpdir, "test-chronoshare");
+  ObjectManager hugeSegmentManager(face, m_keyChain, tmpdir, "test-chronoshare", 1024 * 1024);
+
+  fs::path origFile = fs::path("tests") / "unit-tests" / "object-manager.t.cpp";
+
+  auto small = manager->localFileToObjects(origFile, deviceName);
+  BOOST_CHECK_EQUAL(std::get<2>(small), 1024);
+
+  face.sentData.clear();
+  auto large = largeSegmentManager.localFileToObjects(origFile, otherDeviceName);
+  BOOST_CHECK_LE(std::get<2>(large), DEFAULT_FILE_SEGMENT_SIZE);
+  BOOST_CHECK_LT(std::get<1>(large), std::get<1>(small));
+
+  // segment size is limited by the maximum packet size
+  face.sentData.clear();
+  fs::create_directories(tmpdir);
+  fs::path bigFile = tmpdir / "big.bin";
+  {
+    fs::ofstream os(bigFile, std::ios::out | std::ios::binary);
+    os << std::string(3 * MAX_NDN_PACKET_SIZE, 'a');
+  }
+  auto huge = hugeSegmentManager.localFileToObjects(bigFile, deviceName);
+  BOOST_CHECK_LT(std::get<2>(huge), MAX_NDN_PACKET_SIZE);
+  BOOST_REQUIRE(!face.sentData.empty());
+  for (const auto& data : face.sentData) {
+    BOOST_CHECK_LE(data.wireEncode().size(), MAX_NDN_PACKET_SIZE);
+  }
+
+  // files are assembled no matter which segment size they were published with
+  BOOST_CHECK(manager->objectsToLocalFile(otherDeviceName, *std::get<0>(large), tmpdir / "large.cpp"));
+  BOOST_CHECK(largeSegmentManager.objectsToLocalFile(deviceName, *std::get<0>(small), tmpdir / "small.cpp"));
+  BOOST_CHECK_EQUAL(fs::file_size(tmpdir / "large.cpp"), fs::file_size(origFile));
+  BOOST_CHECK_EQUAL(fs::file_size(tmpdir / "small.cpp"), fs::file_size(origFile));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 } // namespace tests
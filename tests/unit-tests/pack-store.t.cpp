@@ -0,0 +1,492 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#include "pack-store.hpp"
+#include "object-db.hpp"
+
+#include "test-common.hpp"
+
+#include <ndn-cxx/util/sqlite3-statement.hpp>
+
+#include <boost/filesystem/fstream.hpp>
+
+#include <random>
+
+namespace ndn {
+namespace chronoshare {
+namespace tests {
+
+namespace fs = boost::filesystem;
+
+class TestPackStoreFixture : public IdentityManagementFixture
+{
+public:
+  TestPackStoreFixture()
+    : hash(util::Sha256::computeDigest(reinterpret_cast<const uint8_t*>("hash"), 4))
+  {
+    tmpdir = fs::unique_path(UNIT_TEST_CONFIG_PATH) / "TestPackStore";
+    if (exists(tmpdir)) {
+      remove_all(tmpdir);
+    }
+  }
+
+  Data
+  makeData(const std::string& name)
+  {
+    Data data(name);
+    data.setContent(reinterpret_cast<const uint8_t*>(name.data()), name.size());
+    m_keyChain.sign(data);
+    return data;
+  }
+
+public:
+  fs::path tmpdir;
+  ConstBufferPtr hash;
+};
+
+BOOST_FIXTURE_TEST_SUITE(TestPackStore, TestPackStoreFixture)
+
+BOOST_AUTO_TEST_CASE(SaveAndFetch)
+{
+  Data file0 = makeData("/file/0");
+  Data file1 = makeData("/file/1");
+  Data manifest0 = makeData("/manifest/0");
+
+  {
+    PackStorePtr store = PackStore::open(tmpdir);
+    BOOST_CHECK(store == PackStore::open(tmpdir));
+
+    store->saveSegment(*hash, "/device", PackStore::FILE_SEGMENT, 0, file0, false);
+    store->saveSegment(*hash, "/device", PackStore::FILE_SEGMENT, 1, file1, false);
+    store->saveSegment(*hash, "/device", PackStore::MANIFEST_SEGMENT, 0, manifest0, false);
+
+    // existing file segments are kept, manifest segments can be replaced
+    store->saveSegment(*hash, "/device", PackStore::FILE_SEGMENT, 0, file1, false);
+    store->saveSegment(*hash, "/device", PackStore::MANIFEST_SEGMENT, 0, file0, true);
+
+    BOOST_CHECK_EQUAL(store->countSegments(*hash, "/device", PackStore::FILE_SEGMENT), 2);
+    BOOST_CHECK_EQUAL(store->countSegments(*hash, "/other-device", PackStore::FILE_SEGMENT), 0);
+
+    auto data = store->fetchSegment(*hash, "/device", PackStore::FILE_SEGMENT, 0);
+    BOOST_REQUIRE(data != nullptr);
+    BOOST_CHECK_EQUAL(*data, file0);
+    BOOST_CHECK(store->fetchSegment(*hash, "/device", PackStore::FILE_SEGMENT, 2) == nullptr);
+  }
+
+  // everything is persisted when the store is reopened
+  PackStorePtr store = PackStore::open(tmpdir);
+  BOOST_CHECK(exists(tmpdir / "objects" / "pack-0.pack"));
+
+  auto segments = store->fetchSegments(*hash, "/device", PackStore::FILE_SEGMENT);
+  BOOST_REQUIRE_EQUAL(segments.size(), 2);
+  BOOST_CHECK_EQUAL(*segments[0], file0);
+  BOOST_CHECK_EQUAL(*segments[1], file1);
+
+  auto manifest = store->fetchSegment(*hash, "/device", PackStore::MANIFEST_SEGMENT, 0);
+  BOOST_REQUIRE(manifest != nullptr);
+  BOOST_CHECK_EQUAL(*manifest, file0);
+}
+
+BOOST_AUTO_TEST_CASE(RemoveManifest)
+{
+  PackStorePtr store = PackStore::open(tmpdir);
+  store->saveSegment(*hash, "/device", PackStore::FILE_SEGMENT, 0, makeData("/file/0"), false);
+  store->saveSegment(*hash, "/device", PackStore::MANIFEST_SEGMENT, 0, makeData("/manifest/0"), false);
+  store->saveSegment(*hash, "/device", PackStore::MANIFEST_SEGMENT, 1, makeData("/manifest/1"), false);
+  store->saveSegment(*hash, "/other-device", PackStore::MANIFEST_SEGMENT, 0, makeData("/manifest/0"), false);
+
+  BOOST_CHECK_EQUAL(store->removeManifest(*hash, "/device"), 2);
+  BOOST_CHECK_EQUAL(store->removeManifest(*hash, "/device"), 0);
+  BOOST_CHECK(store->fetchSegments(*hash, "/device", PackStore::MANIFEST_SEGMENT).empty());
+
+  // file segments and manifests of other devices are kept
+  BOOST_CHECK_EQUAL(store->getFileStatus(*hash, "/device").nSegments, 1);
+  BOOST_CHECK(store->fetchSegment(*hash, "/device", PackStore::FILE_SEGMENT, 0) != nullptr);
+  BOOST_CHECK(store->fetchSegment(*hash, "/other-device", PackStore::MANIFEST_SEGMENT, 0) != nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(SharedPayloads)
+{
+  ConstBufferPtr otherHash = util::Sha256::computeDigest(reinterpret_cast<const uint8_t*>("other"), 5);
+  PackStorePtr store = PackStore::open(tmpdir);
+
+  // two versions of a file that differ only in the last segment
+  std::vector<Data> version1;
+  std::vector<Data> version2;
+  for (int segment = 0; segment < 4; ++segment) {
+    std::string payload(1024, static_cast<char>('a' + segment));
+    for (auto version : {std::make_pair(hash, &version1), std::make_pair(otherHash, &version2)}) {
+      if (segment == 3 && version.second == &version2) {
+        payload = std::string(1024, 'z');
+      }
+      Data data(Name("/device/file").append(name::Component(*version.first)).appendSegment(segment));
+      data.setContent(reinterpret_cast<const uint8_t*>(payload.data()), payload.size());
+      m_keyChain.sign(data);
+      version.second->push_back(data);
+
+      store->saveSegment(*version.first, "/device", PackStore::FILE_SEGMENT, segment, data, false);
+    }
+  }
+
+  PackStore::Stats stats = store->getStats();
+  BOOST_CHECK_EQUAL(stats.nSegments, 8);
+  BOOST_CHECK_EQUAL(stats.nChunks, 5);
+  BOOST_CHECK_LT(stats.storedSize, stats.logicalSize);
+  BOOST_CHECK_GT(stats.getDedupRatio(), 1.2);
+
+  // reassembled packets are exactly the ones that were saved
+  for (int segment = 0; segment < 4; ++segment) {
+    auto data = store->fetchSegment(*hash, "/device", PackStore::FILE_SEGMENT, segment);
+    BOOST_REQUIRE(data != nullptr);
+    BOOST_CHECK(data->wireEncode() == version1[segment].wireEncode());
+
+    data = store->fetchSegment(*otherHash, "/device", PackStore::FILE_SEGMENT, segment);
+    BOOST_REQUIRE(data != nullptr);
+    BOOST_CHECK(data->wireEncode() == version2[segment].wireEncode());
+  }
+}
+
+BOOST_AUTO_TEST_CASE(Compression)
+{
+  PackStorePtr store = PackStore::open(tmpdir);
+  store->setCompression(true);
+
+  std::string text;
+  for (int line = 0; text.size() < 4096; ++line) {
+    text += "2017-04-01 12:00:" + std::to_string(line % 60) + ",sensor-" + std::to_string(line % 7) + ",ok\n";
+  }
+  std::vector<uint8_t> noise(4096);
+  std::mt19937 rng(1);
+  for (auto& byte : noise) {
+    byte = static_cast<uint8_t>(rng());
+  }
+
+  Data textData(Name("/device/file").append(name::Component(*hash)).appendSegment(0));
+  textData.setContent(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+  m_keyChain.sign(textData);
+  store->saveSegment(*hash, "/device", PackStore::FILE_SEGMENT, 0, textData, false);
+
+  Data noiseData(Name("/device/file").append(name::Component(*hash)).appendSegment(1));
+  noiseData.setContent(noise.data(), noise.size());
+  m_keyChain.sign(noiseData);
+  store->saveSegment(*hash, "/device", PackStore::FILE_SEGMENT, 1, noiseData, false);
+
+  // only the text is compressed
+  PackStore::Stats stats = store->getStats();
+  BOOST_CHECK_EQUAL(stats.nChunks, 2);
+  BOOST_CHECK_EQUAL(stats.nCompressedChunks, 1);
+  BOOST_CHECK_LT(stats.storedSize, stats.logicalSize * 3 / 4);
+
+  auto data = store->fetchSegment(*hash, "/device", PackStore::FILE_SEGMENT, 0);
+  BOOST_REQUIRE(data != nullptr);
+  BOOST_CHECK(data->wireEncode() == textData.wireEncode());
+
+  auto chunk = store->fetchChunk(*util::Sha256::computeDigest(reinterpret_cast<const uint8_t*>(text.data()),
+                                                              text.size()));
+  BOOST_REQUIRE(chunk != nullptr);
+  BOOST_CHECK_EQUAL(std::string(chunk->begin(), chunk->end()), text);
+
+  // payloads are decompressed for assembly as well
+  auto locations = store->locateSegments(*hash, "/device", PackStore::FILE_SEGMENT);
+  BOOST_REQUIRE_EQUAL(locations.size(), 2);
+  BOOST_CHECK_NE(locations[0].rawSize, 0);
+  BOOST_CHECK_EQUAL(locations[1].rawSize, 0);
+
+  Buffer buffer;
+  const uint8_t* payload = nullptr;
+  size_t payloadSize = 0;
+  BOOST_REQUIRE(store->readPayload(locations[0], buffer, payload, payloadSize));
+  BOOST_CHECK_EQUAL(std::string(payload, payload + payloadSize), text);
+  BOOST_REQUIRE(store->readPayload(locations[1], buffer, payload, payloadSize));
+  BOOST_CHECK_EQUAL_COLLECTIONS(payload, payload + payloadSize, noise.begin(), noise.end());
+
+  // compressed payloads stay readable when compression is off
+  store->setCompression(false);
+  data = store->fetchSegment(*hash, "/device", PackStore::FILE_SEGMENT, 0);
+  BOOST_REQUIRE(data != nullptr);
+  BOOST_CHECK(data->wireEncode() == textData.wireEncode());
+}
+
+BOOST_AUTO_TEST_CASE(CompletenessIndex)
+{
+  Data file0 = makeData("/file/0");
+  Data file1 = makeData("/file/1");
+  std::string hashStr = toHex(*hash);
+
+  {
+    PackStorePtr store = PackStore::open(tmpdir);
+    BOOST_CHECK_EQUAL(store->getFileStatus(*hash, "/device").nSegments, 0);
+    BOOST_CHECK(!store->getFileStatus(*hash, "/device").isComplete());
+
+    store->setFileSegmentCount(*hash, "/device", 2);
+    store->saveSegment(*hash, "/device", PackStore::FILE_SEGMENT, 0, file0, false);
+    store->saveSegment(*hash, "/device", PackStore::FILE_SEGMENT, 0, file0, false);
+    BOOST_CHECK_EQUAL(ObjectDb::doesExist(tmpdir, "/device", hashStr), true);
+    BOOST_CHECK_EQUAL(ObjectDb::isComplete(tmpdir, "/device", hashStr), false);
+
+    store->saveSegment(*hash, "/device", PackStore::FILE_SEGMENT, 1, file1, false);
+    store->saveSegment(*hash, "/device", PackStore::MANIFEST_SEGMENT, 0, file0, false);
+    BOOST_CHECK_EQUAL(store->getFileStatus(*hash, "/device").nSegments, 2);
+    BOOST_CHECK_EQUAL(ObjectDb::isComplete(tmpdir, "/device", hashStr), true);
+    BOOST_CHECK_EQUAL(ObjectDb::doesExist(tmpdir, "/other-device", hashStr), false);
+  }
+
+  {
+    // persisted
+    PackStorePtr store = PackStore::open(tmpdir);
+    PackStore::FileStatus status = store->getFileStatus(*hash, "/device");
+    BOOST_CHECK_EQUAL(status.nSegments, 2);
+    BOOST_CHECK_EQUAL(status.nTotalSegments, 2);
+  }
+
+  // index of an older version, the index is rebuilt from stored segments
+  {
+    sqlite3* db;
+    BOOST_REQUIRE_EQUAL(sqlite3_open((tmpdir / "objects" / "index.db").c_str(), &db), SQLITE_OK);
+    BOOST_CHECK_EQUAL(sqlite3_exec(db, "DELETE FROM File", nullptr, nullptr, nullptr), SQLITE_OK);
+    sqlite3_close(db);
+  }
+  PackStorePtr store = PackStore::open(tmpdir);
+  PackStore::FileStatus status = store->getFileStatus(*hash, "/device");
+  BOOST_CHECK_EQUAL(status.nSegments, 2);
+  BOOST_CHECK_EQUAL(status.nTotalSegments, 0);
+  BOOST_CHECK(status.isComplete());
+}
+
+BOOST_AUTO_TEST_CASE(RemoveAndCompact)
+{
+  ConstBufferPtr otherHash = util::Sha256::computeDigest(reinterpret_cast<const uint8_t*>("other"), 5);
+
+  // two versions of a file sharing the first segment
+  std::vector<Data> version2;
+  {
+    PackStorePtr store = PackStore::open(tmpdir);
+    for (int segment = 0; segment < 3; ++segment) {
+      for (auto version : {hash, otherHash}) {
+        std::string payload(4096, segment == 0 ? 'a' : static_cast<char>('b' + (version == hash)));
+        payload += std::to_string(segment);
+        Data data(Name("/device/file").append(name::Component(*version)).appendSegment(segment));
+        data.setContent(reinterpret_cast<const uint8_t*>(payload.data()), payload.size());
+        m_keyChain.sign(data);
+        if (version == otherHash) {
+          version2.push_back(data);
+        }
+        store->saveSegment(*version, "/device", PackStore::FILE_SEGMENT, segment, data, false);
+      }
+    }
+    store->saveSegment(*hash, "/device", PackStore::MANIFEST_SEGMENT, 0, makeData("/manifest/0"), false);
+    BOOST_CHECK(store->getPackUsage().empty());
+  }
+
+  // start appending to a new pack
+  fs::ofstream(tmpdir / "objects" / "pack-1.pack");
+
+  PackStorePtr store = PackStore::open(tmpdir);
+  BOOST_CHECK_EQUAL(store->listFiles().size(), 2);
+  BOOST_CHECK_EQUAL(store->removeFile(*hash, "/device"), 4);
+  BOOST_CHECK_EQUAL(store->removeFile(*hash, "/device"), 0);
+  BOOST_CHECK_EQUAL(store->getFileStatus(*hash, "/device").nSegments, 0);
+  BOOST_REQUIRE_EQUAL(store->listFiles().size(), 1);
+  BOOST_CHECK(store->listFiles()[0].first == *otherHash);
+
+  auto usage = store->getPackUsage();
+  BOOST_REQUIRE_EQUAL(usage.size(), 1);
+  BOOST_CHECK_EQUAL(usage[0].pack, 0);
+  BOOST_CHECK_GT(usage[0].liveSize, 0);
+  BOOST_CHECK_LT(usage[0].liveSize, usage[0].size);
+
+  BOOST_CHECK_THROW(store->compactPack(1), PackStore::Error);
+  while (!store->compactPack(0)) {
+  }
+  BOOST_CHECK(!exists(tmpdir / "objects" / "pack-0.pack"));
+  BOOST_CHECK(store->getPackUsage().empty());
+  BOOST_CHECK(store->fetchSegment(*hash, "/device", PackStore::FILE_SEGMENT, 1) == nullptr);
+
+  // the remaining version is intact, including its payload shared with the removed one
+  for (int segment = 0; segment < 3; ++segment) {
+    auto data = store->fetchSegment(*otherHash, "/device", PackStore::FILE_SEGMENT, segment);
+    BOOST_REQUIRE(data != nullptr);
+    BOOST_CHECK(data->wireEncode() == version2[segment].wireEncode());
+  }
+  BOOST_CHECK_EQUAL(store->getStats().nChunks, 3);
+}
+
+BOOST_AUTO_TEST_CASE(CompactWhileReading)
+{
+  Data file0 = makeData("/file/0");
+  PackStore::open(tmpdir)->saveSegment(*hash, "/device", PackStore::FILE_SEGMENT, 0, file0, false);
+
+  // start appending to a new pack
+  fs::ofstream(tmpdir / "objects" / "pack-1.pack");
+  PackStorePtr store = PackStore::open(tmpdir);
+
+  Buffer buffer;
+  const uint8_t* payload = nullptr;
+  size_t payloadSize = 0;
+  {
+    PackStore::ReadLock readLock(*store);
+    auto locations = store->locateSegments(*hash, "/device", PackStore::FILE_SEGMENT);
+    BOOST_REQUIRE_EQUAL(locations.size(), 1);
+    BOOST_CHECK_EQUAL(locations[0].pack, 0);
+
+    while (!store->compactPack(0)) {
+    }
+
+    // the located record is still there
+    BOOST_CHECK(exists(tmpdir / "objects" / "pack-0.pack"));
+    BOOST_REQUIRE(store->readPayload(locations[0], buffer, payload, payloadSize));
+    BOOST_CHECK_EQUAL(std::string(payload, payload + payloadSize), "/file/0");
+  }
+  BOOST_CHECK(!exists(tmpdir / "objects" / "pack-0.pack"));
+
+  // locations of a removed pack cannot be read, but do not throw
+  PackStore::SegmentLocation location{0, 0, 0, file0.wireEncode().size(), false, 0};
+  BOOST_CHECK(!store->readPayload(location, buffer, payload, payloadSize));
+
+  auto data = store->fetchSegment(*hash, "/device", PackStore::FILE_SEGMENT, 0);
+  BOOST_REQUIRE(data != nullptr);
+  BOOST_CHECK_EQUAL(*data, file0);
+}
+
+BOOST_AUTO_TEST_CASE(DerivedSegments)
+{
+  ConstBufferPtr grownHash = util::Sha256::computeDigest(reinterpret_cast<const uint8_t*>("grown"), 5);
+  ConstBufferPtr otherHash = util::Sha256::computeDigest(reinterpret_cast<const uint8_t*>("other"), 5);
+
+  auto makeSegment = [this] (const Buffer& fileHash, uint64_t segment) {
+    std::string payload = "payload-" + std::to_string(segment);
+    Data data(Name("/device/app/file").append(name::Component(fileHash)).appendSegment(segment));
+    data.setFreshnessPeriod(time::seconds(60));
+    data.setContent(reinterpret_cast<const uint8_t*>(payload.data()), payload.size());
+    m_keyChain.sign(data, signingWithSha256());
+    return data;
+  };
+
+  {
+    PackStorePtr store = PackStore::open(tmpdir);
+    for (uint64_t segment = 0; segment < 4; ++segment) {
+      store->saveSegment(*hash, "/device", PackStore::FILE_SEGMENT, segment,
+                         makeSegment(*hash, segment), false);
+    }
+    store->setFileSegmentCount(*hash, "/device", 4);
+
+    // the grown version has the first 3 segments of the previous one, and 2 more
+    store->setFileSegmentCount(*grownHash, "/device", 5);
+    BOOST_CHECK(store->deriveSegments(*grownHash, "/device", {{0, 3, *hash, "/device"}}));
+    BOOST_CHECK(!store->deriveSegments(*grownHash, "/device", {{0, 3, *hash, "/device"}}));
+    BOOST_CHECK(store->isBase(*hash));
+    BOOST_CHECK(!store->isBase(*grownHash));
+    BOOST_CHECK(!store->getFileStatus(*grownHash, "/device").isComplete());
+
+    for (uint64_t segment = 3; segment < 5; ++segment) {
+      store->saveSegment(*grownHash, "/device", PackStore::FILE_SEGMENT, segment,
+                         makeSegment(*grownHash, segment), false);
+    }
+    BOOST_CHECK(store->getFileStatus(*grownHash, "/device").isComplete());
+    BOOST_CHECK_EQUAL(store->countSegments(*grownHash, "/device", PackStore::FILE_SEGMENT), 5);
+
+    // derived segments are the same as segments made for the grown version
+    for (uint64_t segment = 0; segment < 5; ++segment) {
+      auto data = store->fetchSegment(*grownHash, "/device", PackStore::FILE_SEGMENT, segment);
+      BOOST_REQUIRE(data != nullptr);
+      BOOST_CHECK(data->wireEncode() == makeSegment(*grownHash, segment).wireEncode());
+    }
+    BOOST_CHECK_EQUAL(store->fetchSegments(*grownHash, "/device", PackStore::FILE_SEGMENT).size(), 5);
+
+    auto locations = store->locateSegments(*grownHash, "/device", PackStore::FILE_SEGMENT);
+    BOOST_REQUIRE_EQUAL(locations.size(), 5);
+    for (uint64_t segment = 0; segment < 5; ++segment) {
+      BOOST_CHECK_EQUAL(locations[segment].segment, segment);
+    }
+
+    // ranges of a grown version refer to where the segments are stored
+    store->setFileSegmentCount(*otherHash, "/device", 5);
+    BOOST_CHECK(store->deriveSegments(*otherHash, "/device",
+                                      {{0, 3, *hash, "/device"}, {3, 4, *grownHash, "/device"}}));
+    auto data = store->fetchSegment(*otherHash, "/device", PackStore::FILE_SEGMENT, 3);
+    BOOST_REQUIRE(data != nullptr);
+    BOOST_CHECK(data->wireEncode() == makeSegment(*otherHash, 3).wireEncode());
+    BOOST_CHECK(store->fetchSegment(*otherHash, "/device", PackStore::FILE_SEGMENT, 4) == nullptr);
+  }
+
+  // persisted
+  PackStorePtr store = PackStore::open(tmpdir);
+  auto ranges = store->getDerivedRanges(*otherHash, "/device");
+  BOOST_REQUIRE_EQUAL(ranges.size(), 2);
+  BOOST_CHECK_EQUAL(ranges[1].begin, 3);
+  BOOST_CHECK_EQUAL(ranges[1].end, 4);
+  BOOST_CHECK(ranges[1].baseHash == *grownHash);
+  BOOST_CHECK_EQUAL(store->getFileStatus(*otherHash, "/device").nSegments, 4);
+  BOOST_CHECK(store->isBase(*grownHash));
+
+  // bases are kept until the files derived from them are removed
+  BOOST_CHECK_EQUAL(store->removeFile(*otherHash, "/device"), 0);
+  BOOST_CHECK(store->getDerivedRanges(*otherHash, "/device").empty());
+  BOOST_CHECK(!store->isBase(*grownHash));
+  BOOST_CHECK_EQUAL(store->removeFile(*grownHash, "/device"), 2);
+  BOOST_CHECK(!store->isBase(*hash));
+}
+
+BOOST_AUTO_TEST_CASE(MigrateLegacyDatabase)
+{
+  Data file0 = makeData("/file/0");
+  Data manifest0 = makeData("/manifest/0");
+  std::string hashStr = toHex(*hash);
+
+  // database of an older version
+  fs::path legacyPath = tmpdir / "objects" / hashStr.substr(0, 2) / hashStr.substr(2);
+  fs::create_directories(legacyPath.parent_path());
+  {
+    sqlite3* db;
+    BOOST_REQUIRE_EQUAL(sqlite3_open(legacyPath.c_str(), &db), SQLITE_OK);
+    sqlite3_exec(db, "CREATE TABLE File(device_name BLOB NOT NULL, segment INTEGER, content_object BLOB, "
+                     "PRIMARY KEY (device_name, segment));"
+                     "CREATE TABLE Manifest(device_name BLOB NOT NULL, segment INTEGER, content_object BLOB, "
+                     "PRIMARY KEY (device_name, segment));", nullptr, nullptr, nullptr);
+
+    for (auto table : {std::make_pair("File", &file0), std::make_pair("Manifest", &manifest0)}) {
+      util::Sqlite3Statement stmt(db, std::string("INSERT INTO ") + table.first + " VALUES (?, ?, ?)");
+      stmt.bind(1, Name("/device").wireEncode(), SQLITE_TRANSIENT);
+      stmt.bind(2, 0);
+      stmt.bind(3, table.second->wireEncode(), SQLITE_STATIC);
+      BOOST_CHECK_EQUAL(stmt.step(), SQLITE_DONE);
+    }
+    sqlite3_close(db);
+  }
+
+  BOOST_CHECK_EQUAL(ObjectDb::doesExist(tmpdir, "/device", hashStr), true);
+  BOOST_CHECK(!exists(legacyPath));
+  BOOST_CHECK(!exists(legacyPath.parent_path()));
+
+  ObjectDb db(tmpdir, hashStr);
+  auto data = db.fetchSegment("/device", 0);
+  BOOST_REQUIRE(data != nullptr);
+  BOOST_CHECK_EQUAL(*data, file0);
+
+  auto manifest = db.fetchManifestSegment("/device", 0);
+  BOOST_REQUIRE(manifest != nullptr);
+  BOOST_CHECK_EQUAL(*manifest, manifest0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace tests
+} // namespace chronoshare
+} // namespace ndn
@@ -0,0 +1,137 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/**
+ * Copyright (c) 2013-2017, Regents of the University of California.
+ *
+ * This file is part of ChronoShare, a decentralized file sharing application over NDN.
+ *
+ * ChronoShare is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * ChronoShare is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * You should have received copies of the GNU General Public License along with
+ * ChronoShare, e.g., in COPYING.md file.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See AUTHORS.md for complete list of ChronoShare authors and contributors.
+ */
+
+#include "partial-file.hpp"
+
+#include "test-common.hpp"
+
+#include <boost/filesystem/fstream.hpp>
+
+namespace ndn {
+namespace chronoshare {
+namespace tests {
+
+namespace fs = boost::filesystem;
+
+class TestPartialFileFixture
+{
+public:
+  TestPartialFileFixture()
+  {
+    tmpdir = fs::unique_path(UNIT_TEST_CONFIG_PATH) / "TestPartialFile";
+    if (exists(tmpdir)) {
+      remove_all(tmpdir);
+    }
+
+    for (size_t i = 0; i < 10000; ++i) {
+      content.push_back(static_cast<char>('a' + i % 26));
+    }
+  }
+
+  ~TestPartialFileFixture()
+  {
+    remove_all(tmpdir);
+  }
+
+  const uint8_t*
+  at(size_t offset) const
+  {
+    return reinterpret_cast<const uint8_t*>(content.data()) + offset;
+  }
+
+  std::string
+  read(const fs::path& file) const
+  {
+    fs::ifstream input(file, std::ios::in | std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+  }
+
+public:
+  fs::path tmpdir;
+  std::string content;
+};
+
+BOOST_FIXTURE_TEST_SUITE(TestPartialFile, TestPartialFileFixture)
+
+BOOST_AUTO_TEST_CASE(FixedSizeSegments)
+{
+  {
+    PartialFile file(tmpdir / "part", 10, 1000);
+    for (uint64_t segment = 9; segment >= 5; --segment) {
+      file.writeSegment(segment, at(segment * 1000), 1000);
+    }
+    BOOST_CHECK(!file.isComplete());
+    BOOST_CHECK_THROW(file.finalize(tmpdir / "file"), PartialFile::Error);
+  }
+
+  // received segments survive reopening
+  PartialFile file(tmpdir / "part", 10, 1000);
+  BOOST_CHECK_EQUAL(file.getReceivedSegmentCount(), 5);
+  BOOST_CHECK(file.hasSegment(5));
+  BOOST_CHECK(!file.hasSegment(4));
+
+  for (uint64_t segment = 0; segment < 5; ++segment) {
+    file.writeSegment(segment, at(segment * 1000), 1000);
+  }
+  BOOST_REQUIRE(file.isComplete());
+  file.finalize(tmpdir / "file");
+
+  BOOST_CHECK_EQUAL(read(tmpdir / "file"), content);
+  BOOST_CHECK(!fs::exists(tmpdir / "part"));
+  BOOST_CHECK(!fs::exists(tmpdir / "part.map"));
+}
+
+BOOST_AUTO_TEST_CASE(VariableSizeSegments)
+{
+  // content-defined segments of up to 1000 bytes, including an empty one
+  std::vector<size_t> boundaries = {0, 700, 1500, 1500, 2300, 3300, 3400};
+
+  PartialFile file(tmpdir / "part", boundaries.size() - 1, 1000);
+  for (size_t segment = boundaries.size() - 1; segment > 0; --segment) {
+    file.writeSegment(segment - 1, at(boundaries[segment - 1]),
+                      boundaries[segment] - boundaries[segment - 1]);
+  }
+  BOOST_CHECK_THROW(file.writeSegment(0, at(0), 1001), PartialFile::Error);
+  BOOST_CHECK_THROW(file.writeSegment(6, at(0), 10), PartialFile::Error);
+
+  file.finalize(tmpdir / "file");
+  BOOST_CHECK_EQUAL(read(tmpdir / "file"), content.substr(0, 3400));
+}
+
+BOOST_AUTO_TEST_CASE(LayoutChange)
+{
+  {
+    PartialFile file(tmpdir / "part", 4, 10);
+    file.writeSegment(0, at(0), 10);
+  }
+
+  PartialFile file(tmpdir / "part", 5, 10);
+  BOOST_CHECK_EQUAL(file.getReceivedSegmentCount(), 0);
+
+  file.remove();
+  BOOST_CHECK(!fs::exists(tmpdir / "part"));
+  BOOST_CHECK(!fs::exists(tmpdir / "part.map"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+} // namespace tests
+} // namespace chronoshare
+} // namespace ndn
@@ -57,6 +57,7 @@ public:
     , filePath(root / "random-file")
     , character('m')
     , repeat(1024 * 40)
+    , segments(0)
     , finished(false)
     , ack(0)
   {
@@ -108,7 +109,7 @@ public:
   void
   finishCallback(Name& deviceName, Name& baseName)
   {
-    BOOST_CHECK_EQUAL(ack, repeat / 1024);
+    BOOST_CHECK_EQUAL(ack, segments);
     finished = true;
     cond.notify_one();
   }
@@ -120,6 +121,7 @@ public:
 
   unsigned char character;
   int repeat;
+  int segments;
 
   boost::condition_variable cond;
   bool finished;
@@ -145,6 +147,9 @@ BOOST_AUTO_TEST_CASE(TestServeAndFetch)
   // publish file to db
   ObjectManager om(face_serve, m_keyChain, root, APPNAME);
   auto pub = om.localFileToObjects(filePath, deviceName);
+  BOOST_CHECK_LE(std::get<2>(pub), DEFAULT_FILE_SEGMENT_SIZE);
+  segments = (repeat + std::get<2>(pub) - 1) / std::get<2>(pub);
+  BOOST_CHECK_EQUAL(std::get<1>(pub), segments);
 
   time_t end = std::time(NULL);
   _LOG_DEBUG("At time " << end << ", publish finally finished, used " << end - start
@@ -79,12 +79,12 @@ public:
     fileSize = fs::file_size(abf);
 
     _LOG_DEBUG("absolutePath: " << abf << " localUserName: " << localName);
-    tie(hash, seg_num) = manager->localFileToObjects(abf, localName);
+    tie(hash, seg_num, seg_size, manifestDigest) = manager->localFileToObjects(abf, localName);
 
     BOOST_REQUIRE_MESSAGE(fs::exists(abf), " failed to create the file");
 
     actionLog->AddLocalActionUpdate(filename.generic_string(), *hash,
-                                    std::time(nullptr), 0644, seg_num);
+                                    std::time(nullptr), 0644, seg_num, seg_size, manifestDigest);
 
     actionLog->AddLocalActionUpdate("sharefolder/file.txt",
                                     *fromHex("2ff3ab223a23c2435519eef13daabf8576dceffc62618a431715aaf6eea2bf1c"),
@@ -124,7 +124,9 @@ public:
   unique_ptr<ObjectManager> manager;
 
   int seg_num;
+  size_t seg_size;
   ConstBufferPtr hash;
+  ConstBufferPtr manifestDigest;
 
   uintmax_t fileSize;
 };
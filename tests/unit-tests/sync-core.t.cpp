@@ -123,6 +123,123 @@ BOOST_AUTO_TEST_CASE(TwoNodes)
   BOOST_CHECK_EQUAL(log2->LookupLocator(user2), loc2);
 }
 
+BOOST_AUTO_TEST_CASE(OfflinePastHorizon)
+{
+  fs::path tmpdir = fs::unique_path(UNIT_TEST_CONFIG_PATH) / "SyncCoreTest";
+  if (exists(tmpdir)) {
+    remove_all(tmpdir);
+  }
+
+  std::string dir1 = (tmpdir / "1").string();
+  std::string dir2 = (tmpdir / "2").string();
+  Name user1("/shuai");
+  Name loc1("/locator1");
+  Name user2("/loli");
+  Name loc2("/locator2");
+  Name syncPrefix("/broadcast/arslan");
+
+  Face& c1 = forwarder.addFace();
+  auto log1 = make_shared<SyncLog>(dir1, user1);
+  auto core1 = make_shared<SyncCore>(c1, log1, user1, loc1, syncPrefix, bind(&callback, _1));
+  log1->SetStateRetention(time::days(30), 5);
+
+  Face& c2 = forwarder.addFace();
+  auto log2 = make_shared<SyncLog>(dir2, user2);
+  auto core2 = make_shared<SyncCore>(c2, log2, user2, loc2, syncPrefix, bind(&callback, _1));
+
+  core1->updateLocalState(1);
+  advanceClocks(time::milliseconds(10), 100);
+  BOOST_CHECK_EQUAL(toHex(*core1->root()), toHex(*core2->root()));
+  ConstBufferPtr offlineDigest = core2->root();
+
+  // the second peer goes offline while the first one moves on
+  core2.reset();
+  c2.removeAllPendingInterests();
+
+  for (int seq = 2; seq <= 20; ++seq) {
+    core1->updateLocalState(seq);
+    advanceClocks(time::milliseconds(10), 10);
+  }
+
+  // the state the second peer knows is pruned
+  advanceClocks(time::seconds(1), SyncCore::STATE_LOG_PRUNING_INTERVAL.count() + 1);
+  BOOST_CHECK_EQUAL(log1->LookupSyncLog(*offlineDigest), 0);
+  BOOST_CHECK_EQUAL(log1->LogSize(), 5);
+
+  // the peers still converge through recovery
+  Face& c3 = forwarder.addFace();
+  core2 = make_shared<SyncCore>(c3, log2, user2, loc2, syncPrefix, bind(&callback, _1));
+  advanceClocks(time::milliseconds(10), 1000);
+
+  BOOST_CHECK_EQUAL(toHex(*core1->root()), toHex(*core2->root()));
+  BOOST_CHECK_EQUAL(core2->seq(user1), 20);
+  BOOST_CHECK_EQUAL(log2->LookupLocator(user1), loc1);
+}
+
+BOOST_AUTO_TEST_CASE(ReconcileLargeGroup)
+{
+  fs::path tmpdir = fs::unique_path(UNIT_TEST_CONFIG_PATH) / "SyncCoreTest";
+  if (exists(tmpdir)) {
+    remove_all(tmpdir);
+  }
+
+  std::string dir1 = (tmpdir / "1").string();
+  std::string dir2 = (tmpdir / "2").string();
+  Name user1("/shuai");
+  Name loc1("/locator1");
+  Name user2("/loli");
+  Name loc2("/locator2");
+  Name syncPrefix("/broadcast/arslan");
+
+  // both peers know a group large enough for a sketch to be smaller than the whole state
+  SyncStateMsg group;
+  for (int device = 0; device < 1000; ++device) {
+    Name name = Name("/ndn/edu/ucla").append("user-" + std::to_string(device)).append("laptop");
+    Name locator = Name("/ndn/edu/ucla/hub").appendNumber(device % 16);
+    SyncState* state = group.add_state();
+    state->set_name(reinterpret_cast<const char*>(name.wireEncode().wire()), name.wireEncode().size());
+    state->set_locator(reinterpret_cast<const char*>(locator.wireEncode().wire()),
+                       locator.wireEncode().size());
+    state->set_type(SyncState::UPDATE);
+    state->set_seq(device % 100 + 1);
+  }
+
+  Face& c1 = forwarder.addFace();
+  auto log1 = make_shared<SyncLog>(dir1, user1);
+  SyncStateMsg diff;
+  log1->ApplyStateMsg(group, diff);
+  auto core1 = make_shared<SyncCore>(c1, log1, user1, loc1, syncPrefix, bind(&callback, _1));
+
+  Face& c2 = forwarder.addFace();
+  auto log2 = make_shared<SyncLog>(dir2, user2);
+  log2->ApplyStateMsg(group, diff);
+  auto core2 = make_shared<SyncCore>(c2, log2, user2, loc2, syncPrefix, bind(&callback, _1));
+
+  // the peers only know their own devices apart from the group, and learn them from each other
+  advanceClocks(time::milliseconds(10), 100);
+  BOOST_CHECK_EQUAL(toHex(*core1->root()), toHex(*core2->root()));
+  BOOST_CHECK_EQUAL(log2->LookupLocator(user1), loc1);
+
+  core1->updateLocalState(5);
+  advanceClocks(time::milliseconds(10), 10);
+  BOOST_CHECK_EQUAL(toHex(*core1->root()), toHex(*core2->root()));
+  BOOST_CHECK_EQUAL(core2->seq(user1), 5);
+
+  size_t nReconcile = 0;
+  size_t nRecover = 0;
+  for (Face* face : {&c1, &c2}) {
+    for (const Interest& interest : static_cast<util::DummyClientFace*>(face)->sentInterests) {
+      if (interest.getName().size() > syncPrefix.size() + 1) {
+        std::string type = interest.getName().get(syncPrefix.size()).toUri();
+        nReconcile += type == SyncCore::RECONCILE;
+        nRecover += type == SyncCore::RECOVER;
+      }
+    }
+  }
+  BOOST_CHECK_GT(nReconcile, 0);
+  BOOST_CHECK_EQUAL(nRecover, 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 } // namespace tests
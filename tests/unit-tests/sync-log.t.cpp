@@ -28,6 +28,35 @@ namespace tests {
 
 namespace fs = boost::filesystem;
 
+class SyncLogInspector : public SyncLog
+{
+public:
+  using SyncLog::SyncLog;
+
+  std::string
+  computeDigestInDb()
+  {
+    Statement stmt(*this, "SELECT hash(device_name, seq_no) FROM (SELECT * FROM SyncNodes "
+                          "ORDER BY device_name)");
+    BOOST_REQUIRE_EQUAL(stmt.step(), SQLITE_ROW);
+    return toHex(stmt.getBlob(0), stmt.getSize(0));
+  }
+
+  void
+  exec(const std::string& sql)
+  {
+    BOOST_REQUIRE_EQUAL(sqlite3_exec(m_db, sql.c_str(), 0, 0, 0), SQLITE_OK);
+  }
+
+  sqlite3_int64
+  countRows(const std::string& table)
+  {
+    Statement stmt(*this, "SELECT count(*) FROM " + table);
+    BOOST_REQUIRE_EQUAL(stmt.step(), SQLITE_ROW);
+    return sqlite3_column_int64(stmt, 0);
+  }
+};
+
 BOOST_FIXTURE_TEST_SUITE(TestSyncLog, IdentityManagementTimeFixture)
 
 BOOST_AUTO_TEST_CASE(BasicDatabaseTest)
@@ -111,6 +140,383 @@ BOOST_AUTO_TEST_CASE(BasicDatabaseTest)
   BOOST_CHECK_EQUAL(msg->state(1).seq(), 1);
 }
 
+BOOST_AUTO_TEST_CASE(CachedDigest)
+{
+  fs::path tmpdir = fs::unique_path(UNIT_TEST_CONFIG_PATH);
+  if (exists(tmpdir)) {
+    remove_all(tmpdir);
+  }
+
+  SyncLogInspector db(tmpdir, Name("/lijing"));
+
+  // names of different lengths, including one that is a prefix of another
+  db.UpdateDeviceSeqNo(Name("/shuai"), 3);
+  db.UpdateDeviceSeqNo(Name("/alex/laptop"), 10);
+  db.UpdateDeviceSeqNo(Name("/alex"), 7);
+  db.GetNextLocalSeqNo();
+  BOOST_CHECK_EQUAL(toHex(*db.RememberStateInStateLog()), db.computeDigestInDb());
+
+  // seq_no never decreases
+  db.UpdateDeviceSeqNo(Name("/alex/laptop"), 5);
+  BOOST_CHECK_EQUAL(toHex(*db.RememberStateInStateLog()), db.computeDigestInDb());
+  BOOST_CHECK_EQUAL(db.SeqNo(Name("/alex/laptop")), 10);
+
+  // changes that are rolled back are dropped from the cached state too
+  std::string digest = toHex(*db.RememberStateInStateLog());
+  db.exec("BEGIN TRANSACTION");
+  db.UpdateDeviceSeqNo(Name("/shuai"), 4);
+  db.UpdateDeviceSeqNo(Name("/yingdi"), 1);
+  db.UpdateLocalSeqNo(20);
+  db.exec("ROLLBACK TRANSACTION");
+  BOOST_CHECK_EQUAL(toHex(*db.RememberStateInStateLog()), digest);
+  BOOST_CHECK_EQUAL(db.computeDigestInDb(), digest);
+
+  BOOST_CHECK_EQUAL(db.GetNextLocalSeqNo(), 2);
+
+  // state loaded by a new instance
+  std::string newDigest = toHex(*db.RememberStateInStateLog());
+  BOOST_CHECK_NE(newDigest, digest);
+  SyncLogInspector db2(tmpdir, Name("/lijing"));
+  BOOST_CHECK_EQUAL(toHex(*db2.RememberStateInStateLog()), newDigest);
+}
+
+BOOST_AUTO_TEST_CASE(DeltaEncodedHistory)
+{
+  fs::path tmpdir = fs::unique_path(UNIT_TEST_CONFIG_PATH);
+  if (exists(tmpdir)) {
+    remove_all(tmpdir);
+  }
+
+  SyncLogInspector db(tmpdir, Name("/lijing"));
+
+  const int nDevices = 20;
+  const int nStates = SyncLog::STATE_CHECKPOINT_INTERVAL * 2 - 10;
+  for (int device = 0; device < nDevices; ++device) {
+    db.UpdateDeviceSeqNo(Name("/device").appendNumber(device), 1);
+  }
+
+  std::vector<ConstBufferPtr> digests;
+  digests.push_back(db.RememberStateInStateLog());
+  for (int state = 1; state < nStates; ++state) {
+    db.UpdateDeviceSeqNo(Name("/device").appendNumber(state % nDevices), state / nDevices + 2);
+    digests.push_back(db.RememberStateInStateLog());
+  }
+
+  // checkpoints record all the devices, the other states only the changed one
+  BOOST_CHECK_EQUAL(db.countRows("SyncLog"), nStates);
+  BOOST_CHECK_EQUAL(db.countRows("SyncStateNodes"), 2 * (nDevices + 1) + nStates - 2);
+
+  // one device changed, across a checkpoint too
+  for (int state : {1, SyncLog::STATE_CHECKPOINT_INTERVAL, nStates - 1}) {
+    SyncStateMsgPtr msg = db.FindStateDifferences(*digests[state - 1], *digests[state], true);
+    BOOST_REQUIRE_EQUAL(msg->state_size(), 1);
+    BOOST_CHECK_EQUAL(Name(Block(msg->state(0).name().data(), msg->state(0).name().size())),
+                      Name("/device").appendNumber(state % nDevices));
+    BOOST_CHECK_EQUAL(msg->state(0).old_seq(), state < nDevices ? 1 : state / nDevices + 1);
+    BOOST_CHECK_EQUAL(msg->state(0).seq(), state / nDevices + 2);
+  }
+
+  // every device changed
+  SyncStateMsgPtr msg = db.FindStateDifferences(*digests[0], *digests[nStates - 1]);
+  BOOST_CHECK_EQUAL(msg->state_size(), nDevices);
+
+  // the whole state
+  msg = db.FindStateDifferences(Buffer(1), *digests[nStates - 1]);
+  BOOST_REQUIRE_EQUAL(msg->state_size(), nDevices + 1);
+  for (int i = 0; i < msg->state_size(); ++i) {
+    Name device(Block(msg->state(i).name().data(), msg->state(i).name().size()));
+    BOOST_CHECK_EQUAL(msg->state(i).seq(), db.SeqNo(device));
+  }
+
+  // a state seen again is not recorded twice
+  db.UpdateDeviceSeqNo(Name("/device").appendNumber(0), 1);
+  BOOST_CHECK(*db.RememberStateInStateLog() == *digests[nStates - 1]);
+  BOOST_CHECK_EQUAL(db.countRows("SyncLog"), nStates);
+
+  // the state index is rebuilt from the database, and the history continues from the last state
+  SyncLogInspector db2(tmpdir, Name("/lijing"));
+  BOOST_CHECK_EQUAL(db2.LookupSyncLog(*digests[1]), 2);
+  msg = db2.FindStateDifferences(*digests[0], *digests[nStates - 1]);
+  BOOST_CHECK_EQUAL(msg->state_size(), nDevices);
+
+  BOOST_CHECK(*db2.RememberStateInStateLog() == *digests[nStates - 1]);
+  db2.UpdateDeviceSeqNo(Name("/device").appendNumber(0), 100);
+  db2.RememberStateInStateLog();
+  BOOST_CHECK_EQUAL(db2.countRows("SyncStateNodes"), 2 * (nDevices + 1) + nStates - 1);
+}
+
+BOOST_AUTO_TEST_CASE(LegacySnapshots)
+{
+  fs::path tmpdir = fs::unique_path(UNIT_TEST_CONFIG_PATH);
+  if (exists(tmpdir)) {
+    remove_all(tmpdir);
+  }
+  fs::create_directories(tmpdir / ".chronoshare");
+
+  // full snapshots of every state, as kept by older versions in a separate database
+  sqlite3* legacy = nullptr;
+  BOOST_REQUIRE_EQUAL(sqlite3_open((tmpdir / ".chronoshare" / "sync-log.db").c_str(), &legacy),
+                      SQLITE_OK);
+  Name alice("/alice");
+  Name bob("/bob");
+  std::string sql = "\
+CREATE TABLE SyncNodes(device_id INTEGER PRIMARY KEY AUTOINCREMENT, device_name BLOB NOT NULL, \
+                       description TEXT, seq_no INTEGER NOT NULL, last_known_locator BLOB,     \
+                       last_update TIMESTAMP);                                                 \
+CREATE TABLE SyncLog(state_id INTEGER PRIMARY KEY AUTOINCREMENT, state_hash BLOB NOT NULL UNIQUE, \
+                     last_update TIMESTAMP NOT NULL);                                          \
+CREATE TABLE SyncStateNodes(id INTEGER PRIMARY KEY AUTOINCREMENT, state_id INTEGER NOT NULL,   \
+                            device_id INTEGER NOT NULL, seq_no INTEGER NOT NULL);              \
+INSERT INTO SyncNodes (device_id, device_name, seq_no) VALUES (1, x'" + toHex(alice.wireEncode().wire(), alice.wireEncode().size()) + "', 2); \
+INSERT INTO SyncNodes (device_id, device_name, seq_no) VALUES (2, x'" + toHex(bob.wireEncode().wire(), bob.wireEncode().size()) + "', 1); \
+INSERT INTO SyncLog VALUES (1, x'01', datetime('now'));                                        \
+INSERT INTO SyncLog VALUES (2, x'02', datetime('now'));                                        \
+INSERT INTO SyncLog VALUES (3, x'03', datetime('now'));                                        \
+INSERT INTO SyncStateNodes (state_id, device_id, seq_no) VALUES (1, 1, 1), (1, 2, 0);          \
+INSERT INTO SyncStateNodes (state_id, device_id, seq_no) VALUES (2, 1, 2), (2, 2, 0);          \
+INSERT INTO SyncStateNodes (state_id, device_id, seq_no) VALUES (3, 1, 2), (3, 2, 1);          \
+";
+  BOOST_REQUIRE_EQUAL(sqlite3_exec(legacy, sql.c_str(), 0, 0, 0), SQLITE_OK);
+  sqlite3_close(legacy);
+
+  SyncLogInspector db(tmpdir, alice);
+  BOOST_CHECK(!exists(tmpdir / ".chronoshare" / "sync-log.db"));
+
+  // the snapshots after the first are reduced to the changed device
+  BOOST_CHECK_EQUAL(db.countRows("SyncLog"), 3);
+  BOOST_CHECK_EQUAL(db.countRows("SyncStateNodes"), 4);
+
+  SyncStateMsgPtr msg = db.FindStateDifferences(*fromHex("01"), *fromHex("03"), true);
+  BOOST_REQUIRE_EQUAL(msg->state_size(), 2);
+  BOOST_CHECK_EQUAL(msg->state(0).old_seq(), 1);
+  BOOST_CHECK_EQUAL(msg->state(0).seq(), 2);
+  BOOST_CHECK_EQUAL(msg->state(1).old_seq(), 0);
+  BOOST_CHECK_EQUAL(msg->state(1).seq(), 1);
+
+  msg = db.FindStateDifferences(*fromHex("02"), *fromHex("03"));
+  BOOST_REQUIRE_EQUAL(msg->state_size(), 1);
+  BOOST_CHECK_EQUAL(msg->state(0).seq(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(PruneStateLog)
+{
+  fs::path tmpdir = fs::unique_path(UNIT_TEST_CONFIG_PATH);
+  if (exists(tmpdir)) {
+    remove_all(tmpdir);
+  }
+
+  SyncLogInspector db(tmpdir, Name("/lijing"));
+
+  const int nDevices = 10;
+  const int nStates = 100;
+  for (int device = 0; device < nDevices; ++device) {
+    db.UpdateDeviceSeqNo(Name("/device").appendNumber(device), 1);
+  }
+
+  // state_id of digests[i] is i + 1
+  std::vector<ConstBufferPtr> digests;
+  digests.push_back(db.RememberStateInStateLog());
+  for (int state = 1; state < nStates; ++state) {
+    db.UpdateDeviceSeqNo(Name("/device").appendNumber(state % nDevices), state / nDevices + 2);
+    digests.push_back(db.RememberStateInStateLog());
+  }
+
+  auto checkState = [&] (SyncLog& db, int state) {
+    SyncStateMsgPtr msg = db.FindStateDifferences(Buffer(1), *digests[state]);
+    BOOST_REQUIRE_EQUAL(msg->state_size(), nDevices + 1);
+    for (int i = 0; i < msg->state_size(); ++i) {
+      Name device(Block(msg->state(i).name().data(), msg->state(i).name().size()));
+      if (device == Name("/lijing")) {
+        continue;
+      }
+      // seq_no of the device after the last of its updates up to the state
+      int lastUpdate = state - (state + nDevices - device.get(-1).toNumber()) % nDevices;
+      BOOST_CHECK_EQUAL(msg->state(i).seq(), lastUpdate > 0 ? lastUpdate / nDevices + 2 : 1);
+    }
+  };
+
+  // states beyond the newest 50 are removed in batches
+  db.SetStateRetention(time::days(1), 50);
+  BOOST_CHECK_EQUAL(db.PruneStateLog(20), 20);
+  BOOST_CHECK_EQUAL(db.PruneStateLog(20), 20);
+  BOOST_CHECK_EQUAL(db.PruneStateLog(20), 10);
+  BOOST_CHECK_EQUAL(db.PruneStateLog(20), 0);
+
+  BOOST_CHECK_EQUAL(db.countRows("SyncLog"), nStates - 50);
+  BOOST_CHECK_EQUAL(db.LookupSyncLog(*digests[49]), 0);
+  BOOST_CHECK_EQUAL(db.LookupSyncLog(*digests[50]), 51);
+
+  // the oldest kept state became a checkpoint
+  BOOST_CHECK_EQUAL(db.countRows("SyncStateNodes"), nDevices + 1 + nStates - 51);
+  checkState(db, 50);
+  checkState(db, 75);
+  SyncStateMsgPtr msg = db.FindStateDifferences(*digests[50], *digests[nStates - 1]);
+  BOOST_CHECK_EQUAL(msg->state_size(), nDevices);
+
+  // pruned states are unknown
+  msg = db.FindStateDifferences(*digests[10], *digests[nStates - 1]);
+  BOOST_CHECK_EQUAL(msg->state_size(), nDevices + 1);
+
+  SyncLogInspector db2(tmpdir, Name("/lijing"));
+  BOOST_CHECK_EQUAL(db2.LookupSyncLog(*digests[49]), 0);
+  checkState(db2, 50);
+
+  // states not seen for longer than the retention period
+  db.exec("UPDATE SyncLog SET last_update=datetime('now', '-2 days') WHERE state_id <= 60");
+  db.SetStateRetention(time::days(1), 1000);
+  BOOST_CHECK_EQUAL(db.PruneStateLog(1000), 10);
+  BOOST_CHECK_EQUAL(db.LookupSyncLog(*digests[59]), 0);
+  checkState(db, 60);
+
+  // the last state is always kept, and the history continues from it
+  db.SetStateRetention(time::seconds(0), 0);
+  BOOST_CHECK_EQUAL(db.PruneStateLog(1000), nStates - 61);
+  BOOST_CHECK_EQUAL(db.LookupSyncLog(*digests[nStates - 1]), nStates);
+  checkState(db, nStates - 1);
+
+  db.UpdateDeviceSeqNo(Name("/device").appendNumber(0), 100);
+  ConstBufferPtr digest = db.RememberStateInStateLog();
+  msg = db.FindStateDifferences(*digests[nStates - 1], *digest);
+  BOOST_CHECK_EQUAL(msg->state_size(), 1);
+  BOOST_CHECK_EQUAL(db.countRows("SyncStateNodes"), nDevices + 1 + 1);
+}
+
+BOOST_AUTO_TEST_CASE(StateSketch)
+{
+  fs::path tmpdir = fs::unique_path(UNIT_TEST_CONFIG_PATH);
+  if (exists(tmpdir)) {
+    remove_all(tmpdir);
+  }
+
+  SyncLog db1(tmpdir / "1", Name("/lijing"));
+  SyncLog db2(tmpdir / "2", Name("/alex"));
+  db1.UpdateDeviceSeqNo(Name("/alex"), 0);
+  db2.UpdateDeviceSeqNo(Name("/lijing"), 0);
+
+  const int nDevices = 200;
+  for (int device = 0; device < nDevices; ++device) {
+    db1.UpdateDeviceSeqNo(Name("/device").appendNumber(device), device + 1);
+    db2.UpdateDeviceSeqNo(Name("/device").appendNumber(device), device + 1);
+  }
+
+  // the second log knows newer seq_nos of three devices and one more device, the first one newer
+  // seq_nos of two other devices
+  std::map<Name, sqlite3_int64> missing;
+  for (int device : {3, 50, 199}) {
+    db2.UpdateDeviceSeqNo(Name("/device").appendNumber(device), device + 10);
+    missing[Name("/device").appendNumber(device)] = device + 10;
+  }
+  db2.UpdateDeviceSeqNo(Name("/new-device"), 1);
+  missing[Name("/new-device")] = 1;
+  for (int device : {7, 8}) {
+    db1.UpdateDeviceSeqNo(Name("/device").appendNumber(device), device + 10);
+    missing[Name("/device").appendNumber(device)] = device + 1;
+  }
+
+  ConstBufferPtr digest1 = db1.RememberStateInStateLog();
+  ConstBufferPtr digest2 = db2.RememberStateInStateLog();
+
+  // only the entries of the second state that are not in the first one
+  shared_ptr<SyncStateSketch> sketch = db1.GetStateSketch(*digest1, 96);
+  BOOST_CHECK_EQUAL(sketch->count_size(), 96);
+  SyncStateMsgPtr msg = db2.FindStateDifferences(*sketch, *digest2);
+  BOOST_REQUIRE(msg != nullptr);
+  BOOST_REQUIRE_EQUAL(msg->state_size(), missing.size());
+  for (int i = 0; i < msg->state_size(); ++i) {
+    Name device(Block(msg->state(i).name().data(), msg->state(i).name().size()));
+    BOOST_REQUIRE_EQUAL(missing.count(device), 1);
+    BOOST_CHECK_EQUAL(msg->state(i).seq(), missing[device]);
+    BOOST_CHECK_EQUAL(msg->state(i).type(), SyncState::UPDATE);
+  }
+
+  // same states
+  msg = db1.FindStateDifferences(*sketch, *digest1);
+  BOOST_REQUIRE(msg != nullptr);
+  BOOST_CHECK_EQUAL(msg->state_size(), 0);
+
+  // too many differences for the sketch
+  sketch = db1.GetStateSketch(*digest1, 3);
+  BOOST_CHECK(db2.FindStateDifferences(*sketch, *digest2) == nullptr);
+
+  sketch->add_count(1);
+  BOOST_CHECK_THROW(db2.FindStateDifferences(*sketch, *digest2), SyncLog::Error);
+}
+
+BOOST_AUTO_TEST_CASE(ApplyStateMsg)
+{
+  fs::path tmpdir = fs::unique_path(UNIT_TEST_CONFIG_PATH);
+  if (exists(tmpdir)) {
+    remove_all(tmpdir);
+  }
+
+  SyncLogInspector db(tmpdir, Name("/lijing"));
+  db.UpdateDeviceSeqNo(Name("/alex"), 5);
+  db.UpdateDeviceSeqNo(Name("/shuai"), 7);
+  db.UpdateLocator(Name("/shuai"), Name("/locator/shuai"));
+  ConstBufferPtr oldDigest = db.RememberStateInStateLog();
+
+  auto addState = [] (SyncStateMsg& msg, const Name& device, sqlite3_int64 seq,
+                      const Name& locator = Name()) {
+    SyncState* state = msg.add_state();
+    state->set_name(reinterpret_cast<const char*>(device.wireEncode().wire()),
+                    device.wireEncode().size());
+    state->set_type(SyncState::UPDATE);
+    state->set_seq(seq);
+    if (!locator.empty()) {
+      state->set_locator(reinterpret_cast<const char*>(locator.wireEncode().wire()),
+                         locator.wireEncode().size());
+    }
+    return state;
+  };
+
+  SyncStateMsg msg;
+  addState(msg, Name("/alex"), 6);
+  addState(msg, Name("/alex"), 8, Name("/locator/alex"));
+  addState(msg, Name("/shuai"), 3, Name("/locator/shuai2")); // older seq_no, newer locator
+  addState(msg, Name("/yingdi"), 1, Name("/locator/yingdi"));
+  addState(msg, Name("/lijing"), 100)->set_type(SyncState::DELETE);
+
+  SyncStateMsg diff;
+  ConstBufferPtr digest = db.ApplyStateMsg(msg, diff);
+
+  BOOST_CHECK_EQUAL(toHex(*digest), db.computeDigestInDb());
+  BOOST_CHECK_EQUAL(db.LookupSyncLog(*digest), db.LogSize());
+  BOOST_CHECK_EQUAL(db.SeqNo(Name("/alex")), 8);
+  BOOST_CHECK_EQUAL(db.SeqNo(Name("/shuai")), 7);
+  BOOST_CHECK_EQUAL(db.SeqNo(Name("/yingdi")), 1);
+  BOOST_CHECK_EQUAL(db.SeqNo(Name("/lijing")), 0);
+  BOOST_CHECK_EQUAL(db.LookupLocator(Name("/alex")), Name("/locator/alex"));
+  BOOST_CHECK_EQUAL(db.LookupLocator(Name("/shuai")), Name("/locator/shuai2"));
+
+  // the same difference as between the states in the state log
+  SyncStateMsgPtr expected = db.FindStateDifferences(*oldDigest, *digest, true);
+  BOOST_REQUIRE_EQUAL(diff.state_size(), 2);
+  BOOST_REQUIRE_EQUAL(expected->state_size(), 2);
+  for (int i = 0; i < diff.state_size(); ++i) {
+    BOOST_CHECK_EQUAL(diff.state(i).type(), SyncState::UPDATE);
+    bool isFound = false;
+    for (int j = 0; j < expected->state_size(); ++j) {
+      if (diff.state(i).name() == expected->state(j).name()) {
+        isFound = true;
+        BOOST_CHECK_EQUAL(diff.state(i).old_seq(), expected->state(j).old_seq());
+        BOOST_CHECK_EQUAL(diff.state(i).seq(), expected->state(j).seq());
+        BOOST_CHECK_EQUAL(diff.state(i).locator(), expected->state(j).locator());
+      }
+    }
+    BOOST_CHECK(isFound);
+  }
+
+  // nothing new
+  diff.Clear();
+  BOOST_CHECK(*db.ApplyStateMsg(msg, diff) == *digest);
+  BOOST_CHECK_EQUAL(diff.state_size(), 0);
+
+  // the applied state is in the database
+  SyncLogInspector db2(tmpdir, Name("/lijing"));
+  BOOST_CHECK_EQUAL(db2.LookupSyncLog(*digest), db.LookupSyncLog(*digest));
+  BOOST_CHECK_EQUAL(db2.LookupLocator(Name("/yingdi")), Name("/locator/yingdi"));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 } // namespace tests